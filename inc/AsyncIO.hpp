@@ -0,0 +1,56 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+/* Disk I/O offload pool
+
+Blocking file work (reading a file, writing an upload, listing a
+directory, unlinking) runs on a few worker threads so one slow disk or
+NFS mount can't stall every connection on the event loop:
+
+	loop thread		submit(work)  ──►  worker: work()
+					...serves other clients...
+	loop thread		eventfd readable  ◄──  worker: done, write(eventfd)
+					drain() → ids of finished jobs
+
+Work closures run off the loop: they must only touch their own captured
+data (no Logger, no caches, no RequestHandler). Everything else happens
+in the completion, back on the loop thread.
+*/
+
+const size_t DISK_IO_THREADS = 4;
+
+class AsyncIO {
+	private:
+		struct Job {
+			uint64_t				id;
+			std::function<void()>	work;
+		};
+
+		std::vector<std::thread>	_workers;
+		std::mutex					_mutex;
+		std::condition_variable		_cv;
+		std::deque<Job>				_queue;
+		std::vector<uint64_t>		_done;		// finished, not yet drained
+		int							_eventFd;
+		bool						_stopping;
+		uint64_t					_nextId;
+
+		void workerLoop();
+
+	public:
+		AsyncIO(size_t threads = DISK_IO_THREADS);
+		AsyncIO(const AsyncIO& other) = delete;
+		AsyncIO& operator=(const AsyncIO& other) = delete;
+		~AsyncIO();
+
+		int						eventFd() const;
+		uint64_t				submit(std::function<void()> work);
+		std::vector<uint64_t>	drain();
+};
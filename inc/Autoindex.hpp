@@ -0,0 +1,60 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <map>
+#include <utility>
+#include <ctime>
+#include <sys/stat.h>
+
+/* Autoindex listings
+
+Directory scans are cached per directory (its device and inode, so every
+path that resolves to it shares one entry) and reused until the
+directory's mtime changes (any create, delete or rename inside it bumps
+it). Rendered HTML is cached alongside, per page, so a crawler hammering
+/pictures/ costs one stat() per hit. Pages show the request path, so
+another spelling of the URL (/pictures//, an alias) renders them again
+in place of the old ones rather than next to them.
+
+Big directories are listed AUTOINDEX_PAGE_SIZE entries at a time:
+
+	/pictures/?page=2
+
+The scan itself reads getdents64 batches straight into the entry list
+and runs on the disk pool (it must not touch the cache).
+*/
+
+const size_t AUTOINDEX_PAGE_SIZE = 1000;
+const size_t AUTOINDEX_CACHE_MAX_DIRS = 256;
+
+struct DirEntry {
+	std::string	name;
+	bool		isDir;
+};
+
+struct DirListing {
+	std::vector<DirEntry>							entries;	// sorted, without "." and ".."
+	struct timespec									mtime;
+	time_t											lastUsed;
+	std::string										renderedFor;	// request path of the pages below
+	std::unordered_map<size_t, std::string>			rendered;		// page → HTML
+};
+
+class Autoindex {
+	private:
+		typedef std::pair<dev_t, ino_t>	DirKey;
+		static std::map<DirKey, DirListing> _cache;
+
+	public:
+		static bool			scan(const std::string& dir, std::vector<DirEntry>& out);
+
+		// st: the directory's stat(), which identifies it
+		static DirListing*	lookup(const struct stat& st);
+		static DirListing*	store(const struct stat& st, std::vector<DirEntry>&& entries);
+
+		static size_t		pageFromQuery(const std::string& query);
+		static const std::string&	renderHtml(DirListing& listing, const std::string& reqPath, size_t page);
+		static std::string	renderPlain(const DirListing& listing);
+};
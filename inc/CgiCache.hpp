@@ -0,0 +1,113 @@
+#pragma once
+
+#include "Location.hpp"
+#include "HttpRequest.hpp"
+#include "HttpResponse.hpp"
+#include <string>
+#include <list>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <ctime>
+
+/* CGI response cache (cgi_cache)
+
+One cache per location, keyed by method, path, query, Host and the
+location's cgi_cache_key headers. Only GET requests go through it:
+
+	fresh		answered from the cache, no script runs
+	stale		answered from the cache while one refill runs in the
+				background (stale-while-revalidate)
+	miss		the first request runs the script; identical requests
+				arriving meanwhile wait for that run instead of starting
+				their own
+
+How long an answer stays fresh is up to the script: Cache-Control
+s-maxage / max-age (and stale-while-revalidate), else Expires, else
+cgi_cache_valid. Only 200 responses are stored, and never ones marked
+no-store, no-cache or private, or setting a cookie.
+
+Memory holds up to cgi_cache bytes, least recently used out first. With
+cgi_cache_path every stored answer is also written to a file there, read
+back on a memory miss, so it outlives evictions and restarts. The
+directory is swept every CGI_CACHE_SWEEP_INTERVAL, or sooner after a
+quarter of its cap was written: files past their stale time go, then the
+least recently used ones until it fits its size cap. Disk work runs on
+the AsyncIO pool: readDisk/writeDisk/sweepDisk touch only their arguments.
+*/
+
+const time_t CGI_CACHE_SWEEP_INTERVAL = 60;	// seconds between cgi_cache_path sweeps
+
+struct CgiCacheEntry {
+	std::string		key;
+	HttpResponse	response;
+	time_t			expires = 0;		// fresh until
+	time_t			staleUntil = 0;		// then served stale until
+	size_t			bytes = 0;			// 0 = no entry
+};
+
+class CgiCache {
+	public:
+		enum State { MISS, FRESH, STALE };
+
+		// A request waiting on a refill. res is the answer, or null with
+		// code: the error to send, or 0 = not shareable, run it yourself
+		typedef std::function<void(const HttpResponse* res, int code)>	WaitFn;
+
+		struct Fill {
+			int										leader = -1;	// client whose miss started it
+			std::vector<std::pair<int, WaitFn>>		waiters;
+		};
+
+	private:
+		typedef std::list<CgiCacheEntry>	Lru;	// most recently used first
+
+		std::string		_zone;
+		CgiCacheConfig	_config;
+		Lru				_lru;
+		std::unordered_map<std::string, Lru::iterator>	_index;
+		size_t			_bytes = 0;
+		std::unordered_map<std::string, Fill>	_fills;		// key → refill in flight
+		size_t			_diskWritten = 0;	// bytes written since the last sweep
+		time_t			_lastSweep;
+		bool			_sweeping = false;
+
+		void	evict();
+
+	public:
+		CgiCache(const std::string& zone, const CgiCacheConfig& config);
+		CgiCache(const CgiCache& other) = delete;
+		CgiCache& operator=(const CgiCache& other) = delete;
+		~CgiCache() = default;
+
+		// Locations with the same settings share a zone (a reload keeps it)
+		static std::string	zoneKey(const std::string& serverRoot, const Location& loc);
+		static bool			cacheable(const HttpRequest& req);
+
+		const CgiCacheConfig&	config() const;
+		std::string				key(const HttpRequest& req) const;
+		State					lookup(const std::string& key, time_t now, HttpResponse& out);
+		void					insert(const CgiCacheEntry& entry);
+		// Applies the freshness rules; false (and the key dropped) if res can't be kept
+		bool					store(const std::string& key, const HttpResponse& res,
+									time_t now, CgiCacheEntry& entry);
+
+		// One refill per key; everyone else waits on it
+		bool	filling(const std::string& key) const;
+		void	beginFill(const std::string& key, int leader);	// -1: refreshing a stale entry
+		void	wait(const std::string& key, int clientFd, WaitFn fn);
+		Fill	endFill(const std::string& key);
+		void	forget(int clientFd);
+
+		// Disk tier, on the AsyncIO pool
+		std::string		diskFile(const std::string& key) const;
+		static void		readDisk(const std::string& file, const std::string& key, CgiCacheEntry& entry);
+		static void		writeDisk(const std::string& file, const CgiCacheEntry& entry);
+		static void		removeDisk(const std::string& file);
+		// Expired files, then the least recently used past maxBytes
+		static void		sweepDisk(const std::string& dir, size_t maxBytes, time_t now);
+		void			noteDiskWrite(size_t bytes);
+		bool			sweepDue(time_t now) const;
+		void			beginSweep(time_t now);
+		void			endSweep();
+};
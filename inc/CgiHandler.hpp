@@ -4,6 +4,29 @@
 #include "HttpResponse.hpp"
 #include "Server.hpp"
 #include "Location.hpp"
+#include <sys/types.h>
+
+const time_t CGI_TIMEOUT = 10;	// seconds before the script is killed
+const size_t CGI_STDIN_PIPE_SIZE = 1024 * 1024;	// stdin pipe buffer for large request bodies
+
+// A running script. All pipe ends are non-blocking and polled by the
+// ServerManager; -1 once closed.
+struct CgiProcess {
+	pid_t	pid = -1;
+	int		stdinFd = -1;		// request body goes here (POST only)
+	int		stdoutFd = -1;
+	int		stderrFd = -1;
+};
+
+// How a script run ended, whichever way it ran (spawned, pooled, FastCGI)
+struct CgiOutcome {
+	bool		fastcgi = false;
+	bool		timedOut = false;
+	bool		ok = false;		// exited 0 / the backend answered
+	int			rejected = 0;	// never ran: the error to answer (cgi_max_concurrency)
+	std::string	out;
+	std::string	err;
+};
 
 class CgiHandler {
 
@@ -13,24 +36,31 @@ class CgiHandler {
 		CgiHandler& operator=(const CgiHandler& other) = delete;
 		~CgiHandler() = default;
 
-		HttpResponse execute(
+		// Spawns the interpreter and returns right away
+		CgiProcess start(
 			const std::string& scriptPath,
 			const std::string& interpreterPath,
-			const std::string& serverRoot
+			const Location& loc
 			);
 
-	private:
-		const HttpRequest& _request;
+		// Turns what the script printed into a response
+		static HttpResponse parseOutput(const std::string& output);
+		// Same for the header block alone, when the body is streamed
+		static HttpResponse parseHead(const std::string& headers);
+		// The response of a finished run, or the error code to answer instead (logged)
+		static int interpret(const CgiOutcome& outcome, const std::string& path, HttpResponse& res);
 
+		// CGI environment; also sent as FastCGI params
 		std::map<std::string, std::string> buildEnv(
 			const std::string& scriptPath,
-			const std::string& serverRoot
+			const Location& loc
 			) const;
-		int runProcess(
-			const std::string& scriptPath,
-			const std::map<std::string, std::string>& env,
-			const std::string& interpreterPath,
-			std::string& stdoutStr,
-			std::string& stderrStr
-		);
-};
\ No newline at end of file
+
+		// KEY=VALUE pairs that are the same for every request (Location::getCgiEnv)
+		static std::vector<std::string> baseEnv(const std::string& serverRoot);
+
+	private:
+		const HttpRequest& _request;
+
+		std::vector<std::string> requestEnv(const std::string& scriptPath) const;
+};
@@ -0,0 +1,119 @@
+#pragma once
+
+#include "Location.hpp"
+#include <string>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <functional>
+#include <ctime>
+#include <cstdint>
+
+class CgiQueue;
+
+/* CGI admission (cgi_max_concurrency)
+
+Each location with cgi_max_concurrency is a gate: at most that many of
+its scripts run at once, whichever way they run (spawned, cgi_pool,
+cgi_pass, cache refills). A request that finds the gate full waits:
+
+	submit		a slot is free → it starts now
+				else it queues, or gets 503 if cgi_queue_size are waiting
+	later		a slot frees up → the next waiter starts (from flush())
+				cgi_queue_timeout passes first → 503
+
+The queue is FIFO per client address, and addresses take turns, so one
+client firing a burst of requests can't push everyone else to the back.
+
+A running script holds a CgiSlot; the slot going away (the job done or
+cancelled) frees its place. Starts and rejections triggered that way are
+queued and run by flush(), once per loop pass, never from inside a
+destructor.
+
+Every CGI_QUEUE_REPORT_INTERVAL, gates that saw traffic log their queue
+depth, admissions, rejections and queue wait times.
+*/
+
+const time_t CGI_QUEUE_REPORT_INTERVAL = 60;	// seconds between queue metrics lines
+
+// A place at a gate, held while the script runs
+class CgiSlot {
+	private:
+		CgiQueue&	_queue;
+		std::string	_gate;
+
+	public:
+		CgiSlot(CgiQueue& queue, const std::string& gate);
+		CgiSlot(const CgiSlot& other) = delete;
+		CgiSlot& operator=(const CgiSlot& other) = delete;
+		~CgiSlot();
+};
+
+class CgiQueue {
+	public:
+		typedef std::function<void(const std::shared_ptr<CgiSlot>& slot)>	StartFn;
+		typedef std::function<void()>										RejectFn;
+
+	private:
+		struct Waiter {
+			std::string	gate;
+			std::string	client;			// address, the unit of fairness
+			int			clientFd = -1;	// -1: a cache refill
+			uint64_t	queuedAt = 0;	// ms
+			time_t		deadline = 0;
+			StartFn		start;
+			RejectFn	reject;
+		};
+
+		struct Stats {
+			size_t		peakDepth = 0;
+			size_t		admitted = 0;		// started right away or after waiting
+			size_t		queued = 0;
+			size_t		rejected = 0;		// queue full
+			size_t		timedOut = 0;
+			size_t		waited = 0;			// started after waiting
+			uint64_t	waitTotal = 0;		// ms, over those
+			uint64_t	waitMax = 0;
+		};
+
+		struct Gate {
+			CgiLimits	limits;
+			size_t		running = 0;
+			size_t		depth = 0;
+			std::unordered_map<std::string, std::deque<uint64_t>>	byClient;
+			std::deque<std::string>									turns;	// addresses with waiters, next first
+			Stats		stats;
+		};
+
+		std::unordered_map<std::string, Gate>		_gates;
+		std::unordered_map<uint64_t, Waiter>		_waiters;
+		std::vector<std::string>					_freed;		// gates a slot left since the last flush
+		std::deque<std::pair<int, RejectFn>>		_rejected;	// client fd → its 503
+		uint64_t									_nextId = 1;
+		time_t										_lastReport = 0;
+
+		void	unlink(Gate& gate, uint64_t id, const std::string& client);
+		void	dispatch(const std::string& name);
+
+	public:
+		CgiQueue() = default;
+		CgiQueue(const CgiQueue& other) = delete;
+		CgiQueue& operator=(const CgiQueue& other) = delete;
+		~CgiQueue() = default;
+
+		static std::string	gateKey(const std::string& serverRoot, const Location& loc);
+
+		// A slot right away, or null: then start or reject runs later, from flush()
+		std::shared_ptr<CgiSlot>	submit(const std::string& gate, const CgiLimits& limits,
+										int clientFd, const std::string& client,
+										StartFn start, RejectFn reject);
+		void		release(const std::string& gate);
+		// The client went away: its place in the queue and a 503 not run yet go
+		void		forget(int clientFd);
+		bool		waiting(int clientFd) const;
+
+		void		checkTimeouts(time_t now);
+		void		flush();
+		void		report(time_t now);
+};
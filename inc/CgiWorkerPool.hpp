@@ -0,0 +1,135 @@
+#pragma once
+
+#include "Location.hpp"
+#include <string>
+#include <map>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <ctime>
+#include <cstdint>
+#include <sys/types.h>
+
+class ConfigSnapshot;
+
+/* Pre-forked CGI workers (cgi_pool)
+
+A pool keeps long-lived Python interpreters around so a request pays
+for running the script, not for starting python3 and importing its
+modules. Each worker runs CGI_WORKER_BOOTSTRAP and serves one request
+at a time over two pipes:
+
+	fd 3 (request)		"<envlen> <bodylen>\n" env body
+						env = KEY=VALUE pairs, each NUL-terminated
+	fd 4 (response)		"<exit status> <outlen> <errlen>\n" stdout stderr
+
+The script runs in-process through runpy with sys.stdin/stdout/stderr
+and os.environ swapped in, so it sees what a forked CGI would. The
+worker's own fd 1 and 2 (a script writing past sys.stdout, or a child
+process it starts) go to the error log.
+
+Pools are warmed to their minimum when the configuration is loaded,
+grow up to their maximum on demand, queue beyond that, recycle a worker
+after maxRequests requests and shrink back after CGI_WORKER_IDLE_TIMEOUT.
+A script running past CGI_TIMEOUT gets its worker killed.
+
+Like FastCgiPool, completions are queued and run by flush(), and
+cancel() drops one still queued.
+*/
+
+const time_t CGI_WORKER_IDLE_TIMEOUT = 60;	// seconds before a worker above the minimum exits
+
+struct CgiWorkerResult {
+	bool		ok = false;			// the worker answered
+	bool		timedOut = false;
+	int			status = 0;			// script exit status
+	std::string	out;
+	std::string	err;
+};
+
+class CgiWorkerPool {
+	public:
+		typedef std::function<void(int fd, short events)>		WatchFn;
+		typedef std::function<void(pid_t pid)>					ReapFn;
+		typedef std::function<void(const CgiWorkerResult&)>		DoneFn;
+
+	private:
+		struct Pool {
+			std::string				interpreter;
+			std::vector<std::string>	env;		// the location's CGI base (Location::getCgiEnv)
+			CgiPoolConfig			config;
+			std::deque<uint64_t>	queue;
+			size_t					workers = 0;
+			bool					retired = false;	// gone from the configuration
+		};
+
+		struct Worker {
+			pid_t		pid = -1;
+			std::string	pool;
+			int			reqFd = -1;		// we write requests
+			int			respFd = -1;	// we read responses (the worker's key)
+			int			errFd = -1;		// its stdout/stderr
+			size_t		served = 0;
+			uint64_t	request = 0;	// 0 = idle
+			time_t		deadline = 0;	// of the running request
+			std::string	out;
+			size_t		outPos = 0;
+			std::string	in;
+			time_t		idleSince = 0;
+		};
+
+		struct Request {
+			std::string		pool;
+			std::string		frame;
+			time_t			deadline = 0;
+			int				worker = -1;	// respFd of the worker running it
+			CgiWorkerResult	result;
+			DoneFn			done;
+		};
+
+		struct Finished {
+			uint64_t		id;
+			DoneFn			done;
+			CgiWorkerResult	result;
+		};
+
+		WatchFn										_watch;
+		ReapFn										_reap;
+		std::unordered_map<std::string, Pool>		_pools;
+		std::unordered_map<int, Worker>				_workers;	// respFd → worker
+		std::unordered_map<int, int>				_fdOwner;	// any worker fd → respFd
+		std::unordered_map<uint64_t, Request>		_requests;
+		std::deque<Finished>						_finished;
+		uint64_t									_nextId = 1;
+
+		int		spawn(const std::string& key, Pool& pool);
+		void	dispatch(const std::string& key);
+		void	assign(Worker& w, uint64_t id);
+		bool	writeRequest(Worker& w);
+		bool	readResponse(Worker& w);
+		void	readErrors(Worker& w);
+		void	retire(int respFd, bool kill);
+		void	finish(uint64_t id);
+
+	public:
+		CgiWorkerPool(WatchFn watch, ReapFn reap);
+		CgiWorkerPool(const CgiWorkerPool& other) = delete;
+		CgiWorkerPool& operator=(const CgiWorkerPool& other) = delete;
+		~CgiWorkerPool();
+
+		static std::string	poolKey(const Location& loc, const std::string& ext);
+
+		// Creates the configured pools, warms them, retires the others
+		void		configure(const ConfigSnapshot& config);
+
+		uint64_t	submit(const std::string& key,
+						const std::map<std::string, std::string>& env,
+						const std::string& body, DoneFn done);
+		void		cancel(uint64_t id);
+
+		bool		owns(int fd) const;
+		void		handle(int fd, short revents);
+		void		checkTimeouts(time_t now);
+		void		flush();
+};
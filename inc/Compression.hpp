@@ -0,0 +1,130 @@
+#pragma once
+
+#include "HttpRequest.hpp"
+#include "HttpResponse.hpp"
+#include "Location.hpp"
+#include "Server.hpp"
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <ctime>
+#include <sys/stat.h>
+
+/* Response compression
+
+Negotiated from the client's Accept-Encoding header:
+
+	Accept-Encoding: gzip, deflate;q=0.5, br;q=0
+
+Only the location's gzip_types (text/html is always included) are
+compressed, and only when the body is at least gzip_min_length bytes.
+Compressed variants of static files are cached by (path, mtime to the
+nanosecond, size) so a hot stylesheet is deflated once, not on every
+request, and a file rewritten within the same second isn't served stale.
+
+Other full responses (CGI output, listings, pages) are deflated on the
+disk pool once the body reaches COMPRESSION_OFFLOAD_MIN; below that the
+round trip costs more than deflating on the loop.
+
+Streamed bodies (CGI output sent as it is produced) go through a
+CompressionStream instead: every piece is deflated and flushed on its
+own, so the client can decode what it has so far. Their size is not
+known up front, so gzip_min_length does not apply.
+
+With gzip_static, precompressed sidecars (style.css.br, style.css.gz)
+are served as-is when the client accepts them; gzip_static_generate
+creates missing .gz sidecars at startup, and on the disk pool after a
+reload (from SidecarTasks: the directory and what to compress, copied
+out of the configuration so the walk needs nothing shared).
+*/
+
+enum ContentEncoding {
+	ENCODING_IDENTITY,
+	ENCODING_GZIP,
+	ENCODING_DEFLATE
+};
+
+const int		GZIP_COMP_LEVEL = 6;
+const int		GZIP_STATIC_LEVEL = 9;	// sidecars are built once, squeeze them
+const size_t	COMPRESSION_CACHE_MAX_BYTES = 32 * 1024 * 1024;
+const size_t	COMPRESSION_OFFLOAD_MIN = 16 * 1024;	// smaller bodies deflate on the loop
+
+struct z_stream_s;
+
+// One gzip_static_generate location, walked off the event loop
+struct SidecarTask {
+	std::string								dir;
+	size_t									minLength = 0;
+	std::unordered_map<std::string, bool>	extensions;		// known extension → compressible
+	bool									otherTypes = false;	// the default type is
+	size_t									created = 0;
+	std::vector<std::string>				errors;			// logged back on the loop
+};
+
+// Incremental gzip/deflate of a body sent piece by piece
+class CompressionStream {
+	private:
+		z_stream_s*	_zs;
+
+		std::string	run(const char* data, size_t len, int flush);
+
+	public:
+		CompressionStream(ContentEncoding enc, int level = GZIP_COMP_LEVEL);
+		CompressionStream(const CompressionStream& other) = delete;
+		CompressionStream& operator=(const CompressionStream& other) = delete;
+		~CompressionStream();
+
+		std::string	write(const char* data, size_t len);	// flushed: decodable right away
+		std::string	finish();								// trailer
+};
+
+class Compression {
+	private:
+		struct CacheEntry {
+			std::string		key;
+			struct timespec	mtime;
+			off_t			size;		// of the file it encodes
+			std::string		body;
+		};
+
+		static std::list<CacheEntry>	_lru;	// front = most recently used
+		static std::unordered_map<std::string, std::list<CacheEntry>::iterator> _index;
+		static size_t					_cacheBytes;
+
+		static std::string cacheKey(const std::string& path, ContentEncoding enc);
+		static double	qValue(const std::string& header, const std::string& coding);
+		static void		generateSidecarsIn(const std::string& dir, SidecarTask& task);
+		static bool		eligible(const HttpResponse& res, const Location& loc, std::string& contentType);
+		static bool		fresh(const CacheEntry& entry, const struct stat& st);
+
+	public:
+		static ContentEncoding	negotiate(const HttpRequest& req);
+		// q-value the client gives coding ("*" if it isn't listed); 0 = refused
+		static double			acceptance(const HttpRequest& req, const std::string& coding);
+		static bool				accepts(const HttpRequest& req, const std::string& coding);
+		static std::string		encodingName(ContentEncoding enc);
+		static bool				compress(const std::string& in, std::string& out,
+									ContentEncoding enc, int level = GZIP_COMP_LEVEL);
+
+		static bool	matchesType(const Location& loc, const std::string& contentType);
+		static bool	isCompressible(const Location& loc, const std::string& contentType, size_t size);
+		static void	apply(HttpResponse& res, const HttpRequest& req, const Location& loc);
+		// apply() in two steps, so the deflate can run elsewhere in between:
+		// the coding to compress res with (identity = send as is), then the swap
+		static ContentEncoding	plan(HttpResponse& res, const HttpRequest& req, const Location& loc);
+		static void	useEncoded(HttpResponse& res, std::string& out, ContentEncoding enc);
+		// Head of a streamed body: the coding to run it through (identity = none)
+		static ContentEncoding	applyStream(HttpResponse& res, const HttpRequest& req, const Location& loc);
+
+		// -------------------- Static file cache --------------------
+		static const std::string*	cached(const std::string& path, const struct stat& st, ContentEncoding enc);
+		static const std::string*	store(const std::string& path, const struct stat& st, ContentEncoding enc,
+										std::string&& body);
+
+		// -------------------- Precompressed sidecars --------------------
+		static std::vector<SidecarTask>	sidecarTasks(const std::vector<Server>& servers);
+		static void	generateSidecars(std::vector<SidecarTask>& tasks);	// any thread
+		static void	reportSidecars(const std::vector<SidecarTask>& tasks);
+		// All three in a row (startup, before the loop runs)
+		static void	generateSidecars(const std::vector<Server>& servers);
+};
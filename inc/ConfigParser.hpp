@@ -2,10 +2,20 @@
 
 #include "Server.hpp"
 #include "Location.hpp"
+#include "Upstream.hpp"
+#include "SessionManager.hpp"
+#include <map>
+#include <utility>
+#include <ctime>
+
+// Seconds in-flight requests get on SIGINT/SIGTERM or after an upgrade
+const time_t DEFAULT_SHUTDOWN_TIMEOUT = 10;
 
 enum ConfigLineType {
 	BLOCK_START_SERVER,
 	BLOCK_START_LOCATION,
+	BLOCK_START_TYPES,
+	BLOCK_START_UPSTREAM,
 	BLOCK_END,
 	DIRECTIVE,
 	UNKNOWN
@@ -21,7 +31,24 @@ enum LocationDirective {
 	UPLOAD_PATH,
 	CGI_EXTENSION,
 	CGI_PASS,
+	CGI_POOL,
+	CGI_CACHE,
+	CGI_CACHE_VALID,
+	CGI_CACHE_PATH,
+	CGI_CACHE_KEY,
+	CGI_MAX_CONCURRENCY,
+	CGI_QUEUE_SIZE_DIR,
+	CGI_QUEUE_TIMEOUT_DIR,
 	RETURN,
+	GZIP,
+	GZIP_TYPES,
+	GZIP_MIN_LENGTH,
+	GZIP_STATIC,
+	GZIP_STATIC_GENERATE,
+	MMAP_THRESHOLD,
+	INTERNAL,
+	PROXY_PASS,
+	SESSION,
 	OTHER
 };
 
@@ -41,11 +68,23 @@ class ConfigParser {
 	private:
 		std::string _config_path;
 		std::vector<Server> _servers;
+		std::vector<std::pair<std::string, std::string>> _types;	// (type, extension)
+		time_t _shutdownTimeout = DEFAULT_SHUTDOWN_TIMEOUT;
+		std::map<std::string, UpstreamConfig> _upstreams;
+		SessionConfig _sessions;
 
+		void parseFile(const std::string& path, int depth);
+		void parseTypesBlock(std::ifstream& file);
+		void parseUpstreamBlock(std::ifstream& file, const std::string& line);
 		void parseServerBlock(std::ifstream& file);
 		void parseLocationBlock(std::ifstream& file, Server& server, const std::string& line);
 		void parseServerDirective(const std::string& line, Server& server);
 		void parseLocationDirective(const std::string& line, Location& location);
+		void checkCgiPools(const Location& location);
+		void checkCgiCache(const Location& location);
+		void checkCgiLimits(const Location& location);
+		void checkProxy(const Location& location);
+		void resolveUpstreams();
 
 		void setDefaultServers();
 
@@ -64,4 +103,8 @@ class ConfigParser {
 
 	// -------------------- Getters --------------------
 		const std::vector<Server>& getServers() const;
+		const std::vector<std::pair<std::string, std::string>>& getTypes() const;
+		time_t getShutdownTimeout() const;
+		const std::map<std::string, UpstreamConfig>& getUpstreams() const;
+		const SessionConfig& getSessionConfig() const;
 };
\ No newline at end of file
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "Server.hpp"
+#include "VirtualHosts.hpp"
+#include "Upstream.hpp"
+#include "SessionManager.hpp"
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <utility>
+
+/* Compiled configuration
+
+Everything a request reads from the config, built in one go and never
+modified afterwards: the servers (with their location routers and page
+templates), the vhost table, the MIME types, the upstream groups and
+the session limits.
+
+	ServerManager		holds the current snapshot
+	RequestHandler		holds the snapshot it started with
+
+On SIGHUP a new snapshot is parsed and swapped in. Requests already in
+flight (waiting on the disk pool) keep the old one alive until they
+finish, so servers and locations they point to never move under them.
+*/
+
+class ConfigSnapshot {
+	private:
+		std::string											_path;
+		unsigned long										_generation;
+		std::vector<Server>									_servers;
+		VirtualHosts										_vhosts;
+		std::vector<std::pair<std::string, std::string>>	_types;
+		time_t												_shutdownTimeout;
+		std::map<std::string, UpstreamConfig>				_upstreams;		// name → group
+		SessionConfig										_sessions;
+
+		ConfigSnapshot(const std::string& path, unsigned long generation);
+
+	public:
+		ConfigSnapshot() = delete;
+		ConfigSnapshot(const ConfigSnapshot& other) = delete;
+		ConfigSnapshot& operator=(const ConfigSnapshot& other) = delete;
+		~ConfigSnapshot() = default;
+
+		// Throws std::runtime_error on any config error
+		static std::shared_ptr<const ConfigSnapshot> load(const std::string& path, unsigned long generation = 1);
+
+	// -------------------- Getters --------------------
+		const std::string&			getPath() const;
+		unsigned long				getGeneration() const;
+		const std::vector<Server>&	getServers() const;
+		const Server&				getServer(size_t index) const;
+		const Server&				resolveServer(int port, const std::string& host) const;
+		const std::vector<std::pair<std::string, std::string>>&	getTypes() const;
+		time_t						getShutdownTimeout() const;
+		const std::map<std::string, UpstreamConfig>&	getUpstreams() const;
+		const SessionConfig&		getSessionConfig() const;
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <cstdint>
+#include <sys/socket.h>
+
+/* FastCGI wire format (FastCGI 1.0 specification)
+
+Everything travels in records: an 8-byte header, up to 65535 bytes of
+content, and padding up to a multiple of 8.
+
+	version | type | requestId (2) | contentLength (2) | padding | reserved
+
+One request is:
+
+	→ BEGIN_REQUEST (role RESPONDER, flag KEEP_CONN)
+	→ PARAMS ... PARAMS(empty)		the CGI environment as name-value pairs
+	→ STDIN ... STDIN(empty)		the request body
+	← STDOUT / STDERR ...			CGI output, same format as a CGI script
+	← END_REQUEST					app status + protocol status
+
+Request ids are per connection, so one connection can carry several
+requests at once when the backend says so (FCGI_MPXS_CONNS).
+*/
+
+const uint8_t	FCGI_VERSION_1 = 1;
+const size_t	FCGI_HEADER_LEN = 8;
+const size_t	FCGI_MAX_CONTENT = 65535;
+
+enum FcgiType {
+	FCGI_BEGIN_REQUEST = 1,
+	FCGI_ABORT_REQUEST = 2,
+	FCGI_END_REQUEST = 3,
+	FCGI_PARAMS = 4,
+	FCGI_STDIN = 5,
+	FCGI_STDOUT = 6,
+	FCGI_STDERR = 7,
+	FCGI_DATA = 8,
+	FCGI_GET_VALUES = 9,
+	FCGI_GET_VALUES_RESULT = 10,
+	FCGI_UNKNOWN_TYPE = 11
+};
+
+const uint16_t	FCGI_RESPONDER = 1;
+const uint8_t	FCGI_KEEP_CONN = 1;
+const uint8_t	FCGI_REQUEST_COMPLETE = 0;	// END_REQUEST protocol status
+
+struct FcgiRecord {
+	uint8_t		type = 0;
+	uint16_t	requestId = 0;
+	std::string	content;
+};
+
+// Where a cgi_pass backend listens: "unix:/run/app.sock" or "127.0.0.1:9000"
+struct FcgiAddress {
+	struct sockaddr_storage	addr;
+	socklen_t				len = 0;
+	int						family = 0;
+};
+
+class FastCgi {
+	public:
+		static FcgiAddress	parseAddress(const std::string& spec);
+
+		static void	appendRecord(std::string& out, uint8_t type, uint16_t id, const char* data, size_t len);
+		static void	appendStream(std::string& out, uint8_t type, uint16_t id, const std::string& data);
+		static void	appendBegin(std::string& out, uint16_t id, uint8_t flags);
+		static void	appendParams(std::string& out, uint16_t id, const std::map<std::string, std::string>& params);
+
+		static std::map<std::string, std::string>	parsePairs(const std::string& content);
+
+		// Reads the complete record at buf[pos], if there is one, and moves pos past it
+		static bool	nextRecord(const std::string& buf, size_t& pos, FcgiRecord& rec);
+};
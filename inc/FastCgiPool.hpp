@@ -0,0 +1,122 @@
+#pragma once
+
+#include "FastCgi.hpp"
+#include <string>
+#include <map>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <ctime>
+#include <cstdint>
+
+/* FastCGI connection pool (cgi_pass)
+
+Connections to each backend are opened on demand, kept alive between
+requests (FCGI_KEEP_CONN) and reused, up to FASTCGI_MAX_CONNS per
+backend. A fresh connection asks the backend whether it multiplexes
+(FCGI_GET_VALUES); if so, up to FASTCGI_MAX_REQS_PER_CONN requests share
+it, otherwise it carries one at a time. Requests beyond that wait in a
+per-backend queue.
+
+Everything is non-blocking and driven by the ServerManager's poll loop:
+the pool tells it which fds to watch (watch(fd, 0) = forget), and gets
+handle(fd, revents) back. Request bodies are encoded into STDIN records
+only as the socket drains, FASTCGI_STDIN_WINDOW bytes ahead; STDOUT
+records are collected as they arrive.
+
+Completions are never run from inside the pool: they are queued and run
+by flush(), once per loop pass, so a callback may submit new requests.
+cancel() drops a queued completion too: its client is gone.
+*/
+
+const size_t FASTCGI_MAX_CONNS = 8;				// per backend
+const size_t FASTCGI_MAX_REQS_PER_CONN = 16;	// when the backend multiplexes
+const time_t FASTCGI_IDLE_TIMEOUT = 60;			// seconds a kept-alive connection may sit unused
+const time_t FASTCGI_TIMEOUT = 10;				// seconds a request may take, queueing included
+const size_t FASTCGI_STDIN_WINDOW = 65536;		// body bytes encoded ahead of the socket
+
+struct FastCgiResult {
+	bool		ok = false;			// END_REQUEST received
+	bool		timedOut = false;
+	std::string	out;				// STDOUT: CGI headers + body
+	std::string	err;				// STDERR
+	uint32_t	appStatus = 0;
+};
+
+class FastCgiPool {
+	public:
+		typedef std::function<void(int fd, short events)>	WatchFn;
+		typedef std::function<void(const FastCgiResult&)>	DoneFn;
+
+	private:
+		struct Request {
+			std::string							backend;
+			std::map<std::string, std::string>	params;
+			std::string							body;
+			size_t								bodySent = 0;	// encoded into STDIN records
+			bool								stdinDone = false;
+			int									connFd = -1;	// -1 while queued
+			uint16_t							fcgiId = 0;
+			int									attempts = 0;
+			bool								idempotent = false;	// GET/HEAD: safe to send twice
+			bool								responded = false;	// any record came back
+			time_t								deadline = 0;
+			FastCgiResult						result;
+			DoneFn								done;
+		};
+
+		struct Finished {
+			uint64_t		id;
+			DoneFn			done;
+			FastCgiResult	result;
+		};
+
+		struct Connection {
+			std::string						backend;
+			bool							connecting = true;
+			bool							closed = false;		// the backend hung up: nothing new on it
+			bool							multiplexed = false;	// learned from GET_VALUES_RESULT
+			size_t							maxReqs = 1;
+			std::string						out;
+			size_t							outPos = 0;
+			std::string						in;
+			std::map<uint16_t, uint64_t>	active;		// FastCGI id → request (0 = abandoned)
+			time_t							idleSince = 0;
+		};
+
+		WatchFn												_watch;
+		std::unordered_map<uint64_t, Request>				_requests;
+		std::unordered_map<int, Connection>					_conns;		// socket fd → connection
+		std::unordered_map<std::string, std::deque<uint64_t>>	_queues;	// backend → waiting requests
+		std::deque<Finished>								_finished;
+		uint64_t											_nextId = 1;
+
+		int		connect(const std::string& backend);
+		void	dispatch(const std::string& backend);
+		void	assign(int fd, Connection& conn, uint64_t id);
+		void	pump(Connection& conn);
+		bool	write(int fd, Connection& conn);
+		bool	read(int fd, Connection& conn);
+		void	onRecord(Connection& conn, const FcgiRecord& rec);
+		void	detach(int fd, Connection& conn, Request& req);
+		void	finish(uint64_t id);
+		void	closeConnection(int fd, bool retry);
+		void	updateEvents(int fd, const Connection& conn);
+
+	public:
+		FastCgiPool(WatchFn watch);
+		FastCgiPool(const FastCgiPool& other) = delete;
+		FastCgiPool& operator=(const FastCgiPool& other) = delete;
+		~FastCgiPool();
+
+		uint64_t	submit(const std::string& backend,
+						const std::map<std::string, std::string>& params,
+						std::string body, DoneFn done);
+		void		cancel(uint64_t id);
+
+		bool		owns(int fd) const;
+		void		handle(int fd, short revents);
+		void		checkTimeouts(time_t now);
+		void		flush();
+};
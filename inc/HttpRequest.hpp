@@ -56,6 +56,8 @@ class HttpRequest {
 		std::string			getHeader(const std::string& key) const;
 		const std::multimap<std::string, std::string>& getHeaders() const;
 		const std::string&	getBody() const;
+		std::string			takeBody();		// moves it out, once nothing else needs it
+		void				rewrite(const std::string& uri);	// internal redirect: GET uri instead
 		std::string			getCookie(const std::string& key) const;
 		const std::string	getQueryString() const;
 
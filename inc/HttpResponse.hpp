@@ -4,6 +4,8 @@
 #include <sstream>
 #include <map>
 #include <vector>
+#include <memory>
+#include "MappedFile.hpp"
 
 /* HTTP Response
 
@@ -21,6 +23,9 @@ Empty line: separates headers from body (\r\n)
 Body: actual content of the response — HTML, JSON, image data, etc. _body contains binary data in case of image
 
 	<html><body>Hello, world!</body></html>
+
+	Large static files are not copied into _body: the response points into a
+	shared MappedFile instead, and serialize() then returns only the head.
 */
 
 class HttpResponse {
@@ -31,6 +36,7 @@ private:
 	std::map<std::string, std::string> _headers;
 	std::string _body;
 	std::vector<std::string> _setCookies;
+	std::shared_ptr<const MappedFile> _mapping;
 
 public:
 	HttpResponse();
@@ -40,16 +46,22 @@ public:
 	~HttpResponse() = default;
 
 	void setHeader(const std::string& key, const std::string& value);
+	void removeHeader(const std::string& key);
 	void setBody(const std::string& body);
+	void setBodyMapping(const std::shared_ptr<const MappedFile>& file);
+	void setStatusMessage(const std::string& message);
 
 	static std::string statusMessageForCode(int code);
 	std::string serialize() const;
 
 	const std::string& getBody() const;
+	const std::shared_ptr<const MappedFile>& getBodyMapping() const;
 	int getStatusCode() const;
 	const std::map<std::string, std::string>& getHeaders() const;
 
 	void setCookie(const std::string& key,
 				const std::string& value,
 				const std::string& attrs = "Path=/; HttpOnly; SameSite=Lax");
+	// A Set-Cookie value passed through as is (one per call, never joined)
+	void addSetCookie(const std::string& raw);
 };
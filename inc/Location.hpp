@@ -3,6 +3,36 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <ctime>
+
+// cgi_pool: warm interpreter workers for one CGI extension
+struct CgiPoolConfig {
+	size_t	minWorkers = 0;
+	size_t	maxWorkers = 0;
+	size_t	maxRequests = 0;	// recycle a worker after this many (0 = never)
+};
+
+const size_t CGI_QUEUE_SIZE = 32;		// default cgi_queue_size
+const time_t CGI_QUEUE_TIMEOUT = 5;		// default cgi_queue_timeout (seconds)
+const size_t CGI_CACHE_DISK_MAX = 256 * 1024 * 1024;	// default cgi_cache_path size cap
+
+// cgi_max_concurrency: scripts of the location running at once; the
+// others wait in a queue of queueSize for up to queueTimeout, then 503
+struct CgiLimits {
+	size_t	maxConcurrency = 0;		// 0 = unlimited
+	size_t	queueSize = CGI_QUEUE_SIZE;
+	time_t	queueTimeout = CGI_QUEUE_TIMEOUT;
+};
+
+// cgi_cache: responses of the location's scripts, kept and shared
+struct CgiCacheConfig {
+	size_t						maxBytes = 0;	// memory tier (0 = off)
+	time_t						validFor = 0;	// responses that don't say (0 = not stored)
+	time_t						staleFor = 0;	// served stale while one request refills
+	std::string					path;			// on-disk tier (optional)
+	size_t						diskMaxBytes = CGI_CACHE_DISK_MAX;	// files in path, at most
+	std::vector<std::string>	keyHeaders;		// request headers the response depends on
+};
 
 class Location {
 private:
@@ -15,13 +45,27 @@ private:
 	bool								_autoindex;
 	std::map<std::string, std::string>	_cgiExtensions;
 	std::string							_uploadPath;
-	std::string							_cgiProgram;
+	std::string							_cgiProgram;	// cgi_pass: FastCGI backend address
+	std::map<std::string, CgiPoolConfig>	_cgiPools;		// extension → worker pool
+	std::vector<std::string>			_cgiEnv;		// KEY=VALUE common to every script here
+	CgiCacheConfig						_cgiCache;
+	CgiLimits							_cgiLimits;
+	bool								_internal = false;	// only reachable through X-Accel-Redirect
+	std::string							_proxyPass;		// upstream group answering the location
+	bool								_session = false;	// session on: cookie read, session kept
 
 	bool								_hasReturn;
 	bool								_hasMaxSize;
 	int									_returnCode;
 	std::string							_returnTarget;
 
+	bool								_gzip;
+	std::vector<std::string>			_gzipTypes;
+	size_t								_gzipMinLength;
+	bool								_gzipStatic;
+	bool								_gzipStaticGenerate;
+	size_t								_mmapThreshold;
+
 public:
 	Location();
 	~Location() = default;
@@ -37,12 +81,25 @@ public:
 	const std::map<std::string, std::string>& getCgiExtensions() const;
 	const std::string& getUploadPath() const;
 	const std::string& getCgiProgram() const;
+	const std::map<std::string, CgiPoolConfig>& getCgiPools() const;
+	const std::vector<std::string>& getCgiEnv() const;
+	const CgiCacheConfig& getCgiCache() const;
+	const CgiLimits& getCgiLimits() const;
+	bool	isInternal() const;
+	const std::string& getProxyPass() const;
+	bool	usesSession() const;
 	const std::string& getReturnTarget() const;
 	bool	getAutoindex() const;
 	bool	hasReturn() const;
 	bool	hasMaxSize() const;
 	int		getReturnCode() const;
 	size_t	getClientMaxBodySize() const;
+	bool	getGzip() const;
+	const std::vector<std::string>& getGzipTypes() const;
+	size_t	getGzipMinLength() const;
+	bool	getGzipStatic() const;
+	bool	getGzipStaticGenerate() const;
+	size_t	getMmapThreshold() const;
 
 	// -------------------- Setters --------------------
 	void setPath(const std::string& p);
@@ -55,6 +112,19 @@ public:
 	void setCgiExtensions(const std::map<std::string, std::string>& cgi);
 	void setUploadPath(const std::string& path);
 	void setCgiProgram(const std::string& p);
+	void setCgiPool(const std::string& ext, const CgiPoolConfig& pool);
+	void setCgiEnv(const std::vector<std::string>& env);
+	void setCgiCache(const CgiCacheConfig& cache);
+	void setCgiLimits(const CgiLimits& limits);
+	void setInternal(bool internal);
+	void setProxyPass(const std::string& upstream);
+	void setSession(bool session);
 	void setReturn(int code, const std::string& target);
 	void setMaxSize();
+	void setGzip(bool g);
+	void setGzipTypes(const std::vector<std::string>& types);
+	void setGzipMinLength(size_t len);
+	void setGzipStatic(bool g);
+	void setGzipStaticGenerate(bool g);
+	void setMmapThreshold(size_t size);
 };
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <regex>
+
+/* Location router
+
+Built as locations are added to a Server, so matching a request never
+parses a pattern or copies a Location:
+
+	location /            ─┐
+	location /pictures/    ├─ radix trie over the paths
+	location /pictures/cat ┘  (exact and longest-prefix in one walk)
+	location ~ \.py$       ── regex compiled once, tried in config order
+
+match() returns an index into the server's location list, following the
+usual precedence: exact path, then the first matching regex, then the
+longest prefix.
+*/
+
+class LocationRouter {
+	private:
+		struct Node {
+			std::string			label;			// edge from the parent
+			std::vector<size_t>	children;		// node indices
+			long				location = -1;	// location ending here
+		};
+		struct Pattern {
+			std::regex	regex;
+			size_t		location;
+		};
+
+		std::vector<Node>		_nodes;			// _nodes[0] is the root
+		std::vector<Pattern>	_patterns;
+
+		void	insert(const std::string& path, size_t location);
+
+	public:
+		LocationRouter();
+
+		// Throws std::runtime_error for an invalid regex
+		void	add(const std::string& path, size_t location);
+		long	match(const std::string& path) const;	// -1: no location
+};
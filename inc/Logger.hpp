@@ -20,8 +20,11 @@ class Logger {
 
 		static std::ofstream _accessFile;
 		static std::ofstream _errorFile;
+		static std::string _accessPath;
+		static std::string _errorPath;
 
 	public:
 		static void log(LogLevel level, const std::string& msg);
 		static void init(const std::string& accessPath, const std::string& errorPath);
+		static void reopen();
 };
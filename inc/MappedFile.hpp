@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <unordered_map>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/* Memory-mapped file
+
+Large read-mostly files (at least the location's mmap_threshold) are
+mapped once and shared by every response that sends them:
+
+	MappedFile::open("./www/pictures/big.jpg", st)
+		→ same shared_ptr for all concurrent downloads of that file
+
+The mapping stays alive while any response still points into it and is
+unmapped when the last one finishes. A changed file (new inode, size or
+mtime, to the nanosecond) gets a fresh mapping; old responses keep
+reading the old one.
+*/
+
+class MappedFile {
+	private:
+		const char*	_data;
+		size_t		_size;
+		ino_t		_ino;
+		struct timespec	_mtime;		// st_mtim: a rewrite within the same second counts
+		std::string	_contentType;	// resolved once per mapping
+
+		// path → currently shared mapping (expired once no response uses it)
+		static std::unordered_map<std::string, std::weak_ptr<const MappedFile>> _open;
+
+		MappedFile(const char* data, size_t size, const struct stat& st, const std::string& contentType);
+
+	public:
+		MappedFile() = delete;
+		MappedFile(const MappedFile& other) = delete;
+		MappedFile& operator=(const MappedFile& other) = delete;
+		~MappedFile();
+
+		static std::shared_ptr<const MappedFile> open(const std::string& path, const struct stat& st);
+
+	// -------------------- Getters --------------------
+		const char*	data() const;
+		size_t		size() const;
+		const std::string&	contentType() const;
+};
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+#include <unordered_map>
+
+/* Extension → Content-Type table
+
+Built from the top-level `types { }` block (usually pulled in with
+`include mime.types;`), or from the built-in table below when the config
+has none. Either way it ends up as one flat array sorted by extension:
+
+	lookup("./www/css/Style.CSS")  → "text/css"
+	lookup("./www/archive")        → "application/octet-stream"
+
+Lookups are a binary search comparing bytes case-insensitively in place:
+no substring, no lowercase copy, and the result refers into the table.
+Static files go through forFile(), which remembers the answer per path so
+a file served again costs one hash lookup; load() forgets them all.
+*/
+
+const size_t MIME_FILE_CACHE_MAX = 4096;	// paths remembered by forFile()
+
+struct MimeType {
+	std::string_view	ext;	// lowercase, without the dot
+	std::string_view	type;
+};
+
+// Fallback when the config has no `types` block; must stay sorted by ext
+constexpr MimeType BUILTIN_MIME_TYPES[] = {
+	{ "avif",	"image/avif" },
+	{ "bmp",	"image/bmp" },
+	{ "br",		"application/x-brotli" },
+	{ "css",	"text/css" },
+	{ "csv",	"text/csv" },
+	{ "gif",	"image/gif" },
+	{ "gz",		"application/gzip" },
+	{ "htm",	"text/html" },
+	{ "html",	"text/html" },
+	{ "ico",	"image/x-icon" },
+	{ "jpeg",	"image/jpeg" },
+	{ "jpg",	"image/jpeg" },
+	{ "js",		"application/javascript" },
+	{ "json",	"application/json" },
+	{ "map",	"application/json" },
+	{ "md",		"text/markdown" },
+	{ "mjs",	"application/javascript" },
+	{ "mp3",	"audio/mpeg" },
+	{ "mp4",	"video/mp4" },
+	{ "ogg",	"audio/ogg" },
+	{ "otf",	"font/otf" },
+	{ "pdf",	"application/pdf" },
+	{ "png",	"image/png" },
+	{ "svg",	"image/svg+xml" },
+	{ "tar",	"application/x-tar" },
+	{ "ttf",	"font/ttf" },
+	{ "txt",	"text/plain" },
+	{ "wasm",	"application/wasm" },
+	{ "wav",	"audio/wav" },
+	{ "webm",	"video/webm" },
+	{ "webp",	"image/webp" },
+	{ "woff",	"font/woff" },
+	{ "woff2",	"font/woff2" },
+	{ "xml",	"application/xml" },
+	{ "zip",	"application/zip" },
+};
+
+constexpr bool mimeTableSorted(const MimeType* table, size_t n) {
+	for (size_t i = 1; i < n; ++i) {
+		if (!(table[i - 1].ext < table[i].ext))
+			return false;
+	}
+	return true;
+}
+
+static_assert(mimeTableSorted(BUILTIN_MIME_TYPES, std::size(BUILTIN_MIME_TYPES)),
+	"BUILTIN_MIME_TYPES must be sorted by extension without duplicates");
+
+class MimeTypes {
+	private:
+		struct Entry {
+			std::string	ext;
+			std::string	type;
+		};
+		static std::vector<Entry>	_table;
+		static std::unordered_map<std::string, std::string>	_byFile;	// path → type
+
+	public:
+		static const std::string	DEFAULT_TYPE;
+
+		// (type, extension) pairs in config order; empty → built-in table
+		static void					load(const std::vector<std::pair<std::string, std::string>>& types);
+		static const std::string&	lookup(std::string_view path);
+		// lookup() resolved once per file path (loop thread only)
+		static const std::string&	forFile(const std::string& path);
+		// (extension, type) copies of the table, for work done off the loop
+		static std::vector<std::pair<std::string, std::string>>	entries();
+};
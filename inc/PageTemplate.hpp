@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+
+/* Precompiled HTML page
+
+Error, success and redirect pages are read once at config time and split
+into literal segments and {{key}} slots:
+
+	"<p>{{filename}} ({{size}})</p>"
+	→ literals: "<p>", " (", ")</p>"   slots: filename, size
+
+render() sizes the output up front and appends each piece once. A slot
+with no value is written back as "{{key}}", like the old find/replace.
+*/
+
+class PageTemplate {
+	private:
+		std::vector<std::string>	_literals;	// always _slots.size() + 1
+		std::vector<std::string>	_slots;
+		size_t						_literalBytes;
+
+		explicit PageTemplate(const std::string& text);
+
+	public:
+		static std::shared_ptr<const PageTemplate>	load(const std::string& path);
+
+		std::string	render(const std::map<std::string, std::string>& vars = {}) const;
+};
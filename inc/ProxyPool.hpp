@@ -0,0 +1,162 @@
+#pragma once
+
+#include "Upstream.hpp"
+#include "HttpRequest.hpp"
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <deque>
+#include <functional>
+#include <ctime>
+#include <cstdint>
+
+class ConfigSnapshot;
+
+/* Reverse proxy connections (proxy_pass)
+
+Requests go to an HTTP/1.1 backend picked by their Upstream, over
+connections kept alive between requests: after a complete answer the
+connection goes back to an idle list (up to the group's keepalive per
+server) and the next request to that server reuses it.
+
+	submit		pick a server, reuse or open a connection, send the
+				request head, then the body as the socket drains
+	answer		the head is parsed and handed over (onHead), the body
+				passed on piece by piece (onBody) as it arrives:
+				Content-Length, chunked (decoded) or up to the close
+	done		queued, run by flush() like the other pools (cancel()
+				drops it)
+
+Nothing back yet when the connection fails or times out: the server
+takes the blame (Upstream::failed) and the request moves to another
+one, if it is safe to resend (GET, DELETE, or it never got through).
+A kept-alive connection the backend closed meanwhile is just retried.
+
+A client that reads slower than the backend writes pauses its request:
+its connection is not read until resume() (the data waiting is handled
+at the next flush()).
+
+Everything is non-blocking and driven by the ServerManager's poll loop,
+which is told what to watch (watch(fd, 0) = forget).
+*/
+
+const time_t PROXY_CONNECT_TIMEOUT = 5;		// seconds to connect to a backend
+const time_t PROXY_TIMEOUT = 60;			// seconds a backend may stay silent
+const time_t PROXY_IDLE_TIMEOUT = 60;		// seconds a kept-alive connection may sit unused
+const size_t PROXY_MAX_HEAD = 16384;		// bytes of response head
+
+// Status line and headers of a backend's answer, as sent
+struct ProxyHead {
+	int													status = 0;
+	std::string											reason;
+	std::vector<std::pair<std::string, std::string>>	headers;
+	bool												hasBody = true;		// no for 1xx, 204, 304
+	bool												hasLength = false;	// Content-Length passed on
+};
+
+struct ProxyResult {
+	bool		ok = false;			// the whole answer came through
+	bool		started = false;	// onHead ran
+	bool		timedOut = false;
+	std::string	server;				// last server tried
+};
+
+class ProxyPool {
+	public:
+		typedef std::function<void(int fd, short events)>			WatchFn;
+		typedef std::function<void(const ProxyHead&)>				HeadFn;
+		typedef std::function<void(const char* data, size_t len)>	BodyFn;
+		typedef std::function<void(const ProxyResult&)>				DoneFn;
+
+	private:
+		enum ReadState { READ_HEAD, READ_LENGTH, READ_CHUNK_SIZE, READ_CHUNK_DATA,
+			READ_CHUNK_END, READ_TRAILER, READ_TO_CLOSE };
+
+		struct Request {
+			std::shared_ptr<Upstream>	upstream;
+			std::string					key;			// for hash balancing
+			std::string					head;
+			std::string					body;
+			bool						idempotent = false;
+			int							connFd = -1;
+			int							peer = -1;
+			std::vector<size_t>			tried;
+			bool						retried = false;	// once on a fresh connection
+			bool						responded = false;	// any byte came back
+			bool						paused = false;
+			time_t						deadline = 0;
+			ProxyResult					result;
+			HeadFn						onHead;
+			BodyFn						onBody;
+			DoneFn						done;
+		};
+
+		struct Finished {
+			uint64_t	id;
+			DoneFn		done;
+			ProxyResult	result;
+		};
+
+		struct Connection {
+			std::shared_ptr<Upstream>	upstream;
+			size_t						peer = 0;
+			bool						connecting = true;
+			bool						reused = false;		// served a request before
+			uint64_t					request = 0;		// 0 = idle
+			size_t						headSent = 0;
+			size_t						bodySent = 0;
+			std::string					in;
+			ReadState					state = READ_HEAD;
+			size_t						remaining = 0;		// of the body, or of the chunk
+			bool						keepAlive = true;
+			time_t						idleSince = 0;
+		};
+
+		WatchFn												_watch;
+		std::map<std::string, std::shared_ptr<Upstream>>	_upstreams;
+		std::unordered_map<uint64_t, Request>				_requests;
+		std::unordered_map<int, Connection>					_conns;		// socket fd → connection
+		std::deque<Finished>								_finished;
+		std::vector<int>									_resumed;	// paused connections to read again
+		uint64_t											_nextId = 1;
+
+		int		connect(const std::shared_ptr<Upstream>& upstream, size_t peer);
+		void	dispatch(uint64_t id);
+		void	assign(int fd, Connection& conn, uint64_t id);
+		bool	write(int fd, Connection& conn);
+		bool	read(int fd, Connection& conn);
+		bool	parse(int fd, Connection& conn);
+		bool	parseHead(Connection& conn, Request& req, const std::string& head);
+		void	complete(int fd, Connection& conn);
+		void	fail(int fd, bool timedOut);
+		void	finish(uint64_t id);
+		void	closeConnection(int fd);
+		void	updateEvents(int fd, const Connection& conn);
+
+	public:
+		ProxyPool(WatchFn watch);
+		ProxyPool(const ProxyPool& other) = delete;
+		ProxyPool& operator=(const ProxyPool& other) = delete;
+		~ProxyPool();
+
+		// Upstream groups of a (new) configuration; unchanged ones keep their health
+		void		configure(const ConfigSnapshot& config);
+
+		// The request as the backend sees it: same method and URI, hop-by-hop
+		// headers dropped, X-Forwarded-For / X-Real-IP / X-Forwarded-Proto added
+		static std::string	requestHead(const HttpRequest& req, const std::string& client, size_t bodyLength);
+
+		// body: the request's, already taken out of req
+		uint64_t	submit(const std::string& upstream, const HttpRequest& req, const std::string& client,
+						std::string body, HeadFn onHead, BodyFn onBody, DoneFn done);
+		void		pause(uint64_t id);
+		void		resume(uint64_t id);
+		void		cancel(uint64_t id);
+
+		bool		owns(int fd) const;
+		void		handle(int fd, short revents);
+		void		checkTimeouts(time_t now);
+		void		flush();
+};
@@ -5,6 +5,7 @@
 #include "HttpResponse.hpp"
 #include "Session.hpp"
 #include "Logger.hpp"
+#include <functional>
 
 const size_t MAX_URI_LENGTH = 8192;
 
@@ -33,21 +34,47 @@ inline HttpMethod stringToMethod(const std::string& m) {
 
 class RequestHandler {
 private:
-	Session*		_session;
+	std::shared_ptr<Session>	_session;
 	ServerManager&	_serverManager;
 	HttpRequest		_request;
 	int				_clientFd;
 	bool			_keepAlive;
 	bool			_processed = false;
-	bool			_newSession;
+	bool			_newSession = false;
+	bool			_suspended = false;
+	std::shared_ptr<const ConfigSnapshot>	_config;	// keeps _server/_location alive
+	const Server*	_server = nullptr;
+	const Location*	_location = nullptr;	// matched location, owned by the Server
+	HttpResponse	_accelHead;				// script headers naming an X-Accel-Redirect target
+	std::vector<std::pair<std::string, std::string>>	_carriedHeaders;	// script headers kept on that target
 
 	HttpMethod getMethod() const;
 
-	Server&	matchServer(const HttpRequest& req, int listenPort);
-	void	handleGet(Server& srv, Location& loc);
-	void	handlePost(Server& srv, Location& loc);
-	void	handleDelete(Server& srv, Location& loc);
+	const Server&	matchServer(const HttpRequest& req, int listenPort);
+	void	handleGet(const Server& srv, const Location& loc);
+	void	handlePost(const Server& srv, const Location& loc);
+	void	handleDelete(const Server& srv, const Location& loc);
 	void	handleVisitCounter();
+	Session&	session();
+	void	runScript(const Location& loc, const std::string& ext, const std::string& scriptPath);
+	void	launchScript(const Location& loc, const std::string& ext, const std::string& scriptPath,
+				const std::shared_ptr<CgiSlot>& slot);
+	void	runCgi(const Location& loc, const std::string& scriptPath, const std::string& interpreter,
+				const std::shared_ptr<CgiSlot>& slot);
+	void	runPooledCgi(const Location& loc, const std::string& ext, const std::string& scriptPath,
+				const std::shared_ptr<CgiSlot>& slot);
+	void	runFastCgi(const Location& loc, const std::string& scriptPath, const std::shared_ptr<CgiSlot>& slot);
+	void	streamCgi(CgiJob& job, const std::string& head);
+	void	runProxy(const Location& loc);
+	bool	streamProxy(const ProxyHead& head);
+	void	answerCgi(const CgiOutcome& outcome);
+	void	serveCgiCached(const std::shared_ptr<CgiCache>& cache, const std::string& ext,
+				const std::string& scriptPath, bool diskChecked = false);
+	void	fillCgiCache(const std::shared_ptr<CgiCache>& cache, const std::string& key, int leader,
+				const std::string& ext, const std::string& scriptPath);
+	void	answerCached(const HttpResponse& res, const std::string& status);
+	bool	accelRedirect(const HttpResponse& res);
+	void	queueResponse(HttpResponse& res);
 
 public:
 	RequestHandler(ServerManager& manager, const std::string& rawRequest, int clientFd);
@@ -60,6 +87,10 @@ public:
 	void setKeepAlive(bool val);
 	void markProcessed();
 	bool processed() const;
+	bool suspended() const;
+
+	// Runs work on the disk pool; finish builds the response back on the loop
+	void offload(std::function<void()> work, std::function<HttpResponse()> finish);
 
 	void sendResponse(const HttpResponse& res);
 	HttpResponse makeErrorResponse(
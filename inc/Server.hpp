@@ -3,7 +3,10 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <memory>
 #include "Location.hpp"
+#include "PageTemplate.hpp"
+#include "LocationRouter.hpp"
 
 class Server {
 private:
@@ -18,9 +21,15 @@ private:
 	bool						_autoindex;
 	std::vector<std::string>	_methods;
 	std::vector<Location>		_locations;
+	LocationRouter				_router;		// indices into _locations
 	bool						_hasListen;
 	bool						_hasRoot;
 
+	// Pages compiled by loadPages(), shared between copies of the server
+	std::map<int, std::shared_ptr<const PageTemplate>>	_errorTemplates;
+	std::shared_ptr<const PageTemplate>					_successTemplate;
+	std::shared_ptr<const PageTemplate>					_redirectTemplate;
+
 public:
 	// Constructors
 	Server();
@@ -45,6 +54,10 @@ public:
 	bool	hasListen() const;
 	bool	hasRoot() const;
 
+	const PageTemplate*	getErrorTemplate(int code) const;
+	const PageTemplate*	getSuccessTemplate() const;
+	const PageTemplate*	getRedirectTemplate() const;
+
 	// -------------------- Setters --------------------
 	void setHost(const std::string& host);
 	void setListenPort(int port);
@@ -58,9 +71,11 @@ public:
 	void setMethod(const std::vector<std::string>& methods);
 	void setListenFlag();
 	void setRootFlag();
+	void loadPages();
+	void prepareCgiEnv();
 
 	// -------------------- Locations --------------------
 	void		addLocation(const Location& loc);
 	void		addLocation(Location&& loc);
-	Location	findLocation(const std::string& path) const;
+	const Location&	findLocation(const std::string& path) const;
 };
@@ -1,28 +1,102 @@
 #pragma once
 
-#include "Server.hpp"
+#include "ConfigSnapshot.hpp"
 #include "HttpRequest.hpp"
 #include "HttpResponse.hpp"
 #include "SessionManager.hpp"
+#include "AsyncIO.hpp"
+#include "CgiHandler.hpp"
+#include "FastCgiPool.hpp"
+#include "CgiWorkerPool.hpp"
+#include "Compression.hpp"
+#include "CgiCache.hpp"
+#include "CgiQueue.hpp"
+#include "ProxyPool.hpp"
 #include <vector>
 #include <map>
 #include <unordered_map>
+#include <deque>
+#include <memory>
+#include <functional>
 #include <poll.h>
 
 const size_t MAX_HEADER_SIZE = 8192;
 const time_t CLIENT_TIMEOUT = 10;
+const size_t CGI_STREAM_WINDOW = 65536;	// bytes queued to a client before its script's stdout is paused
+const size_t PROXY_STREAM_WINDOW = 65536;	// same, before its backend's answer stops being read
+
+// Binary upgrade (SIGUSR2): listening sockets handed to the new process
+// as "fd:port,fd:port", and the pid it reports readiness to (SIGWINCH)
+const char* const LISTEN_FDS_ENV = "WEBSERV_LISTEN_FDS";
+const char* const UPGRADE_PARENT_ENV = "WEBSERV_UPGRADE_PARENT";
+
+// One pending piece of a response: bytes we own, or a window of a shared mapping
+struct OutChunk {
+	std::string							data;
+	std::shared_ptr<const MappedFile>	file;
+	size_t								offset = 0;
+};
 
 struct ClientState {
 	int		fd;
 	int		requestCount;
 	time_t	lastActivity;
+	std::deque<OutChunk>	out;					// written on POLLOUT, in order
+	bool					closeAfterWrite = false;
+	bool					suspended = false;		// request waiting on disk I/O
+	int						port = 0;				// listen port it connected to
+	std::string				address;				// peer IP (cgi_max_concurrency fairness)
+};
+
+// Completion of a disk job, run on the loop for the client that asked
+struct IoWaiter {
+	int						clientFd;
+	std::function<void()>	done;
+};
+
+// How a CGI body goes out: collected and answered at the end, forwarded
+// as it is produced (with the script's Content-Length, or chunked), or
+// dropped (X-Accel-Redirect: the answer is another resource)
+enum CgiFraming { CGI_BUFFERED, CGI_LENGTH, CGI_CHUNKED, CGI_DISCARD };
+
+// A CGI script run for a suspended client (or, with clientFd -1, for no
+// one: a cgi_cache refill). Its pipes are polled like sockets; done runs
+// once it has exited and closed stdout/stderr.
+// Once the header block is in and the script is still writing, onHead
+// may take the response over (by setting framing, and encoder to
+// compress): the rest of stdout then goes straight to the client, and
+// done only learns how the stream ended.
+struct CgiJob {
+	int			clientFd;
+	CgiProcess	proc;
+	std::string	input;			// request body, fed as stdin accepts it, freed once in
+	size_t		written = 0;
+	std::string	out;
+	std::string	err;
+	time_t		deadline = 0;
+	bool		exited = false;
+	int			status = 0;		// wait status
+	bool		timedOut = false;
+	CgiFraming	framing = CGI_BUFFERED;
+	bool		headSeen = false;	// onHead already asked
+	bool		paused = false;		// stdout not polled: the client is behind
+	std::unique_ptr<CompressionStream>	encoder;
+	std::function<void(CgiJob& job, const std::string& head)>	onHead;
+	std::function<void(const CgiJob&)>	done;
+};
+
+// A proxied request, as its client sees it
+struct ProxyStream {
+	uint64_t	id = 0;			// ProxyPool request
+	bool		chunked = false;	// body re-framed as chunks (backend sent no length)
+	bool		paused = false;
 };
 
 class RequestHandler;
 
 class ServerManager {
 private:
-	std::vector<Server>						_servers;
+	std::shared_ptr<const ConfigSnapshot>	_config;		// swapped on SIGHUP
 	std::vector<struct pollfd>				_fds;
 	std::map<int, int>						_portSocketMap;	// key = socket fd, value = port
 	std::unordered_map<int, std::string>	_clientBuffers; // client fd → received data
@@ -31,9 +105,71 @@ private:
 	std::unordered_map<int, ClientState>	_clientState;
 	std::vector<int>						_toClose;
 
+	AsyncIO													_io;
+	std::unordered_map<uint64_t, IoWaiter>					_ioWaiters;	// job id → completion
+	std::unordered_map<int, std::unique_ptr<RequestHandler>>	_suspended;	// client fd → paused request
+
+	CgiQueue											_cgiQueue;	// cgi_max_concurrency gates (outlives the slots below)
+	std::unordered_map<int, std::shared_ptr<CgiJob>>	_cgiJobs;	// client fd → running script
+	std::unordered_map<int, std::shared_ptr<CgiJob>>	_cgiPipes;	// pipe fd → its job
+	std::unordered_map<pid_t, std::shared_ptr<CgiJob>>	_detachedCgi;	// pid → script filling a cache
+
+	std::unordered_map<std::string, std::shared_ptr<CgiCache>>	_cgiCaches;		// zone → cache
+	std::unordered_map<int, std::shared_ptr<CgiCache>>			_cacheWaits;	// client fd → cache it waits on
+
+	FastCgiPool							_fastcgi;		// cgi_pass backends
+	std::unordered_map<int, uint64_t>	_fcgiRequests;	// client fd → pool request
+
+	CgiWorkerPool						_cgiWorkers;		// cgi_pool interpreters
+	std::unordered_map<int, uint64_t>	_workerRequests;	// client fd → pool request
+
+	ProxyPool								_proxy;				// proxy_pass backends
+	std::unordered_map<int, ProxyStream>	_proxyRequests;		// client fd → its proxied request
+
+	int							_signalFd = -1;
+	bool						_running = true;
+	std::unordered_map<pid_t, std::function<void(int)>>	_children;	// pid → exit callback (wait status)
+
+	std::vector<std::string>	_argv;				// to exec on upgrade
+	pid_t						_upgradePid = -1;	// new binary, until it takes over
+	bool						_draining = false;	// not accepting, finishing clients
+	time_t						_drainDeadline = 0;
+
 	void setupSockets();
+	void closeUnusedListeners();
+	void reload();
+
+	void inheritSockets();
+	void upgrade();
+	void handOver();
+	void stopListening();
+	void startDraining(time_t grace);
+	bool drained() const;
+
+	void handleSignals();
+	void reapChildren();
 	void acceptNewClient(int listenFd);
 	void readFromClient(int clientFd);
+	void processRequests(int clientFd);
+	bool finishRequest(int clientFd, const RequestHandler& h);
+	void completeIO();
+	void resumeClient(int clientFd);
+
+	void handleCgiPipe(int fd, short revents);
+	void closeCgiPipe(int& fd);
+	void stopCgi(CgiJob& job);
+	void finishCgi(const std::shared_ptr<CgiJob>& job);
+	void streamCgi(CgiJob& job);
+	void forwardCgi(CgiJob& job, const char* data, size_t len);
+	void endCgiStream(CgiJob& job);
+	void resumeCgiStream(int clientFd);
+	size_t queuedBytes(int clientFd);
+	void forwardProxy(int clientFd, const char* data, size_t len);
+	void resumeProxyStream(int clientFd);
+	void sweepFds();
+	void watchFd(int fd, short events);
+	void pruneCgiCaches();
+	void sweepCgiCache(const std::shared_ptr<CgiCache>& cache, time_t now);
 
 	bool readSocketIntoBuffer(int clientFd, std::string &buf);
 	bool hasFullRequest(const std::string &buf, size_t &reqEnd);
@@ -41,19 +177,54 @@ private:
 	bool shouldCloseAfterRequest(int fd, const RequestHandler &h);
 	void checkTimeouts();
 
+	bool flushClient(int clientFd);
+	void closeWhenFlushed(int clientFd);
+	void updatePollEvents(int fd);
+
 public:
 	ServerManager() = delete;
-	ServerManager(const std::vector<Server>& servers);
+	ServerManager(std::shared_ptr<const ConfigSnapshot> config);
 	ServerManager(const ServerManager& other) = delete;
 	ServerManager& operator=(const ServerManager& other) = delete;
 	~ServerManager();
 
 	// -------------------- Getters --------------------
-	const std::vector<Server>&	getServers() const;
-	const Server&				getServer(size_t index) const;
-	Server&						getServer(size_t index);
+	const std::shared_ptr<const ConfigSnapshot>&	getConfig() const;
 	SessionManager& 			getSessionManager();
 
+	void setCommandLine(int argc, char** argv);
 	void run();
 	void cleanupClient(int clientFd);
+	bool queueSend(int clientFd, const std::string& data,
+		const std::shared_ptr<const MappedFile>& file = nullptr);
+	void submitIO(int clientFd, std::function<void()> work, std::function<void()> done);
+	void startCgi(int clientFd, const CgiProcess& proc, std::string input,
+		std::function<void(CgiJob&, const std::string&)> onHead,
+		std::function<void(const CgiJob&)> done);
+	void submitCgiWorker(int clientFd, const std::string& pool,
+		const std::map<std::string, std::string>& env, const std::string& body,
+		std::function<void(const CgiWorkerResult&)> done);
+	void submitFastCgi(int clientFd, const std::string& backend,
+		const std::map<std::string, std::string>& params, std::string body,
+		std::function<void(const FastCgiResult&)> done);
+	void watchChild(pid_t pid, std::function<void(int)> onExit);
+
+	// proxy_pass: onHead sends the answer's head (true: the body goes out
+	// chunked), the body follows as it arrives, done runs at the end
+	void submitProxy(int clientFd, const std::string& upstream, const HttpRequest& req, std::string body,
+		std::function<bool(const ProxyHead&)> onHead, std::function<void(const ProxyResult&)> done);
+
+	// cgi_max_concurrency: start runs now or once the location has room
+	// (may throw only then); reject gets 503 (queue full, waited too long)
+	// or 500 (a queued start that threw)
+	void queueCgi(const Server& srv, const Location& loc, int clientFd,
+		CgiQueue::StartFn start, std::function<void(int code)> reject);
+
+	// cgi_cache: the location's cache (null if it has none), waiting on a
+	// refill, and a refill's result (clientFd -1 runs above are the refills)
+	std::shared_ptr<CgiCache> cgiCache(const Server& srv, const Location& loc);
+	void waitCgiCache(const std::shared_ptr<CgiCache>& cache, const std::string& key,
+		int clientFd, CgiCache::WaitFn fn);
+	void completeCgiFill(const std::shared_ptr<CgiCache>& cache, const std::string& key,
+		const std::string& path, const CgiOutcome& outcome);
 };
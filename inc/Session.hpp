@@ -1,33 +1,58 @@
 #pragma once
 #include <string>
-#include <map>
+#include <vector>
+#include <utility>
 #include <ctime>
+#include <cstdint>
+
+// A session id as stored: 128 random bits (sent as 32 hex digits)
+struct SessionKey {
+	uint64_t	hi = 0;
+	uint64_t	lo = 0;
+};
+
+bool operator==(const SessionKey& a, const SessionKey& b);
 
 class Session {
 private:
-	std::string							_id;
-	std::map<std::string, std::string>	_data;
+	SessionKey											_key;
+	std::vector<std::pair<std::string, std::string>>	_data;		// a handful of keys: scanned
 
-	time_t								_lastAccess;
-	time_t								_expirySeconds;
+	time_t												_lastAccess;
+	bool												_dirty = false;		// set() since the last save
+	uint32_t											_slot = UINT32_MAX;	// where a shared store keeps it
+	uint32_t											_generation = 0;
 
 public:
 	Session();
-	Session(const std::string& id);
+	Session(const SessionKey& key);
 	Session(const Session& other) = default;
 	Session& operator=(const Session& other) = default;
 	~Session() = default;
 
 	// -------------------- Getters --------------------
 	std::string			getSession(const std::string& key) const;
-	const std::string&	getId() const ;
-	const std::map<std::string, std::string>& getData() const;
+	std::string			getId() const;
+	const SessionKey&	getKey() const;
+	const std::vector<std::pair<std::string, std::string>>& getData() const;
+	time_t				lastAccess() const;
+	bool				dirty() const;
+	uint32_t			storeSlot() const;
+	uint32_t			storeGeneration() const;
 
 	// -------------------- Setters --------------------
 	void				set(const std::string& key, const std::string& value);
+	void				markSaved();
+	void				setStoreSlot(uint32_t slot, uint32_t generation);
 
 	void touch();
-	bool expired() const;
 	bool has(const std::string& key) const;
+
+	static SessionKey	generateKey();
 	static std::string	generateSessionId();
-};
\ No newline at end of file
+	static std::string	formatId(const SessionKey& key);
+	// false unless id is 32 hex digits
+	static bool			parseId(const std::string& id, SessionKey& key);
+	// Bucket / slot of a key, mixed with a seed so clients can't aim collisions
+	static uint64_t		hashKey(const SessionKey& key, uint64_t seed);
+};
@@ -1,19 +1,124 @@
 #pragma once
 
 #include "Session.hpp"
+#include "SharedSessionStore.hpp"
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <ctime>
+#include <cstdint>
+
+/* Session store
+
+Sessions are keyed by their 128-bit id and spread over SESSION_SHARDS
+shards, each behind its own mutex so that threads touching different
+sessions don't wait on each other. A shard is:
+
+	index		open addressing (linear probing, at most half full),
+				slot → entry number; deletions shift the run back,
+				so there are no tombstones
+	entries		the sessions, with a free list; an entry's generation
+				changes whenever it is freed
+	LRU list	threaded through the entries, most recent first: once
+				session_max sessions exist in all, a new one first
+				evicts its shard's least recently used (or the
+				next shard's, if its own is empty)
+	wheel		SESSION_WHEEL_SLOTS buckets of (entry, generation),
+				one tick apart; a session waits in the bucket of its
+				deadline, and when that comes round it is dropped, or
+				moved further if it was used meanwhile
+
+A lookup never returns an expired session, whether the wheel got to it
+or not. Handlers hold a shared_ptr: a session evicted or expired while
+a request still uses it stays valid for that request.
+
+With session_store shared, all of this is left to a SharedSessionStore
+instead (sessions seen by every process mapping it); handlers then
+work on a copy, which save() writes back.
+*/
+
+const size_t SESSION_SHARDS = 16;
+const size_t SESSION_WHEEL_SLOTS = 64;
+const size_t DEFAULT_SESSION_MAX = 100000;
+const time_t DEFAULT_SESSION_TIMEOUT = 3600;	// seconds since the last request
+
+enum SessionStoreType { SESSION_STORE_MEMORY, SESSION_STORE_SHARED };
+
+struct SessionConfig {
+	size_t				maxSessions = DEFAULT_SESSION_MAX;
+	time_t				timeout = DEFAULT_SESSION_TIMEOUT;
+	SessionStoreType	store = SESSION_STORE_MEMORY;
+	std::string			path;		// shared: file to map (empty = shared memory object)
+};
 
 class SessionManager {
 private:
-	std::map<std::string, Session> _sessions;
+	static const uint32_t NIL = UINT32_MAX;
+
+	struct Entry {
+		SessionKey					key;
+		uint64_t					hash = 0;
+		std::shared_ptr<Session>	session;	// null: free
+		uint32_t					generation = 0;
+		uint32_t					newer = NIL;	// LRU neighbours
+		uint32_t					older = NIL;
+		uint64_t					due = 0;		// wheel tick it waits for
+	};
+
+	struct Shard {
+		std::mutex									lock;
+		std::vector<uint32_t>						index;		// entry + 1, 0 = empty
+		std::vector<Entry>							entries;
+		std::vector<uint32_t>						free;
+		size_t										count = 0;
+		uint32_t									newest = NIL;
+		uint32_t									oldest = NIL;
+		std::vector<std::vector<std::pair<uint32_t, uint32_t>>>	wheel;	// (entry, generation)
+		uint64_t									tick = 0;	// last tick processed
+	};
+
+	Shard			_shards[SESSION_SHARDS];
+	SessionConfig	_config;
+	std::atomic<size_t>	_total{0};
+	std::unique_ptr<SharedSessionStore>	_shared;	// session_store shared
+	time_t			_tickSeconds = 1;
+	uint64_t		_seed;
+
+	uint64_t	hash(const SessionKey& key) const;
+	Shard&		shardFor(uint64_t h);
+
+	// All of these run with the shard locked
+	int64_t		lookup(Shard& shard, const SessionKey& key, uint64_t h) const;
+	uint32_t	insert(Shard& shard, const SessionKey& key, uint64_t h);
+	void		erase(Shard& shard, uint32_t entry);
+	void		grow(Shard& shard);
+	void		unlinkLru(Shard& shard, uint32_t entry);
+	void		pushNewest(Shard& shard, uint32_t entry);
+	void		schedule(Shard& shard, uint32_t entry);
+	bool		expired(const Entry& e, time_t now) const;
+	size_t		advance(Shard& shard, time_t now);
+	void		configureShared(const SessionConfig& config);
 
 public:
 	SessionManager();
-	SessionManager(const SessionManager& other) = default;
-	SessionManager& operator=(const SessionManager& other) = default;
+	SessionManager(const SessionManager& other) = delete;
+	SessionManager& operator=(const SessionManager& other) = delete;
 	~SessionManager() = default;
 
-	Session& getOrCreate(const std::string& sessionId);
-	bool exists(const std::string& sessionId) const;
+	// session_max / session_timeout / session_store; shrinking evicts right
+	// away, a shared store that can't be mapped leaves sessions in memory
+	void configure(const SessionConfig& config);
+
+	// A new session under a fresh id (ids sent by clients are never taken as is)
+	std::shared_ptr<Session> create();
+	// The live session for id; null if unknown, expired or not an id at all
+	std::shared_ptr<Session> find(const std::string& sessionId);
+	// Stores what changed (set()) where other processes see it; nothing to do in memory
+	void save(Session& session);
+	bool exists(const std::string& sessionId);
 	void remove(const std::string& sessionId);
-	void cleanupExpired();
+	// Turns the wheels up to now; returns how many sessions expired
+	size_t cleanupExpired(time_t now);
+	size_t size();
 };
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "Session.hpp"
+#include <string>
+#include <memory>
+#include <ctime>
+#include <cstdint>
+#include <pthread.h>
+
+/* Shared-memory session store (session_store shared)
+
+Sessions live in a file mapped MAP_SHARED, so every process that maps
+it sees the same ones: the old and the new binary during an upgrade
+(SIGUSR2), or the next run after a restart. The file is a POSIX shared
+memory object (/dev/shm, gone at reboot) unless a path is given.
+
+	header		magic, layout, SHARED_SESSION_STRIPES mutexes
+				(process-shared, robust: a process dying with one
+				held doesn't block the others)
+	slots		fixed size, SHARED_SESSION_WAYS per bucket; a key
+				belongs to one bucket, guarded by the stripe of the
+				bucket's number
+
+A bucket is a little LRU cache: a new session takes a free or expired
+slot there, else the least recently used one. Every slot has a
+generation, bumped whenever it is freed or taken: a Session remembers
+(slot, generation), and saving one whose slot went to somebody else
+meanwhile gets it a new slot instead of overwriting the other session.
+
+Session data is kept serialized in the slot ("key\0value\0" pairs, at
+most SHARED_SESSION_DATA bytes); a Session read from here is a copy,
+written back by save().
+
+The first process to map the file (nobody else holds its flock)
+checks the layout, starting over if it doesn't match session_max, and
+resets the mutexes; "<file>.lock" keeps two starting processes from
+both believing they are first. Both must belong to the server's user
+and be closed to everyone else, or the store is refused.
+*/
+
+const size_t SHARED_SESSION_STRIPES = 64;
+const size_t SHARED_SESSION_WAYS = 8;
+const size_t SHARED_SESSION_SLOT = 512;		// bytes per slot
+const char* const SHARED_SESSION_NAME = "/webserv-sessions";	// shm_open name without a path
+
+class SharedSessionStore {
+	private:
+		struct Header;
+		struct Slot;
+
+		std::string		_path;
+		bool			_shm;			// shm_open'ed rather than a file
+		size_t			_maxSessions;
+		time_t			_timeout;
+		int				_fd = -1;
+		void*			_map = nullptr;
+		size_t			_mapSize = 0;
+		Header*			_header = nullptr;
+		Slot*			_slots = nullptr;
+		size_t			_buckets;
+		uint64_t		_seed = 0;
+		size_t			_sweep = 0;		// next bucket cleanupExpired() looks at
+		time_t			_swept = 0;		// last second it did
+
+		static size_t	slotsOffset();
+		void			open();
+		bool			matches(size_t fileSize) const;
+		void			initialize();
+		void			resetLocks();
+
+		size_t			bucketOf(const SessionKey& key) const;
+		pthread_mutex_t*	stripe(size_t bucket);
+		bool			expired(const Slot& slot, time_t now) const;
+		void			release(Slot& slot);
+		int64_t			lookup(size_t bucket, const SessionKey& key, time_t now);
+		size_t			take(size_t bucket, const SessionKey& key, time_t now);
+		std::shared_ptr<Session>	load(size_t index);
+		bool			store(Slot& slot, const Session& session);
+
+	public:
+		// Maps path (a file, or the shared memory object if empty) sized
+		// for maxSessions; throws std::runtime_error if it can't
+		SharedSessionStore(const std::string& path, size_t maxSessions, time_t timeout);
+		SharedSessionStore(const SharedSessionStore& other) = delete;
+		SharedSessionStore& operator=(const SharedSessionStore& other) = delete;
+		~SharedSessionStore();
+
+		// The file a configuration would map (the shared memory object if path is empty)
+		static std::string	pathFor(const std::string& path);
+
+		const std::string&	path() const;
+		size_t				maxSessions() const;
+		void				setTimeout(time_t timeout);
+
+		std::shared_ptr<Session>	create();
+		std::shared_ptr<Session>	find(const SessionKey& key);
+		void						save(Session& session);
+		void						remove(const SessionKey& key);
+		// Frees the expired slots of the next few buckets (once a second)
+		size_t						cleanupExpired(time_t now);
+		size_t						size() const;
+};
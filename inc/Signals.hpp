@@ -0,0 +1,30 @@
+#pragma once
+
+#include <csignal>
+#include <spawn.h>
+
+/* Signals
+
+The signals the server reacts to are blocked in every thread and read
+from a signalfd in the event loop, like any other fd:
+
+	SIGINT, SIGTERM		graceful shutdown (a second one exits at once)
+	SIGHUP				reload the configuration
+	SIGUSR1				reopen the log files (after logrotate)
+	SIGUSR2				binary upgrade; SIGWINCH: the new binary took over
+	SIGCHLD				reap children, run their exit callbacks
+
+block() must run before any thread is created so the disk pool inherits
+the mask. SIGPIPE is ignored (writes to a closed CGI pipe fail with
+EPIPE instead). Children get a clean mask back before exec: forked
+ones through unblockInChild(), spawned ones through spawnAttributes().
+*/
+
+class Signals {
+	public:
+		static sigset_t	handled();
+		static void		block();
+		static void		unblockInChild();	// after fork(), before exec
+		static void		spawnAttributes(posix_spawnattr_t& attr);	// same, for posix_spawn()
+		static int		openFd();			// non-blocking signalfd
+};
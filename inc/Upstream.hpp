@@ -0,0 +1,97 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <ctime>
+#include <cstdint>
+
+/* Upstream groups (upstream / proxy_pass)
+
+An upstream block names the backends proxy_pass locations forward to:
+
+	upstream app {
+		server 127.0.0.1:9001 weight=2;
+		server 127.0.0.1:9002 max_fails=3 fail_timeout=30s;
+		least_conn;						(or hash $request_uri / $remote_addr)
+		keepalive 16;
+	}
+
+proxy_pass http://host:port without a matching block is a group of one.
+
+Balancing picks among the servers that are up:
+
+	round robin		smooth and weighted: weight=2 gets two requests in three,
+					spread out rather than back to back (the default)
+	least_conn		fewest requests in flight per unit of weight
+	hash			a consistent ring over the key: a server going down
+					only moves its own share of the keys
+
+Health is passive: a failed connect, a timeout, or a connection lost
+before the answer counts against a server; max_fails of them within
+fail_timeout take it out of rotation for fail_timeout. If every server
+is out, they are all tried again rather than failing outright.
+*/
+
+const size_t UPSTREAM_KEEPALIVE = 16;		// idle connections kept per server (default)
+const unsigned UPSTREAM_MAX_FAILS = 1;
+const time_t UPSTREAM_FAIL_TIMEOUT = 10;	// seconds
+const unsigned UPSTREAM_RING_POINTS = 160;	// hash: ring points per unit of weight
+
+enum UpstreamBalance { BALANCE_ROUND_ROBIN, BALANCE_LEAST_CONN, BALANCE_HASH };
+
+struct UpstreamServer {
+	std::string	address;		// "host:port" or "unix:/path"
+	unsigned	weight = 1;
+	unsigned	maxFails = UPSTREAM_MAX_FAILS;
+	time_t		failTimeout = UPSTREAM_FAIL_TIMEOUT;
+};
+
+struct UpstreamConfig {
+	std::string					name;
+	std::vector<UpstreamServer>	servers;
+	UpstreamBalance				balance = BALANCE_ROUND_ROBIN;
+	std::string					hashKey;	// "$request_uri" or "$remote_addr"
+	size_t						keepalive = UPSTREAM_KEEPALIVE;
+};
+
+bool operator==(const UpstreamServer& a, const UpstreamServer& b);
+bool operator==(const UpstreamConfig& a, const UpstreamConfig& b);
+
+class Upstream {
+	private:
+		struct Peer {
+			UpstreamServer	config;
+			long			current = 0;	// smooth round robin
+			size_t			active = 0;		// requests in flight
+			unsigned		fails = 0;
+			time_t			firstFail = 0;
+			time_t			downUntil = 0;
+		};
+
+		UpstreamConfig								_config;
+		std::vector<Peer>							_peers;
+		std::vector<std::pair<uint32_t, size_t>>	_ring;		// hash point → peer, sorted
+
+		bool	usable(size_t i, time_t now, const std::vector<size_t>& tried, bool ignoreHealth) const;
+		int		pickRoundRobin(time_t now, const std::vector<size_t>& tried, bool ignoreHealth);
+		int		pickLeastConn(time_t now, const std::vector<size_t>& tried, bool ignoreHealth);
+		int		pickHash(const std::string& key, time_t now, const std::vector<size_t>& tried, bool ignoreHealth);
+
+	public:
+		Upstream(const UpstreamConfig& config);
+		Upstream(const Upstream& other) = delete;
+		Upstream& operator=(const Upstream& other) = delete;
+		~Upstream() = default;
+
+		static uint32_t		hash(const std::string& key);
+
+		const UpstreamConfig&	config() const;
+		const UpstreamServer&	server(size_t i) const;
+
+		// A server for this request other than those tried; -1 once none is left
+		int		pick(const std::string& key, time_t now, const std::vector<size_t>& tried);
+		void	acquire(size_t i);
+		void	release(size_t i);
+		void	failed(size_t i, time_t now);
+		void	succeeded(size_t i);
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "Server.hpp"
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <regex>
+
+/* Virtual host table
+
+Built once from the parsed servers; picks the server for a request from
+its listen port and Host header (port and trailing dot stripped, case
+folded), with nginx precedence:
+
+	server_name example.com;		exact			hash lookup
+	server_name *.example.com;		leading wildcard	longest match wins
+	server_name .example.com;		both of the above
+	server_name ~^api\d+\.;			regex			config order
+	(none of them)					default server of the port
+
+Wildcards live in a trie keyed by domain labels read right to left, so
+the cost depends on the Host, not on the number of vhosts.
+*/
+
+class VirtualHosts {
+	private:
+		struct LabelNode {
+			std::unordered_map<std::string, size_t>	children;	// label → node
+			long									wildcard = -1;	// "*.<this suffix>"
+		};
+		struct Pattern {
+			std::regex	regex;
+			size_t		server;
+		};
+		struct PortTable {
+			std::unordered_map<std::string, size_t>	exact;
+			std::vector<LabelNode>					labels;		// [0] is the root
+			std::vector<Pattern>					patterns;
+			long									defaultServer = -1;
+		};
+
+		std::unordered_map<int, PortTable>	_ports;
+
+		static void	addWildcard(PortTable& table, const std::string& suffix, size_t server);
+		static long	matchWildcard(const PortTable& table, const std::string& host);
+
+	public:
+		VirtualHosts() = default;
+		explicit VirtualHosts(const std::vector<Server>& servers);
+
+		static std::string	normalizeHost(const std::string& host);
+
+		// Index into the server list; 0 when nothing listens on the port
+		size_t	resolve(int port, const std::string& host) const;
+};
@@ -26,10 +26,11 @@ std::pair<int, std::string> parseReturn(const std::string& line);
 
 std::string getFileExtension(const std::string& path);
 std::string urlDecode(const std::string &src);
+std::string htmlEscape(const std::string &src);
 std::string sanitizeFilename(const std::string &n);
 bool endsWith(const std::string& str, const std::string& suffix);
 bool readFile(const std::string& path, std::string& out);
-std::string detectMime(const std::string& path);
+const std::string& detectMime(const std::string& path);
 std::string ensureTrailingSlash(const std::string &s);
 std::string trimLeadingSlash(const std::string &s);
 std::string resolveRoot(const Server& srv, const Location& loc);
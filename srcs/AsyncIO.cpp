@@ -0,0 +1,84 @@
+#include "AsyncIO.hpp"
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <string>
+
+AsyncIO::AsyncIO(size_t threads)
+	: _eventFd(-1), _stopping(false), _nextId(1)
+{
+	// Non-blocking counter the loop polls for "some job finished"
+	_eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (_eventFd < 0)
+		throw std::runtime_error("failed to create eventfd: " + std::string(strerror(errno)));
+
+	for (size_t i = 0; i < threads; ++i)
+		_workers.emplace_back(&AsyncIO::workerLoop, this);
+}
+
+AsyncIO::~AsyncIO() {
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stopping = true;
+	}
+	_cv.notify_all();
+	for (std::thread& t : _workers)
+		t.join();
+	close(_eventFd);
+}
+
+int AsyncIO::eventFd() const { return _eventFd; }
+
+uint64_t AsyncIO::submit(std::function<void()> work) {
+	uint64_t id;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		id = _nextId++;
+		_queue.push_back(Job{id, std::move(work)});
+	}
+	_cv.notify_one();
+	return id;
+}
+
+// Called on the loop thread when the eventfd is readable
+std::vector<uint64_t> AsyncIO::drain() {
+	uint64_t count;
+	// Reset the counter; EAGAIN just means another drain got there first
+	ssize_t n = read(_eventFd, &count, sizeof(count));
+	(void)n;
+
+	std::vector<uint64_t> finished;
+	std::lock_guard<std::mutex> lock(_mutex);
+	finished.swap(_done);
+	return finished;
+}
+
+void AsyncIO::workerLoop() {
+	while (true) {
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_cv.wait(lock, [this] { return _stopping || !_queue.empty(); });
+			if (_stopping)
+				return;
+			job = std::move(_queue.front());
+			_queue.pop_front();
+		}
+
+		try {
+			job.work();
+		} catch (...) {
+			// The completion sees whatever result the job left behind
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_done.push_back(job.id);
+		}
+		uint64_t one = 1;
+		ssize_t n = write(_eventFd, &one, sizeof(one));
+		(void)n;
+	}
+}
@@ -0,0 +1,174 @@
+#include "Autoindex.hpp"
+#include "utils.hpp"
+#include <sstream>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+# include <sys/syscall.h>
+#else
+# include <dirent.h>
+#endif
+
+// 🔹 Define static members
+std::map<Autoindex::DirKey, DirListing> Autoindex::_cache;
+
+#ifdef __linux__
+// Fixed part of struct linux_dirent64; d_name follows right after d_type
+struct Dirent64Header {
+	uint64_t		d_ino;
+	int64_t			d_off;
+	unsigned short	d_reclen;
+	unsigned char	d_type;
+};
+
+static const size_t DIRENT_NAME_OFFSET = offsetof(Dirent64Header, d_type) + 1;
+#endif
+
+// Runs on the disk pool: plain syscalls only
+bool Autoindex::scan(const std::string& dir, std::vector<DirEntry>& out) {
+#ifdef __linux__
+	int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	// One syscall returns as many entries as fit in the buffer
+	alignas(8) char buf[32768];
+	long n;
+	while ((n = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0) {
+		for (long off = 0; off < n; ) {
+			const Dirent64Header* d = reinterpret_cast<const Dirent64Header*>(buf + off);
+			const char* name = buf + off + DIRENT_NAME_OFFSET;
+			if (strcmp(name, ".") != 0 && strcmp(name, "..") != 0)
+				out.push_back({ name, d->d_type == DT_DIR });
+			off += d->d_reclen;
+		}
+	}
+	close(fd);
+	if (n < 0)
+		return false;
+#else
+	DIR* d = opendir(dir.c_str());
+	if (!d)
+		return false;
+	struct dirent* ent;
+	while ((ent = readdir(d)) != NULL) {
+		std::string name = ent->d_name;
+		if (name != "." && name != "..")
+			out.push_back({ name, ent->d_type == DT_DIR });
+	}
+	closedir(d);
+#endif
+	std::sort(out.begin(), out.end(),
+		[](const DirEntry& a, const DirEntry& b) { return a.name < b.name; });
+	return true;
+}
+
+// Cached listing, if the directory hasn't changed since it was scanned
+DirListing* Autoindex::lookup(const struct stat& st) {
+	auto it = _cache.find(DirKey(st.st_dev, st.st_ino));
+	if (it == _cache.end())
+		return NULL;
+
+	DirListing& l = it->second;
+	if (l.mtime.tv_sec != st.st_mtim.tv_sec
+		|| l.mtime.tv_nsec != st.st_mtim.tv_nsec) {
+		_cache.erase(it);
+		return NULL;
+	}
+	l.lastUsed = time(NULL);
+	return &l;
+}
+
+DirListing* Autoindex::store(const struct stat& st, std::vector<DirEntry>&& entries) {
+	DirKey dir(st.st_dev, st.st_ino);
+	// Full: drop the directory nobody asked for the longest
+	if (_cache.size() >= AUTOINDEX_CACHE_MAX_DIRS && !_cache.count(dir)) {
+		auto oldest = _cache.begin();
+		for (auto it = _cache.begin(); it != _cache.end(); ++it) {
+			if (it->second.lastUsed < oldest->second.lastUsed)
+				oldest = it;
+		}
+		_cache.erase(oldest);
+	}
+
+	DirListing& l = _cache[dir];
+	l.entries = std::move(entries);
+	l.mtime = st.st_mtim;
+	l.lastUsed = time(NULL);
+	l.renderedFor.clear();
+	l.rendered.clear();
+	return &l;
+}
+
+// "?page=3" → 3 (pages start at 1)
+size_t Autoindex::pageFromQuery(const std::string& query) {
+	size_t pos = query.find("page=");
+	if (pos == std::string::npos || (pos > 0 && query[pos - 1] != '&'))
+		return 1;
+	long page = std::atol(query.c_str() + pos + 5);
+	return page > 0 ? static_cast<size_t>(page) : 1;
+}
+
+const std::string& Autoindex::renderHtml(DirListing& listing, const std::string& reqPath, size_t page) {
+	// Clamped before it becomes a key: any ?page= past the end is the last page
+	size_t pages = std::max<size_t>(1, (listing.entries.size() + AUTOINDEX_PAGE_SIZE - 1) / AUTOINDEX_PAGE_SIZE);
+	page = std::min(page, pages);
+
+	// Pages embed the request path: another spelling of it starts over
+	if (listing.renderedFor != reqPath) {
+		listing.rendered.clear();
+		listing.renderedFor = reqPath;
+	}
+	auto cached = listing.rendered.find(page);
+	if (cached != listing.rendered.end())
+		return cached->second;
+
+	size_t first = (page - 1) * AUTOINDEX_PAGE_SIZE;
+	size_t last = std::min(first + AUTOINDEX_PAGE_SIZE, listing.entries.size());
+	std::string base = htmlEscape(ensureTrailingSlash(reqPath));
+	std::string title = htmlEscape(reqPath);
+
+	std::ostringstream html;
+	html << "<html><head><meta charset=\"utf-8\">";
+	html << "<title>Index of " << title << "</title></head><body>";
+	html << "<h1>Index of " << title << "</h1><ul>";
+	if (page == 1)
+		html << "<li><a href=\"" << base << "..\">..</a></li>";
+
+	for (size_t i = first; i < last; ++i) {
+		const DirEntry& e = listing.entries[i];
+		std::string name = htmlEscape(e.isDir ? e.name + "/" : e.name);
+		html << "<li><a href=\"" << base << name << "\">" << name << "</a></li>";
+	}
+	html << "</ul>";
+
+	// 🔹 Pager for directories larger than one page
+	if (pages > 1) {
+		html << "<p>";
+		if (page > 1)
+			html << "<a href=\"" << base << "?page=" << page - 1 << "\">&laquo; prev</a> ";
+		html << "page " << page << " of " << pages;
+		if (page < pages)
+			html << " <a href=\"" << base << "?page=" << page + 1 << "\">next &raquo;</a>";
+		html << "</p>";
+	}
+	html << "</body></html>";
+
+	return listing.rendered[page] = html.str();
+}
+
+// Used by /uploads/: one name per line, hidden files skipped
+std::string Autoindex::renderPlain(const DirListing& listing) {
+	std::string out;
+	for (const DirEntry& e : listing.entries) {
+		if (e.name[0] == '.') continue;
+		out += e.name;
+		out += "\n";
+	}
+	return out;
+}
@@ -0,0 +1,348 @@
+#include "CgiCache.hpp"
+#include "CgiHandler.hpp"
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+static const char* const DISK_MAGIC = "webserv-cgi-cache 1";
+
+static std::string lower(std::string s) {
+	for (char& c : s)
+		c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+	return s;
+}
+
+// Response header by name, whatever case the script used ("" if absent)
+static std::string header(const HttpResponse& res, const std::string& name) {
+	for (const auto& h : res.getHeaders()) {
+		if (lower(h.first) == name)
+			return h.second;
+	}
+	return "";
+}
+
+// "max-age=60, private" → { "max-age": "60", "private": "" }
+static std::map<std::string, std::string> cacheControl(const std::string& value) {
+	std::map<std::string, std::string> out;
+	std::istringstream ss(lower(value));
+	std::string part;
+	while (std::getline(ss, part, ',')) {
+		part.erase(0, part.find_first_not_of(" \t"));
+		part.erase(part.find_last_not_of(" \t") + 1);
+		size_t eq = part.find('=');
+		if (eq == std::string::npos)
+			out[part] = "";
+		else
+			out[part.substr(0, eq)] = part.substr(eq + 1);
+	}
+	return out;
+}
+
+// "Sun, 06 Nov 1994 08:49:37 GMT" → time_t, -1 if it doesn't parse
+static time_t httpDate(const std::string& value) {
+	struct tm tm = {};
+	const char* end = strptime(value.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+	if (!end || *end)
+		return -1;
+	return timegm(&tm);
+}
+
+static size_t entrySize(const CgiCacheEntry& entry) {
+	size_t bytes = entry.key.size() + entry.response.getBody().size();
+	for (const auto& h : entry.response.getHeaders())
+		bytes += h.first.size() + h.second.size() + 4;
+	return bytes;
+}
+
+CgiCache::CgiCache(const std::string& zone, const CgiCacheConfig& config)
+	: _zone(zone), _config(config), _lastSweep(time(NULL)) { }
+
+std::string CgiCache::zoneKey(const std::string& serverRoot, const Location& loc) {
+	const CgiCacheConfig& c = loc.getCgiCache();
+	std::string key = serverRoot + "\n" + loc.getPath() + "\n" + std::to_string(c.maxBytes)
+		+ " " + std::to_string(c.validFor) + " " + std::to_string(c.staleFor) + "\n" + c.path
+		+ " " + std::to_string(c.diskMaxBytes);
+	for (const std::string& h : c.keyHeaders)
+		key += "\n" + lower(h);
+	return key;
+}
+
+bool CgiCache::cacheable(const HttpRequest& req) {
+	return req.getMethod() == "GET";
+}
+
+const CgiCacheConfig& CgiCache::config() const { return _config; }
+
+std::string CgiCache::key(const HttpRequest& req) const {
+	std::string key = req.getMethod() + " " + req.getPath() + "?" + req.getQueryString()
+		+ "\nhost:" + req.getHeader("host");
+	for (const std::string& h : _config.keyHeaders)
+		key += "\n" + lower(h) + ":" + req.getHeader(lower(h));
+	return key;
+}
+
+CgiCache::State CgiCache::lookup(const std::string& key, time_t now, HttpResponse& out) {
+	auto it = _index.find(key);
+	if (it == _index.end())
+		return MISS;
+	Lru::iterator entry = it->second;
+	if (now >= entry->staleUntil) {
+		_bytes -= entry->bytes;
+		_lru.erase(entry);
+		_index.erase(it);
+		return MISS;
+	}
+	_lru.splice(_lru.begin(), _lru, entry);
+	out = entry->response;
+	return (now < entry->expires) ? FRESH : STALE;
+}
+
+void CgiCache::insert(const CgiCacheEntry& entry) {
+	auto it = _index.find(entry.key);
+	if (it != _index.end()) {
+		_bytes -= it->second->bytes;
+		_lru.erase(it->second);
+		_index.erase(it);
+	}
+	if (entry.bytes == 0 || entry.bytes > _config.maxBytes)
+		return;
+	_lru.push_front(entry);
+	_index[entry.key] = _lru.begin();
+	_bytes += entry.bytes;
+	evict();
+}
+
+void CgiCache::evict() {
+	while (_bytes > _config.maxBytes && !_lru.empty()) {
+		_bytes -= _lru.back().bytes;
+		_index.erase(_lru.back().key);
+		_lru.pop_back();
+	}
+}
+
+bool CgiCache::store(const std::string& key, const HttpResponse& res, time_t now, CgiCacheEntry& entry) {
+	CgiCacheEntry none;
+	none.key = key;
+	insert(none);	// whatever happens, the old answer is outdated
+
+	if (res.getStatusCode() != 200 || !header(res, "set-cookie").empty()
+		|| header(res, "vary") == "*")
+		return false;
+	// An X-Accel-Redirect answer is an authorization, often per user:
+	// replayed only if the script says it may be (Cache-Control)
+	bool accel = !header(res, "x-accel-redirect").empty() || !header(res, "x-sendfile").empty();
+	if (accel && header(res, "cache-control").empty())
+		return false;
+	std::map<std::string, std::string> cc = cacheControl(header(res, "cache-control"));
+	if (cc.count("no-store") || cc.count("no-cache") || cc.count("private"))
+		return false;
+
+	// 🔹 Freshness: s-maxage, max-age, Expires, then cgi_cache_valid
+	time_t ttl = _config.validFor;
+	if (cc.count("s-maxage"))
+		ttl = std::atol(cc["s-maxage"].c_str());
+	else if (cc.count("max-age"))
+		ttl = std::atol(cc["max-age"].c_str());
+	else if (!header(res, "expires").empty())
+		ttl = httpDate(header(res, "expires")) - now;	// unparsable = already expired
+	if (ttl <= 0)
+		return false;
+	time_t stale = cc.count("stale-while-revalidate")
+		? std::atol(cc["stale-while-revalidate"].c_str()) : _config.staleFor;
+
+	entry.key = key;
+	entry.response = res;
+	entry.expires = now + ttl;
+	entry.staleUntil = entry.expires + std::max<time_t>(stale, 0);
+	entry.bytes = entrySize(entry);
+	insert(entry);
+	return true;
+}
+
+bool CgiCache::filling(const std::string& key) const {
+	return _fills.count(key) != 0;
+}
+
+void CgiCache::beginFill(const std::string& key, int leader) {
+	_fills[key].leader = leader;
+}
+
+void CgiCache::wait(const std::string& key, int clientFd, WaitFn fn) {
+	_fills[key].waiters.push_back(std::make_pair(clientFd, std::move(fn)));
+}
+
+CgiCache::Fill CgiCache::endFill(const std::string& key) {
+	Fill fill;
+	auto it = _fills.find(key);
+	if (it != _fills.end()) {
+		fill = std::move(it->second);
+		_fills.erase(it);
+	}
+	return fill;
+}
+
+// The client went away: the refill goes on for the others (and the cache)
+void CgiCache::forget(int clientFd) {
+	for (auto& fill : _fills) {
+		if (fill.second.leader == clientFd)
+			fill.second.leader = -1;	// a new client may get its fd
+		auto& w = fill.second.waiters;
+		w.erase(std::remove_if(w.begin(), w.end(),
+			[clientFd](const std::pair<int, WaitFn>& p) { return p.first == clientFd; }), w.end());
+	}
+}
+
+// <cgi_cache_path>/<FNV-1a of zone and key, 16 hex digits>
+std::string CgiCache::diskFile(const std::string& key) const {
+	uint64_t hash = 14695981039346656037ULL;
+	std::string full = _zone + "\n" + key;
+	for (unsigned char c : full) {
+		hash ^= c;
+		hash *= 1099511628211ULL;
+	}
+	char name[17];
+	snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(hash));
+	return _config.path + "/" + name;
+}
+
+/*
+	File layout:
+		webserv-cgi-cache 1
+		<expires> <staleUntil> <key length>
+		<key><response as CGI output: Status, headers, blank line, body>
+	Anything that doesn't match (another key hashed to the same name, a
+	torn write, an older format) reads as a miss.
+*/
+void CgiCache::readDisk(const std::string& file, const std::string& key, CgiCacheEntry& entry) {
+	std::ifstream in(file.c_str(), std::ios::binary);
+	if (!in)
+		return;
+	std::string magic;
+	long long expires = 0, staleUntil = 0;
+	size_t keyLen = 0;
+	if (!std::getline(in, magic) || magic != DISK_MAGIC
+		|| !(in >> expires >> staleUntil >> keyLen) || in.get() != '\n' || keyLen != key.size())
+		return;
+	std::string stored(keyLen, '\0');
+	if (!in.read(&stored[0], static_cast<std::streamsize>(keyLen)) || stored != key)
+		return;
+	std::ostringstream rest;
+	rest << in.rdbuf();
+	try {
+		entry.response = CgiHandler::parseOutput(rest.str());
+	}
+	catch (const std::exception&) {
+		return;
+	}
+	entry.key = key;
+	entry.expires = static_cast<time_t>(expires);
+	entry.staleUntil = static_cast<time_t>(staleUntil);
+	entry.bytes = entrySize(entry);
+	utimes(file.c_str(), NULL);		// sweeps drop the least recently used first
+}
+
+// Written aside and renamed in, so a reader never sees half a file
+void CgiCache::writeDisk(const std::string& file, const CgiCacheEntry& entry) {
+	std::string tmp = file + ".tmp" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+	{
+		std::ofstream out(tmp.c_str(), std::ios::binary | std::ios::trunc);
+		if (!out)
+			return;
+		out << DISK_MAGIC << "\n" << static_cast<long long>(entry.expires) << " "
+			<< static_cast<long long>(entry.staleUntil) << " " << entry.key.size() << "\n" << entry.key
+			<< "Status: " << entry.response.getStatusCode() << "\r\n";
+		for (const auto& h : entry.response.getHeaders())
+			out << h.first << ": " << h.second << "\r\n";
+		out << "\r\n" << entry.response.getBody();
+		if (!out.flush()) {
+			out.close();
+			std::remove(tmp.c_str());
+			return;
+		}
+	}
+	if (std::rename(tmp.c_str(), file.c_str()) != 0)
+		std::remove(tmp.c_str());
+}
+
+void CgiCache::removeDisk(const std::string& file) {
+	std::remove(file.c_str());
+}
+
+// When a stored answer may no longer be served (0 if the file isn't ours)
+static time_t staleUntilOf(const std::string& file) {
+	std::ifstream in(file.c_str(), std::ios::binary);
+	std::string magic;
+	long long expires = 0, staleUntil = 0;
+	if (!in || !std::getline(in, magic) || magic != DISK_MAGIC || !(in >> expires >> staleUntil))
+		return 0;
+	return static_cast<time_t>(staleUntil);
+}
+
+void CgiCache::sweepDisk(const std::string& dir, size_t maxBytes, time_t now) {
+	DIR* d = opendir(dir.c_str());
+	if (!d)
+		return;
+	struct File {
+		std::string		path;
+		struct timespec	used;
+		size_t			bytes;
+	};
+	std::vector<File> kept;
+	size_t total = 0;
+	while (struct dirent* e = readdir(d)) {
+		std::string name = e->d_name;
+		std::string path = dir + "/" + name;
+		struct stat st;
+		if (name[0] == '.' || lstat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+			continue;
+		// Leftover of a write that never got renamed in
+		if (name.find(".tmp") != std::string::npos) {
+			if (now - st.st_mtime > CGI_CACHE_SWEEP_INTERVAL)
+				std::remove(path.c_str());
+			continue;
+		}
+		if (staleUntilOf(path) <= now) {
+			std::remove(path.c_str());
+			continue;
+		}
+		kept.push_back(File{ path, st.st_mtim, static_cast<size_t>(st.st_size) });
+		total += static_cast<size_t>(st.st_size);
+	}
+	closedir(d);
+	if (total <= maxBytes)
+		return;
+	std::sort(kept.begin(), kept.end(), [](const File& a, const File& b) {
+		return a.used.tv_sec != b.used.tv_sec ? a.used.tv_sec < b.used.tv_sec : a.used.tv_nsec < b.used.tv_nsec;
+	});
+	for (size_t i = 0; i < kept.size() && total > maxBytes; ++i) {
+		std::remove(kept[i].path.c_str());
+		total -= kept[i].bytes;
+	}
+}
+
+void CgiCache::noteDiskWrite(size_t bytes) {
+	_diskWritten += bytes;
+}
+
+bool CgiCache::sweepDue(time_t now) const {
+	return !_config.path.empty() && !_sweeping
+		&& (now - _lastSweep >= CGI_CACHE_SWEEP_INTERVAL || _diskWritten >= _config.diskMaxBytes / 4);
+}
+
+void CgiCache::beginSweep(time_t now) {
+	_sweeping = true;
+	_lastSweep = now;
+	_diskWritten = 0;
+}
+
+void CgiCache::endSweep() {
+	_sweeping = false;
+}
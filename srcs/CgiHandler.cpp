@@ -1,5 +1,12 @@
 #include "CgiHandler.hpp"
+#include "Signals.hpp"
 #include <sys/wait.h>
+#include <spawn.h>
+#include <cstring>
+#include <strings.h>
+#include <algorithm>
+#include <csignal>
+#include <cstdlib>
 #include <fcntl.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -7,25 +14,91 @@
 #include "Logger.hpp"
 CgiHandler::CgiHandler(const HttpRequest& req) : _request(req) {}
 
-HttpResponse CgiHandler::execute(
+CgiProcess CgiHandler::start(
 	const std::string& scriptPath,
 	const std::string& interpreterPath,
-	const std::string& serverRoot
+	const Location& loc
 ) {
 	if (access(scriptPath.c_str(), F_OK) != 0) {
 		throw std::runtime_error("CGI script does not exist");
 	}
 
-	std::map<std::string, std::string> env = buildEnv(scriptPath, serverRoot);
+	// argv and envp are built here: posix_spawn() only dup2()s and execs
+	std::vector<std::string> reqEnv = requestEnv(scriptPath);
+	const std::vector<std::string>& base = loc.getCgiEnv();
+	std::vector<char*> envp;
+	envp.reserve(base.size() + reqEnv.size() + 1);
+	for (size_t i = 0; i < base.size(); ++i)
+		envp.push_back(const_cast<char*>(base[i].c_str()));
+	for (size_t i = 0; i < reqEnv.size(); ++i)
+		envp.push_back(const_cast<char*>(reqEnv[i].c_str()));
+	envp.push_back(nullptr);
+
+	char* args[] = {
+		const_cast<char*>(interpreterPath.c_str()),
+		const_cast<char*>(scriptPath.c_str()),
+		nullptr
+	};
 
-	// Run the script and capture stdout, stderr, and exit code
-	std::string output, errorOutput;
-	int exitCode = runProcess(scriptPath, env, interpreterPath, output, errorOutput);
+	int inPipe[2], outPipe[2], errPipe[2];
+	if (pipe2(inPipe, O_CLOEXEC) < 0)
+		throw std::runtime_error("pipe failed");
+	if (pipe2(outPipe, O_CLOEXEC) < 0) {
+		close(inPipe[0]); close(inPipe[1]);
+		throw std::runtime_error("pipe failed");
+	}
+	if (pipe2(errPipe, O_CLOEXEC) < 0) {
+		close(inPipe[0]); close(inPipe[1]);
+		close(outPipe[0]); close(outPipe[1]);
+		throw std::runtime_error("pipe failed");
+	}
+
+	// dup2() clears close-on-exec on the copies; the originals close at exec.
+	// glibc spawns with CLONE_VFORK, so the cost does not grow with our memory.
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, inPipe[0], STDIN_FILENO);
+	posix_spawn_file_actions_adddup2(&actions, outPipe[1], STDOUT_FILENO);
+	posix_spawn_file_actions_adddup2(&actions, errPipe[1], STDERR_FILENO);
+	posix_spawnattr_t attr;
+	Signals::spawnAttributes(attr);
+
+	pid_t pid;
+	int err = posix_spawn(&pid, interpreterPath.c_str(), &actions, &attr, args, envp.data());
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
 
-	if (exitCode != 0) {
-		throw std::runtime_error("CGI script execution failed");
+	close(inPipe[0]);
+	close(outPipe[1]);
+	close(errPipe[1]);
+	if (err != 0) {
+		close(inPipe[1]);
+		close(outPipe[0]);
+		close(errPipe[0]);
+		throw std::runtime_error("cannot run " + interpreterPath + ": " + strerror(err));
 	}
 
+	CgiProcess proc;
+	proc.pid = pid;
+	proc.stdoutFd = outPipe[0];
+	proc.stderrFd = errPipe[0];
+	fcntl(proc.stdoutFd, F_SETFL, O_NONBLOCK);
+	fcntl(proc.stderrFd, F_SETFL, O_NONBLOCK);
+
+	if (_request.getMethod() == "POST" && !_request.getBody().empty()) {
+		proc.stdinFd = inPipe[1];
+		fcntl(proc.stdinFd, F_SETFL, O_NONBLOCK);
+		// Fewer wakeups for a large body (best effort: capped by fs.pipe-max-size)
+		size_t body = _request.getBody().size();
+		if (body > CGI_STDIN_PIPE_SIZE / 16)
+			fcntl(proc.stdinFd, F_SETPIPE_SZ, static_cast<int>(std::min(body, CGI_STDIN_PIPE_SIZE)));
+	} else {
+		close(inPipe[1]);	// EOF right away
+	}
+	return proc;
+}
+
+HttpResponse CgiHandler::parseOutput(const std::string& output) {
 	size_t headerSize = output.find("\r\n\r\n");
 	if (headerSize == std::string::npos)
 		headerSize = output.find("\n\n");
@@ -34,21 +107,73 @@ HttpResponse CgiHandler::execute(
 		throw std::runtime_error("Invalid CGI output");
 	}
 
-	std::string headers = output.substr(0, headerSize);
+	HttpResponse res = parseHead(output.substr(0, headerSize));
 	std::string body = output.substr(headerSize + ((output[headerSize] == '\r') ? 4 : 2));
+	res.setBody(body);
+	if (!res.getHeaders().count("Content-Length"))
+		res.setHeader("Content-Length", std::to_string(body.size()));
+	return res;
+}
 
-	HttpResponse res(200, body);
+// 504 when it ran out of time; 500 for a failed script, 502 for a
+// failed backend, or output that isn't a CGI response
+int CgiHandler::interpret(const CgiOutcome& o, const std::string& path, HttpResponse& res) {
+	std::string what = o.fastcgi ? "FastCGI" : "CGI";
+	int failure = o.fastcgi ? 502 : 500;
+	if (o.rejected)
+		return o.rejected;
+	if (!o.err.empty())
+		Logger::log(WARNING, what + " stderr: " + o.err);
+	if (o.timedOut) {
+		Logger::log(ERROR, "504 " + what + " request timed out: " + path);
+		return 504;
+	}
+	if (!o.ok) {
+		Logger::log(ERROR, std::to_string(failure) + " " + what
+			+ (o.fastcgi ? " backend unavailable: " : " script execution failed: ") + path);
+		return failure;
+	}
+	try {
+		res = parseOutput(o.out);
+	}
+	catch (const std::exception& e) {
+		Logger::log(ERROR, std::to_string(failure) + " invalid " + what + " response: " + e.what());
+		return failure;
+	}
+	return 0;
+}
 
+// Status line and headers only; Content-Length is set only if the script sent one
+HttpResponse CgiHandler::parseHead(const std::string& headers) {
+	std::vector<std::pair<std::string, std::string>> fields;
 	std::istringstream hs(headers);
 	std::string line;
 	bool hasContentType = false;
+	int code = 200;
+	std::string reason;
 	while (std::getline(hs, line) && !line.empty()) {
 		size_t sep = line.find(':');
 		if (sep != std::string::npos) {
 			std::string key = line.substr(0, sep);
 			std::string val = line.substr(sep + 1);
-			res.setHeader(key, val);
-			if (key == "Content-Type")
+			val.erase(0, val.find_first_not_of(" \t"));
+			if (!val.empty() && val.back() == '\r')
+				val.pop_back();
+			// "Status: 404 Not Found" sets the response code and reason (RFC 3875 6.3.3);
+			// field names are case-insensitive
+			if (strcasecmp(key.c_str(), "Status") == 0) {
+				code = std::atoi(val.c_str());
+				if (code < 100 || code > 599)
+					throw std::runtime_error("Invalid CGI status: " + val);
+				size_t text = val.find_first_not_of("0123456789");
+				if (text != std::string::npos)
+					text = val.find_first_not_of(" \t", text);
+				if (text != std::string::npos)
+					reason = val.substr(text);
+				continue;
+			}
+			fields.push_back(std::make_pair(key, val));
+			if (strcasecmp(key.c_str(), "Content-Type") == 0)
 				hasContentType = true;
 		}
 	}
@@ -57,19 +182,36 @@ HttpResponse CgiHandler::execute(
 		throw std::runtime_error("Invalid CGI output");
 	}
 
+	HttpResponse res(code);
+	if (!reason.empty())
+		res.setStatusMessage(reason);
+	res.removeHeader("Content-Length");
+	for (auto& f : fields)
+		res.setHeader(f.first, f.second);
 	return res;
 }
-std::map<std::string, std::string> CgiHandler::buildEnv(
-	const std::string& scriptPath,
-	const std::string& serverRoot
-	) const {
 
-	std::map<std::string, std::string> env;
+std::vector<std::string> CgiHandler::baseEnv(const std::string& serverRoot) {
+	std::vector<std::string> env;
+	env.push_back("GATEWAY_INTERFACE=CGI/1.1");
+	env.push_back("SERVER_PROTOCOL=HTTP/1.1");
+	env.push_back("SERVER_SOFTWARE=MyWebServ/1.0");
+	env.push_back("REDIRECT_STATUS=200");
+
+	char cwd[4096];
+	if (getcwd(cwd, sizeof(cwd)) == NULL)
+		cwd[0] = '\0';
+	env.push_back("SERVER_ROOT=" + std::string(cwd) + "/" + serverRoot);
+	return env;
+}
+
+std::vector<std::string> CgiHandler::requestEnv(const std::string& scriptPath) const {
+	std::vector<std::string> env;
 	std::string fullPath = _request.getPath();
 	std::string scriptName = scriptPath.substr(scriptPath.find_last_of('/') + 1);
 
 	// SCRIPT_NAME: the executed CGI file
-	env["SCRIPT_NAME"] = "/" + scriptName;
+	env.push_back("SCRIPT_NAME=/" + scriptName);
 
 	// PATH_INFO = extra path after script name
 	std::string pathInfo;
@@ -77,118 +219,28 @@ std::map<std::string, std::string> CgiHandler::buildEnv(
 	if (scriptPos != std::string::npos) {
 		pathInfo = fullPath.substr(scriptPos + scriptName.size());
 	}
-	env["PATH_INFO"] = pathInfo;
-
-	//  Logger::log(
-	// 	DEBUG,
-	// 	"Enviroment in CGI: PATH_INFO: " + pathInfo + " SCRIPT_NAME: /" + scriptName);
-
-	// Standard CGI varszz
-	env["GATEWAY_INTERFACE"]	= "CGI/1.1";
-	env["SCRIPT_FILENAME"]		= scriptPath;
-	env["REQUEST_METHOD"]		= _request.getMethod();
-	env["QUERY_STRING"]			= _request.getQueryString();
-	env["CONTENT_LENGTH"]		= std::to_string(_request.getBody().size());
-	env["CONTENT_TYPE"]			= _request.getHeader("Content-Type");
-	env["SERVER_PROTOCOL"]		= "HTTP/1.1";
-	env["SERVER_SOFTWARE"]		= "MyWebServ/1.0";
-	env["REDIRECT_STATUS"]		= "200";
-
-	char cwd[4096];
-	getcwd(cwd, sizeof(cwd));
-	std::string absRoot = std::string(cwd) + "/" + serverRoot;
-	env["SERVER_ROOT"] = absRoot;
+	env.push_back("PATH_INFO=" + pathInfo);
 
+	env.push_back("SCRIPT_FILENAME=" + scriptPath);
+	env.push_back("REQUEST_METHOD=" + _request.getMethod());
+	env.push_back("QUERY_STRING=" + _request.getQueryString());
+	env.push_back("CONTENT_LENGTH=" + std::to_string(_request.getBody().size()));
+	env.push_back("CONTENT_TYPE=" + _request.getHeader("Content-Type"));
 	return env;
 }
 
-int CgiHandler::runProcess(
+std::map<std::string, std::string> CgiHandler::buildEnv(
 	const std::string& scriptPath,
-	const std::map<std::string, std::string>& env,
-	const std::string& interpreterPath,
-	std::string& stdoutStr,
-	std::string& stderrStr
-) {
-	const int CGI_TIMEOUT = 10;
-
-	int inPipe[2], outPipe[2], errPipe[2];
-	if (pipe(inPipe) < 0 || pipe(outPipe) < 0 || pipe(errPipe) < 0)
-		throw std::runtime_error("pipe failed");
-
-	pid_t pid = fork();
-	if (pid < 0)
-		throw std::runtime_error("fork failed");
-
-	if (pid == 0) {
-		// Child
-		dup2(inPipe[0], STDIN_FILENO);
-		dup2(outPipe[1], STDOUT_FILENO);
-		dup2(errPipe[1], STDERR_FILENO);
-
-		close(inPipe[1]);
-		close(outPipe[0]);
-		close(errPipe[0]);
-
-		std::vector<std::string> envStrings;
-		std::vector<char*> envp;
-		for (auto& it : env)
-			envStrings.push_back(it.first + "=" + it.second);
-		for (size_t i = 0; i < envStrings.size(); ++i)
-			envp.push_back(const_cast<char*>(envStrings[i].c_str()));
-		envp.push_back(nullptr);
-
-		char* args[] = {
-			const_cast<char*>(interpreterPath.c_str()),
-			const_cast<char*>(scriptPath.c_str()),
-			nullptr
-		};
-		execve(interpreterPath.c_str(), args, envp.data());
-		perror("execve failed");
-		_exit(127);
-	}
-
-	// Parent
-	close(inPipe[0]);
-	close(outPipe[1]);
-	close(errPipe[1]);
-
-	if (_request.getMethod() == "POST")
-		write(inPipe[1], _request.getBody().c_str(), _request.getBody().size());
-	close(inPipe[1]);
-
-	fcntl(outPipe[0], F_SETFL, O_NONBLOCK);
-	fcntl(errPipe[0], F_SETFL, O_NONBLOCK);
-
-	stdoutStr.clear();
-	stderrStr.clear();
-
-	int status = -1;
-	time_t start = time(NULL);
-
-	char buffer[2048];
-
-	while (true) {
-		pid_t result = waitpid(pid, &status, WNOHANG);
-		if (result == pid) {
-			ssize_t n;
-			while ((n = read(outPipe[0], buffer, sizeof(buffer))) > 0) stdoutStr.append(buffer, n);
-			while ((n = read(errPipe[0], buffer, sizeof(buffer))) > 0) stderrStr.append(buffer, n);
-			break;
-		}
-
-		// Timeout check
-		if (difftime(time(NULL), start) > CGI_TIMEOUT) {
-			kill(pid, SIGKILL);
-			waitpid(pid, &status, 0);
-			throw std::runtime_error("CGI script timed out");
-		}
-
-		ssize_t n;
-		while ((n = read(outPipe[0], buffer, sizeof(buffer))) > 0) stdoutStr.append(buffer, n);
-		while ((n = read(errPipe[0], buffer, sizeof(buffer))) > 0) stderrStr.append(buffer, n);
+	const Location& loc
+	) const {
 
-		usleep(100 * 1000); // sleep 100ms
+	std::map<std::string, std::string> env;
+	std::vector<std::string> pairs = loc.getCgiEnv();
+	std::vector<std::string> reqEnv = requestEnv(scriptPath);
+	pairs.insert(pairs.end(), reqEnv.begin(), reqEnv.end());
+	for (size_t i = 0; i < pairs.size(); ++i) {
+		size_t eq = pairs[i].find('=');
+		env[pairs[i].substr(0, eq)] = pairs[i].substr(eq + 1);
 	}
-
-	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
-}
\ No newline at end of file
+	return env;
+}
@@ -0,0 +1,199 @@
+#include "CgiQueue.hpp"
+#include "Logger.hpp"
+#include <algorithm>
+#include <time.h>
+
+// Monotonic milliseconds, for queue wait times
+static uint64_t nowMs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<uint64_t>(ts.tv_sec) * 1000 + static_cast<uint64_t>(ts.tv_nsec) / 1000000;
+}
+
+CgiSlot::CgiSlot(CgiQueue& queue, const std::string& gate)
+	: _queue(queue), _gate(gate) { }
+
+CgiSlot::~CgiSlot() {
+	_queue.release(_gate);
+}
+
+std::string CgiQueue::gateKey(const std::string& serverRoot, const Location& loc) {
+	return serverRoot + " " + loc.getPath();
+}
+
+std::shared_ptr<CgiSlot> CgiQueue::submit(const std::string& name, const CgiLimits& limits,
+	int clientFd, const std::string& client, StartFn start, RejectFn reject)
+{
+	Gate& gate = _gates[name];
+	gate.limits = limits;	// the latest configuration wins
+
+	// 🔹 Room and nobody ahead: run now
+	if (gate.running < limits.maxConcurrency && gate.depth == 0) {
+		gate.running++;
+		gate.stats.admitted++;
+		return std::make_shared<CgiSlot>(*this, name);
+	}
+	if (gate.depth >= limits.queueSize) {
+		gate.stats.rejected++;
+		_rejected.push_back(std::make_pair(clientFd, std::move(reject)));
+		return nullptr;
+	}
+
+	// 🔹 Wait behind this client's earlier requests
+	uint64_t id = _nextId++;
+	Waiter& w = _waiters[id];
+	w.gate = name;
+	w.client = client;
+	w.clientFd = clientFd;
+	w.queuedAt = nowMs();
+	w.deadline = time(NULL) + limits.queueTimeout;
+	w.start = std::move(start);
+	w.reject = std::move(reject);
+
+	std::deque<uint64_t>& mine = gate.byClient[client];
+	if (mine.empty())
+		gate.turns.push_back(client);
+	mine.push_back(id);
+	gate.depth++;
+	gate.stats.queued++;
+	gate.stats.peakDepth = std::max(gate.stats.peakDepth, gate.depth);
+	return nullptr;
+}
+
+// A slot went away; the next waiter starts at the next flush()
+void CgiQueue::release(const std::string& name) {
+	auto it = _gates.find(name);
+	if (it == _gates.end() || it->second.running == 0)
+		return;
+	it->second.running--;
+	_freed.push_back(name);
+}
+
+void CgiQueue::unlink(Gate& gate, uint64_t id, const std::string& client) {
+	auto mine = gate.byClient.find(client);
+	if (mine != gate.byClient.end()) {
+		std::deque<uint64_t>& q = mine->second;
+		q.erase(std::remove(q.begin(), q.end(), id), q.end());
+		if (q.empty()) {
+			gate.byClient.erase(mine);
+			gate.turns.erase(std::remove(gate.turns.begin(), gate.turns.end(), client), gate.turns.end());
+		}
+	}
+	gate.depth--;
+}
+
+// Starts waiters while the gate has room, one per client address in turn
+void CgiQueue::dispatch(const std::string& name) {
+	auto it = _gates.find(name);
+	if (it == _gates.end())
+		return;
+	Gate& gate = it->second;	// stays valid if a start submits more
+
+	while (gate.running < gate.limits.maxConcurrency && !gate.turns.empty()) {
+		std::string client = gate.turns.front();
+		gate.turns.pop_front();
+		std::deque<uint64_t>& mine = gate.byClient[client];
+		uint64_t id = mine.front();
+		mine.pop_front();
+		if (mine.empty())
+			gate.byClient.erase(client);
+		else
+			gate.turns.push_back(client);
+		gate.depth--;
+
+		auto w = _waiters.find(id);
+		Waiter waiter = std::move(w->second);
+		_waiters.erase(w);
+
+		uint64_t waited = nowMs() - waiter.queuedAt;
+		gate.running++;
+		gate.stats.admitted++;
+		gate.stats.waited++;
+		gate.stats.waitTotal += waited;
+		gate.stats.waitMax = std::max(gate.stats.waitMax, waited);
+		waiter.start(std::make_shared<CgiSlot>(*this, name));
+	}
+}
+
+// The client went away: it leaves the queue without an answer, and a
+// rejection decided already must not run on its freed handler
+void CgiQueue::forget(int clientFd) {
+	for (auto it = _waiters.begin(); it != _waiters.end(); ) {
+		if (it->second.clientFd != clientFd) {
+			++it;
+			continue;
+		}
+		unlink(_gates[it->second.gate], it->first, it->second.client);
+		it = _waiters.erase(it);
+	}
+	_rejected.erase(std::remove_if(_rejected.begin(), _rejected.end(),
+		[clientFd](const std::pair<int, RejectFn>& r) { return r.first == clientFd; }),
+		_rejected.end());
+}
+
+// Queued, or about to get its 503
+bool CgiQueue::waiting(int clientFd) const {
+	for (const auto& w : _waiters) {
+		if (w.second.clientFd == clientFd)
+			return true;
+	}
+	for (const auto& r : _rejected) {
+		if (r.first == clientFd)
+			return true;
+	}
+	return false;
+}
+
+// Waited past cgi_queue_timeout: 503 at the next flush()
+void CgiQueue::checkTimeouts(time_t now) {
+	for (auto it = _waiters.begin(); it != _waiters.end(); ) {
+		if (now < it->second.deadline) {
+			++it;
+			continue;
+		}
+		Gate& gate = _gates[it->second.gate];
+		unlink(gate, it->first, it->second.client);
+		gate.stats.timedOut++;
+		_rejected.push_back(std::make_pair(it->second.clientFd, std::move(it->second.reject)));
+		it = _waiters.erase(it);
+	}
+}
+
+// Runs what slots freed up and rejections decided since the last pass
+void CgiQueue::flush() {
+	while (!_freed.empty() || !_rejected.empty()) {
+		std::vector<std::string> freed;
+		freed.swap(_freed);
+		std::sort(freed.begin(), freed.end());
+		freed.erase(std::unique(freed.begin(), freed.end()), freed.end());
+		for (const std::string& name : freed)
+			dispatch(name);
+
+		std::deque<std::pair<int, RejectFn>> rejected;
+		rejected.swap(_rejected);
+		for (auto& r : rejected)
+			r.second();
+	}
+}
+
+// One line per busy gate every CGI_QUEUE_REPORT_INTERVAL, then the counters restart
+void CgiQueue::report(time_t now) {
+	if (now - _lastReport < CGI_QUEUE_REPORT_INTERVAL)
+		return;
+	_lastReport = now;
+	for (auto& g : _gates) {
+		Gate& gate = g.second;
+		Stats& s = gate.stats;
+		if (!s.admitted && !s.queued && !s.rejected && !s.timedOut && !gate.depth)
+			continue;
+		Logger::log(INFO, "cgi queue " + g.first
+			+ ": running " + std::to_string(gate.running) + "/" + std::to_string(gate.limits.maxConcurrency)
+			+ ", waiting " + std::to_string(gate.depth) + " (peak " + std::to_string(s.peakDepth) + ")"
+			+ ", started " + std::to_string(s.admitted) + ", queued " + std::to_string(s.queued)
+			+ ", wait avg " + std::to_string(s.waited ? s.waitTotal / s.waited : 0) + "ms"
+			+ " max " + std::to_string(s.waitMax) + "ms"
+			+ ", 503 full " + std::to_string(s.rejected) + " timeout " + std::to_string(s.timedOut));
+		s = Stats();
+		s.peakDepth = gate.depth;
+	}
+}
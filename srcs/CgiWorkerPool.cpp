@@ -0,0 +1,545 @@
+#include "CgiWorkerPool.hpp"
+#include "CgiHandler.hpp"
+#include "ConfigSnapshot.hpp"
+#include "Logger.hpp"
+#include "Signals.hpp"
+#include <unistd.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <poll.h>
+#include <csignal>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <set>
+#include <vector>
+#include <algorithm>
+
+// Runs inside each worker (python3 -c). Compiled scripts are cached by mtime.
+static const char* CGI_WORKER_BOOTSTRAP = R"PY(
+import io, os, sys, traceback
+
+class Capture(io.BytesIO):
+	def close(self):
+		pass	# a script closing sys.stdout must not lose its output
+
+rin = os.fdopen(3, 'rb')
+rout = os.fdopen(4, 'wb')
+base_env = dict(os.environ)
+base_path = list(sys.path)
+cwd = os.getcwd()
+compiled = {}
+
+def load(script):
+	mtime = os.stat(script).st_mtime_ns
+	hit = compiled.get(script)
+	if hit and hit[0] == mtime:
+		return hit[1]
+	with open(script, 'rb') as f:
+		code = compile(f.read(), script, 'exec')
+	compiled[script] = (mtime, code)
+	return code
+
+while True:
+	line = rin.readline()
+	if not line:
+		break
+	envlen, bodylen = map(int, line.split())
+	env = rin.read(envlen)
+	body = rin.read(bodylen)
+
+	os.environ.clear()
+	os.environ.update(base_env)
+	for pair in env.split(b'\0'):
+		if pair:
+			key, _, value = pair.partition(b'=')
+			os.environ[key.decode()] = value.decode('utf-8', 'surrogateescape')
+	script = os.environ.get('SCRIPT_FILENAME', '')
+
+	out = Capture()
+	err = io.StringIO()
+	sys.stdin = io.TextIOWrapper(io.BytesIO(body), encoding='utf-8')
+	sys.stdout = io.TextIOWrapper(out, encoding='utf-8', write_through=True)
+	sys.stderr = err
+	sys.argv = [script]
+	sys.path[:] = [os.path.dirname(script)] + base_path[1:]
+
+	status = 0
+	try:
+		exec(load(script), {'__name__': '__main__', '__file__': script, '__builtins__': __builtins__})
+	except SystemExit as e:
+		status = e.code if isinstance(e.code, int) else (0 if e.code is None else 1)
+	except BaseException:
+		traceback.print_exc()
+		status = 1
+	try:
+		sys.stdout.flush()
+	except ValueError:
+		pass
+	sys.stdin, sys.stdout, sys.stderr = sys.__stdin__, sys.__stdout__, sys.__stderr__
+	os.chdir(cwd)
+
+	data = out.getvalue()
+	errors = err.getvalue().encode('utf-8', 'replace')
+	rout.write(b'%d %d %d\n' % (status, len(data), len(errors)) + data + errors)
+	rout.flush()
+)PY";
+
+CgiWorkerPool::CgiWorkerPool(WatchFn watch, ReapFn reap)
+	: _watch(std::move(watch)), _reap(std::move(reap)) {}
+
+// Workers see EOF on their request pipe and exit
+CgiWorkerPool::~CgiWorkerPool() {
+	for (auto& w : _workers) {
+		close(w.second.reqFd);
+		close(w.second.respFd);
+		if (w.second.errFd >= 0)
+			close(w.second.errFd);
+	}
+}
+
+// Same location, extension and settings → same pool
+std::string CgiWorkerPool::poolKey(const Location& loc, const std::string& ext) {
+	const CgiPoolConfig& c = loc.getCgiPools().at(ext);
+	return loc.getPath() + " " + ext + " " + loc.getCgiExtensions().at(ext)
+		+ " " + std::to_string(c.minWorkers) + "/" + std::to_string(c.maxWorkers)
+		+ "/" + std::to_string(c.maxRequests);
+}
+
+bool CgiWorkerPool::owns(int fd) const { return _fdOwner.count(fd) != 0; }
+
+void CgiWorkerPool::configure(const ConfigSnapshot& config) {
+	std::set<std::string> wanted;
+	for (const Server& srv : config.getServers()) {
+		for (const Location& loc : srv.getLocations()) {
+			for (auto& p : loc.getCgiPools()) {
+				std::string key = poolKey(loc, p.first);
+				wanted.insert(key);
+				Pool& pool = _pools[key];
+				pool.interpreter = loc.getCgiExtensions().at(p.first);
+				pool.env = loc.getCgiEnv();
+				pool.config = p.second;
+				pool.retired = false;
+			}
+		}
+	}
+
+	// 🔹 Pools the new configuration dropped: idle workers go now, busy ones after their request
+	std::vector<int> idle;
+	for (auto& w : _workers) {
+		if (!wanted.count(w.second.pool) && w.second.request == 0)
+			idle.push_back(w.first);
+	}
+	for (auto& p : _pools) {
+		if (!wanted.count(p.first))
+			p.second.retired = true;
+	}
+	for (int fd : idle)
+		retire(fd, false);
+
+	// 🔹 Warm the rest
+	for (const std::string& key : wanted) {
+		Pool& pool = _pools[key];
+		while (pool.workers < pool.config.minWorkers) {
+			if (spawn(key, pool) < 0)
+				break;
+		}
+	}
+}
+
+// Starts one idle worker; returns its respFd, or -1
+int CgiWorkerPool::spawn(const std::string& key, Pool& pool) {
+	int reqPipe[2], respPipe[2], errPipe[2];
+	if (pipe2(reqPipe, O_CLOEXEC) < 0)
+		return -1;
+	if (pipe2(respPipe, O_CLOEXEC) < 0) {
+		close(reqPipe[0]); close(reqPipe[1]);
+		return -1;
+	}
+	if (pipe2(errPipe, O_CLOEXEC) < 0) {
+		close(reqPipe[0]); close(reqPipe[1]);
+		close(respPipe[0]); close(respPipe[1]);
+		return -1;
+	}
+
+	// Park the child's ends above fd 4, so no dup2() below lands on one of them
+	int ends[] = { reqPipe[0], respPipe[1], errPipe[1] };
+	for (int& fd : ends) {
+		int moved = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+		if (moved >= 0) {
+			close(fd);
+			fd = moved;
+		}
+	}
+	reqPipe[0] = ends[0];
+	respPipe[1] = ends[1];
+	errPipe[1] = ends[2];
+
+	std::vector<char*> argv;
+	argv.push_back(const_cast<char*>(pool.interpreter.c_str()));
+	argv.push_back(const_cast<char*>("-c"));
+	argv.push_back(const_cast<char*>(CGI_WORKER_BOOTSTRAP));
+	argv.push_back(nullptr);
+	// Same base as a spawned script, not the server's own environment
+	std::vector<char*> envp;
+	for (const std::string& pair : pool.env)
+		envp.push_back(const_cast<char*>(pair.c_str()));
+	envp.push_back(nullptr);
+
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+	posix_spawn_file_actions_adddup2(&actions, errPipe[1], STDOUT_FILENO);
+	posix_spawn_file_actions_adddup2(&actions, errPipe[1], STDERR_FILENO);
+	posix_spawn_file_actions_adddup2(&actions, reqPipe[0], 3);
+	posix_spawn_file_actions_adddup2(&actions, respPipe[1], 4);
+	posix_spawnattr_t attr;
+	Signals::spawnAttributes(attr);
+
+	pid_t pid;
+	int err = posix_spawn(&pid, pool.interpreter.c_str(), &actions, &attr, argv.data(), envp.data());
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+
+	close(reqPipe[0]);
+	close(respPipe[1]);
+	close(errPipe[1]);
+	if (err != 0) {
+		close(reqPipe[1]);
+		close(respPipe[0]);
+		close(errPipe[0]);
+		Logger::log(ERROR, "cannot start CGI worker " + pool.interpreter + ": " + strerror(err));
+		return -1;
+	}
+
+	Worker& w = _workers[respPipe[0]];
+	w.pid = pid;
+	w.pool = key;
+	w.reqFd = reqPipe[1];
+	w.respFd = respPipe[0];
+	w.errFd = errPipe[0];
+	w.idleSince = time(NULL);
+	fcntl(w.reqFd, F_SETFL, O_NONBLOCK);
+	fcntl(w.respFd, F_SETFL, O_NONBLOCK);
+	fcntl(w.errFd, F_SETFL, O_NONBLOCK);
+
+	_fdOwner[w.reqFd] = w.respFd;
+	_fdOwner[w.respFd] = w.respFd;
+	_fdOwner[w.errFd] = w.respFd;
+	_watch(w.respFd, POLLIN);
+	_watch(w.errFd, POLLIN);
+	pool.workers++;
+
+	Logger::log(TRACE, "CGI worker pid " + std::to_string(pid) + " started for " + key);
+	return w.respFd;
+}
+
+uint64_t CgiWorkerPool::submit(const std::string& key,
+	const std::map<std::string, std::string>& env,
+	const std::string& body, DoneFn done)
+{
+	uint64_t id = _nextId++;
+	Request& req = _requests[id];
+	req.pool = key;
+	req.deadline = time(NULL) + CGI_TIMEOUT;
+	req.done = std::move(done);
+
+	std::string block;
+	for (auto& e : env) {
+		block += e.first;
+		block += '=';
+		block += e.second;
+		block += '\0';
+	}
+	req.frame = std::to_string(block.size()) + " " + std::to_string(body.size()) + "\n";
+	req.frame += block;
+	req.frame += body;
+
+	auto p = _pools.find(key);
+	if (p == _pools.end()) {
+		finish(id);		// ok = false
+		return id;
+	}
+	p->second.queue.push_back(id);
+	dispatch(key);
+	return id;
+}
+
+void CgiWorkerPool::cancel(uint64_t id) {
+	auto it = _requests.find(id);
+	if (it == _requests.end()) {
+		// Answered already: the completion must not run for a gone client
+		for (auto f = _finished.begin(); f != _finished.end(); ++f) {
+			if (f->id == id) {
+				_finished.erase(f);
+				break;
+			}
+		}
+		return;
+	}
+	// A running script finishes on its own (or hits the timeout); its answer is dropped
+	if (it->second.worker < 0) {
+		auto p = _pools.find(it->second.pool);
+		if (p != _pools.end()) {
+			std::deque<uint64_t>& q = p->second.queue;
+			q.erase(std::remove(q.begin(), q.end(), id), q.end());
+		}
+	}
+	_requests.erase(it);
+}
+
+// Hands queued requests to idle workers, starting new ones up to the maximum
+void CgiWorkerPool::dispatch(const std::string& key) {
+	auto p = _pools.find(key);
+	if (p == _pools.end())
+		return;
+	Pool& pool = p->second;
+
+	while (!pool.queue.empty()) {
+		int target = -1;
+		for (auto& w : _workers) {
+			if (w.second.pool == key && w.second.request == 0) {
+				target = w.first;
+				break;
+			}
+		}
+		if (target < 0) {
+			if (pool.workers >= pool.config.maxWorkers)
+				return;		// all busy: stay queued
+			target = spawn(key, pool);
+		}
+		if (target < 0) {
+			while (!pool.queue.empty()) {
+				finish(pool.queue.front());
+				pool.queue.pop_front();
+			}
+			return;
+		}
+		uint64_t id = pool.queue.front();
+		pool.queue.pop_front();
+		assign(_workers[target], id);
+	}
+}
+
+void CgiWorkerPool::assign(Worker& w, uint64_t id) {
+	Request& req = _requests[id];
+	req.worker = w.respFd;
+	w.request = id;
+	w.deadline = req.deadline;
+	w.out = std::move(req.frame);
+	w.outPos = 0;
+	w.in.clear();
+	if (!writeRequest(w))
+		retire(w.respFd, true);
+}
+
+bool CgiWorkerPool::writeRequest(Worker& w) {
+	while (w.outPos < w.out.size()) {
+		ssize_t n = write(w.reqFd, w.out.data() + w.outPos, w.out.size() - w.outPos);
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EINTR) {
+				_watch(w.reqFd, POLLOUT);
+				return true;
+			}
+			return false;
+		}
+		w.outPos += static_cast<size_t>(n);
+	}
+	w.out.clear();
+	w.outPos = 0;
+	_watch(w.reqFd, 0);
+	return true;
+}
+
+// Returns false if the worker died
+bool CgiWorkerPool::readResponse(Worker& w) {
+	char buf[16384];
+	while (true) {
+		ssize_t n = read(w.respFd, buf, sizeof(buf));
+		if (n > 0) {
+			w.in.append(buf, static_cast<size_t>(n));
+			continue;
+		}
+		if (n < 0 && (errno == EAGAIN || errno == EINTR))
+			break;
+		return false;
+	}
+
+	// "<status> <outlen> <errlen>\n" then both streams
+	size_t nl = w.in.find('\n');
+	if (nl == std::string::npos)
+		return true;
+	int status = 0;
+	size_t outLen = 0, errLen = 0;
+	if (std::sscanf(w.in.c_str(), "%d %zu %zu", &status, &outLen, &errLen) != 3)
+		return false;
+	if (w.in.size() < nl + 1 + outLen + errLen)
+		return true;
+
+	auto it = _requests.find(w.request);
+	if (it != _requests.end()) {
+		CgiWorkerResult& r = it->second.result;
+		r.ok = true;
+		r.status = status;
+		r.out = w.in.substr(nl + 1, outLen);
+		r.err = w.in.substr(nl + 1 + outLen, errLen);
+		finish(w.request);
+	}
+	w.request = 0;
+	w.in.clear();
+	w.served++;
+	w.idleSince = time(NULL);
+
+	Pool& pool = _pools[w.pool];
+	std::string key = w.pool;
+	if (pool.retired || (pool.config.maxRequests > 0 && w.served >= pool.config.maxRequests))
+		retire(w.respFd, false);	// a fresh one is started on demand
+	else
+		dispatch(key);
+	return true;
+}
+
+// Output that bypassed sys.stdout/sys.stderr
+void CgiWorkerPool::readErrors(Worker& w) {
+	char buf[4096];
+	while (true) {
+		ssize_t n = read(w.errFd, buf, sizeof(buf));
+		if (n > 0) {
+			Logger::log(WARNING, "CGI worker " + std::to_string(w.pid) + ": "
+				+ std::string(buf, static_cast<size_t>(n)));
+			continue;
+		}
+		if (n < 0 && (errno == EAGAIN || errno == EINTR))
+			return;
+		break;
+	}
+	_watch(w.errFd, 0);
+	_fdOwner.erase(w.errFd);
+	close(w.errFd);
+	w.errFd = -1;
+}
+
+// Stops a worker: gently (EOF on its request pipe) or with SIGKILL
+void CgiWorkerPool::retire(int respFd, bool kill) {
+	auto it = _workers.find(respFd);
+	if (it == _workers.end())
+		return;
+	Worker w = std::move(it->second);
+	_workers.erase(it);
+
+	if (kill)
+		::kill(w.pid, SIGKILL);
+	int fds[] = { w.reqFd, w.respFd, w.errFd };
+	for (int fd : fds) {
+		if (fd < 0)
+			continue;
+		_watch(fd, 0);
+		_fdOwner.erase(fd);
+		close(fd);
+	}
+	_reap(w.pid);
+
+	// Its request (if any) can't be answered anymore
+	if (w.request && _requests.count(w.request)) {
+		Logger::log(ERROR, "CGI worker " + std::to_string(w.pid) + " died mid-request");
+		finish(w.request);
+	}
+
+	auto p = _pools.find(w.pool);
+	if (p == _pools.end())
+		return;
+	p->second.workers--;
+	if (p->second.retired && p->second.workers == 0 && p->second.queue.empty())
+		_pools.erase(p);
+	else
+		dispatch(w.pool);
+}
+
+void CgiWorkerPool::finish(uint64_t id) {
+	auto it = _requests.find(id);
+	if (it == _requests.end())
+		return;
+	_finished.push_back(Finished{ id, std::move(it->second.done), std::move(it->second.result) });
+	_requests.erase(it);
+}
+
+void CgiWorkerPool::handle(int fd, short revents) {
+	auto o = _fdOwner.find(fd);
+	if (o == _fdOwner.end())
+		return;
+	int key = o->second;
+	Worker& w = _workers[key];
+
+	if (fd == w.errFd) {
+		readErrors(w);
+	} else if (fd == w.reqFd) {
+		if ((revents & (POLLERR | POLLHUP)) || !writeRequest(w))
+			retire(key, true);
+	} else if (!readResponse(w)) {
+		retire(key, true);
+	}
+}
+
+void CgiWorkerPool::checkTimeouts(time_t now) {
+	// 🔹 Scripts running too long: the worker goes with them
+	std::vector<int> stuck;
+	std::vector<int> idle;
+	for (auto& w : _workers) {
+		if (w.second.request != 0) {
+			// Also catches scripts whose client went away (cancel)
+			if (now >= w.second.deadline)
+				stuck.push_back(w.first);
+			continue;
+		}
+		const Pool& pool = _pools[w.second.pool];
+		if (pool.workers > pool.config.minWorkers && now - w.second.idleSince > CGI_WORKER_IDLE_TIMEOUT)
+			idle.push_back(w.first);
+	}
+	for (int fd : stuck) {
+		Worker& w = _workers[fd];
+		auto r = _requests.find(w.request);
+		if (r != _requests.end()) {
+			Logger::log(WARNING, "CGI worker " + std::to_string(w.pid) + " timed out, killing it");
+			r->second.result.timedOut = true;
+			finish(w.request);
+		}
+		w.request = 0;
+		retire(fd, true);
+	}
+	for (int fd : idle) {
+		const Pool& pool = _pools[_workers[fd].pool];
+		if (pool.workers > pool.config.minWorkers)
+			retire(fd, false);
+	}
+
+	// 🔹 Requests that waited in the queue for too long
+	std::vector<uint64_t> overdue;
+	for (auto& r : _requests) {
+		if (r.second.worker < 0 && now >= r.second.deadline)
+			overdue.push_back(r.first);
+	}
+	for (uint64_t id : overdue) {
+		std::string key = _requests[id].pool;
+		std::deque<uint64_t>& q = _pools[key].queue;
+		q.erase(std::remove(q.begin(), q.end(), id), q.end());
+		_requests[id].result.timedOut = true;
+		finish(id);
+	}
+
+	// 🔹 Back to the minimum after deaths and recycling
+	for (auto& p : _pools) {
+		while (!p.second.retired && p.second.workers < p.second.config.minWorkers) {
+			if (spawn(p.first, p.second) < 0)
+				break;
+		}
+	}
+}
+
+void CgiWorkerPool::flush() {
+	while (!_finished.empty()) {
+		Finished f = std::move(_finished.front());
+		_finished.pop_front();
+		f.done(f.result);
+	}
+}
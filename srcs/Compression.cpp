@@ -0,0 +1,395 @@
+#include "Compression.hpp"
+#include "Logger.hpp"
+#include "utils.hpp"
+#include <zlib.h>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "MimeTypes.hpp"
+
+// 🔹 Define static members
+std::list<Compression::CacheEntry> Compression::_lru;
+std::unordered_map<std::string, std::list<Compression::CacheEntry>::iterator> Compression::_index;
+size_t Compression::_cacheBytes = 0;
+
+// q-value the client gives a coding: -1 when not listed at all
+double Compression::qValue(const std::string& header, const std::string& coding) {
+	std::istringstream iss(header);
+	std::string token;
+	while (std::getline(iss, token, ',')) {
+		std::string name = token;
+		double q = 1.0;
+
+		// "gzip;q=0.8" -> name "gzip", q 0.8
+		size_t semi = token.find(';');
+		if (semi != std::string::npos) {
+			name = token.substr(0, semi);
+			std::string param = trim(token.substr(semi + 1));
+			if (param.rfind("q=", 0) == 0)
+				q = std::atof(param.c_str() + 2);
+		}
+		name = trim(name);
+		std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+		if (name == coding || (coding == "gzip" && name == "x-gzip"))
+			return q;
+	}
+	return -1;
+}
+
+// Returns the coding with the highest q-value the client accepts (gzip wins ties)
+ContentEncoding Compression::negotiate(const HttpRequest& req) {
+	std::string header = req.getHeader("accept-encoding");
+	if (header.empty())
+		return ENCODING_IDENTITY;
+
+	double gzipQ = qValue(header, "gzip");
+	double deflateQ = qValue(header, "deflate");
+	double anyQ = qValue(header, "*");
+
+	// "*" covers every coding not listed explicitly
+	if (gzipQ < 0) gzipQ = anyQ;
+	if (deflateQ < 0) deflateQ = anyQ;
+
+	if (gzipQ > 0 && gzipQ >= deflateQ)
+		return ENCODING_GZIP;
+	if (deflateQ > 0)
+		return ENCODING_DEFLATE;
+	return ENCODING_IDENTITY;
+}
+
+double Compression::acceptance(const HttpRequest& req, const std::string& coding) {
+	std::string header = req.getHeader("accept-encoding");
+	if (header.empty())
+		return 0;
+	double q = qValue(header, coding);
+	if (q < 0)
+		q = qValue(header, "*");
+	return q > 0 ? q : 0;
+}
+
+bool Compression::accepts(const HttpRequest& req, const std::string& coding) {
+	return acceptance(req, coding) > 0;
+}
+
+std::string Compression::encodingName(ContentEncoding enc) {
+	switch (enc) {
+		case ENCODING_GZIP:		return "gzip";
+		case ENCODING_DEFLATE:	return "deflate";
+		default:				return "identity";
+	}
+}
+
+bool Compression::compress(const std::string& in, std::string& out, ContentEncoding enc, int level) {
+	if (enc == ENCODING_IDENTITY)
+		return false;
+
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+
+	// windowBits 15 = zlib wrapper (HTTP "deflate"), +16 = gzip wrapper
+	int windowBits = (enc == ENCODING_GZIP) ? 15 + 16 : 15;
+	if (deflateInit2(&zs, level, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return false;
+
+	out.resize(deflateBound(&zs, in.size()));
+	zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+	zs.avail_in = in.size();
+	zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+	zs.avail_out = out.size();
+
+	int ret = deflate(&zs, Z_FINISH);
+	deflateEnd(&zs);
+	if (ret != Z_STREAM_END) {
+		out.clear();
+		return false;
+	}
+	out.resize(zs.total_out);
+	return true;
+}
+
+bool Compression::isCompressible(const Location& loc, const std::string& contentType, size_t size) {
+	return loc.getGzip() && size >= loc.getGzipMinLength() && matchesType(loc, contentType);
+}
+
+// Is contentType listed in the location's gzip_types?
+bool Compression::matchesType(const Location& loc, const std::string& contentType) {
+	// "text/html; charset=utf-8" -> "text/html"
+	std::string type = trim(contentType.substr(0, contentType.find(';')));
+	std::transform(type.begin(), type.end(), type.begin(), ::tolower);
+
+	if (type == "text/html")
+		return true;
+	for (const std::string& t : loc.getGzipTypes()) {
+		if (t == "*" || t == type)
+			return true;
+	}
+	return false;
+}
+
+// Not compressed yet, and worth it: 200, in memory, not negotiated before
+bool Compression::eligible(const HttpResponse& res, const Location& loc, std::string& contentType) {
+	// Mapped files are too large to compress per request
+	if (!loc.getGzip() || res.getStatusCode() != 200 || res.getBodyMapping())
+		return false;
+
+	for (const auto& h : res.getHeaders()) {
+		std::string key = h.first;
+		std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+		// Already encoded (cached static variant or CGI did it itself)
+		if (key == "content-encoding")
+			return false;
+		// Already negotiated by the static path (compression didn't pay off)
+		if (key == "vary" && h.second.find("Accept-Encoding") != std::string::npos)
+			return false;
+		if (key == "content-type")
+			contentType = h.second;
+	}
+	return true;
+}
+
+// Compresses a fully built response in place (CGI output, listings, pages)
+void Compression::apply(HttpResponse& res, const HttpRequest& req, const Location& loc) {
+	ContentEncoding enc = plan(res, req, loc);
+	std::string out;
+	if (enc != ENCODING_IDENTITY && compress(res.getBody(), out, enc))
+		useEncoded(res, out, enc);
+}
+
+ContentEncoding Compression::plan(HttpResponse& res, const HttpRequest& req, const Location& loc) {
+	std::string contentType;
+	if (!eligible(res, loc, contentType) || !isCompressible(loc, contentType, res.getBody().size()))
+		return ENCODING_IDENTITY;
+
+	res.setHeader("Vary", "Accept-Encoding");
+	return negotiate(req);
+}
+
+// out: res's body compressed with enc; kept only if it came out smaller
+void Compression::useEncoded(HttpResponse& res, std::string& out, ContentEncoding enc) {
+	if (out.empty() || out.size() >= res.getBody().size())
+		return;
+
+	res.setHeader("Content-Encoding", encodingName(enc));
+	res.setHeader("Content-Length", std::to_string(out.size()));
+	res.setBody(out);
+}
+
+ContentEncoding Compression::applyStream(HttpResponse& res, const HttpRequest& req, const Location& loc) {
+	std::string contentType;
+	if (!eligible(res, loc, contentType) || !matchesType(loc, contentType))
+		return ENCODING_IDENTITY;
+
+	res.setHeader("Vary", "Accept-Encoding");
+	ContentEncoding enc = negotiate(req);
+	if (enc != ENCODING_IDENTITY) {
+		res.setHeader("Content-Encoding", encodingName(enc));
+		res.removeHeader("Content-Length");	// of the uncompressed body
+	}
+	return enc;
+}
+
+CompressionStream::CompressionStream(ContentEncoding enc, int level) : _zs(new z_stream) {
+	memset(_zs, 0, sizeof(*_zs));
+	int windowBits = (enc == ENCODING_GZIP) ? 15 + 16 : 15;
+	if (deflateInit2(_zs, level, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		delete _zs;
+		throw std::runtime_error("deflateInit2 failed");
+	}
+}
+
+CompressionStream::~CompressionStream() {
+	deflateEnd(_zs);
+	delete _zs;
+}
+
+std::string CompressionStream::run(const char* data, size_t len, int flush) {
+	std::string out;
+	char buf[16384];
+	_zs->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+	_zs->avail_in = len;
+	do {
+		_zs->next_out = reinterpret_cast<Bytef*>(buf);
+		_zs->avail_out = sizeof(buf);
+		deflate(_zs, flush);
+		out.append(buf, sizeof(buf) - _zs->avail_out);
+	} while (_zs->avail_out == 0);
+	return out;
+}
+
+std::string CompressionStream::write(const char* data, size_t len) {
+	return run(data, len, Z_SYNC_FLUSH);
+}
+
+std::string CompressionStream::finish() {
+	return run(NULL, 0, Z_FINISH);
+}
+
+std::string Compression::cacheKey(const std::string& path, ContentEncoding enc) {
+	return encodingName(enc) + ":" + path;
+}
+
+// Same mtime to the nanosecond and same size: the file wasn't rewritten
+bool Compression::fresh(const CacheEntry& entry, const struct stat& st) {
+	return entry.mtime.tv_sec == st.st_mtim.tv_sec && entry.mtime.tv_nsec == st.st_mtim.tv_nsec
+		&& entry.size == st.st_size;
+}
+
+const std::string* Compression::cached(const std::string& path, const struct stat& st, ContentEncoding enc) {
+	auto it = _index.find(cacheKey(path, enc));
+	// File changed on disk since it was compressed -> stale
+	if (it == _index.end() || !fresh(*it->second, st))
+		return NULL;
+	// Move to front (most recently used)
+	_lru.splice(_lru.begin(), _lru, it->second);
+	return &it->second->body;
+}
+
+const std::string* Compression::store(
+	const std::string& path,
+	const struct stat& st,
+	ContentEncoding enc,
+	std::string&& body)
+{
+	if (body.size() > COMPRESSION_CACHE_MAX_BYTES)
+		return NULL;
+
+	std::string key = cacheKey(path, enc);
+	auto existing = _index.find(key);
+	if (existing != _index.end()) {
+		_cacheBytes -= existing->second->body.size();
+		_lru.erase(existing->second);
+		_index.erase(existing);
+	}
+
+	// Evict least recently used variants until the new one fits
+	while (!_lru.empty() && _cacheBytes + body.size() > COMPRESSION_CACHE_MAX_BYTES) {
+		_cacheBytes -= _lru.back().body.size();
+		_index.erase(_lru.back().key);
+		_lru.pop_back();
+	}
+
+	_cacheBytes += body.size();
+	_lru.push_front(CacheEntry{key, st.st_mtim, st.st_size, std::move(body)});
+	_index[key] = _lru.begin();
+	return &_lru.front().body;
+}
+
+// Compressible by its name? Same rule as MimeTypes::lookup, on the
+// task's own copy of the table (this runs on the disk pool)
+static bool sidecarWanted(const SidecarTask& task, const std::string& name) {
+	size_t dot = name.find_last_of('.');
+	if (dot == std::string::npos)
+		return task.otherTypes;
+	std::string ext = name.substr(dot + 1);
+	std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+	auto it = task.extensions.find(ext);
+	return it != task.extensions.end() ? it->second : task.otherTypes;
+}
+
+// Walks one location's directory tree, writing file.gz next to every
+// compressible file that has no sidecar yet (or an outdated one).
+// Symbolic links are skipped: a link back up the tree would never end.
+void Compression::generateSidecarsIn(const std::string& dir, SidecarTask& task) {
+	DIR* d = opendir(dir.c_str());
+	if (!d)
+		return;
+
+	struct dirent* ent;
+	while ((ent = readdir(d)) != NULL) {
+		std::string name = ent->d_name;
+		if (name[0] == '.' || endsWith(name, ".gz") || endsWith(name, ".br"))
+			continue;
+
+		std::string path = dir + "/" + name;
+		struct stat st;
+		if (lstat(path.c_str(), &st) != 0 || S_ISLNK(st.st_mode))
+			continue;
+		if (S_ISDIR(st.st_mode)) {
+			generateSidecarsIn(path, task);
+			continue;
+		}
+		if (!S_ISREG(st.st_mode)
+			|| static_cast<size_t>(st.st_size) < task.minLength
+			|| !sidecarWanted(task, name))
+			continue;
+
+		std::string gzPath = path + ".gz";
+		struct stat gz;
+		if (stat(gzPath.c_str(), &gz) == 0 && gz.st_mtime >= st.st_mtime)
+			continue;
+
+		std::string body, out;
+		if (!readFile(path, body) || !compress(body, out, ENCODING_GZIP, GZIP_STATIC_LEVEL)
+			|| out.size() >= body.size())
+			continue;
+
+		// Write to a temp file and rename, so a request never sees half a sidecar
+		std::string tmpPath = gzPath + ".XXXXXX";
+		int fd = mkstemp(&tmpPath[0]);
+		if (fd < 0) {
+			task.errors.push_back("gzip_static: cannot create a temporary file for " + gzPath);
+			continue;
+		}
+		fchmod(fd, 0644);
+		bool ok = (::write(fd, out.data(), out.size()) == static_cast<ssize_t>(out.size()));
+		if (close(fd) != 0)
+			ok = false;
+		if (!ok || rename(tmpPath.c_str(), gzPath.c_str()) != 0) {
+			std::remove(tmpPath.c_str());
+			task.errors.push_back("gzip_static: failed to write " + gzPath);
+			continue;
+		}
+		++task.created;
+	}
+	closedir(d);
+}
+
+// On the loop: what each gzip_static_generate location needs, copied out
+// of the configuration and the MIME table
+std::vector<SidecarTask> Compression::sidecarTasks(const std::vector<Server>& servers) {
+	std::vector<SidecarTask> tasks;
+	for (const Server& srv : servers) {
+		for (const Location& loc : srv.getLocations()) {
+			if (!loc.getGzipStaticGenerate())
+				continue;
+			// Regex locations have no directory of their own
+			if (!loc.getPath().empty() && loc.getPath()[0] == '~')
+				continue;
+
+			SidecarTask task;
+			task.dir = resolveRoot(srv, loc) + "/" + trimLeadingSlash(loc.getPath());
+			while (task.dir.size() > 1 && task.dir.back() == '/')
+				task.dir.pop_back();
+			task.minLength = loc.getGzipMinLength();
+			for (const auto& m : MimeTypes::entries())
+				task.extensions[m.first] = matchesType(loc, m.second);
+			task.otherTypes = matchesType(loc, MimeTypes::DEFAULT_TYPE);
+			tasks.push_back(std::move(task));
+		}
+	}
+	return tasks;
+}
+
+// Any thread: touches nothing but the tasks
+void Compression::generateSidecars(std::vector<SidecarTask>& tasks) {
+	for (SidecarTask& task : tasks)
+		generateSidecarsIn(task.dir, task);
+}
+
+void Compression::reportSidecars(const std::vector<SidecarTask>& tasks) {
+	for (const SidecarTask& task : tasks) {
+		for (const std::string& error : task.errors)
+			Logger::log(WARNING, error);
+		Logger::log(INFO, "gzip_static: generated " + std::to_string(task.created)
+			+ " sidecar(s) under " + task.dir);
+	}
+}
+
+void Compression::generateSidecars(const std::vector<Server>& servers) {
+	std::vector<SidecarTask> tasks = sidecarTasks(servers);
+	generateSidecars(tasks);
+	reportSidecars(tasks);
+}
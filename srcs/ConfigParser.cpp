@@ -1,18 +1,29 @@
 #include "ConfigParser.hpp"
 #include "utils.hpp"
+#include "FastCgi.hpp"
 #include <fstream>
 #include <algorithm>
 #include <cctype>
 #include <sstream>
 #include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <sys/stat.h>
+#include <unistd.h>
 
 ConfigParser::ConfigParser(const std::string& path) : _config_path(path) {}
 
 const std::vector<Server>& ConfigParser::getServers() const { return _servers; }
+const std::vector<std::pair<std::string, std::string>>& ConfigParser::getTypes() const { return _types; }
+time_t ConfigParser::getShutdownTimeout() const { return _shutdownTimeout; }
+const SessionConfig& ConfigParser::getSessionConfig() const { return _sessions; }
+const std::map<std::string, UpstreamConfig>& ConfigParser::getUpstreams() const { return _upstreams; }
 
 ConfigLineType ConfigParser::getLineType(const std::string& line) {
 	if (line == "server {") return BLOCK_START_SERVER;
 	if (line.substr(0, 8) == "location") return BLOCK_START_LOCATION;
+	if (line == "types {") return BLOCK_START_TYPES;
+	if (line.rfind("upstream ", 0) == 0 && line.back() == '{') return BLOCK_START_UPSTREAM;
 	if (line == "}") return BLOCK_END;
 	if (isDirective(line)) return DIRECTIVE;
 	return UNKNOWN;
@@ -28,7 +39,26 @@ LocationDirective ConfigParser::getLocationDirective(const std::string& line) {
 	if (line.rfind("upload_path", 0) == 0) return UPLOAD_PATH;
 	if (line.rfind("cgi_extension", 0) == 0) return CGI_EXTENSION;
 	if (line.rfind("cgi_pass", 0) == 0) return CGI_PASS;
+	if (line.rfind("cgi_pool", 0) == 0) return CGI_POOL;
+	// longer names first: "cgi_cache" is a prefix of all of them
+	if (line.rfind("cgi_cache_valid", 0) == 0) return CGI_CACHE_VALID;
+	if (line.rfind("cgi_cache_path", 0) == 0) return CGI_CACHE_PATH;
+	if (line.rfind("cgi_cache_key", 0) == 0) return CGI_CACHE_KEY;
+	if (line.rfind("cgi_cache", 0) == 0) return CGI_CACHE;
+	if (line.rfind("cgi_max_concurrency", 0) == 0) return CGI_MAX_CONCURRENCY;
+	if (line.rfind("cgi_queue_size", 0) == 0) return CGI_QUEUE_SIZE_DIR;
+	if (line.rfind("cgi_queue_timeout", 0) == 0) return CGI_QUEUE_TIMEOUT_DIR;
 	if (line.rfind("return", 0) == 0) return RETURN;
+	// longer names first: "gzip" is a prefix of both
+	if (line.rfind("gzip_types", 0) == 0) return GZIP_TYPES;
+	if (line.rfind("gzip_min_length", 0) == 0) return GZIP_MIN_LENGTH;
+	if (line.rfind("gzip_static_generate", 0) == 0) return GZIP_STATIC_GENERATE;
+	if (line.rfind("gzip_static", 0) == 0) return GZIP_STATIC;
+	if (line.rfind("gzip", 0) == 0) return GZIP;
+	if (line.rfind("mmap_threshold", 0) == 0) return MMAP_THRESHOLD;
+	if (line == "internal;") return INTERNAL;
+	if (line.rfind("proxy_pass", 0) == 0) return PROXY_PASS;
+	if (line.rfind("session ", 0) == 0) return SESSION;
 	return OTHER;
 }
 
@@ -45,15 +75,36 @@ ServerDirective ConfigParser::getServerDirective(const std::string& line) {
 }
 
 void ConfigParser::parse() {
-	std::ifstream file(_config_path);
-	if (!file.is_open()) {
-		throw std::runtime_error("cannot open config file: " + _config_path);
+	parseFile(_config_path, 0);
+	resolveUpstreams();
+
+	for (size_t i = 0; i < _servers.size(); ++i) {
+		if (!_servers[i].hasListen()) {
+			throw std::runtime_error("Server #" + std::to_string(i+1) + " missing 'listen' directive");
+		}
+		if (!_servers[i].hasRoot()) {
+			throw std::runtime_error("Server #" + std::to_string(i+1) + " missing 'root' directive");
+		}
+		_servers[i].loadPages();
+		_servers[i].prepareCgiEnv();
 	}
 
+	setDefaultServers();
+}
+
+// Top level of the main file and of every included file
+void ConfigParser::parseFile(const std::string& path, int depth) {
+	if (depth > 8)
+		throw std::runtime_error("include nested too deeply: " + path);
+
+	std::ifstream file(path);
+	if (!file.is_open()) {
+		throw std::runtime_error("cannot open config file: " + path);
+	}
 	// Check if file is empty
 	file.seekg(0, std::ios::end);
 	if (file.tellg() == 0) {
-		throw std::runtime_error("configuration file is empty: " + _config_path);
+		throw std::runtime_error("configuration file is empty: " + path);
 	}
 	file.seekg(0, std::ios::beg); // reset to start for reading
 
@@ -68,6 +119,67 @@ void ConfigParser::parse() {
 				// reads until the closing BLOCK_END
 				parseServerBlock(file);
 				break;
+			case BLOCK_START_TYPES:
+				parseTypesBlock(file);
+				break;
+			case BLOCK_START_UPSTREAM:
+				parseUpstreamBlock(file, trimmed);
+				break;
+			case DIRECTIVE:
+				if (trimmed.rfind("include ", 0) == 0) {
+					// relative to the including file, like nginx
+					std::string target = parseValue(trimmed);
+					size_t slash = path.find_last_of('/');
+					if (!target.empty() && target[0] != '/' && slash != std::string::npos)
+						target = path.substr(0, slash + 1) + target;
+					parseFile(target, depth + 1);
+					break;
+				}
+				if (trimmed.rfind("shutdown_timeout ", 0) == 0) {
+					// "shutdown_timeout 30s;" or "shutdown_timeout 30;"
+					std::string value = parseValue(trimmed);
+					if (!value.empty() && value.back() == 's')
+						value.pop_back();
+					if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos)
+						throw std::runtime_error("invalid shutdown_timeout: " + trimmed);
+					_shutdownTimeout = std::atol(value.c_str());
+					break;
+				}
+				if (trimmed.rfind("session_timeout ", 0) == 0) {
+					// "session_timeout 30m;": s, m or h, seconds by default
+					std::string value = parseValue(trimmed);
+					time_t unit = 1;
+					if (!value.empty() && (value.back() == 's' || value.back() == 'm' || value.back() == 'h')) {
+						unit = (value.back() == 'h') ? 3600 : (value.back() == 'm') ? 60 : 1;
+						value.pop_back();
+					}
+					if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos
+						|| std::atol(value.c_str()) <= 0)
+						throw std::runtime_error("invalid session_timeout: " + trimmed);
+					_sessions.timeout = std::atol(value.c_str()) * unit;
+					break;
+				}
+				if (trimmed.rfind("session_store ", 0) == 0) {
+					// "session_store memory;", "session_store shared [file];"
+					std::istringstream iss(trimmed.substr(0, trimmed.size() - 1));
+					std::string name, type, path, extra;
+					iss >> name >> type >> path >> extra;
+					if (trimmed.back() != ';' || !extra.empty()
+						|| (type != "memory" && type != "shared") || (type == "memory" && !path.empty()))
+						throw std::runtime_error("invalid session_store: " + trimmed);
+					_sessions.store = (type == "shared") ? SESSION_STORE_SHARED : SESSION_STORE_MEMORY;
+					_sessions.path = path;
+					break;
+				}
+				if (trimmed.rfind("session_max ", 0) == 0) {
+					std::string value = parseValue(trimmed);
+					if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos
+						|| std::atol(value.c_str()) <= 0)
+						throw std::runtime_error("invalid session_max: " + trimmed);
+					_sessions.maxSessions = static_cast<size_t>(std::atol(value.c_str()));
+					break;
+				}
+				throw std::runtime_error("unexpected line outside server block: " + trimmed);
 			case UNKNOWN:
 				throw std::runtime_error("unknown line outside server block: " + trimmed);
 			default:
@@ -75,16 +187,108 @@ void ConfigParser::parse() {
 				throw std::runtime_error("unexpected line outside server block: " + trimmed);
 		}
 	}
-	for (size_t i = 0; i < _servers.size(); ++i) {
-		if (!_servers[i].hasListen()) {
-			throw std::runtime_error("Server #" + std::to_string(i+1) + " missing 'listen' directive");
-		}
-		if (!_servers[i].hasRoot()) {
-			throw std::runtime_error("Server #" + std::to_string(i+1) + " missing 'root' directive");
+}
+
+// "text/html  html htm;" → (text/html, html), (text/html, htm)
+void ConfigParser::parseTypesBlock(std::ifstream& file) {
+	std::string raw;
+
+	while (std::getline(file, raw)) {
+		std::string line = trimLine(raw);
+		if (line.empty()) continue;
+		if (line == "}")
+			return;
+		if (!isDirective(line))
+			throw std::runtime_error("invalid line inside types block: " + line);
+
+		line.pop_back();
+		std::istringstream iss(line);
+		std::string type, ext;
+		iss >> type;
+		if (type.find('/') == std::string::npos)
+			throw std::runtime_error("invalid MIME type: " + line);
+		bool any = false;
+		while (iss >> ext) {
+			_types.push_back(std::make_pair(type, ext));
+			any = true;
 		}
+		if (!any)
+			throw std::runtime_error("MIME type without extensions: " + line);
 	}
+	throw std::runtime_error("types block is not closed");
+}
 
-	setDefaultServers();
+/*
+	upstream app {
+		server 127.0.0.1:9001 weight=2 max_fails=3 fail_timeout=30s;
+		least_conn;  |  hash $request_uri;  |  hash $remote_addr;
+		keepalive 16;
+	}
+*/
+void ConfigParser::parseUpstreamBlock(std::ifstream& file, const std::string& line) {
+	UpstreamConfig upstream;
+	upstream.name = extractPath(line);
+	if (upstream.name.empty() || upstream.name.find_first_of(" \t/") != std::string::npos)
+		throw std::runtime_error("invalid upstream name: " + line);
+	if (_upstreams.count(upstream.name))
+		throw std::runtime_error("duplicate upstream: " + upstream.name);
+	std::string raw;
+
+	while (std::getline(file, raw)) {
+		std::string line = trimLine(raw);
+		if (line.empty()) continue;
+		if (line == "}") {
+			if (upstream.servers.empty())
+				throw std::runtime_error("upstream " + upstream.name + " has no server");
+			_upstreams[upstream.name] = upstream;
+			return;
+		}
+		if (!isDirective(line))
+			throw std::runtime_error("invalid line inside upstream block: " + line);
+
+		std::vector<std::string> args = parseMethods(line);
+		if (line.rfind("server ", 0) == 0 && !args.empty()) {
+			UpstreamServer server;
+			server.address = args[0];
+			try {
+				FastCgi::parseAddress(server.address);
+			}
+			catch (const std::exception&) {
+				throw std::runtime_error("invalid upstream server address (host:port or unix:/path): " + line);
+			}
+			for (size_t i = 1; i < args.size(); ++i) {
+				size_t eq = args[i].find('=');
+				std::string name = args[i].substr(0, eq);
+				std::string value = (eq == std::string::npos) ? "" : args[i].substr(eq + 1);
+				if (name == "fail_timeout" && !value.empty() && value.back() == 's')
+					value.pop_back();
+				if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos)
+					throw std::runtime_error("invalid upstream server parameter: " + line);
+				unsigned long n = std::stoul(value);
+				if (name == "weight" && n > 0 && n <= 100)
+					server.weight = static_cast<unsigned>(n);
+				else if (name == "max_fails")
+					server.maxFails = static_cast<unsigned>(n);
+				else if (name == "fail_timeout" && n > 0)
+					server.failTimeout = static_cast<time_t>(n);
+				else
+					throw std::runtime_error("invalid upstream server parameter: " + line);
+			}
+			upstream.servers.push_back(server);
+		}
+		else if (line == "least_conn;")
+			upstream.balance = BALANCE_LEAST_CONN;
+		else if (line.rfind("hash ", 0) == 0 && args.size() == 1
+			&& (args[0] == "$request_uri" || args[0] == "$remote_addr")) {
+			upstream.balance = BALANCE_HASH;
+			upstream.hashKey = args[0];
+		}
+		else if (line.rfind("keepalive ", 0) == 0)
+			upstream.keepalive = parseSize(parseValue(line));	// 0 = close after each request
+		else
+			throw std::runtime_error("unknown directive in upstream block: " + line);
+	}
+	throw std::runtime_error("upstream block is not closed");
 }
 
 void ConfigParser::parseServerBlock(std::ifstream& file) {
@@ -108,6 +312,10 @@ void ConfigParser::parseServerBlock(std::ifstream& file) {
 				return;
 			case BLOCK_START_SERVER:
 				throw std::runtime_error("nested server bock is invalid: " + line);
+			case BLOCK_START_TYPES:
+				throw std::runtime_error("types block is only allowed at top level: " + line);
+			case BLOCK_START_UPSTREAM:
+				throw std::runtime_error("upstream block is only allowed at top level: " + line);
 			case UNKNOWN:
 				throw std::runtime_error("invalid line inside server block: " + line);
 		}
@@ -131,10 +339,16 @@ void ConfigParser::parseLocationBlock(std::ifstream& file, Server& server, const
 				parseLocationDirective(line, location);
 				break;
 			case BLOCK_END:
+				checkCgiPools(location);
+				checkCgiCache(location);
+				checkCgiLimits(location);
+				checkProxy(location);
 				server.addLocation(location);
 				return;
 			case BLOCK_START_SERVER:
 			case BLOCK_START_LOCATION:
+			case BLOCK_START_TYPES:
+			case BLOCK_START_UPSTREAM:
 			case UNKNOWN:
 				throw std::runtime_error("invalid line inside location block: " + line);
 		}
@@ -176,8 +390,90 @@ void ConfigParser::parseLocationDirective(const std::string& line, Location& loc
 			break;
 		}
 		case CGI_PASS: {
-			std::string prog = parseValue(line);	// "/usr/bin/python3"
-			loc.setCgiProgram(prog);
+			std::string backend = parseValue(line);	// "unix:/run/app.sock" or "127.0.0.1:9000"
+			FastCgi::parseAddress(backend);			// throws on a malformed address
+			loc.setCgiProgram(backend);
+			break;
+		}
+		case CGI_POOL: {
+			// "cgi_pool .py 2 8 500;" → extension, min, max, requests per worker
+			std::vector<std::string> args = parseMethods(line);
+			if (args.size() < 3 || args.size() > 4)
+				throw std::runtime_error("Invalid cgi_pool format (cgi_pool .ext min max [requests]): " + line);
+			CgiPoolConfig pool;
+			pool.minWorkers = parseSize(args[1]);
+			pool.maxWorkers = parseSize(args[2]);
+			pool.maxRequests = (args.size() == 4) ? parseSize(args[3]) : 0;
+			if (pool.maxWorkers == 0 || pool.minWorkers > pool.maxWorkers)
+				throw std::runtime_error("cgi_pool needs 0 <= min <= max and max > 0: " + line);
+			loc.setCgiPool(args[0], pool);
+			break;
+		}
+		case CGI_CACHE: {
+			CgiCacheConfig cache = loc.getCgiCache();
+			cache.maxBytes = parseSize(parseValue(line));
+			if (cache.maxBytes == 0)
+				throw std::runtime_error("cgi_cache needs a size: " + line);
+			loc.setCgiCache(cache);
+			break;
+		}
+		case CGI_CACHE_VALID: {
+			// "cgi_cache_valid 60 30;" → fresh for 60s, then stale for 30s
+			std::vector<std::string> args = parseMethods(line);
+			if (args.empty() || args.size() > 2)
+				throw std::runtime_error("Invalid cgi_cache_valid format (cgi_cache_valid seconds [stale]): " + line);
+			CgiCacheConfig cache = loc.getCgiCache();
+			cache.validFor = static_cast<time_t>(parseSize(args[0]));
+			cache.staleFor = (args.size() == 2) ? static_cast<time_t>(parseSize(args[1])) : 0;
+			loc.setCgiCache(cache);
+			break;
+		}
+		case CGI_CACHE_PATH: {
+			// "cgi_cache_path ./cache/cgi 64M;": directory, then its size cap
+			std::vector<std::string> args = parseMethods(line);
+			if (args.empty() || args.size() > 2)
+				throw std::runtime_error("Invalid cgi_cache_path format (cgi_cache_path dir [max_size]): " + line);
+			CgiCacheConfig cache = loc.getCgiCache();
+			cache.path = args[0];
+			if (args.size() == 2) {
+				cache.diskMaxBytes = parseSize(args[1]);
+				if (cache.diskMaxBytes == 0)
+					throw std::runtime_error("cgi_cache_path size must be positive: " + line);
+			}
+			loc.setCgiCache(cache);
+			break;
+		}
+		case CGI_CACHE_KEY: {
+			CgiCacheConfig cache = loc.getCgiCache();
+			cache.keyHeaders = parseMethods(line);	// same "name a b c;" shape
+			loc.setCgiCache(cache);
+			break;
+		}
+		case CGI_MAX_CONCURRENCY: {
+			CgiLimits limits = loc.getCgiLimits();
+			limits.maxConcurrency = parseSize(parseValue(line));
+			if (limits.maxConcurrency == 0)
+				throw std::runtime_error("cgi_max_concurrency must be at least 1: " + line);
+			loc.setCgiLimits(limits);
+			break;
+		}
+		case CGI_QUEUE_SIZE_DIR: {
+			CgiLimits limits = loc.getCgiLimits();
+			limits.queueSize = parseSize(parseValue(line));	// 0 = no waiting, 503 right away
+			loc.setCgiLimits(limits);
+			break;
+		}
+		case CGI_QUEUE_TIMEOUT_DIR: {
+			// "cgi_queue_timeout 5s;" or "cgi_queue_timeout 5;"
+			std::string value = parseValue(line);
+			if (!value.empty() && value.back() == 's')
+				value.pop_back();
+			if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos
+				|| std::atol(value.c_str()) == 0)
+				throw std::runtime_error("invalid cgi_queue_timeout: " + line);
+			CgiLimits limits = loc.getCgiLimits();
+			limits.queueTimeout = std::atol(value.c_str());
+			loc.setCgiLimits(limits);
 			break;
 		}
 		case RETURN: {
@@ -185,12 +481,120 @@ void ConfigParser::parseLocationDirective(const std::string& line, Location& loc
 			loc.setReturn(ret.first, ret.second);
 			break;
 		}
+		case GZIP:
+			loc.setGzip(parseOnOff(line));
+			break;
+		case GZIP_TYPES:
+			loc.setGzipTypes(parseMethods(line));	// same "name a b c;" shape
+			break;
+		case GZIP_MIN_LENGTH:
+			loc.setGzipMinLength(parseSize(parseValue(line)));
+			break;
+		case GZIP_STATIC:
+			loc.setGzipStatic(parseOnOff(line));
+			break;
+		case GZIP_STATIC_GENERATE:
+			loc.setGzipStaticGenerate(parseOnOff(line));
+			break;
+		case INTERNAL:
+			loc.setInternal(true);
+			break;
+		case SESSION:
+			loc.setSession(parseOnOff(line));
+			break;
+		case PROXY_PASS: {
+			// "proxy_pass http://app;" or "proxy_pass http://127.0.0.1:9001;"
+			std::string target = parseValue(line);
+			if (target.compare(0, 7, "http://") != 0)
+				throw std::runtime_error("proxy_pass needs an http:// address: " + line);
+			target = target.substr(7);
+			if (!target.empty() && target.back() == '/')
+				target.pop_back();
+			if (target.empty() || target.find('/') != std::string::npos)
+				throw std::runtime_error("proxy_pass takes an upstream or host:port, without a path: " + line);
+			loc.setProxyPass(target);
+			break;
+		}
+		case MMAP_THRESHOLD:
+			loc.setMmapThreshold(parseSize(parseValue(line)));
+			break;
 		case OTHER:
 		default:
 			throw std::runtime_error("unknown directive in location block: " + line);
 	}
 }
 
+// Pools run Python workers for an extension mapped in the same location
+void ConfigParser::checkCgiPools(const Location& loc) {
+	for (auto& pool : loc.getCgiPools()) {
+		auto cgi = loc.getCgiExtensions().find(pool.first);
+		if (cgi == loc.getCgiExtensions().end())
+			throw std::runtime_error("cgi_pool " + pool.first + " without a matching cgi_extension in " + loc.getPath());
+		std::string interpreter = cgi->second.substr(cgi->second.find_last_of('/') + 1);
+		if (interpreter.find("python") != 0)
+			throw std::runtime_error("cgi_pool only supports Python interpreters, not " + cgi->second);
+	}
+}
+
+// The cache needs scripts to cache, and its disk tier a directory
+void ConfigParser::checkCgiCache(const Location& loc) {
+	const CgiCacheConfig& cache = loc.getCgiCache();
+	if (cache.maxBytes == 0) {
+		if (cache.validFor || cache.staleFor || !cache.path.empty() || !cache.keyHeaders.empty())
+			throw std::runtime_error("cgi_cache_* directives without cgi_cache in " + loc.getPath());
+		return;
+	}
+	if (loc.getCgiExtensions().empty() && loc.getCgiProgram().empty())
+		throw std::runtime_error("cgi_cache in a location without CGI: " + loc.getPath());
+	if (cache.path.empty())
+		return;
+	if (mkdir(cache.path.c_str(), 0755) < 0 && errno != EEXIST)
+		throw std::runtime_error("cannot create cgi_cache_path " + cache.path + ": " + strerror(errno));
+	if (access(cache.path.c_str(), W_OK | X_OK) != 0)
+		throw std::runtime_error("cgi_cache_path is not a writable directory: " + cache.path);
+}
+
+void ConfigParser::checkCgiLimits(const Location& loc) {
+	const CgiLimits& limits = loc.getCgiLimits();
+	if (limits.maxConcurrency == 0) {
+		if (limits.queueSize != CGI_QUEUE_SIZE || limits.queueTimeout != CGI_QUEUE_TIMEOUT)
+			throw std::runtime_error("cgi_queue_* directives without cgi_max_concurrency in " + loc.getPath());
+		return;
+	}
+	if (loc.getCgiExtensions().empty() && loc.getCgiProgram().empty())
+		throw std::runtime_error("cgi_max_concurrency in a location without CGI: " + loc.getPath());
+}
+
+// A proxied location answers every request itself
+void ConfigParser::checkProxy(const Location& loc) {
+	if (loc.getProxyPass().empty())
+		return;
+	if (!loc.getCgiExtensions().empty() || !loc.getCgiProgram().empty())
+		throw std::runtime_error("proxy_pass and CGI in the same location: " + loc.getPath());
+}
+
+// proxy_pass names an upstream block, or else is a one-server group of its own
+void ConfigParser::resolveUpstreams() {
+	for (const Server& srv : _servers) {
+		for (const Location& loc : srv.getLocations()) {
+			const std::string& target = loc.getProxyPass();
+			if (target.empty() || _upstreams.count(target))
+				continue;
+			try {
+				FastCgi::parseAddress(target);
+			}
+			catch (const std::exception&) {
+				throw std::runtime_error("proxy_pass to an unknown upstream: " + target);
+			}
+			UpstreamConfig upstream;
+			upstream.name = target;
+			upstream.servers.push_back(UpstreamServer());
+			upstream.servers.back().address = target;
+			_upstreams[target] = upstream;
+		}
+	}
+}
+
 void ConfigParser::parseServerDirective(const std::string& line, Server& server) {
 	switch (getServerDirective(line)) {
 		case LISTEN: {
@@ -207,7 +611,9 @@ void ConfigParser::parseServerDirective(const std::string& line, Server& server)
 			break;
 		}
 		case SERVER_NAME:
-			server.setServerName(parseValue(line));
+			// "server_name localhost mysite.fr;" → one entry per name
+			for (const std::string& name : parseMethods(line))
+				server.setServerName(name);
 			break;
 		case ERROR_PAGE: {
 			std::istringstream iss(parseValue(line));
@@ -0,0 +1,38 @@
+#include "ConfigSnapshot.hpp"
+#include "ConfigParser.hpp"
+#include <stdexcept>
+
+ConfigSnapshot::ConfigSnapshot(const std::string& path, unsigned long generation)
+	: _path(path), _generation(generation)
+{
+	ConfigParser parser(path);
+	parser.parse();
+	_servers = parser.getServers();
+	_types = parser.getTypes();
+	_shutdownTimeout = parser.getShutdownTimeout();
+	_upstreams = parser.getUpstreams();
+	_sessions = parser.getSessionConfig();
+	_vhosts = VirtualHosts(_servers);
+}
+
+std::shared_ptr<const ConfigSnapshot> ConfigSnapshot::load(const std::string& path, unsigned long generation) {
+	return std::shared_ptr<const ConfigSnapshot>(new ConfigSnapshot(path, generation));
+}
+
+const std::string&			ConfigSnapshot::getPath() const { return _path; }
+unsigned long				ConfigSnapshot::getGeneration() const { return _generation; }
+const std::vector<Server>&	ConfigSnapshot::getServers() const { return _servers; }
+const std::vector<std::pair<std::string, std::string>>&	ConfigSnapshot::getTypes() const { return _types; }
+time_t						ConfigSnapshot::getShutdownTimeout() const { return _shutdownTimeout; }
+const std::map<std::string, UpstreamConfig>&	ConfigSnapshot::getUpstreams() const { return _upstreams; }
+const SessionConfig&		ConfigSnapshot::getSessionConfig() const { return _sessions; }
+
+const Server& ConfigSnapshot::getServer(size_t index) const {
+	if (index >= _servers.size())
+		throw std::out_of_range("server index out of range");
+	return _servers[index];
+}
+
+const Server& ConfigSnapshot::resolveServer(int port, const std::string& host) const {
+	return getServer(_vhosts.resolve(port, host));
+}
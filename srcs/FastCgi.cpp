@@ -0,0 +1,156 @@
+#include "FastCgi.hpp"
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdexcept>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+FcgiAddress FastCgi::parseAddress(const std::string& spec) {
+	FcgiAddress a;
+	std::memset(&a.addr, 0, sizeof(a.addr));
+
+	// 🔹 unix:/path/to.sock
+	if (spec.compare(0, 5, "unix:") == 0) {
+		std::string path = spec.substr(5);
+		struct sockaddr_un* un = reinterpret_cast<struct sockaddr_un*>(&a.addr);
+		if (path.empty() || path.size() >= sizeof(un->sun_path))
+			throw std::runtime_error("Invalid cgi_pass socket path: " + spec);
+		un->sun_family = AF_UNIX;
+		std::memcpy(un->sun_path, path.c_str(), path.size() + 1);
+		a.len = sizeof(struct sockaddr_un);
+		a.family = AF_UNIX;
+		return a;
+	}
+
+	// 🔹 host:port (IPv4 literal or localhost)
+	size_t colon = spec.rfind(':');
+	if (colon == std::string::npos || colon == 0 || colon + 1 == spec.size())
+		throw std::runtime_error("Invalid cgi_pass address (expected unix:/path or host:port): " + spec);
+	std::string host = spec.substr(0, colon);
+	std::string portStr = spec.substr(colon + 1);
+	char* end = nullptr;
+	long port = std::strtol(portStr.c_str(), &end, 10);
+	if (*end != '\0' || port <= 0 || port > 65535)
+		throw std::runtime_error("Invalid cgi_pass port: " + spec);
+	if (host == "localhost")
+		host = "127.0.0.1";
+
+	struct sockaddr_in* in = reinterpret_cast<struct sockaddr_in*>(&a.addr);
+	in->sin_family = AF_INET;
+	in->sin_port = htons(static_cast<uint16_t>(port));
+	if (inet_pton(AF_INET, host.c_str(), &in->sin_addr) != 1)
+		throw std::runtime_error("Invalid cgi_pass host: " + spec);
+	a.len = sizeof(struct sockaddr_in);
+	a.family = AF_INET;
+	return a;
+}
+
+void FastCgi::appendRecord(std::string& out, uint8_t type, uint16_t id, const char* data, size_t len) {
+	size_t padding = (8 - (len % 8)) % 8;
+	char header[FCGI_HEADER_LEN] = {
+		static_cast<char>(FCGI_VERSION_1),
+		static_cast<char>(type),
+		static_cast<char>(id >> 8), static_cast<char>(id & 0xff),
+		static_cast<char>(len >> 8), static_cast<char>(len & 0xff),
+		static_cast<char>(padding),
+		0
+	};
+	out.append(header, FCGI_HEADER_LEN);
+	out.append(data, len);
+	out.append(padding, '\0');
+}
+
+// Splits data into as many records as needed; empty data is the end-of-stream record
+void FastCgi::appendStream(std::string& out, uint8_t type, uint16_t id, const std::string& data) {
+	if (data.empty()) {
+		appendRecord(out, type, id, "", 0);
+		return;
+	}
+	for (size_t pos = 0; pos < data.size(); pos += FCGI_MAX_CONTENT) {
+		size_t len = std::min(FCGI_MAX_CONTENT, data.size() - pos);
+		appendRecord(out, type, id, data.data() + pos, len);
+	}
+}
+
+void FastCgi::appendBegin(std::string& out, uint16_t id, uint8_t flags) {
+	char body[8] = {
+		static_cast<char>(FCGI_RESPONDER >> 8), static_cast<char>(FCGI_RESPONDER & 0xff),
+		static_cast<char>(flags),
+		0, 0, 0, 0, 0
+	};
+	appendRecord(out, FCGI_BEGIN_REQUEST, id, body, sizeof(body));
+}
+
+// Lengths below 128 take one byte, longer ones four (high bit set)
+static void appendLength(std::string& out, size_t len) {
+	if (len < 128) {
+		out += static_cast<char>(len);
+		return;
+	}
+	out += static_cast<char>(((len >> 24) & 0x7f) | 0x80);
+	out += static_cast<char>((len >> 16) & 0xff);
+	out += static_cast<char>((len >> 8) & 0xff);
+	out += static_cast<char>(len & 0xff);
+}
+
+void FastCgi::appendParams(std::string& out, uint16_t id, const std::map<std::string, std::string>& params) {
+	std::string pairs;
+	for (auto& p : params) {
+		appendLength(pairs, p.first.size());
+		appendLength(pairs, p.second.size());
+		pairs += p.first;
+		pairs += p.second;
+	}
+	appendStream(out, FCGI_PARAMS, id, pairs);
+	appendRecord(out, FCGI_PARAMS, id, "", 0);
+}
+
+static bool readLength(const std::string& s, size_t& pos, size_t& len) {
+	if (pos >= s.size())
+		return false;
+	unsigned char b = static_cast<unsigned char>(s[pos]);
+	if (!(b & 0x80)) {
+		len = b;
+		pos += 1;
+		return true;
+	}
+	if (pos + 4 > s.size())
+		return false;
+	len = (static_cast<size_t>(b & 0x7f) << 24)
+		| (static_cast<size_t>(static_cast<unsigned char>(s[pos + 1])) << 16)
+		| (static_cast<size_t>(static_cast<unsigned char>(s[pos + 2])) << 8)
+		| static_cast<size_t>(static_cast<unsigned char>(s[pos + 3]));
+	pos += 4;
+	return true;
+}
+
+std::map<std::string, std::string> FastCgi::parsePairs(const std::string& content) {
+	std::map<std::string, std::string> pairs;
+	size_t pos = 0;
+	size_t nameLen, valueLen;
+	while (readLength(content, pos, nameLen) && readLength(content, pos, valueLen)) {
+		if (pos + nameLen + valueLen > content.size())
+			break;
+		pairs[content.substr(pos, nameLen)] = content.substr(pos + nameLen, valueLen);
+		pos += nameLen + valueLen;
+	}
+	return pairs;
+}
+
+bool FastCgi::nextRecord(const std::string& buf, size_t& pos, FcgiRecord& rec) {
+	if (buf.size() - pos < FCGI_HEADER_LEN)
+		return false;
+	const unsigned char* h = reinterpret_cast<const unsigned char*>(buf.data() + pos);
+	size_t len = (static_cast<size_t>(h[4]) << 8) | h[5];
+	size_t total = FCGI_HEADER_LEN + len + h[6];
+	if (buf.size() - pos < total)
+		return false;
+
+	rec.type = h[1];
+	rec.requestId = static_cast<uint16_t>((h[2] << 8) | h[3]);
+	rec.content.assign(buf, pos + FCGI_HEADER_LEN, len);
+	pos += total;
+	return true;
+}
@@ -0,0 +1,437 @@
+#include "FastCgiPool.hpp"
+#include "Logger.hpp"
+#include <sys/socket.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+FastCgiPool::FastCgiPool(WatchFn watch) : _watch(std::move(watch)) {}
+
+FastCgiPool::~FastCgiPool() {
+	for (auto& c : _conns)
+		close(c.first);
+}
+
+bool FastCgiPool::owns(int fd) const { return _conns.count(fd) != 0; }
+
+uint64_t FastCgiPool::submit(const std::string& backend,
+	const std::map<std::string, std::string>& params,
+	std::string body, DoneFn done)
+{
+	uint64_t id = _nextId++;
+	Request& req = _requests[id];
+	req.backend = backend;
+	req.params = params;
+	req.body = std::move(body);
+	auto method = params.find("REQUEST_METHOD");
+	req.idempotent = method != params.end()
+		&& (method->second == "GET" || method->second == "HEAD");
+	req.deadline = time(NULL) + FASTCGI_TIMEOUT;
+	req.done = std::move(done);
+
+	_queues[backend].push_back(id);
+	dispatch(backend);
+	return id;
+}
+
+// Client gone: drop the request wherever it is, its completion included
+void FastCgiPool::cancel(uint64_t id) {
+	auto it = _requests.find(id);
+	if (it == _requests.end()) {
+		for (auto f = _finished.begin(); f != _finished.end(); ++f) {
+			if (f->id == id) {
+				_finished.erase(f);
+				break;
+			}
+		}
+		return;
+	}
+	Request& req = it->second;
+
+	if (req.connFd < 0) {
+		std::deque<uint64_t>& q = _queues[req.backend];
+		q.erase(std::remove(q.begin(), q.end(), id), q.end());
+	} else {
+		detach(req.connFd, _conns[req.connFd], req);
+	}
+	_requests.erase(it);
+}
+
+// Non-blocking connect; -1 if it failed right away
+int FastCgiPool::connect(const std::string& backend) {
+	FcgiAddress addr;
+	try {
+		addr = FastCgi::parseAddress(backend);
+	}
+	catch (const std::exception& e) {
+		Logger::log(ERROR, e.what());
+		return -1;
+	}
+
+	int fd = socket(addr.family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		Logger::log(ERROR, "FastCGI socket() failed: " + std::string(strerror(errno)));
+		return -1;
+	}
+	if (::connect(fd, reinterpret_cast<struct sockaddr*>(&addr.addr), addr.len) < 0
+		&& errno != EINPROGRESS) {
+		Logger::log(ERROR, "FastCGI connect to " + backend + " failed: " + std::string(strerror(errno)));
+		close(fd);
+		return -1;
+	}
+
+	Connection& conn = _conns[fd];
+	conn.backend = backend;
+	conn.idleSince = time(NULL);
+
+	// 🔹 Ask whether requests may share this connection
+	std::map<std::string, std::string> query;
+	query["FCGI_MPXS_CONNS"] = "";
+	query["FCGI_MAX_REQS"] = "";
+	std::string pairs;
+	FastCgi::appendParams(pairs, 0, query);
+	// appendParams ends the stream with an empty record: GET_VALUES is a single record
+	FcgiRecord rec;
+	size_t pos = 0;
+	FastCgi::nextRecord(pairs, pos, rec);
+	FastCgi::appendRecord(conn.out, FCGI_GET_VALUES, 0, rec.content.data(), rec.content.size());
+
+	Logger::log(TRACE, "FastCGI connection fd=" + std::to_string(fd) + " to " + backend);
+	updateEvents(fd, conn);
+	return fd;
+}
+
+// Hands queued requests to connections with room, opening new ones up to the limit
+void FastCgiPool::dispatch(const std::string& backend) {
+	std::deque<uint64_t>& q = _queues[backend];
+
+	while (!q.empty()) {
+		int target = -1;
+		size_t count = 0;
+		for (auto& c : _conns) {
+			if (c.second.backend != backend || c.second.closed)
+				continue;
+			++count;
+			size_t cap = c.second.multiplexed ? c.second.maxReqs : 1;
+			if (c.second.active.size() < cap) {
+				target = c.first;
+				break;
+			}
+		}
+		if (target < 0) {
+			if (count >= FASTCGI_MAX_CONNS)
+				return;		// wait for a free slot
+			target = connect(backend);
+		}
+		if (target < 0) {
+			// Backend unreachable: everything waiting for it fails
+			while (!q.empty()) {
+				uint64_t id = q.front();
+				q.pop_front();
+				finish(id);
+			}
+			return;
+		}
+		uint64_t id = q.front();
+		q.pop_front();
+		assign(target, _conns[target], id);
+	}
+}
+
+void FastCgiPool::assign(int fd, Connection& conn, uint64_t id) {
+	Request& req = _requests[id];
+
+	uint16_t fcgiId = 1;
+	while (conn.active.count(fcgiId))
+		++fcgiId;
+	conn.active[fcgiId] = id;
+
+	req.connFd = fd;
+	req.fcgiId = fcgiId;
+	req.attempts++;
+	req.bodySent = 0;
+	req.stdinDone = false;
+
+	FastCgi::appendBegin(conn.out, fcgiId, FCGI_KEEP_CONN);
+	FastCgi::appendParams(conn.out, fcgiId, req.params);
+	pump(conn);
+	if (!conn.connecting)
+		write(fd, conn);
+	updateEvents(fd, conn);
+}
+
+// Encodes the next slices of request bodies, round robin, up to the window
+void FastCgiPool::pump(Connection& conn) {
+	const size_t slice = 32768;
+	bool progress = true;
+	while (progress && conn.out.size() - conn.outPos < FASTCGI_STDIN_WINDOW) {
+		progress = false;
+		for (auto& a : conn.active) {
+			if (a.second == 0)
+				continue;
+			Request& req = _requests[a.second];
+			if (req.stdinDone)
+				continue;
+			size_t len = std::min(slice, req.body.size() - req.bodySent);
+			if (len > 0) {
+				FastCgi::appendRecord(conn.out, FCGI_STDIN, a.first, req.body.data() + req.bodySent, len);
+				req.bodySent += len;
+			}
+			if (req.bodySent == req.body.size()) {
+				FastCgi::appendRecord(conn.out, FCGI_STDIN, a.first, "", 0);	// end of body
+				req.stdinDone = true;
+			}
+			progress = true;
+		}
+	}
+}
+
+// Returns false if the connection broke
+bool FastCgiPool::write(int fd, Connection& conn) {
+	while (conn.outPos < conn.out.size()) {
+		ssize_t n = send(fd, conn.out.data() + conn.outPos, conn.out.size() - conn.outPos, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			Logger::log(ERROR, "FastCGI send() failed: " + std::string(strerror(errno)));
+			return false;
+		}
+		conn.outPos += static_cast<size_t>(n);
+		if (conn.outPos == conn.out.size()) {
+			conn.out.clear();
+			conn.outPos = 0;
+			pump(conn);
+		}
+	}
+	// Don't let the sent prefix pile up
+	if (conn.outPos > FASTCGI_STDIN_WINDOW) {
+		conn.out.erase(0, conn.outPos);
+		conn.outPos = 0;
+		pump(conn);
+	}
+	return true;
+}
+
+// Returns false once the backend closed the connection. What it sent
+// before closing is handled first: many backends ignore FCGI_KEEP_CONN
+// and close right after END_REQUEST, and those answers are complete.
+bool FastCgiPool::read(int fd, Connection& conn) {
+	char buf[16384];
+	while (true) {
+		ssize_t n = recv(fd, buf, sizeof(buf), 0);
+		if (n > 0) {
+			conn.in.append(buf, static_cast<size_t>(n));
+			continue;
+		}
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		conn.closed = true;
+		break;
+	}
+
+	size_t pos = 0;
+	FcgiRecord rec;
+	while (_conns.count(fd) && FastCgi::nextRecord(conn.in, pos, rec))
+		onRecord(conn, rec);
+	if (!_conns.count(fd))
+		return true;
+	conn.in.erase(0, pos);
+	return !conn.closed;
+}
+
+void FastCgiPool::onRecord(Connection& conn, const FcgiRecord& rec) {
+	if (rec.type == FCGI_GET_VALUES_RESULT) {
+		std::map<std::string, std::string> values = FastCgi::parsePairs(rec.content);
+		if (values["FCGI_MPXS_CONNS"] == "1") {
+			conn.multiplexed = true;
+			long max = std::atol(values["FCGI_MAX_REQS"].c_str());
+			conn.maxReqs = (max > 0)
+				? std::min(static_cast<size_t>(max), FASTCGI_MAX_REQS_PER_CONN)
+				: FASTCGI_MAX_REQS_PER_CONN;
+			dispatch(conn.backend);
+		}
+		return;
+	}
+
+	auto a = conn.active.find(rec.requestId);
+	if (a == conn.active.end())
+		return;		// FCGI_UNKNOWN_TYPE, or a stray record
+	uint64_t id = a->second;
+
+	if (rec.type == FCGI_END_REQUEST) {
+		conn.active.erase(a);
+		if (conn.active.empty())
+			conn.idleSince = time(NULL);
+		if (id != 0) {
+			Request& req = _requests[id];
+			req.result.ok = true;
+			if (rec.content.size() >= 4) {
+				const unsigned char* c = reinterpret_cast<const unsigned char*>(rec.content.data());
+				req.result.appStatus = (static_cast<uint32_t>(c[0]) << 24) | (c[1] << 16) | (c[2] << 8) | c[3];
+			}
+			req.connFd = -1;
+			finish(id);
+		}
+		dispatch(conn.backend);
+		return;
+	}
+	if (id == 0)
+		return;		// abandoned: discard until its END_REQUEST
+
+	Request& req = _requests[id];
+	req.responded = true;
+	if (rec.type == FCGI_STDOUT)
+		req.result.out += rec.content;
+	else if (rec.type == FCGI_STDERR)
+		req.result.err += rec.content;
+}
+
+// Takes a request off its connection without waiting for the answer
+void FastCgiPool::detach(int fd, Connection& conn, Request& req) {
+	if (!conn.multiplexed) {
+		// The backend is busy with it anyway: drop the connection
+		conn.active.erase(req.fcgiId);
+		req.connFd = -1;
+		closeConnection(fd, true);
+		return;
+	}
+	// Shared connection: abort, and keep the id reserved until END_REQUEST
+	if (!req.stdinDone) {
+		FastCgi::appendRecord(conn.out, FCGI_STDIN, req.fcgiId, "", 0);
+		req.stdinDone = true;
+	}
+	FastCgi::appendRecord(conn.out, FCGI_ABORT_REQUEST, req.fcgiId, "", 0);
+	conn.active[req.fcgiId] = 0;
+	req.connFd = -1;
+	if (!conn.connecting)
+		write(fd, conn);
+	updateEvents(fd, conn);
+}
+
+// Queues the completion; flush() runs it
+void FastCgiPool::finish(uint64_t id) {
+	auto it = _requests.find(id);
+	if (it == _requests.end())
+		return;
+	_finished.push_back(Finished{ id, std::move(it->second.done), std::move(it->second.result) });
+	_requests.erase(it);
+}
+
+// Requests that got nothing back yet are tried once more on another connection,
+// if running them twice can't do something twice (GET/HEAD only)
+void FastCgiPool::closeConnection(int fd, bool retry) {
+	auto it = _conns.find(fd);
+	if (it == _conns.end())
+		return;
+	std::string backend = it->second.backend;
+	std::map<uint16_t, uint64_t> active = std::move(it->second.active);
+
+	_watch(fd, 0);
+	close(fd);
+	_conns.erase(it);
+
+	std::deque<uint64_t>& q = _queues[backend];
+	for (auto& a : active) {
+		if (a.second == 0)
+			continue;
+		Request& req = _requests[a.second];
+		req.connFd = -1;
+		if (retry && req.idempotent && !req.responded && req.attempts < 2) {
+			q.push_front(a.second);
+		} else {
+			if (retry)
+				Logger::log(ERROR, "FastCGI backend " + backend + " closed the connection mid-request");
+			finish(a.second);
+		}
+	}
+	if (!q.empty())
+		dispatch(backend);
+}
+
+void FastCgiPool::updateEvents(int fd, const Connection& conn) {
+	short events = POLLIN;
+	if (conn.connecting || conn.outPos < conn.out.size())
+		events |= POLLOUT;
+	_watch(fd, events);
+}
+
+void FastCgiPool::handle(int fd, short revents) {
+	auto it = _conns.find(fd);
+	if (it == _conns.end())
+		return;
+	Connection& conn = it->second;
+
+	// 🔹 Connect finished (or failed)
+	if (conn.connecting) {
+		int err = 0;
+		socklen_t len = sizeof(err);
+		if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+			Logger::log(ERROR, "FastCGI connect to " + conn.backend + " failed: "
+				+ std::string(strerror(err ? err : errno)));
+			// Nothing reached the backend: everything on it fails the same way
+			std::string backend = conn.backend;
+			closeConnection(fd, false);
+			std::deque<uint64_t>& q = _queues[backend];
+			while (!q.empty()) {
+				finish(q.front());
+				q.pop_front();
+			}
+			return;
+		}
+		conn.connecting = false;
+	}
+
+	if (revents & (POLLIN | POLLHUP | POLLERR)) {
+		if (!read(fd, conn)) {
+			closeConnection(fd, true);
+			return;
+		}
+		if (!_conns.count(fd))
+			return;
+	}
+	if (!write(fd, conn)) {
+		closeConnection(fd, true);
+		return;
+	}
+	updateEvents(fd, conn);
+}
+
+void FastCgiPool::checkTimeouts(time_t now) {
+	std::vector<uint64_t> overdue;
+	for (auto& r : _requests) {
+		if (now >= r.second.deadline)
+			overdue.push_back(r.first);
+	}
+	for (uint64_t id : overdue) {
+		auto it = _requests.find(id);
+		if (it == _requests.end())
+			continue;
+		Logger::log(WARNING, "FastCGI request to " + it->second.backend + " timed out");
+		it->second.result.timedOut = true;
+		DoneFn done = std::move(it->second.done);
+		FastCgiResult result = std::move(it->second.result);
+		cancel(id);
+		_finished.push_back(Finished{ id, std::move(done), std::move(result) });
+	}
+
+	// Kept-alive connections nobody used for a while
+	std::vector<int> idle;
+	for (auto& c : _conns) {
+		if (c.second.active.empty() && now - c.second.idleSince > FASTCGI_IDLE_TIMEOUT)
+			idle.push_back(c.first);
+	}
+	for (int fd : idle)
+		closeConnection(fd, false);
+}
+
+void FastCgiPool::flush() {
+	while (!_finished.empty()) {
+		Finished f = std::move(_finished.front());
+		_finished.pop_front();
+		f.done(f.result);
+	}
+}
@@ -154,8 +154,17 @@ const std::string& HttpRequest::getVersion() const { return _version; }
 const std::multimap<std::string, std::string>& HttpRequest::getHeaders() const {
 	return _headers; }
 const std::string& HttpRequest::getBody() const { return _body; }
+std::string HttpRequest::takeBody() { return std::move(_body); }
 const std::string	HttpRequest::getQueryString() const { return _queryString; }
 
+void HttpRequest::rewrite(const std::string& uri) {
+	_method = "GET";
+	_body.clear();
+	size_t qmark = uri.find('?');
+	_path = uri.substr(0, qmark);
+	_queryString = (qmark == std::string::npos) ? "" : uri.substr(qmark + 1);
+}
+
 bool HttpRequest::isHeaderValue(const std::string& key,
 								const std::string& value) const {
 	auto range = _headers.equal_range(key);
@@ -15,6 +15,11 @@ std::string HttpResponse::statusMessageForCode(int code) {
 		case 201: return "Created";
 		case 204: return "No Content";
 		case 301: return "Moved Permanently";
+		case 302: return "Found";
+		case 303: return "See Other";
+		case 304: return "Not Modified";
+		case 307: return "Temporary Redirect";
+		case 308: return "Permanent Redirect";
 		case 400: return "Bad Request";
 		case 403: return "Forbidden";
 		case 404: return "Not Found";
@@ -27,6 +32,8 @@ std::string HttpResponse::statusMessageForCode(int code) {
 		case 500: return "Internal Server Error";
 		case 501: return "Not Implemented";
 		case 502: return "Bad Gateway";
+		case 503: return "Service Unavailable";
+		case 504: return "Gateway Timeout";
 		case 505: return "HTTP Version Not Supported";
 		default:  return "Unknown Status";
 	}
@@ -53,9 +60,21 @@ void HttpResponse::setHeader(const std::string& key, const std::string& value) {
 	_headers[key] = value;
 }
 
+void HttpResponse::removeHeader(const std::string& key) {
+	_headers.erase(key);
+}
+
 void HttpResponse::setBody(const std::string& body) { _body = body; }
+void HttpResponse::setStatusMessage(const std::string& message) { _statusMessage = message; }
+
+void HttpResponse::setBodyMapping(const std::shared_ptr<const MappedFile>& file) {
+	_mapping = file;
+	_body.clear();
+	_headers["Content-Length"] = std::to_string(file ? file->size() : 0);
+}
 
 const std::string& HttpResponse::getBody() const { return _body; }
+const std::shared_ptr<const MappedFile>& HttpResponse::getBodyMapping() const { return _mapping; }
 int HttpResponse::getStatusCode() const { return _statusCode; }
 const std::map<std::string, std::string>& HttpResponse::getHeaders() const { return _headers; }
 
@@ -63,4 +82,8 @@ void HttpResponse::setCookie(const std::string& key,
 							 const std::string& value,
 							 const std::string& attrs) {
 	_setCookies.push_back(key + "=" + value + "; " + attrs);
+}
+
+void HttpResponse::addSetCookie(const std::string& raw) {
+	_setCookies.push_back(raw);
 }
\ No newline at end of file
@@ -12,7 +12,12 @@ Location::Location()
 	_hasReturn(false),
 	_hasMaxSize(false),
 	_returnCode(0),
-	_returnTarget("")
+	_returnTarget(""),
+	_gzip(false),
+	_gzipMinLength(20),
+	_gzipStatic(false),
+	_gzipStaticGenerate(false),
+	_mmapThreshold(0)
 {
 }
 
@@ -44,6 +49,21 @@ void Location::setUploadPath(const std::string& path) { _uploadPath = path; }
 void Location::setCgiProgram(const std::string& p) { _cgiProgram = p; }
 const std::string& Location::getCgiProgram() const { return _cgiProgram; }
 
+void Location::setCgiPool(const std::string& ext, const CgiPoolConfig& pool) { _cgiPools[ext] = pool; }
+const std::map<std::string, CgiPoolConfig>& Location::getCgiPools() const { return _cgiPools; }
+void Location::setCgiEnv(const std::vector<std::string>& env) { _cgiEnv = env; }
+const std::vector<std::string>& Location::getCgiEnv() const { return _cgiEnv; }
+void Location::setCgiCache(const CgiCacheConfig& cache) { _cgiCache = cache; }
+const CgiCacheConfig& Location::getCgiCache() const { return _cgiCache; }
+void Location::setCgiLimits(const CgiLimits& limits) { _cgiLimits = limits; }
+const CgiLimits& Location::getCgiLimits() const { return _cgiLimits; }
+void Location::setInternal(bool internal) { _internal = internal; }
+bool Location::isInternal() const { return _internal; }
+void Location::setProxyPass(const std::string& upstream) { _proxyPass = upstream; }
+const std::string& Location::getProxyPass() const { return _proxyPass; }
+void Location::setSession(bool session) { _session = session; }
+bool Location::usesSession() const { return _session; }
+
 void Location::setReturn(int code, const std::string& target) {
 	_hasReturn = true;
 	_returnCode = code;
@@ -57,3 +77,17 @@ bool Location::hasMaxSize() const { return _hasMaxSize; }
 int Location::getReturnCode() const { return _returnCode; }
 size_t	Location::getClientMaxBodySize() const { return _clientMaxBodySize; }
 const std::string& Location::getReturnTarget() const { return _returnTarget; }
+
+bool Location::getGzip() const { return _gzip; }
+const std::vector<std::string>& Location::getGzipTypes() const { return _gzipTypes; }
+size_t Location::getGzipMinLength() const { return _gzipMinLength; }
+bool Location::getGzipStatic() const { return _gzipStatic; }
+bool Location::getGzipStaticGenerate() const { return _gzipStaticGenerate; }
+size_t Location::getMmapThreshold() const { return _mmapThreshold; }
+
+void Location::setGzip(bool g) { _gzip = g; }
+void Location::setGzipTypes(const std::vector<std::string>& types) { _gzipTypes = types; }
+void Location::setGzipMinLength(size_t len) { _gzipMinLength = len; }
+void Location::setGzipStatic(bool g) { _gzipStatic = g; }
+void Location::setGzipStaticGenerate(bool g) { _gzipStaticGenerate = g; }
+void Location::setMmapThreshold(size_t size) { _mmapThreshold = size; }
@@ -0,0 +1,111 @@
+#include "LocationRouter.hpp"
+#include <stdexcept>
+
+LocationRouter::LocationRouter() : _nodes(1) { }
+
+void LocationRouter::add(const std::string& path, size_t location) {
+	if (!path.empty() && path[0] == '~') {
+		std::string pattern = path.substr(1);
+		// remove extra spaces like "~ \.bla$"
+		while (!pattern.empty() && pattern[0] == ' ')
+			pattern.erase(0, 1);
+		try {
+			_patterns.push_back({ std::regex(pattern, std::regex::optimize), location });
+		} catch (const std::regex_error& e) {
+			throw std::runtime_error("invalid location regex: " + pattern + " (" + e.what() + ")");
+		}
+		return;
+	}
+	insert(path, location);
+}
+
+void LocationRouter::insert(const std::string& path, size_t location) {
+	size_t node = 0;
+	size_t pos = 0;
+
+	while (pos < path.size()) {
+		size_t next = 0;
+		size_t common = 0;
+		for (size_t child : _nodes[node].children) {
+			const std::string& label = _nodes[child].label;
+			if (label[0] != path[pos])
+				continue;
+			next = child;
+			while (common < label.size() && pos + common < path.size()
+				&& label[common] == path[pos + common])
+				++common;
+			break;
+		}
+
+		// 🔹 No edge starts with this byte: hang the rest of the path here
+		if (next == 0) {
+			Node leaf;
+			leaf.label = path.substr(pos);
+			_nodes.push_back(leaf);
+			_nodes[node].children.push_back(_nodes.size() - 1);
+			node = _nodes.size() - 1;
+			pos = path.size();
+			break;
+		}
+
+		// 🔹 Path diverges inside the edge: split it at the common part
+		if (common < _nodes[next].label.size()) {
+			Node mid;
+			mid.label = _nodes[next].label.substr(0, common);
+			mid.children.push_back(next);
+			_nodes[next].label.erase(0, common);
+			_nodes.push_back(mid);
+			size_t midIndex = _nodes.size() - 1;
+			for (size_t& child : _nodes[node].children) {
+				if (child == next)
+					child = midIndex;
+			}
+			next = midIndex;
+		}
+		node = next;
+		pos += common;
+	}
+
+	// First location with a given path wins, as before
+	if (_nodes[node].location < 0)
+		_nodes[node].location = static_cast<long>(location);
+}
+
+long LocationRouter::match(const std::string& path) const {
+	long longest = _nodes[0].location;	// "" prefixes everything
+	size_t node = 0;
+	size_t pos = 0;
+
+	// 🔹 One walk: every location passed on the way is a prefix of path
+	while (pos < path.size()) {
+		size_t next = 0;
+		for (size_t child : _nodes[node].children) {
+			if (_nodes[child].label[0] == path[pos]) {
+				next = child;
+				break;
+			}
+		}
+		if (next == 0)
+			break;
+		const std::string& label = _nodes[next].label;
+		if (path.compare(pos, label.size(), label) != 0)
+			break;
+		node = next;
+		pos += label.size();
+		if (_nodes[node].location >= 0)
+			longest = _nodes[node].location;
+	}
+
+	// Exact match wins
+	if (pos == path.size() && _nodes[node].location >= 0)
+		return _nodes[node].location;
+
+	// Regex match, in config order
+	for (const Pattern& p : _patterns) {
+		if (std::regex_search(path, p.regex))
+			return static_cast<long>(p.location);
+	}
+
+	// Longest prefix match
+	return longest;
+}
@@ -4,6 +4,8 @@
 // 🔹 Define static members
 std::ofstream Logger::_accessFile;
 std::ofstream Logger::_errorFile;
+std::string Logger::_accessPath;
+std::string Logger::_errorPath;
 
 std::string Logger::getTimestamp() {
 	time_t now = time(NULL);
@@ -54,10 +56,23 @@ void Logger::log(LogLevel level, const std::string& msg) {
 }
 
 void Logger::init(const std::string& accessPath, const std::string& errorPath) {
+	_accessPath = accessPath;
+	_errorPath = errorPath;
 	_accessFile.open(accessPath.c_str(), std::ios::app);
 	_errorFile.open(errorPath.c_str(), std::ios::app);
 
 	if (!_accessFile.is_open() || !_errorFile.is_open()) {
 		throw std::runtime_error("failed to open log files");
 	}
-}
\ No newline at end of file
+}
+
+// SIGUSR1: logrotate moved the files away, start new ones at the same paths
+void Logger::reopen() {
+	_accessFile.close();
+	_errorFile.close();
+	_accessFile.clear();
+	_errorFile.clear();
+	_accessFile.open(_accessPath.c_str(), std::ios::app);
+	_errorFile.open(_errorPath.c_str(), std::ios::app);
+	log(INFO, "log files reopened");
+}
@@ -0,0 +1,66 @@
+#include "MappedFile.hpp"
+#include "Logger.hpp"
+#include "utils.hpp"
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <cerrno>
+
+// 🔹 Define static members
+std::unordered_map<std::string, std::weak_ptr<const MappedFile>> MappedFile::_open;
+
+MappedFile::MappedFile(const char* data, size_t size, const struct stat& st, const std::string& contentType)
+	: _data(data), _size(size), _ino(st.st_ino), _mtime(st.st_mtim), _contentType(contentType) { }
+
+MappedFile::~MappedFile() {
+	munmap(const_cast<char*>(_data), _size);
+}
+
+std::shared_ptr<const MappedFile> MappedFile::open(const std::string& path, const struct stat& st) {
+	// 🔹 Reuse the live mapping if the file is unchanged
+	auto it = _open.find(path);
+	if (it != _open.end()) {
+		std::shared_ptr<const MappedFile> live = it->second.lock();
+		if (live && live->_ino == st.st_ino && live->_size == static_cast<size_t>(st.st_size)
+			&& live->_mtime.tv_sec == st.st_mtim.tv_sec && live->_mtime.tv_nsec == st.st_mtim.tv_nsec)
+			return live;
+		_open.erase(it);
+	}
+
+	if (st.st_size <= 0)
+		return nullptr;
+
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return nullptr;
+
+	size_t size = static_cast<size_t>(st.st_size);
+	void* addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);	// the mapping keeps its own reference to the file
+	if (addr == MAP_FAILED) {
+		Logger::log(WARNING, "mmap failed for " + path + ": " + std::string(strerror(errno)));
+		return nullptr;
+	}
+
+	// 🔹 Downloads read front to back: read ahead aggressively
+	madvise(addr, size, MADV_SEQUENTIAL);
+	madvise(addr, size, MADV_WILLNEED);
+
+	std::shared_ptr<const MappedFile> mapped(
+		new MappedFile(static_cast<const char*>(addr), size, st, detectMime(path)));
+	_open[path] = mapped;
+
+	// Drop bookkeeping for mappings nobody uses anymore
+	for (auto e = _open.begin(); e != _open.end(); ) {
+		if (e->second.expired())
+			e = _open.erase(e);
+		else
+			++e;
+	}
+	return mapped;
+}
+
+const char*	MappedFile::data() const { return _data; }
+size_t		MappedFile::size() const { return _size; }
+const std::string&	MappedFile::contentType() const { return _contentType; }
@@ -0,0 +1,94 @@
+#include "MimeTypes.hpp"
+#include "Logger.hpp"
+#include <algorithm>
+#include <cctype>
+
+// 🔹 Define static members
+std::vector<MimeTypes::Entry> MimeTypes::_table;
+std::unordered_map<std::string, std::string> MimeTypes::_byFile;
+const std::string MimeTypes::DEFAULT_TYPE = "application/octet-stream";
+
+static std::string toLower(const std::string& s) {
+	std::string out = s;
+	for (size_t i = 0; i < out.size(); ++i)
+		out[i] = static_cast<char>(std::tolower(static_cast<unsigned char>(out[i])));
+	return out;
+}
+
+// Case-insensitive three-way compare, key already lowercase
+static int compareExt(const std::string& key, std::string_view ext) {
+	size_t n = std::min(key.size(), ext.size());
+	for (size_t i = 0; i < n; ++i) {
+		unsigned char a = static_cast<unsigned char>(key[i]);
+		unsigned char b = static_cast<unsigned char>(std::tolower(static_cast<unsigned char>(ext[i])));
+		if (a != b)
+			return a < b ? -1 : 1;
+	}
+	if (key.size() == ext.size())
+		return 0;
+	return key.size() < ext.size() ? -1 : 1;
+}
+
+void MimeTypes::load(const std::vector<std::pair<std::string, std::string>>& types) {
+	std::vector<Entry> table;
+	if (types.empty()) {
+		for (const MimeType& m : BUILTIN_MIME_TYPES)
+			table.push_back({ std::string(m.ext), std::string(m.type) });
+	} else {
+		for (size_t i = 0; i < types.size(); ++i)
+			table.push_back({ toLower(types[i].second), types[i].first });
+		// stable: for a repeated extension the later line wins
+		std::stable_sort(table.begin(), table.end(),
+			[](const Entry& a, const Entry& b) { return a.ext < b.ext; });
+		std::vector<Entry> unique;
+		for (size_t i = 0; i < table.size(); ++i) {
+			if (!unique.empty() && unique.back().ext == table[i].ext)
+				unique.back() = std::move(table[i]);
+			else
+				unique.push_back(std::move(table[i]));
+		}
+		table.swap(unique);
+	}
+	_table.swap(table);
+	_byFile.clear();	// answers from the previous table
+	Logger::log(INFO, "MIME types loaded: " + std::to_string(_table.size()) + " extensions");
+}
+
+const std::string& MimeTypes::lookup(std::string_view path) {
+	size_t dot = path.find_last_of("./");
+	if (dot == std::string_view::npos || path[dot] != '.')
+		return DEFAULT_TYPE;
+	std::string_view ext = path.substr(dot + 1);
+
+	size_t lo = 0;
+	size_t hi = _table.size();
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		int cmp = compareExt(_table[mid].ext, ext);
+		if (cmp == 0)
+			return _table[mid].type;
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return DEFAULT_TYPE;
+}
+
+const std::string& MimeTypes::forFile(const std::string& path) {
+	auto it = _byFile.find(path);
+	if (it != _byFile.end())
+		return it->second;
+	// 🔹 Bounded: start over rather than track recency for a cheap answer
+	if (_byFile.size() >= MIME_FILE_CACHE_MAX)
+		_byFile.clear();
+	return _byFile.emplace(path, lookup(path)).first->second;
+}
+
+std::vector<std::pair<std::string, std::string>> MimeTypes::entries() {
+	std::vector<std::pair<std::string, std::string>> out;
+	out.reserve(_table.size());
+	for (const Entry& e : _table)
+		out.push_back(std::make_pair(e.ext, e.type));
+	return out;
+}
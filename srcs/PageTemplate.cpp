@@ -0,0 +1,61 @@
+#include "PageTemplate.hpp"
+#include "utils.hpp"
+#include "Logger.hpp"
+
+PageTemplate::PageTemplate(const std::string& text) : _literalBytes(0) {
+	size_t pos = 0;
+	while (true) {
+		size_t open = text.find("{{", pos);
+		size_t close = open == std::string::npos ? open : text.find("}}", open + 2);
+		if (close == std::string::npos) {
+			_literals.push_back(text.substr(pos));
+			break;
+		}
+		_literals.push_back(text.substr(pos, open - pos));
+		_slots.push_back(text.substr(open + 2, close - open - 2));
+		pos = close + 2;
+	}
+	for (const std::string& lit : _literals)
+		_literalBytes += lit.size();
+}
+
+// nullptr when the file is missing or doesn't look like HTML
+std::shared_ptr<const PageTemplate> PageTemplate::load(const std::string& path) {
+	std::string content;
+	if (!readFile(path, content))
+		return nullptr;
+	if (content.empty() ||
+		(content.find("<html") == std::string::npos &&
+		 content.find("<body") == std::string::npos)) {
+		Logger::log(WARNING, "Invalid page content, using fallback: " + path);
+		return nullptr;
+	}
+	return std::shared_ptr<const PageTemplate>(new PageTemplate(content));
+}
+
+std::string PageTemplate::render(const std::map<std::string, std::string>& vars) const {
+	// 🔹 Resolve slots first so the output is allocated once
+	std::vector<const std::string*> values(_slots.size(), NULL);
+	size_t total = _literalBytes;
+	for (size_t i = 0; i < _slots.size(); ++i) {
+		auto it = vars.find(_slots[i]);
+		if (it != vars.end()) {
+			values[i] = &it->second;
+			total += it->second.size();
+		} else {
+			total += _slots[i].size() + 4;
+		}
+	}
+
+	std::string out;
+	out.reserve(total);
+	for (size_t i = 0; i < _slots.size(); ++i) {
+		out += _literals[i];
+		if (values[i])
+			out += *values[i];
+		else
+			out.append("{{").append(_slots[i]).append("}}");
+	}
+	out += _literals.back();
+	return out;
+}
@@ -0,0 +1,666 @@
+#include "ProxyPool.hpp"
+#include "ConfigSnapshot.hpp"
+#include "FastCgi.hpp"
+#include "Logger.hpp"
+#include "utils.hpp"
+#include <sys/socket.h>
+#include <unistd.h>
+#include <poll.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <sstream>
+#include <algorithm>
+
+static std::string lower(std::string s) {
+	for (char& c : s)
+		c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+	return s;
+}
+
+// Connection-level headers, never passed through a proxy (RFC 9110 7.6.1)
+static bool hopByHop(const std::string& name) {
+	static const char* const names[] = { "connection", "keep-alive", "proxy-connection",
+		"te", "trailer", "transfer-encoding", "upgrade" };
+	for (const char* n : names) {
+		if (name == n)
+			return true;
+	}
+	return false;
+}
+
+ProxyPool::ProxyPool(WatchFn watch) : _watch(std::move(watch)) {}
+
+ProxyPool::~ProxyPool() {
+	for (auto& c : _conns)
+		close(c.first);
+}
+
+bool ProxyPool::owns(int fd) const { return _conns.count(fd) != 0; }
+
+void ProxyPool::configure(const ConfigSnapshot& config) {
+	std::map<std::string, std::shared_ptr<Upstream>> next;
+	for (auto& u : config.getUpstreams()) {
+		auto old = _upstreams.find(u.first);
+		if (old != _upstreams.end() && old->second->config() == u.second)
+			next[u.first] = old->second;
+		else
+			next[u.first] = std::make_shared<Upstream>(u.second);
+	}
+	_upstreams.swap(next);
+
+	// 🔹 Idle connections of groups that changed or went away (busy ones close when done)
+	std::vector<int> stale;
+	for (auto& c : _conns) {
+		auto cur = _upstreams.find(c.second.upstream->config().name);
+		if (c.second.request == 0 && (cur == _upstreams.end() || cur->second != c.second.upstream))
+			stale.push_back(c.first);
+	}
+	for (int fd : stale)
+		closeConnection(fd);
+}
+
+std::string ProxyPool::requestHead(const HttpRequest& req, const std::string& client, size_t bodyLength) {
+	std::string uri = req.getPath();
+	if (!req.getQueryString().empty())
+		uri += "?" + req.getQueryString();
+	std::string head = req.getMethod() + " " + uri + " HTTP/1.1\r\n";
+
+	std::string forwarded;
+	for (auto& h : req.getHeaders()) {
+		if (hopByHop(h.first) || h.first == "content-length"
+			|| h.first == "x-real-ip" || h.first == "x-forwarded-proto")
+			continue;
+		if (h.first == "x-forwarded-for") {
+			forwarded += (forwarded.empty() ? "" : ", ") + h.second;
+			continue;
+		}
+		head += h.first + ": " + h.second + "\r\n";
+	}
+	forwarded += (forwarded.empty() ? "" : ", ") + client;
+	head += "x-forwarded-for: " + forwarded + "\r\n"
+		"x-real-ip: " + client + "\r\n"
+		"x-forwarded-proto: http\r\n";
+	if (bodyLength > 0 || req.getMethod() == "POST")
+		head += "content-length: " + std::to_string(bodyLength) + "\r\n";
+	head += "connection: keep-alive\r\n\r\n";
+	return head;
+}
+
+uint64_t ProxyPool::submit(const std::string& upstream, const HttpRequest& req, const std::string& client,
+	std::string body, HeadFn onHead, BodyFn onBody, DoneFn done)
+{
+	uint64_t id = _nextId++;
+	Request& r = _requests[id];
+	r.onHead = std::move(onHead);
+	r.onBody = std::move(onBody);
+	r.done = std::move(done);
+
+	auto up = _upstreams.find(upstream);
+	if (up == _upstreams.end()) {
+		Logger::log(ERROR, "proxy_pass to unknown upstream " + upstream);
+		finish(id);
+		return id;
+	}
+	r.upstream = up->second;
+	r.key = (r.upstream->config().hashKey == "$remote_addr") ? client : req.getPath();
+	if (r.key != client && !req.getQueryString().empty())
+		r.key += "?" + req.getQueryString();
+	r.head = requestHead(req, client, body.size());
+	r.body = std::move(body);
+	r.idempotent = (req.getMethod() == "GET" || req.getMethod() == "DELETE");
+	dispatch(id);
+	return id;
+}
+
+// Picks a server and a connection to it; fails the request once no server is left
+void ProxyPool::dispatch(uint64_t id) {
+	Request& req = _requests[id];
+	time_t now = time(NULL);
+
+	while (true) {
+		int peer = req.upstream->pick(req.key, now, req.tried);
+		if (peer < 0) {
+			Logger::log(ERROR, "upstream " + req.upstream->config().name + ": no server left to try");
+			finish(id);
+			return;
+		}
+		req.peer = peer;
+		req.result.server = req.upstream->server(peer).address;
+
+		// 🔹 A kept-alive connection to it, else a new one
+		int fd = -1;
+		for (auto& c : _conns) {
+			if (c.second.request == 0 && c.second.upstream == req.upstream
+				&& c.second.peer == static_cast<size_t>(peer)) {
+				fd = c.first;
+				break;
+			}
+		}
+		if (fd < 0)
+			fd = connect(req.upstream, peer);
+		if (fd >= 0) {
+			assign(fd, _conns[fd], id);
+			return;
+		}
+		req.upstream->failed(peer, now);
+		req.tried.push_back(peer);	// nothing was sent: safe to go elsewhere
+	}
+}
+
+// Non-blocking connect; -1 if it failed right away
+int ProxyPool::connect(const std::shared_ptr<Upstream>& upstream, size_t peer) {
+	const std::string& address = upstream->server(peer).address;
+	FcgiAddress addr = FastCgi::parseAddress(address);	// checked when the config was loaded
+
+	int fd = socket(addr.family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		Logger::log(ERROR, "proxy socket() failed: " + std::string(strerror(errno)));
+		return -1;
+	}
+	if (::connect(fd, reinterpret_cast<struct sockaddr*>(&addr.addr), addr.len) < 0
+		&& errno != EINPROGRESS) {
+		Logger::log(ERROR, "proxy connect to " + address + " failed: " + std::string(strerror(errno)));
+		close(fd);
+		return -1;
+	}
+
+	Connection& conn = _conns[fd];
+	conn.upstream = upstream;
+	conn.peer = peer;
+	conn.idleSince = time(NULL);
+	Logger::log(TRACE, "proxy connection fd=" + std::to_string(fd) + " to " + address);
+	return fd;
+}
+
+void ProxyPool::assign(int fd, Connection& conn, uint64_t id) {
+	Request& req = _requests[id];
+	conn.request = id;
+	conn.headSent = 0;
+	conn.bodySent = 0;
+	conn.in.clear();
+	conn.state = READ_HEAD;
+	conn.remaining = 0;
+	conn.keepAlive = true;
+
+	req.connFd = fd;
+	req.upstream->acquire(conn.peer);
+	req.deadline = time(NULL) + (conn.connecting ? PROXY_CONNECT_TIMEOUT : PROXY_TIMEOUT);
+	if (!conn.connecting && !write(fd, conn)) {
+		fail(fd, false);
+		return;
+	}
+	updateEvents(fd, conn);
+}
+
+// Head first, then the body, as far as the socket takes them; false if the connection broke
+bool ProxyPool::write(int fd, Connection& conn) {
+	if (conn.request == 0)
+		return true;
+	Request& req = _requests[conn.request];
+
+	while (conn.headSent < req.head.size() || conn.bodySent < req.body.size()) {
+		bool inHead = conn.headSent < req.head.size();
+		const std::string& src = inHead ? req.head : req.body;
+		size_t& pos = inHead ? conn.headSent : conn.bodySent;
+		ssize_t n = send(fd, src.data() + pos, src.size() - pos, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			Logger::log(ERROR, "proxy send() to " + req.result.server + " failed: " + std::string(strerror(errno)));
+			return false;
+		}
+		pos += static_cast<size_t>(n);
+		req.deadline = time(NULL) + PROXY_TIMEOUT;
+	}
+	return true;
+}
+
+// Reads what the backend sent and passes it on; false once the request
+// is off the connection (answered, failed or cut short)
+bool ProxyPool::read(int fd, Connection& conn) {
+	char buf[16384];
+	while (true) {
+		auto r = _requests.find(conn.request);
+		if (r == _requests.end() || r->second.paused)
+			return true;
+		ssize_t n = recv(fd, buf, sizeof(buf), 0);
+		if (n > 0) {
+			r->second.responded = true;
+			r->second.deadline = time(NULL) + PROXY_TIMEOUT;
+			conn.in.append(buf, static_cast<size_t>(n));
+			if (!parse(fd, conn))
+				return false;
+			continue;
+		}
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return true;
+		// 🔹 Closed: the end of a body without length, else cut short
+		if (n == 0 && conn.state == READ_TO_CLOSE) {
+			conn.keepAlive = false;
+			complete(fd, conn);
+			return false;
+		}
+		if (n < 0)
+			Logger::log(ERROR, "proxy recv() from " + r->second.result.server + " failed: " + std::string(strerror(errno)));
+		fail(fd, false);
+		return false;
+	}
+}
+
+/*
+	Walks conn.in through the answer:
+
+		READ_HEAD		up to the blank line (interim 1xx heads are skipped)
+		READ_LENGTH		Content-Length bytes (0 for 204/304)
+		READ_CHUNK_*	size line, data, CRLF ... 0, then trailers (dropped)
+		READ_TO_CLOSE	everything until the backend closes
+
+	Body bytes go to onBody as they come; a paused request stops the walk
+	and keeps the rest in conn.in. False once the request is off the
+	connection.
+*/
+bool ProxyPool::parse(int fd, Connection& conn) {
+	size_t pos = 0;
+	bool done = false;
+	bool invalid = false;
+
+	while (!done && !invalid) {
+		Request& req = _requests[conn.request];
+		if (req.paused)
+			break;
+		size_t avail = conn.in.size() - pos;
+
+		if (conn.state == READ_HEAD) {
+			size_t end = conn.in.find("\r\n\r\n", pos);
+			if (end == std::string::npos) {
+				invalid = (avail > PROXY_MAX_HEAD);
+				break;
+			}
+			std::string head = conn.in.substr(pos, end - pos);
+			pos = end + 4;
+			invalid = !parseHead(conn, req, head);
+		}
+		else if (conn.state == READ_LENGTH || conn.state == READ_CHUNK_DATA) {
+			if (conn.remaining == 0) {
+				if (conn.state == READ_LENGTH)
+					done = true;
+				else
+					conn.state = READ_CHUNK_END;
+				continue;
+			}
+			if (avail == 0)
+				break;
+			size_t len = std::min(conn.remaining, avail);
+			size_t at = pos;
+			pos += len;
+			conn.remaining -= len;
+			req.onBody(conn.in.data() + at, len);
+		}
+		else if (conn.state == READ_CHUNK_SIZE || conn.state == READ_TRAILER) {
+			size_t eol = conn.in.find("\r\n", pos);
+			if (eol == std::string::npos) {
+				invalid = (avail > PROXY_MAX_HEAD);
+				break;
+			}
+			std::string line = conn.in.substr(pos, eol - pos);
+			pos = eol + 2;
+			if (conn.state == READ_TRAILER) {
+				done = line.empty();
+				continue;
+			}
+			// "1a3f;ext=..." → 0x1a3f
+			char* end = nullptr;
+			unsigned long size = std::strtoul(line.c_str(), &end, 16);
+			if (end == line.c_str()) {
+				invalid = true;
+				break;
+			}
+			conn.remaining = size;
+			conn.state = size ? READ_CHUNK_DATA : READ_TRAILER;
+		}
+		else if (conn.state == READ_CHUNK_END) {
+			if (avail < 2)
+				break;
+			invalid = (conn.in.compare(pos, 2, "\r\n") != 0);
+			pos += 2;
+			conn.state = READ_CHUNK_SIZE;
+		}
+		else {	// READ_TO_CLOSE
+			if (avail == 0)
+				break;
+			size_t at = pos;
+			pos += avail;
+			req.onBody(conn.in.data() + at, avail);
+		}
+	}
+
+	if (invalid) {
+		Logger::log(ERROR, "invalid HTTP answer from " + _requests[conn.request].result.server);
+		conn.keepAlive = false;
+		fail(fd, false);
+		return false;
+	}
+	conn.in.erase(0, pos);
+	if (done) {
+		complete(fd, conn);
+		return false;
+	}
+	return true;
+}
+
+// Status line and headers; onHead gets them once they are the final answer
+bool ProxyPool::parseHead(Connection& conn, Request& req, const std::string& head) {
+	std::istringstream hs(head);
+	std::string line;
+	std::getline(hs, line);
+	if (!line.empty() && line.back() == '\r')
+		line.pop_back();
+
+	// 🔹 "HTTP/1.1 200 OK"
+	size_t sp = line.find(' ');
+	if (line.compare(0, 5, "HTTP/") != 0 || sp == std::string::npos)
+		return false;
+	std::string version = line.substr(0, sp);
+	int status = std::atoi(line.c_str() + sp + 1);
+	if (status < 100 || status > 599)
+		return false;
+	if (status < 200)
+		return true;	// 100 Continue and the like: the answer follows
+
+	ProxyHead out;
+	out.status = status;
+	size_t sp2 = line.find(' ', sp + 1);
+	out.reason = (sp2 == std::string::npos) ? "" : line.substr(sp2 + 1);
+
+	bool chunked = false;
+	bool close = (version != "HTTP/1.1");
+	long long length = -1;
+	while (std::getline(hs, line)) {
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+		size_t sep = line.find(':');
+		if (sep == std::string::npos)
+			continue;
+		std::string name = trim(line.substr(0, sep));
+		std::string value = trim(line.substr(sep + 1));
+		std::string key = lower(name);
+		if (key == "transfer-encoding")
+			chunked = lower(value).find("chunked") != std::string::npos;
+		else if (key == "connection")
+			close = lower(value).find("close") != std::string::npos
+				|| (close && lower(value).find("keep-alive") == std::string::npos);
+		if (hopByHop(key))
+			continue;
+		if (key == "content-length") {
+			char* end = nullptr;
+			length = std::strtoll(value.c_str(), &end, 10);
+			if (*end != '\0' || length < 0)
+				return false;
+		}
+		out.headers.push_back(std::make_pair(name, value));
+	}
+
+	// 🔹 How the body is framed
+	conn.keepAlive = !close;
+	out.hasBody = (status != 204 && status != 304);
+	if (!out.hasBody) {
+		conn.state = READ_LENGTH;
+		conn.remaining = 0;
+	} else if (chunked) {
+		conn.state = READ_CHUNK_SIZE;
+		out.headers.erase(std::remove_if(out.headers.begin(), out.headers.end(),
+			[](const std::pair<std::string, std::string>& h) { return lower(h.first) == "content-length"; }),
+			out.headers.end());
+	} else if (length >= 0) {
+		conn.state = READ_LENGTH;
+		conn.remaining = static_cast<size_t>(length);
+		out.hasLength = true;
+	} else {
+		conn.state = READ_TO_CLOSE;
+		conn.keepAlive = false;
+	}
+	req.result.started = true;
+	req.onHead(out);
+	return true;
+}
+
+// The answer is all in: the connection goes back to the idle list if it can
+void ProxyPool::complete(int fd, Connection& conn) {
+	uint64_t id = conn.request;
+	Request& req = _requests[id];
+	req.result.ok = true;
+	req.upstream->release(conn.peer);
+	req.upstream->succeeded(conn.peer);
+	if (conn.bodySent < req.body.size())
+		conn.keepAlive = false;		// answered before taking the whole body
+	conn.request = 0;
+	req.connFd = -1;
+	finish(id);
+
+	size_t idle = 0;
+	for (auto& c : _conns) {
+		if (c.first != fd && c.second.request == 0
+			&& c.second.upstream == conn.upstream && c.second.peer == conn.peer)
+			++idle;
+	}
+	auto cur = _upstreams.find(conn.upstream->config().name);
+	bool current = (cur != _upstreams.end() && cur->second == conn.upstream);
+	if (!conn.keepAlive || !conn.in.empty() || !current || idle >= conn.upstream->config().keepalive) {
+		closeConnection(fd);
+		return;
+	}
+	conn.reused = true;
+	conn.idleSince = time(NULL);
+	updateEvents(fd, conn);
+}
+
+// The connection broke (or the backend went quiet) with a request on it
+void ProxyPool::fail(int fd, bool timedOut) {
+	auto c = _conns.find(fd);
+	if (c == _conns.end())
+		return;
+	uint64_t id = c->second.request;
+	bool reused = c->second.reused;
+	bool sent = c->second.headSent > 0;
+	std::shared_ptr<Upstream> upstream = c->second.upstream;
+	size_t peer = c->second.peer;
+	c->second.request = 0;
+	closeConnection(fd);
+
+	auto r = _requests.find(id);
+	if (r == _requests.end())
+		return;
+	Request& req = r->second;
+	req.connFd = -1;
+	upstream->release(peer);
+	req.result.timedOut = timedOut;
+
+	if (req.responded) {
+		Logger::log(ERROR, "upstream " + upstream->config().name + ": " + req.result.server
+			+ (timedOut ? " timed out" : " failed") + " mid-answer");
+		finish(id);
+		return;
+	}
+	// 🔹 A kept-alive connection the backend had closed meanwhile: not the server's fault
+	if (reused && !timedOut && !req.retried) {
+		req.retried = true;
+		std::vector<int> idle;
+		for (auto& other : _conns) {
+			if (other.second.request == 0 && other.second.upstream == upstream && other.second.peer == peer)
+				idle.push_back(other.first);
+		}
+		for (int other : idle)
+			closeConnection(other);
+		dispatch(id);
+		return;
+	}
+
+	Logger::log(WARNING, "upstream " + upstream->config().name + ": " + req.result.server
+		+ (timedOut ? " timed out" : " failed"));
+	upstream->failed(peer, time(NULL));
+	req.tried.push_back(peer);
+	// Resent elsewhere only if that can't do something twice
+	if (req.idempotent || !sent)
+		dispatch(id);
+	else
+		finish(id);
+}
+
+// Queues the completion; flush() runs it
+void ProxyPool::finish(uint64_t id) {
+	auto it = _requests.find(id);
+	if (it == _requests.end())
+		return;
+	_finished.push_back(Finished{ id, std::move(it->second.done), std::move(it->second.result) });
+	_requests.erase(it);
+}
+
+void ProxyPool::closeConnection(int fd) {
+	if (_conns.erase(fd) == 0)
+		return;
+	_watch(fd, 0);
+	close(fd);
+}
+
+// Paused: not polled at all (a hung-up backend would wake poll() for nothing)
+void ProxyPool::updateEvents(int fd, const Connection& conn) {
+	short events = 0;
+	auto r = _requests.find(conn.request);
+	bool busy = (conn.request != 0 && r != _requests.end());
+	if (!busy || !r->second.paused)
+		events |= POLLIN;
+	if (conn.connecting || (busy && (conn.headSent < r->second.head.size()
+			|| conn.bodySent < r->second.body.size())))
+		events |= POLLOUT;
+	_watch(fd, events);
+}
+
+void ProxyPool::handle(int fd, short revents) {
+	auto it = _conns.find(fd);
+	if (it == _conns.end())
+		return;
+	Connection& conn = it->second;
+
+	// 🔹 Connect finished (or failed)
+	if (conn.connecting) {
+		int err = 0;
+		socklen_t len = sizeof(err);
+		if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+			Logger::log(ERROR, "proxy connect to " + conn.upstream->server(conn.peer).address + " failed: "
+				+ std::string(strerror(err ? err : errno)));
+			fail(fd, false);
+			return;
+		}
+		conn.connecting = false;
+		auto r = _requests.find(conn.request);
+		if (r != _requests.end())
+			r->second.deadline = time(NULL) + PROXY_TIMEOUT;
+	}
+
+	// 🔹 Idle: the backend closed it (or sent something unasked)
+	if (conn.request == 0) {
+		if (revents & (POLLIN | POLLHUP | POLLERR))
+			closeConnection(fd);
+		return;
+	}
+
+	if ((revents & (POLLIN | POLLHUP | POLLERR)) && !read(fd, conn))
+		return;
+	if (!_conns.count(fd) || conn.request == 0)
+		return;
+	if (!write(fd, conn)) {
+		fail(fd, false);
+		return;
+	}
+	updateEvents(fd, conn);
+}
+
+// A client fell behind: stop reading its answer
+void ProxyPool::pause(uint64_t id) {
+	auto r = _requests.find(id);
+	if (r == _requests.end() || r->second.paused)
+		return;
+	r->second.paused = true;
+	auto c = _conns.find(r->second.connFd);
+	if (c != _conns.end())
+		updateEvents(c->first, c->second);
+}
+
+// It caught up: read again from the next flush()
+void ProxyPool::resume(uint64_t id) {
+	auto r = _requests.find(id);
+	if (r == _requests.end() || !r->second.paused)
+		return;
+	r->second.paused = false;
+	r->second.deadline = time(NULL) + PROXY_TIMEOUT;
+	if (r->second.connFd >= 0)
+		_resumed.push_back(r->second.connFd);
+}
+
+// Client gone: drop the request (or its queued completion); a connection
+// in the middle of it can't be reused
+void ProxyPool::cancel(uint64_t id) {
+	auto it = _requests.find(id);
+	if (it == _requests.end()) {
+		for (auto f = _finished.begin(); f != _finished.end(); ++f) {
+			if (f->id == id) {
+				_finished.erase(f);
+				break;
+			}
+		}
+		return;
+	}
+	Request& req = it->second;
+	auto c = _conns.find(req.connFd);
+	if (c != _conns.end()) {
+		req.upstream->release(req.peer);
+		c->second.request = 0;
+		closeConnection(c->first);
+	}
+	_requests.erase(it);
+}
+
+void ProxyPool::checkTimeouts(time_t now) {
+	std::vector<int> overdue;
+	for (auto& r : _requests) {
+		if (!r.second.paused && r.second.connFd >= 0 && now >= r.second.deadline)
+			overdue.push_back(r.second.connFd);
+	}
+	for (int fd : overdue) {
+		auto c = _conns.find(fd);
+		if (c == _conns.end() || c->second.request == 0)
+			continue;
+		Logger::log(WARNING, "proxy request to " + c->second.upstream->server(c->second.peer).address + " timed out");
+		fail(fd, true);
+	}
+
+	// Kept-alive connections nobody used for a while
+	std::vector<int> idle;
+	for (auto& c : _conns) {
+		if (c.second.request == 0 && now - c.second.idleSince > PROXY_IDLE_TIMEOUT)
+			idle.push_back(c.first);
+	}
+	for (int fd : idle)
+		closeConnection(fd);
+}
+
+void ProxyPool::flush() {
+	// 🔹 Resumed requests: first what already waits in their buffer
+	std::vector<int> resumed;
+	resumed.swap(_resumed);
+	for (int fd : resumed) {
+		auto c = _conns.find(fd);
+		if (c == _conns.end() || c->second.request == 0)
+			continue;
+		if (parse(fd, c->second))
+			updateEvents(fd, c->second);
+	}
+
+	while (!_finished.empty()) {
+		Finished f = std::move(_finished.front());
+		_finished.pop_front();
+		f.done(f.result);
+	}
+}
@@ -4,50 +4,55 @@
 #include "StaticPost.hpp"
 #include "StaticDelete.hpp"
 #include "RequestValidator.hpp"
+#include "Compression.hpp"
 #include <algorithm>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <iostream>
-#include <fstream>
 #include "utils.hpp"
 #include <cstring>
+#include <strings.h>
 #include <fcntl.h>
+#include <sys/wait.h>
 
 RequestHandler::RequestHandler(ServerManager& manager, 
 						const std::string& rawRequest, int clientFd)
 	: _serverManager(manager),
 	_request(rawRequest),
 	_clientFd(clientFd),
-	_keepAlive(true) {}
+	_keepAlive(true),
+	_config(manager.getConfig()) {}
 
 void RequestHandler::handle(int listenPort) {
-	Server& srv = matchServer(_request, listenPort);
+	const Server& srv = matchServer(_request, listenPort);
+	_server = &srv;
 	// Logger::log(INFO, "host: " + _request.getHeader("host"));
 	_processed = false;
 	_keepAlive = true;
 
 	try {
-		std::string sessionId = _request.getCookie("session_id");
-
-		_newSession = false;
-
 		// 🔹 Close connection if server request it
 		if (_request.isHeaderValue("connection", "close"))
 			_keepAlive = false;
 
-		// 🔹 If no cookie was sent, make a new one
-		if (sessionId.empty()) {
-			sessionId = Session::generateSessionId();
-			_newSession = true;
+		// 🔹 Find matching location
+		_location = &srv.findLocation(_request.getPath());
+		const Location& loc = *_location;
+
+		// 🔹 session on: the client's session if we know it; a new one
+		// only once something is stored (session())
+		if (loc.usesSession()) {
+			std::string sessionId = _request.getCookie("session_id");
+			if (!sessionId.empty())
+				_session = _serverManager.getSessionManager().find(sessionId);
+			handleVisitCounter();
 		}
-		_session = &_serverManager.getSessionManager().getOrCreate(sessionId);
-		_session->touch();
-		handleVisitCounter();
 
-		// Logger::log(DEBUG, std::string("Sesson ID: ") + sessionId);
-
-		// 🔹 Find matching location
-		Location loc = srv.findLocation(_request.getPath());
+		// 🔹 internal: only scripts may send clients there (X-Accel-Redirect)
+		if (loc.isInternal()) {
+			sendResponse(makeErrorResponse(srv, 404));
+			return;
+		}
 
 		// 🔹 Check request
 		if (RequestValidator::check(*this, srv,loc) == false)
@@ -55,12 +60,19 @@ void RequestHandler::handle(int listenPort) {
 		std::string path = _request.getPath();
 		std::string ext = getFileExtension(path);
 
-		// If extension matches a CGI handler in this location
-		if (loc.getCgiExtensions().count(ext)) {
-			std::string interpreter = loc.getCgiExtensions().at(ext);
-			CgiHandler cgi(_request);
-			HttpResponse res = cgi.execute(srv.getRoot() + path, interpreter, srv.getRoot());
-			sendResponse(res);
+		// 🔹 proxy_pass: the whole location is answered by its upstream
+		if (!loc.getProxyPass().empty()) {
+			runProxy(loc);
+			return;
+		}
+
+		// cgi_pass answers the whole location, cgi_extension matching files
+		if (!loc.getCgiProgram().empty() || loc.getCgiExtensions().count(ext)) {
+			std::shared_ptr<CgiCache> cache = _serverManager.cgiCache(srv, loc);
+			if (cache && CgiCache::cacheable(_request))
+				serveCgiCached(cache, ext, srv.getRoot() + path);
+			else
+				runScript(loc, ext, srv.getRoot() + path);
 			return;
 		}
 
@@ -79,31 +91,9 @@ void RequestHandler::handle(int listenPort) {
 	}
 }
 
-Server& RequestHandler::matchServer(const HttpRequest& req, int listenPort) {
-	std::string host = req.getHeader("host");
-
-	// 🔹 Access servers via ServerManager
-	const std::vector<Server>& servers = _serverManager.getServers();
-
-	// 🔹 Search for matching host & port
-	for (size_t i = 0; i < servers.size(); ++i) {
-		const Server& srv = servers[i];
-		if (srv.getListenPort() == listenPort) {
-			if (std::find(srv.getServerNames().begin(),
-						  srv.getServerNames().end(), host) != srv.getServerNames().end()) {
-				return _serverManager.getServer(i);
-			}
-		}
-	}
-	// 🔹 Default server for this port
-	for (size_t i = 0; i < servers.size(); ++i) {
-		const Server& srv = servers[i];
-		if (srv.getListenPort() == listenPort && srv.isDefault()) {
-			return _serverManager.getServer(i);
-		}
-	}
-	// 🔹 Fallback
-	return _serverManager.getServer(0);
+const Server& RequestHandler::matchServer(const HttpRequest& req, int listenPort) {
+	// 🔹 Exact name, wildcard, regex, then the port's default server
+	return _config->resolveServer(listenPort, req.getHeader("host"));
 }
 
 const HttpRequest&	RequestHandler::getRequest() const { return _request; }
@@ -112,47 +102,478 @@ bool	RequestHandler::keepAlive() const { return _keepAlive; }
 void	RequestHandler::setKeepAlive(bool val) { _keepAlive = val; }
 void	RequestHandler::markProcessed() { _processed = true; }
 bool	RequestHandler::processed() const { return _processed; }
+bool	RequestHandler::suspended() const { return _suspended; }
 HttpMethod			RequestHandler::getMethod() const {
 	return stringToMethod(_request.getMethod());
 	}
 
-bool sendAll(int clientFd, const std::string &data) {
-	size_t totalSent = 0;
-	ssize_t sent = 0;
-	size_t dataSize = data.size();
+void RequestHandler::offload(std::function<void()> work, std::function<HttpResponse()> finish) {
+	_suspended = true;
+	_serverManager.submitIO(_clientFd, std::move(work), [this, finish]() {
+		_suspended = false;
+		try {
+			sendResponse(finish());
+		}
+		catch (const std::exception& e) {
+			Logger::log(ERROR, std::string("500 error handling request: ") + e.what());
+			sendResponse(makeErrorResponse(*_server, 500));
+		}
+	});
+}
+
+// A response being deflated on the disk pool
+struct EncodeJob {
+	HttpResponse	res;
+	std::string		encoded;
+};
+
+// A script's header by name, whatever case it used (end() if absent)
+static std::map<std::string, std::string>::const_iterator findHeader(
+	const std::map<std::string, std::string>& headers, const char* name) {
+	for (auto it = headers.begin(); it != headers.end(); ++it) {
+		if (strcasecmp(it->first.c_str(), name) == 0)
+			return it;
+	}
+	return headers.end();
+}
+
+// Does the script hand the answer back to the static path?
+static bool namesAccelTarget(const HttpResponse& res) {
+	const std::map<std::string, std::string>& headers = res.getHeaders();
+	return findHeader(headers, "X-Accel-Redirect") != headers.end()
+		|| findHeader(headers, "X-Sendfile") != headers.end();
+}
+
+// What a finished run amounts to, whichever way it ran
+static CgiOutcome outcomeOf(const CgiJob& job) {
+	CgiOutcome o;
+	o.timedOut = job.timedOut;
+	o.ok = WIFEXITED(job.status) && WEXITSTATUS(job.status) == 0;
+	o.out = job.out;
+	o.err = job.err;
+	return o;
+}
+
+static CgiOutcome outcomeOf(const CgiWorkerResult& result) {
+	CgiOutcome o;
+	o.timedOut = result.timedOut;
+	o.ok = result.ok && result.status == 0;
+	o.out = result.out;
+	o.err = result.err;
+	return o;
+}
+
+static CgiOutcome outcomeOf(const FastCgiResult& result) {
+	CgiOutcome o;
+	o.fastcgi = true;
+	o.timedOut = result.timedOut;
+	o.ok = result.ok;
+	o.out = result.out;
+	o.err = result.err;
+	return o;
+}
+
+// Runs the script once the location has room for it (cgi_max_concurrency)
+void RequestHandler::runScript(const Location& loc, const std::string& ext, const std::string& scriptPath) {
+	if (loc.getCgiLimits().maxConcurrency == 0) {
+		launchScript(loc, ext, scriptPath, nullptr);
+		return;
+	}
+	_suspended = true;
+	_serverManager.queueCgi(*_server, loc, _clientFd,
+		[this, ext, scriptPath](const std::shared_ptr<CgiSlot>& slot) {
+			_suspended = false;
+			launchScript(*_location, ext, scriptPath, slot);
+		},
+		[this](int code) {
+			_suspended = false;
+			HttpResponse res = makeErrorResponse(*_server, code);
+			if (code == 503) {
+				Logger::log(WARNING, "503 CGI queue full or wait too long: " + _request.getPath());
+				res.setHeader("Retry-After", std::to_string(_location->getCgiLimits().queueTimeout));
+			}
+			sendResponse(res);
+		});
+}
+
+// cgi_pass backend, pooled interpreter, or a fresh process; the slot is
+// held until the run is over
+void RequestHandler::launchScript(const Location& loc, const std::string& ext, const std::string& scriptPath,
+	const std::shared_ptr<CgiSlot>& slot)
+{
+	if (!loc.getCgiProgram().empty())
+		runFastCgi(loc, scriptPath, slot);
+	else if (loc.getCgiPools().count(ext))
+		runPooledCgi(loc, ext, scriptPath, slot);
+	else
+		runCgi(loc, scriptPath, loc.getCgiExtensions().at(ext), slot);
+}
 
-	while (totalSent < dataSize) {
-		sent = send(clientFd, data.c_str() + totalSent, dataSize - totalSent, 0);
-		if (sent < 0) {
-			Logger::log(ERROR, std::string("send() failed: ") + std::strerror(errno));
-			return false;
+// Starts the script and suspends; the loop answers once it has exited
+void RequestHandler::runCgi(const Location& loc, const std::string& scriptPath, const std::string& interpreter,
+	const std::shared_ptr<CgiSlot>& slot)
+{
+	CgiHandler cgi(_request);
+	CgiProcess proc = cgi.start(scriptPath, interpreter, loc);
+
+	_suspended = true;
+	_serverManager.startCgi(_clientFd, proc, _request.takeBody(),
+		[this](CgiJob& job, const std::string& head) { streamCgi(job, head); },
+		[this, slot](const CgiJob& job) {
+			_suspended = false;
+			CgiOutcome outcome = outcomeOf(job);
+			if (job.framing == CGI_BUFFERED) {
+				answerCgi(outcome);
+				return;
+			}
+			if (job.framing == CGI_DISCARD) {
+				if (outcome.ok && !outcome.timedOut)
+					accelRedirect(_accelHead);
+				else
+					answerCgi(outcome);		// nothing sent yet: an error page
+				return;
+			}
+			if (!job.err.empty())
+				Logger::log(WARNING, "CGI stderr: " + job.err);
+			// Too late for an error page: cut the body short instead
+			if (!outcome.ok || outcome.timedOut) {
+				Logger::log(ERROR, "CGI script failed while streaming: " + _request.getPath());
+				_keepAlive = false;
+			}
+		});
+}
+
+// Headers of a script that is still running: send them now and let the
+// body follow as it comes (left buffered if they don't parse; that 500s at the end)
+void RequestHandler::streamCgi(CgiJob& job, const std::string& head) {
+	HttpResponse res;
+	try {
+		res = CgiHandler::parseHead(head);
+		if (namesAccelTarget(res)) {
+			_accelHead = res;
+			job.framing = CGI_DISCARD;	// served once the script is done
+			return;
 		}
-		if (sent == 0) {
-			Logger::log(ERROR, "connection closed by client");
-			return false;
+		ContentEncoding enc = Compression::applyStream(res, _request, *_location);
+		if (enc != ENCODING_IDENTITY)
+			job.encoder.reset(new CompressionStream(enc));
+	}
+	catch (const std::exception&) {
+		return;
+	}
+	if (res.getHeaders().count("Content-Length")) {
+		job.framing = CGI_LENGTH;
+	} else {
+		res.setHeader("Transfer-Encoding", "chunked");
+		job.framing = CGI_CHUNKED;
+	}
+	queueResponse(res);
+}
+
+// Same, on a warm interpreter of the location's cgi_pool
+void RequestHandler::runPooledCgi(const Location& loc, const std::string& ext, const std::string& scriptPath,
+	const std::shared_ptr<CgiSlot>& slot)
+{
+	if (access(scriptPath.c_str(), F_OK) != 0)
+		throw std::runtime_error("CGI script does not exist");
+	CgiHandler cgi(_request);
+
+	_suspended = true;
+	_serverManager.submitCgiWorker(_clientFd, CgiWorkerPool::poolKey(loc, ext),
+		cgi.buildEnv(scriptPath, loc), _request.getBody(),
+		[this, slot](const CgiWorkerResult& result) {
+			_suspended = false;
+			answerCgi(outcomeOf(result));
+		});
+}
+
+// Turns a finished script into the response
+void RequestHandler::answerCgi(const CgiOutcome& outcome) {
+	HttpResponse res;
+	int code = CgiHandler::interpret(outcome, _request.getPath(), res);
+	if (code == 0 && accelRedirect(res))
+		return;
+	sendResponse(code ? makeErrorResponse(*_server, code) : res);
+}
+
+// Same as runCgi, over a pooled connection to the location's backend
+void RequestHandler::runFastCgi(const Location& loc, const std::string& scriptPath,
+	const std::shared_ptr<CgiSlot>& slot)
+{
+	CgiHandler cgi(_request);
+	std::map<std::string, std::string> params = cgi.buildEnv(scriptPath, loc);	// CONTENT_LENGTH before the body moves
+
+	_suspended = true;
+	_serverManager.submitFastCgi(_clientFd, loc.getCgiProgram(), params, _request.takeBody(),
+		[this, slot](const FastCgiResult& result) {
+			_suspended = false;
+			answerCgi(outcomeOf(result));
+		});
+}
+
+// Forwards the request to the location's upstream; the answer is relayed
+// as it arrives, so past its head a failure can only cut it short
+void RequestHandler::runProxy(const Location& loc) {
+	_suspended = true;
+	_serverManager.submitProxy(_clientFd, loc.getProxyPass(), _request, _request.takeBody(),
+		[this](const ProxyHead& head) { return streamProxy(head); },
+		[this](const ProxyResult& result) {
+			_suspended = false;
+			if (result.started) {
+				if (!result.ok) {
+					Logger::log(ERROR, "proxied answer cut short: " + _request.getPath());
+					_keepAlive = false;
+				}
+				return;
+			}
+			sendResponse(makeErrorResponse(*_server, result.timedOut ? 504 : 502));
+		});
+}
+
+// The backend's head, sent on to the client; true if the body has to go
+// out chunked (the backend framed it by chunks or by closing)
+bool RequestHandler::streamProxy(const ProxyHead& head) {
+	HttpResponse res(head.status);
+	res.removeHeader("Content-Length");
+	if (!head.reason.empty())
+		res.setStatusMessage(head.reason);
+
+	for (const auto& h : head.headers) {
+		if (strcasecmp(h.first.c_str(), "Set-Cookie") == 0) {
+			res.addSetCookie(h.second);
+			continue;
+		}
+		// Repeated headers are joined (RFC 9110 5.3)
+		auto prev = res.getHeaders().find(h.first);
+		res.setHeader(h.first, prev == res.getHeaders().end() ? h.second : prev->second + ", " + h.second);
+	}
+	bool chunked = head.hasBody && !head.hasLength;
+	if (chunked)
+		res.setHeader("Transfer-Encoding", "chunked");
+	queueResponse(res);
+	return chunked;
+}
+
+// Runs the script for req with no client attached (a cache refill):
+// done gets the outcome even if the request's handler is gone by then
+static void runDetachedCgi(ServerManager& manager, const HttpRequest& req, const Location& loc,
+	const std::string& ext, const std::string& scriptPath, const std::shared_ptr<CgiSlot>& slot,
+	std::function<void(const CgiOutcome&)> done)
+{
+	CgiHandler cgi(req);
+	if (!loc.getCgiProgram().empty()) {
+		manager.submitFastCgi(-1, loc.getCgiProgram(), cgi.buildEnv(scriptPath, loc), req.getBody(),
+			[done, slot](const FastCgiResult& result) { done(outcomeOf(result)); });
+	} else if (loc.getCgiPools().count(ext)) {
+		if (access(scriptPath.c_str(), F_OK) != 0)
+			throw std::runtime_error("CGI script does not exist");
+		manager.submitCgiWorker(-1, CgiWorkerPool::poolKey(loc, ext),
+			cgi.buildEnv(scriptPath, loc), req.getBody(),
+			[done, slot](const CgiWorkerResult& result) { done(outcomeOf(result)); });
+	} else {
+		CgiProcess proc = cgi.start(scriptPath, loc.getCgiExtensions().at(ext), loc);
+		manager.startCgi(-1, proc, req.getBody(), nullptr,
+			[done, slot](const CgiJob& job) { done(outcomeOf(job)); });
+	}
+}
+
+// cgi_cache: answer from the cache, or from the one run of the script
+// that every request for the same key waits on
+void RequestHandler::serveCgiCached(const std::shared_ptr<CgiCache>& cache, const std::string& ext,
+	const std::string& scriptPath, bool diskChecked)
+{
+	std::string key = cache->key(_request);
+	HttpResponse cached;
+	CgiCache::State state = cache->lookup(key, time(NULL), cached);
+	if (state != CgiCache::MISS) {
+		answerCached(cached, (state == CgiCache::FRESH) ? "HIT" : "STALE");
+		if (state == CgiCache::STALE && !cache->filling(key)) {
+			try {
+				fillCgiCache(cache, key, -1, ext, scriptPath);
+			}
+			catch (const std::exception& e) {
+				Logger::log(ERROR, std::string("cgi_cache refresh failed: ") + e.what());
+			}
+		}
+		return;
+	}
+
+	// 🔹 Not in memory: try the disk tier, then come back here
+	if (!diskChecked && !cache->config().path.empty() && !cache->filling(key)) {
+		std::shared_ptr<CgiCacheEntry> entry = std::make_shared<CgiCacheEntry>();
+		std::string file = cache->diskFile(key);
+		_suspended = true;
+		_serverManager.submitIO(_clientFd,
+			[file, key, entry]() { CgiCache::readDisk(file, key, *entry); },
+			[this, cache, entry, ext, scriptPath]() {
+				_suspended = false;
+				if (entry->bytes)
+					cache->insert(*entry);
+				try {
+					serveCgiCached(cache, ext, scriptPath, true);
+				}
+				catch (const std::exception& e) {
+					Logger::log(ERROR, std::string("500 error handling request: ") + e.what());
+					sendResponse(makeErrorResponse(*_server, 500));
+				}
+			});
+		return;
+	}
+
+	if (!cache->filling(key))
+		fillCgiCache(cache, key, _clientFd, ext, scriptPath);
+	_suspended = true;
+	_serverManager.waitCgiCache(cache, key, _clientFd,
+		[this, ext, scriptPath](const HttpResponse* res, int code) {
+			_suspended = false;
+			if (res) {
+				answerCached(*res, "MISS");
+				return;
+			}
+			if (code) {
+				sendResponse(makeErrorResponse(*_server, code));
+				return;
+			}
+			// Someone else's answer that can't be shared: get our own
+			try {
+				runScript(*_location, ext, scriptPath);
+			}
+			catch (const std::exception& e) {
+				Logger::log(ERROR, std::string("500 error handling request: ") + e.what());
+				sendResponse(makeErrorResponse(*_server, 500));
+			}
+		});
+}
+
+// One run of the script for the key, owned by the cache rather than by a
+// client: the first to ask disconnecting doesn't cancel it for the others
+void RequestHandler::fillCgiCache(const std::shared_ptr<CgiCache>& cache, const std::string& key,
+	int leader, const std::string& ext, const std::string& scriptPath)
+{
+	ServerManager& manager = _serverManager;
+	std::string path = _request.getPath();
+	std::function<void(const CgiOutcome&)> done = [&manager, cache, key, path](const CgiOutcome& outcome) {
+		manager.completeCgiFill(cache, key, path, outcome);
+	};
+	cache->beginFill(key, leader);
+	try {
+		if (_location->getCgiLimits().maxConcurrency == 0) {
+			runDetachedCgi(manager, _request, *_location, ext, scriptPath, nullptr, done);
+			return;
 		}
-		totalSent += static_cast<size_t>(sent);
+		// May start after this request is answered: keep what it needs
+		std::shared_ptr<const ConfigSnapshot> config = _config;
+		const Location* loc = _location;
+		HttpRequest request = _request;
+		manager.queueCgi(*_server, *loc, -1,
+			[&manager, config, loc, request, ext, scriptPath, done](const std::shared_ptr<CgiSlot>& slot) {
+				runDetachedCgi(manager, request, *loc, ext, scriptPath, slot, done);
+			},
+			[done](int code) {
+				CgiOutcome outcome;
+				outcome.rejected = code;
+				done(outcome);
+			});
+	}
+	catch (const std::exception&) {
+		cache->endFill(key);
+		throw;
+	}
+}
+
+void RequestHandler::answerCached(const HttpResponse& res, const std::string& status) {
+	if (accelRedirect(res))
+		return;
+	HttpResponse out = res;
+	out.setHeader("X-Cache-Status", status);
+	sendResponse(out);
+}
+
+// X-Accel-Redirect (or X-Sendfile, also a URI here): the script only
+// authorized the request. Its body is dropped and the target, which must
+// be in an internal location, goes through the static GET path (mmap,
+// gzip_static...) with the script's download headers kept. false if
+// res names no target.
+bool RequestHandler::accelRedirect(const HttpResponse& res) {
+	const std::map<std::string, std::string>& headers = res.getHeaders();
+	auto it = findHeader(headers, "X-Accel-Redirect");
+	if (it == headers.end())
+		it = findHeader(headers, "X-Sendfile");
+	if (it == headers.end())
+		return false;
+	std::string target = it->second;
+
+	try {
+		if (target.empty() || target[0] != '/' || target.find("..") != std::string::npos)
+			throw std::runtime_error("invalid X-Accel-Redirect target: " + target);
+		_request.rewrite(target);
+		const Location& loc = _server->findLocation(_request.getPath());
+		if (!loc.isInternal())
+			throw std::runtime_error("X-Accel-Redirect outside an internal location: " + target);
+		_location = &loc;
+
+		static const char* const kept[] = { "Content-Disposition", "Cache-Control", "Expires", "Set-Cookie" };
+		for (const char* name : kept) {
+			auto h = findHeader(headers, name);
+			if (h != headers.end())
+				_carriedHeaders.push_back(std::make_pair(std::string(name), h->second));
+		}
+		handleGet(*_server, loc);
+	}
+	catch (const std::exception& e) {
+		Logger::log(ERROR, std::string("500 error handling request: ") + e.what());
+		sendResponse(makeErrorResponse(*_server, 500));
 	}
-	// Logger::log(TRACE, std::string("bytes sent: ") + std::to_string(totalSent));
 	return true;
 }
 
 void RequestHandler::sendResponse(const HttpResponse& other) {
 
 	HttpResponse res = other;
-	if (_newSession) {
-		res.setCookie("session_id", _session->getId());
+	// Listings, pages, CGI output (static files arrive already encoded)
+	ContentEncoding enc = _location ? Compression::plan(res, _request, *_location) : ENCODING_IDENTITY;
+	if (enc == ENCODING_IDENTITY || res.getBody().size() < COMPRESSION_OFFLOAD_MIN) {
+		std::string out;
+		if (enc != ENCODING_IDENTITY && Compression::compress(res.getBody(), out, enc))
+			Compression::useEncoded(res, out, enc);
+		queueResponse(res);
+		return;
 	}
 
+	// 🔹 Big body: deflate on the disk pool, queue it back on the loop
+	auto job = std::make_shared<EncodeJob>();
+	job->res = res;
+	_suspended = true;
+	_serverManager.submitIO(_clientFd,
+		[job, enc]() {
+			if (!Compression::compress(job->res.getBody(), job->encoded, enc))
+				job->encoded.clear();
+		},
+		[this, job, enc]() {
+			_suspended = false;
+			Compression::useEncoded(job->res, job->encoded, enc);
+			queueResponse(job->res);
+		});
+}
+
+// Session cookies and Connection, then onto the client's queue
+void RequestHandler::queueResponse(HttpResponse& res) {
+	if (res.getStatusCode() < 400) {
+		for (auto& h : _carriedHeaders)
+			res.setHeader(h.first, h.second);
+	}
 	if (_session) {
+		// A shared store holds a copy: write back what changed
+		if (_session->dirty())
+			_serverManager.getSessionManager().save(*_session);
+		// Session ID only if new
+		if (_newSession) {
+			res.setCookie("session_id", _session->getId());
+		}
 		// Only send session-owned cookies
 		if (_session->has("visits")) {
 			res.setCookie("visits", _session->getSession("visits"), "Path=/");
 		}
-		// Session ID only if new
-		if (_newSession) {
-			res.setCookie("session_id", _session->getId(), "Path=/");
-		}
 	}
 
 	if (_keepAlive == false) {
@@ -165,7 +586,8 @@ void RequestHandler::sendResponse(const HttpResponse& other) {
 
 	// Logger::log(DEBUG, std::string("Response ") + serialized);
 
-	bool success = sendAll(_clientFd, serialized);
+	// Body of a mapped file goes out straight from the shared mapping
+	bool success = _serverManager.queueSend(_clientFd, serialized, res.getBodyMapping());
 	if (!success) {
 		res.setHeader("Connection", "close");
 		_keepAlive = false;
@@ -179,42 +601,16 @@ void RequestHandler::sendResponse(const HttpResponse& other) {
 }
 
 HttpResponse RequestHandler::makeErrorResponse(const Server& srv, int code, bool fatal) {
-	std::string filePath;
-	// 🔹 Check if server has custom error page
-	auto it = srv.getErrorPages().find(code);
-	if (it != srv.getErrorPages().end())
-		filePath = srv.getRoot() + "/" + it->second;
-	else
-	// 🔹 Fallback default error folder
-		filePath = srv.getRoot() + "/errors/" + std::to_string(code) + ".html";
-
-	std::ifstream file(filePath.c_str(), std::ios::binary);
-	std::ostringstream buffer;
-	// 🔹 Check if file exist and not epmty
-	if (file.good()) {
-		std::ostringstream tmp;
-		tmp << file.rdbuf();
-		std::string content = tmp.str();
-
-	// 🔹 Check html exists
-		if (!content.empty() &&
-			(content.find("<html") != std::string::npos ||
-			content.find("<body") != std::string::npos)) {
-			buffer.str(content);
-			Logger::log(INFO, "Default HTML error page used: " + filePath);
-		} else {
-			Logger::log(WARNING, "Invalid error page content, using fallback");
-		}
-	}
-	if (buffer.str().empty()) {
+	std::string body;
+	// 🔹 Custom or root/errors/ page, compiled at config time
+	if (const PageTemplate* page = srv.getErrorTemplate(code))
+		body = page->render();
+	else {
 	// 🔹 Minimal inline fallback
-		Logger::log(INFO, "Fallback error page triggered");
-		buffer.str("");
-		buffer << "<html><body><h1>" << code << " "
-			<< HttpResponse::statusMessageForCode(code)
-			<< "</h1></body></html>";
+		body = "<html><body><h1>" + std::to_string(code) + " "
+			+ HttpResponse::statusMessageForCode(code)
+			+ "</h1></body></html>";
 	}
-	std::string body = buffer.str();
 	HttpResponse res(code, body);
 	res.setHeader("Content-Type", "text/html");
 	res.setHeader("Content-Length", std::to_string(body.size()));
@@ -236,45 +632,12 @@ HttpResponse RequestHandler::makeSuccessResponse(
 		const Server& srv,
 		const std::map<std::string, std::string>& vars)
 {
-	// Always load a single HTML file — no config
-	std::string filePath = srv.getRoot() + "/pages/202.html";
-
-	std::ifstream file(filePath.c_str(), std::ios::binary);
-	std::ostringstream buffer;
-
-	// Load file if exists
-	if (file.good()) {
-		std::ostringstream tmp;
-		tmp << file.rdbuf();
-		std::string content = tmp.str();
-
-		if (!content.empty() &&
-			(content.find("<html") != std::string::npos ||
-			 content.find("<body") != std::string::npos))
-		{
-			buffer.str(content);
-			Logger::log(INFO, "Success page used: " + filePath);
-		}
-		else {
-			Logger::log(WARNING, "Invalid success page content, using fallback");
-		}
-	}
-	// Fallback if file missing or invalid
-	if (buffer.str().empty()) {
-		Logger::log(INFO, "Fallback success page triggered");
-		buffer.str("");
-		buffer << "<html><body><h1>Success</h1></body></html>";
-	}
+	// pages/202.html, compiled at config time
+	const PageTemplate* page = srv.getSuccessTemplate();
+	std::string html = page
+		? page->render(vars)
+		: "<html><body><h1>Success</h1></body></html>";
 
-	// Template replacement: {{key}}
-	std::string html = buffer.str();
-	for (const auto &p : vars) {
-		std::string tag = "{{" + p.first + "}}";
-		size_t pos;
-		while ((pos = html.find(tag)) != std::string::npos) {
-			html.replace(pos, tag.length(), p.second);
-		}
-	}
 	HttpResponse res(200, html);
 	res.setHeader("Content-Type", "text/html");
 	res.setHeader("Content-Length", std::to_string(html.size()));
@@ -282,8 +645,11 @@ HttpResponse RequestHandler::makeSuccessResponse(
 }
 
 // GET, POST, DELETE methods
-void RequestHandler::handleGet(Server& srv, Location& loc) {
-	if (auto res = serveGetStatic(_request, srv, loc, *this)) {
+void RequestHandler::handleGet(const Server& srv, const Location& loc) {
+	std::optional<HttpResponse> res = serveGetStatic(_request, srv, loc, *this);
+	if (_suspended)		// answered once the disk pool is done
+		return;
+	if (res) {
 		sendResponse(*res);
 		return;
 	}
@@ -291,8 +657,11 @@ void RequestHandler::handleGet(Server& srv, Location& loc) {
 	sendResponse(makeErrorResponse(srv, 404));
 }
 
-void RequestHandler::handlePost(Server& srv, Location& loc) {
-	if (auto res = servePostStatic(_request, srv, loc, *this)) {
+void RequestHandler::handlePost(const Server& srv, const Location& loc) {
+	std::optional<HttpResponse> res = servePostStatic(_request, srv, loc, *this);
+	if (_suspended)		// answered once the disk pool is done
+		return;
+	if (res) {
 		sendResponse(*res);
 		return;
 	}
@@ -300,8 +669,11 @@ void RequestHandler::handlePost(Server& srv, Location& loc) {
 	sendResponse(makeErrorResponse(srv, 404));
 }
 
-void RequestHandler::handleDelete(Server& srv, Location& loc) {
-	if (auto res = serveDeleteStatic(_request, srv, loc, *this)) {
+void RequestHandler::handleDelete(const Server& srv, const Location& loc) {
+	std::optional<HttpResponse> res = serveDeleteStatic(_request, srv, loc, *this);
+	if (_suspended)		// answered once the disk pool is done
+		return;
+	if (res) {
 		sendResponse(*res);
 		return;
 	}
@@ -309,16 +681,25 @@ void RequestHandler::handleDelete(Server& srv, Location& loc) {
 	sendResponse(makeErrorResponse(srv, 404));
 }
 
+// The request's session, created (with its cookie) on first use
+Session& RequestHandler::session() {
+	if (!_session) {
+		_session = _serverManager.getSessionManager().create();
+		_newSession = true;
+	}
+	return *_session;
+}
+
 void RequestHandler::handleVisitCounter() {
 	std::string str = _request.getPath();
 	// Logger::log(DEBUG, "path in handleVisitCounter:" + str);
 	if (str == "/") {
-		std::string visits = _session->getSession("visits");
+		std::string visits = session().getSession("visits");
 		if (visits.empty())
 			visits = "0";
 
 		int count = std::atoi(visits.c_str()) + 1;
-		_session->set("visits", std::to_string(count));
+		session().set("visits", std::to_string(count));
 		// Logger::log(DEBUG, "number of visits:" + std::to_string(count));
 	}
 }
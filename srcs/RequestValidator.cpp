@@ -1,7 +1,6 @@
 #include "RequestValidator.hpp"
 #include "Logger.hpp"
 #include <cstring>
-#include <fstream>
 #include <algorithm>
 #include <sys/stat.h>
 
@@ -49,7 +48,7 @@ std::string resolveFullPath(
 	return full;
 }
 
-bool RequestValidator::check(RequestHandler& handl, Server& srv, Location& loc) {
+bool RequestValidator::check(RequestHandler& handl, const Server& srv, const Location& loc) {
 	HttpRequest req = handl.getRequest();
 
 	// 🔹 Redirection
@@ -126,7 +125,7 @@ bool RequestValidator::check(RequestHandler& handl, Server& srv, Location& loc)
 	return true;
 }
 
-bool RequestValidator::checkHeaders(RequestHandler& handl, Server& srv) {
+bool RequestValidator::checkHeaders(RequestHandler& handl, const Server& srv) {
 	(void)srv;
 	const std::multimap<std::string, std::string>& headers = handl.getRequest().getHeaders();
 
@@ -209,7 +208,7 @@ bool RequestValidator::isMethodAllowed(
 		handl.getRequest().getMethod()) != allowed.end();
 }
 
-bool RequestValidator::checkPost(RequestHandler& handl, Server& srv) {
+bool RequestValidator::checkPost(RequestHandler& handl, const Server& srv) {
 	std::string length = handl.getRequest().getHeader("content-length");
 	std::string type   = handl.getRequest().getHeader("content-type");
 
@@ -243,7 +242,7 @@ bool RequestValidator::checkPost(RequestHandler& handl, Server& srv) {
 		long long len = std::atoll(cl.c_str());
 		size_t contentLength = static_cast<size_t>(len);
 		// Reject invalid lengths
-		if (contentLength < 0 || contentLength != handl.getRequest().getBody().size()) {
+		if (contentLength != handl.getRequest().getBody().size()) {
 			handl.sendResponse(handl.makeErrorResponse(srv, 400, true));
 			Logger::log(ERROR, "400 Bad Request: Invalid Content-Length value");
 			return false;
@@ -254,8 +253,8 @@ bool RequestValidator::checkPost(RequestHandler& handl, Server& srv) {
 
 bool RequestValidator::handleRedirect(
 	RequestHandler& handl,
-	Server& srv,
-	Location& loc)
+	const Server& srv,
+	const Location& loc)
 {
 	int code = loc.getReturnCode();
 	std::string target = loc.getReturnTarget();
@@ -272,34 +271,15 @@ bool RequestValidator::handleRedirect(
 	// Fancy Browser redirection
 	if (isBrowser)
 	{
-		std::string path = srv.getRoot() + "/errors/301.html";
-		std::ifstream file(path.c_str());
-		std::string buffer;
-
-		if (file) {
-			std::ostringstream ss;
-			ss << file.rdbuf();
-			buffer = ss.str();
-
-			// Replace placeholder
-			std::string target = loc.getReturnTarget();
-			size_t pos = buffer.find("{{REDIRECT_URL}}");
-			while (pos != std::string::npos) {
-				buffer.replace(pos, std::string("{{REDIRECT_URL}}").length(), target);
-				pos = buffer.find("{{REDIRECT_URL}}", pos + target.length());
-			}
-
-
-			if (!buffer.empty())
-			{
-				HttpResponse res(200, buffer);
-				res.setHeader("Content-Type", "text/html");
-				res.setHeader("Content-Length", std::to_string(buffer.size()));
-				handl.sendResponse(res);
-
-				Logger::log(WARNING, "Custom 301 HTML for browser requests");
-				return false;
-			}
+		if (const PageTemplate* page = srv.getRedirectTemplate()) {
+			std::string buffer = page->render({ { "REDIRECT_URL", target } });
+			HttpResponse res(200, buffer);
+			res.setHeader("Content-Type", "text/html");
+			res.setHeader("Content-Length", std::to_string(buffer.size()));
+			handl.sendResponse(res);
+
+			Logger::log(WARNING, "Custom 301 HTML for browser requests");
+			return false;
 		}
 	}
 
@@ -1,7 +1,9 @@
 #include "Server.hpp"
-#include <regex>
 #include <limits>
 #include "Logger.hpp"
+#include "CgiHandler.hpp"
+#include <dirent.h>
+#include <cstdlib>
 
 Server::Server()
 	: _host("127.0.0.1"),
@@ -41,76 +43,79 @@ void Server::setAutoindex(bool value) { _autoindex = value; }
 void Server::setMethod(const std::vector<std::string>& methods) { _methods = methods; }
 void Server::setListenFlag() { _hasListen = true; }
 void Server::setRootFlag() { _hasRoot = true; }
-void Server::addLocation(const Location& loc) { _locations.push_back(loc); }
-void Server::addLocation(Location&& loc) { _locations.push_back(std::move(loc)); }
+void Server::addLocation(const Location& loc) {
+	_router.add(loc.getPath(), _locations.size());
+	_locations.push_back(loc);
+}
+void Server::addLocation(Location&& loc) {
+	_router.add(loc.getPath(), _locations.size());
+	_locations.push_back(std::move(loc));
+}
 bool Server::hasListen() const { return _hasListen; }
 bool Server::hasRoot() const { return _hasRoot; }
 
-#include <iostream>
-
-Location Server::findLocation(const std::string& path) const {
+const PageTemplate* Server::getErrorTemplate(int code) const {
+	auto it = _errorTemplates.find(code);
+	return it != _errorTemplates.end() ? it->second.get() : NULL;
+}
+const PageTemplate* Server::getSuccessTemplate() const { return _successTemplate.get(); }
+const PageTemplate* Server::getRedirectTemplate() const { return _redirectTemplate.get(); }
+
+// Reads every page the server can answer with, once, at config time:
+// error_page entries first, then root/errors/<code>.html for the rest
+void Server::loadPages() {
+	_errorTemplates.clear();
+	for (std::map<int, std::string>::const_iterator it = _errorPages.begin();
+		it != _errorPages.end(); ++it) {
+		if (auto page = PageTemplate::load(_root + "/" + it->second))
+			_errorTemplates[it->first] = page;
+	}
 
-	// No locations
-	if (_locations.empty()) {
-		return Location();
+	DIR* dir = opendir((_root + "/errors").c_str());
+	if (dir) {
+		struct dirent* ent;
+		while ((ent = readdir(dir)) != NULL) {
+			std::string name = ent->d_name;
+			int code = std::atoi(name.c_str());
+			if (code < 100 || code > 599 || name != std::to_string(code) + ".html"
+				|| _errorTemplates.count(code))
+				continue;
+			if (auto page = PageTemplate::load(_root + "/errors/" + name))
+				_errorTemplates[code] = page;
+		}
+		closedir(dir);
 	}
 
-	Location const* bestMatch = NULL;
+	_successTemplate = PageTemplate::load(_root + "/pages/202.html");
+	_redirectTemplate = PageTemplate::load(_root + "/errors/301.html");
+	Logger::log(INFO, "Loaded " + std::to_string(_errorTemplates.size())
+		+ " error page templates from " + _root);
+}
 
-	// Exact match
-	for (std::vector<Location>::const_iterator it = _locations.begin();
-		it != _locations.end(); ++it)
-	{
-		if (it->getPath() == path)
-			return *it; // exact match wins
-	}
+// The part of the CGI environment that does not depend on the request,
+// built once per location instead of for every script
+void Server::prepareCgiEnv() {
+	std::vector<std::string> env = CgiHandler::baseEnv(_root);
+	for (size_t i = 0; i < _locations.size(); ++i)
+		_locations[i].setCgiEnv(env);
+}
 
-	// Regex match
-	for (const Location& loc : _locations) {
-		const std::string& p = loc.getPath();
-		if (!p.empty() && p[0] == '~') {
-			std::string pattern = p.substr(1);
-			// remove extra spaces like "~ \.bla$"
-			while (!pattern.empty() && pattern[0] == ' ')
-				pattern.erase(0, 1);
-			try {
-				std::regex rgx(pattern);
-				if (std::regex_search(path, rgx)) {
-					Logger::log(INFO, "Regex match: " + path);
-					return loc;
-				}
-			} catch (...) {
-				continue; // ignore invalid regex
-			}
-		}
-	}
+// The returned location lives as long as this Server
+const Location& Server::findLocation(const std::string& path) const {
+	static const Location none;
 
-	// Longest prefix match
-	for (std::vector<Location>::const_iterator it = _locations.begin();
-		it != _locations.end(); ++it)
-	{
-		const std::string& locPath = it->getPath();
-
-		if (path.compare(0, locPath.size(), locPath) == 0) {
-			// Only first match
-			if (bestMatch == NULL || locPath.size() > bestMatch->getPath().size()) {
-				bestMatch = &(*it);
-			}
-		}
-	}
+	// No locations
+	if (_locations.empty())
+		return none;
 
-	// If nothing matched, return default "/"
-	if (bestMatch != NULL) {
-		return *bestMatch;
-	}
+	long match = _router.match(path);
+	if (match >= 0)
+		return _locations[match];
 
 	// fallback to root "/" explicitly
-	for (std::vector<Location>::const_iterator it = _locations.begin();
-		it != _locations.end(); ++it)
-	{
-		if (it->getPath() == "/")
-			return *it;
-	}
+	match = _router.match("/");
+	if (match >= 0 && _locations[match].getPath() == "/")
+		return _locations[match];
 
 	// Should not happen
 	return _locations.front();
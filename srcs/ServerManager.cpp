@@ -1,6 +1,10 @@
 #include "ServerManager.hpp"
 #include "RequestHandler.hpp"
 #include "Logger.hpp"
+#include "MimeTypes.hpp"
+#include "Compression.hpp"
+#include "Signals.hpp"
+#include <sys/signalfd.h>
 #include <sys/socket.h> // for socket, bind, listen
 #include <netinet/in.h> // for sockaddr_in
 #include <arpa/inet.h> // for inet_pton, htons
@@ -9,37 +13,86 @@
 #include <cstring>
 #include <fcntl.h>
 #include <algorithm>
+#include <sstream>
+#include <set>
+#include <csignal>
+#include <sys/wait.h>
 
-extern bool g_running;
+extern char** environ;
 
-ServerManager::ServerManager(const std::vector<Server>& servers)
-	: _servers(servers), _sessionManager() { }
+ServerManager::ServerManager(std::shared_ptr<const ConfigSnapshot> config)
+	: _config(config), _sessionManager(),
+	_fastcgi([this](int fd, short events) { watchFd(fd, events); }),
+	_cgiWorkers([this](int fd, short events) { watchFd(fd, events); },
+		[this](pid_t pid) { watchChild(pid, [](int) {}); }),
+	_proxy([this](int fd, short events) { watchFd(fd, events); }) { }
 
 ServerManager::~ServerManager() {
+	if (_signalFd >= 0)
+		close(_signalFd);
 	for (auto& pair : _portSocketMap)
 		close(pair.first);
 	for (auto& client : _clientToListenFd)
 		close(client.first);
 }
 
-const std::vector<Server>& ServerManager::getServers() const { return _servers; }
+const std::shared_ptr<const ConfigSnapshot>& ServerManager::getConfig() const { return _config; }
 SessionManager& ServerManager::getSessionManager() { return _sessionManager; }
 
-const Server& ServerManager::getServer(size_t index) const {
-	if (index >= _servers.size())
-		throw std::out_of_range("server index out of range");
-	return _servers[index];
-}
+// Options, bind() and listen() for srv's port; throws on failure
+static void listenOn(int sock, const Server& srv) {
+	// Allows restart immediately and reuse the same port safely
+	int opt = 1;		// 0/1 -> off/on
+	if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
+		throw std::runtime_error("failed to setsockopt: " + std::string(strerror(errno)));
+	// Make socket non-blocking
+	if (fcntl(sock, F_SETFL, O_NONBLOCK) == -1)
+		throw std::runtime_error("failed to set non-blocking: " + std::string(strerror(errno)));
+	// Make socket close-on-exec
+	if (fcntl(sock, F_SETFD, FD_CLOEXEC) == -1)
+		throw std::runtime_error("failed to set close-on-exec: " + std::string(strerror(errno)));
+
+/*  ----- bind()/listen() -----
+	from <netinet/in.h>
+
+		struct sockaddr_in {
+			sa_family_t    sin_family;   // address family (AF_INET for IPv4)
+			in_port_t      sin_port;     // port number (16-bit), must be in network byte order
+			struct in_addr sin_addr;     // IPv4 address
+			char           sin_zero[8];  // padding, usually zeroed
+		};
+*/
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
 
-Server& ServerManager::getServer(size_t index) {
-	if (index >= _servers.size())
-		throw std::out_of_range("server index out of range");
-	return _servers[index];
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(srv.getListenPort());
+
+	if (srv.getHost() == "*" || srv.getHost().empty()) {
+		addr.sin_addr.s_addr = INADDR_ANY;
+	} else {
+		if (inet_pton(AF_INET, srv.getHost().c_str(), &addr.sin_addr) <= 0)
+			throw std::runtime_error("invalid host: " + srv.getHost());
+	}
+	// associates the socket with an IP address and port
+	// failure occurs if the port is already in use, you don’t have permission, or the IP is invalid
+	if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+		throw std::runtime_error("failed to bind socket: " + std::string(strerror(errno)));
+
+	// start listening for incoming TCP connections on the socket
+	// failure returns -1 if the socket is invalid or not bound
+	// SOMAXCONN: OS decide how many pending connections can wait
+	if (listen(sock, 511) < 0)
+		throw std::runtime_error("failed to listen on socket: " + std::string(strerror(errno)));
+	else
+		Logger::log(INFO, "server started on port: " + std::to_string(srv.getListenPort()));
 }
 
+// Binds every configured port that has no listening socket yet
 void ServerManager::setupSockets() {
-	for (size_t i = 0; i < _servers.size(); ++i) {
-		Server& srv = _servers[i];
+	const std::vector<Server>& servers = _config->getServers();
+	for (size_t i = 0; i < servers.size(); ++i) {
+		const Server& srv = servers[i];
 		int port = srv.getListenPort();
 
 		// check if a server is already bound to THIS port
@@ -65,53 +118,263 @@ void ServerManager::setupSockets() {
 		int sock = socket(AF_INET, SOCK_STREAM, 0);
 		if (sock < 0)
 			throw std::runtime_error("failed to create socket: " + std::string(strerror(errno)));
+		try {
+			listenOn(sock, srv);
+		} catch (const std::exception&) {
+			close(sock);	// a failed reload keeps running: don't leak it
+			throw;
+		}
+		_portSocketMap[sock] = port;
+		_fds.push_back({ sock, POLLIN, 0 });
+	}
+}
 
-		// Allows restart immediately and reuse the same port safely
-		int opt = 1;		// 0/1 -> off/on
-		if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
-			throw std::runtime_error("failed to setsockopt: " + std::string(strerror(errno)));
-		// Make socket non-blocking
-		if (fcntl(sock, F_SETFL, O_NONBLOCK) == -1)
-			throw std::runtime_error("failed to set non-blocking: " + std::string(strerror(errno)));
-		// Make socket close-on-exec
-		if (fcntl(sock, F_SETFD, FD_CLOEXEC) == -1)
-			throw std::runtime_error("failed to set close-on-exec: " + std::string(strerror(errno)));
-
-	/*  ----- bind()/listen() -----
-		from <netinet/in.h>
-
-			struct sockaddr_in {
-				sa_family_t    sin_family;   // address family (AF_INET for IPv4)
-				in_port_t      sin_port;     // port number (16-bit), must be in network byte order
-				struct in_addr sin_addr;     // IPv4 address
-				char           sin_zero[8];  // padding, usually zeroed
-			};
-	*/
-		sockaddr_in addr;
-		memset(&addr, 0, sizeof(addr));
+// Stops accepting on ports the configuration no longer has; clients
+// already connected through them are served until they leave
+void ServerManager::closeUnusedListeners() {
+	const std::vector<Server>& servers = _config->getServers();
+	for (std::map<int,int>::iterator it = _portSocketMap.begin(); it != _portSocketMap.end(); ) {
+		bool used = false;
+		for (size_t i = 0; i < servers.size() && !used; ++i)
+			used = servers[i].getListenPort() == it->second;
+		if (used) {
+			++it;
+			continue;
+		}
+		Logger::log(INFO, "stopped listening on port: " + std::to_string(it->second));
+		watchFd(it->first, 0);	// we may be inside run()'s pass over _fds
+		close(it->first);
+		it = _portSocketMap.erase(it);
+	}
+}
+
+// SIGHUP: parse the config file again and swap the snapshot in. A broken
+// file leaves the running configuration untouched.
+void ServerManager::reload() {
+	std::shared_ptr<const ConfigSnapshot> next;
+	try {
+		next = ConfigSnapshot::load(_config->getPath(), _config->getGeneration() + 1);
+	} catch (const std::exception& e) {
+		Logger::log(ERROR, "reload failed, keeping current configuration: " + std::string(e.what()));
+		return;
+	}
+	MimeTypes::load(next->getTypes());
+	// 🔹 Sidecars are written on the disk pool: a large tree would stall the loop
+	auto sidecars = std::make_shared<std::vector<SidecarTask>>(Compression::sidecarTasks(next->getServers()));
+	if (!sidecars->empty()) {
+		submitIO(-1, [sidecars]() { Compression::generateSidecars(*sidecars); },
+			[sidecars]() { Compression::reportSidecars(*sidecars); });
+	}
 
-		addr.sin_family = AF_INET;
-		addr.sin_port = htons(port);
+	// Requests still waiting on the disk pool hold on to the old snapshot
+	_config = next;
+	try {
+		setupSockets();
+	} catch (const std::exception& e) {
+		Logger::log(ERROR, "reload: " + std::string(e.what()));
+	}
+	closeUnusedListeners();
+	_cgiWorkers.configure(*_config);
+	_proxy.configure(*_config);
+	_sessionManager.configure(_config->getSessionConfig());
+	pruneCgiCaches();
+	Logger::log(INFO, "configuration reloaded (generation "
+		+ std::to_string(_config->getGeneration()) + ")");
+}
 
-		if (srv.getHost() == "*" || srv.getHost().empty()) {
-			addr.sin_addr.s_addr = INADDR_ANY;
-		} else {
-			if (inet_pton(AF_INET, srv.getHost().c_str(), &addr.sin_addr) <= 0)
-				throw std::runtime_error("invalid host: " + srv.getHost());
+void ServerManager::setCommandLine(int argc, char** argv) {
+	_argv.assign(argv, argv + argc);
+}
+
+/*
+	Binary upgrade, nginx style:
+
+	old: SIGUSR2 → fork + exec the binary at argv[0] with the listening
+	     sockets left open and listed in WEBSERV_LISTEN_FDS
+	new: adopts those sockets instead of binding, then sends SIGWINCH to
+	     the old process
+	old: stops accepting, finishes the connections it has (each one is
+	     closed after its current response), exits once they are gone or
+	     after shutdown_timeout
+
+	If the new binary fails to start, the old one just keeps going.
+*/
+
+// New process: take over the listening sockets of the one that exec'ed us
+void ServerManager::inheritSockets() {
+	const char* env = getenv(LISTEN_FDS_ENV);
+	if (!env)
+		return;
+
+	std::istringstream list(env);
+	std::string item;
+	while (std::getline(list, item, ',')) {
+		size_t colon = item.find(':');
+		if (colon == std::string::npos)
+			continue;
+		int fd = std::atoi(item.substr(0, colon).c_str());
+		int port = std::atoi(item.substr(colon + 1).c_str());
+		if (fd < 0 || fcntl(fd, F_SETFD, FD_CLOEXEC) == -1) {
+			Logger::log(WARNING, "upgrade: inherited fd " + item + " is not open");
+			continue;
 		}
-		// associates the socket with an IP address and port
-		// failure occurs if the port is already in use, you don’t have permission, or the IP is invalid
-		if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0)
-			throw std::runtime_error("failed to bind socket: " + std::string(strerror(errno)));
-
-		// start listening for incoming TCP connections on the socket
-		// failure returns -1 if the socket is invalid or not bound
-		// SOMAXCONN: OS decide how many pending connections can wait
-		if (listen(sock, 511) < 0)
-			throw std::runtime_error("failed to listen on socket: " + std::string(strerror(errno)));
-		else
-			Logger::log(INFO, "server started on port: " + std::to_string(port));
-		_portSocketMap[sock] = port;
+		_portSocketMap[fd] = port;
+		_fds.push_back({ fd, POLLIN, 0 });
+		Logger::log(INFO, "upgrade: inherited listening socket for port " + std::to_string(port));
+	}
+	unsetenv(LISTEN_FDS_ENV);
+}
+
+// Old process: start the new binary; it inherits the listening sockets
+void ServerManager::upgrade() {
+	if (_upgradePid > 0 || _draining || _argv.empty()) {
+		Logger::log(WARNING, "upgrade: already in progress");
+		return;
+	}
+
+	// Everything the child needs is built before fork(): the disk pool
+	// threads may hold locks the child would never see released
+	std::string fds;
+	for (std::map<int,int>::iterator it = _portSocketMap.begin(); it != _portSocketMap.end(); ++it) {
+		if (!fds.empty())
+			fds += ",";
+		fds += std::to_string(it->first) + ":" + std::to_string(it->second);
+	}
+	std::vector<std::string> env;
+	for (char** e = environ; *e; ++e) {
+		std::string var = *e;
+		if (var.rfind(std::string(LISTEN_FDS_ENV) + "=", 0) != 0
+			&& var.rfind(std::string(UPGRADE_PARENT_ENV) + "=", 0) != 0)
+			env.push_back(var);
+	}
+	env.push_back(std::string(LISTEN_FDS_ENV) + "=" + fds);
+	env.push_back(std::string(UPGRADE_PARENT_ENV) + "=" + std::to_string(getpid()));
+
+	std::vector<char*> args, envp;
+	for (size_t i = 0; i < _argv.size(); ++i)
+		args.push_back(const_cast<char*>(_argv[i].c_str()));
+	args.push_back(NULL);
+	for (size_t i = 0; i < env.size(); ++i)
+		envp.push_back(const_cast<char*>(env[i].c_str()));
+	envp.push_back(NULL);
+
+	// Listening sockets must survive exec, just this once
+	for (std::map<int,int>::iterator it = _portSocketMap.begin(); it != _portSocketMap.end(); ++it)
+		fcntl(it->first, F_SETFD, 0);
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		Signals::unblockInChild();
+		execve(args[0], args.data(), envp.data());
+		_exit(127);
+	}
+
+	for (std::map<int,int>::iterator it = _portSocketMap.begin(); it != _portSocketMap.end(); ++it)
+		fcntl(it->first, F_SETFD, FD_CLOEXEC);
+
+	if (pid < 0) {
+		Logger::log(ERROR, "upgrade: fork failed: " + std::string(strerror(errno)));
+		return;
+	}
+	_upgradePid = pid;
+	Logger::log(INFO, "upgrade: started " + _argv[0] + " (pid " + std::to_string(pid) + ")");
+	watchChild(pid, [this](int) {
+		// New binary died before taking over: keep serving
+		if (!_draining) {
+			Logger::log(ERROR, "upgrade: new binary exited before taking over");
+			_upgradePid = -1;
+		}
+	});
+}
+
+// Old process: the new binary is accepting, stop and drain
+void ServerManager::handOver() {
+	stopListening();
+	Logger::log(INFO, "upgrade: new binary is up, draining "
+		+ std::to_string(_clientState.size()) + " connection(s)");
+	startDraining(_config->getShutdownTimeout());
+}
+
+void ServerManager::stopListening() {
+	// Called from signal handling, inside run()'s pass over _fds: the
+	// entries are retired there and swept after the pass
+	for (std::map<int,int>::iterator it = _portSocketMap.begin(); it != _portSocketMap.end(); ++it) {
+		watchFd(it->first, 0);
+		close(it->first);
+	}
+	_portSocketMap.clear();
+}
+
+// Finish what's in progress; idle keep-alive connections go right away
+void ServerManager::startDraining(time_t grace) {
+	_draining = true;
+	_drainDeadline = time(NULL) + grace;
+	for (auto& client : _clientState) {
+		int fd = client.first;
+		if (client.second.out.empty() && !client.second.suspended
+			&& _clientBuffers[fd].empty())
+			_toClose.push_back(fd);
+	}
+}
+
+bool ServerManager::drained() const {
+	return _clientState.empty() || time(NULL) >= _drainDeadline;
+}
+
+void ServerManager::watchChild(pid_t pid, std::function<void(int)> onExit) {
+	_children[pid] = std::move(onExit);
+}
+
+// Everything that was blocked in main() arrives here, on the loop
+void ServerManager::handleSignals() {
+	struct signalfd_siginfo info;
+	while (read(_signalFd, &info, sizeof(info)) == static_cast<ssize_t>(sizeof(info))) {
+		switch (info.ssi_signo) {
+			case SIGINT:
+			case SIGTERM:
+				if (_draining) {
+					Logger::log(WARNING, "second stop signal, exiting now");
+					_running = false;
+					break;
+				}
+				Logger::log(INFO, "shutting down: finishing "
+					+ std::to_string(_clientState.size()) + " connection(s) within "
+					+ std::to_string(_config->getShutdownTimeout()) + "s");
+				stopListening();
+				startDraining(_config->getShutdownTimeout());
+				_upgradePid = -1;
+				break;
+			case SIGHUP:
+				reload();
+				break;
+			case SIGUSR1:
+				Logger::reopen();
+				break;
+			case SIGUSR2:
+				upgrade();
+				break;
+			case SIGWINCH:
+				if (_upgradePid > 0 && !_draining)
+					handOver();
+				break;
+			case SIGCHLD:
+				reapChildren();
+				break;
+		}
+	}
+}
+
+// SIGCHLD coalesces: collect every child that has exited
+void ServerManager::reapChildren() {
+	int status;
+	pid_t pid;
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		auto it = _children.find(pid);
+		if (it == _children.end())
+			continue;
+		std::function<void(int)> onExit = std::move(it->second);
+		_children.erase(it);
+		onExit(status);
 	}
 }
 
@@ -151,9 +414,9 @@ void ServerManager::acceptNewClient(int listenFd) {
 		return;
 	}
 
-	_clientState[clientFd] = {clientFd, 0, time(NULL)};
 	char clientIP[INET_ADDRSTRLEN];
 	inet_ntop(AF_INET, &clientAddr.sin_addr, clientIP, INET_ADDRSTRLEN);
+	_clientState[clientFd] = {clientFd, 0, time(NULL), {}, false, false, _portSocketMap[listenFd], clientIP};
 
 	Logger::log(INFO, "accepted connection from " +
 						std::string(clientIP) + ", client fd: " +
@@ -163,6 +426,8 @@ void ServerManager::acceptNewClient(int listenFd) {
 		close(clientFd);
 		return;
 	}
+	// Keep connections out of CGI children and upgraded binaries
+	fcntl(clientFd, F_SETFD, FD_CLOEXEC);
 
 	// Add to poll and client buffer map
 	_fds.push_back({ clientFd, POLLIN, 0 });
@@ -187,13 +452,19 @@ void ServerManager::readFromClient(int clientFd) {
 	// Reject if HEADERS are too big
 	// or we haven't found the end of headers yet and buffer is too large
 	if (headerEnd == std::string::npos && buf.size() > MAX_HEADER_SIZE) {
-		_toClose.push_back(clientFd);
+		closeWhenFlushed(clientFd);
 		return;
 	}
 
-	// Process all complete requests (pipelining)
+	processRequests(clientFd);
+}
+
+// Process all complete requests (pipelining), stopping at one that waits on disk
+void ServerManager::processRequests(int clientFd) {
+	std::string &buf = _clientBuffers[clientFd];
 	size_t reqEnd;
-	while (hasFullRequest(buf, reqEnd)) {
+
+	while (!_clientState[clientFd].suspended && hasFullRequest(buf, reqEnd)) {
 
 		std::string raw = extractNextRequest(buf, reqEnd);
 
@@ -202,24 +473,38 @@ void ServerManager::readFromClient(int clientFd) {
 		_clientState[clientFd].requestCount++;
 		_clientState[clientFd].lastActivity = time(NULL);
 
-		int listenFd = _clientToListenFd[clientFd];
-		int listenPort = _portSocketMap[listenFd];
+		int listenPort = _clientState[clientFd].port;
 
-		RequestHandler h(*this, raw, clientFd);
-		h.handle(listenPort);
+		std::unique_ptr<RequestHandler> h(new RequestHandler(*this, raw, clientFd));
+		h->handle(listenPort);
 
-		if (shouldCloseAfterRequest(clientFd, h)) {
-			buf.clear();
-			_toClose.push_back(clientFd);
+		// 🔹 Parked until its disk job completes; later requests wait behind it
+		if (h->suspended()) {
+			_clientState[clientFd].suspended = true;
+			_suspended[clientFd] = std::move(h);
+			updatePollEvents(clientFd);
 			return;
 		}
 
+		if (!finishRequest(clientFd, *h))
+			return;
+
 		// If no remaining pipelined data, stop
 		if (buf.empty())
 			return;
 	}
 }
 
+// Returns false once the connection is going away
+bool ServerManager::finishRequest(int clientFd, const RequestHandler& h) {
+	if (_draining || shouldCloseAfterRequest(clientFd, h)) {
+		_clientBuffers[clientFd].clear();
+		closeWhenFlushed(clientFd);
+		return false;
+	}
+	return true;
+}
+
 bool ServerManager::readSocketIntoBuffer(int clientFd, std::string &buf) {
 	char tmp[4096];
 	ssize_t bytes = recv(clientFd, tmp, sizeof(tmp), 0);
@@ -274,16 +559,35 @@ std::string ServerManager::extractNextRequest(std::string &buf, size_t reqEnd) {
 }
 
 void ServerManager::run() {
+	inheritSockets();
 	setupSockets();
+	closeUnusedListeners();
 
-	// Add all listening sockets to poll
-	for (std::map<int,int>::iterator it = _portSocketMap.begin();
-		it != _portSocketMap.end(); ++it) {
-		_fds.push_back({ it->first, POLLIN, 0 });
+	// Started by an upgrade: tell the old process we're accepting
+	if (const char* parent = getenv(UPGRADE_PARENT_ENV)) {
+		kill(static_cast<pid_t>(std::atoi(parent)), SIGWINCH);
+		unsetenv(UPGRADE_PARENT_ENV);
 	}
+	// Disk pool signals finished jobs here
+	_fds.push_back({ _io.eventFd(), POLLIN, 0 });
+	// So do signals (blocked in main)
+	_signalFd = Signals::openFd();
+	_fds.push_back({ _signalFd, POLLIN, 0 });
+	// Warm the cgi_pool workers before the first request
+	_cgiWorkers.configure(*_config);
+	_proxy.configure(*_config);
+	_sessionManager.configure(_config->getSessionConfig());
 
 	// vector::data() returns a raw pointer to the internal array of elements
-	while (g_running) {
+	while (_running) {
+		if (_draining && drained())
+			break;
+		// FastCGI, worker and proxy answers collected during the last pass
+		_fastcgi.flush();
+		_cgiWorkers.flush();
+		_proxy.flush();
+		// Scripts that finished above freed their cgi_max_concurrency slots
+		_cgiQueue.flush();
 		int ret = poll(_fds.data(), _fds.size(), 1000); // -1 = wait forever
 		if (ret < 0) {
 			if (errno == EINTR) {
@@ -295,24 +599,71 @@ void ServerManager::run() {
 		}
 		checkTimeouts();
 		for (size_t i = 0; i < _fds.size(); ++i) {
+			// Retired earlier in this pass (its fd may even be reused by now)
+			if (_fds[i].fd < 0)
+				continue;
+			// CGI pipes: stdin wants POLLOUT, and POLLHUP alone means EOF
+			if (_fds[i].revents && _cgiPipes.count(_fds[i].fd)) {
+				handleCgiPipe(_fds[i].fd, _fds[i].revents);
+				continue;
+			}
+			if (_fds[i].revents && _fastcgi.owns(_fds[i].fd)) {
+				_fastcgi.handle(_fds[i].fd, _fds[i].revents);
+				continue;
+			}
+			if (_fds[i].revents && _cgiWorkers.owns(_fds[i].fd)) {
+				_cgiWorkers.handle(_fds[i].fd, _fds[i].revents);
+				continue;
+			}
+			if (_fds[i].revents && _proxy.owns(_fds[i].fd)) {
+				_proxy.handle(_fds[i].fd, _fds[i].revents);
+				continue;
+			}
+			// Client hung up while its script runs: no one to answer
+			if (_fds[i].revents & (POLLRDHUP | POLLHUP | POLLERR)
+				&& (_cgiJobs.count(_fds[i].fd) || _fcgiRequests.count(_fds[i].fd)
+					|| _workerRequests.count(_fds[i].fd) || _cacheWaits.count(_fds[i].fd)
+					|| _cgiQueue.waiting(_fds[i].fd) || _proxyRequests.count(_fds[i].fd))) {
+				Logger::log(INFO, "client fd " + std::to_string(_fds[i].fd) + " went away, stopping its CGI");
+				_toClose.push_back(_fds[i].fd);
+				continue;
+			}
 			// true if there is data to read on this fd
 			if (_fds[i].revents & POLLIN) {
-				if (_portSocketMap.count(_fds[i].fd)) {
+				if (_fds[i].fd == _io.eventFd()) {
+					completeIO();
+				} else if (_fds[i].fd == _signalFd) {
+					handleSignals();
+				} else if (_portSocketMap.count(_fds[i].fd)) {
 					acceptNewClient(_fds[i].fd);
 				} else {
 					readFromClient(_fds[i].fd);
 				}
 			}
+			// socket has room again for a pending response
+			if (_fds[i].revents & (POLLOUT | POLLERR | POLLHUP)
+				&& _clientState.count(_fds[i].fd)
+				&& !_clientState[_fds[i].fd].out.empty()) {
+				flushClient(_fds[i].fd);
+			}
 		}
-		// delayed cleanup
+		// delayed cleanup (a client may have been queued more than once)
 		if (!_toClose.empty()) {
+			std::sort(_toClose.begin(), _toClose.end());
+			_toClose.erase(std::unique(_toClose.begin(), _toClose.end()), _toClose.end());
 			for (int fd : _toClose) {
 				cleanupClient(fd);
 			}
 			_toClose.clear();
 		}
+		sweepFds();
 	}
 
+	for (auto& job : _cgiJobs)
+		stopCgi(*job.second);
+	for (auto& job : _detachedCgi)
+		stopCgi(*job.second);
+
 	for (auto& pair : _portSocketMap)
 		close(pair.first); // socket fd
 
@@ -329,9 +680,40 @@ bool ServerManager::shouldCloseAfterRequest(int fd, const RequestHandler &h) {
 void ServerManager::checkTimeouts() {
 	time_t now = time(NULL);
 
+	// 🔹 Scripts past CGI_TIMEOUT: kill them, the client gets a 504
+	// (not while paused: then it's the client that is slow)
+	std::vector<std::shared_ptr<CgiJob>> overdue;
+	for (auto& pair : _cgiJobs) {
+		if (!pair.second->timedOut && !pair.second->paused && now >= pair.second->deadline)
+			overdue.push_back(pair.second);
+	}
+	for (auto& pair : _detachedCgi) {
+		if (!pair.second->timedOut && now >= pair.second->deadline)
+			overdue.push_back(pair.second);
+	}
+	for (auto& job : overdue) {
+		Logger::log(WARNING, "CGI pid " + std::to_string(job->proc.pid) + " timed out, killing it");
+		job->timedOut = true;
+		stopCgi(*job);		// answered once SIGCHLD reports the exit
+		finishCgi(job);
+	}
+	_fastcgi.checkTimeouts(now);
+	_cgiWorkers.checkTimeouts(now);
+	_proxy.checkTimeouts(now);
+	_cgiQueue.checkTimeouts(now);
+	_cgiQueue.report(now);
+	_sessionManager.cleanupExpired(now);
+	for (auto& zone : _cgiCaches)
+		sweepCgiCache(zone.second, now);
+
 	for (auto it = _clientState.begin(); it != _clientState.end(); ) {
 		int fd = it->first;
 
+		// A request waiting on disk or CGI isn't the client idling
+		if (it->second.suspended) {
+			++it;
+			continue;
+		}
 		if (now - it->second.lastActivity > CLIENT_TIMEOUT) {
 			// Logger::log(INFO, "timeout reached for fd " + std::to_string(fd));
 			const char *msg =
@@ -352,6 +734,44 @@ void ServerManager::cleanupClient(int clientFd) {
 	// Close OS socket
 	close(clientFd);
 
+	// Forget disk jobs it was waiting on (their results are dropped)
+	for (auto it = _ioWaiters.begin(); it != _ioWaiters.end(); ) {
+		if (it->second.clientFd == clientFd)
+			it = _ioWaiters.erase(it);
+		else
+			++it;
+	}
+	_suspended.erase(clientFd);
+
+	// Nobody left to answer: kill its script
+	auto cgi = _cgiJobs.find(clientFd);
+	if (cgi != _cgiJobs.end()) {
+		stopCgi(*cgi->second);
+		_cgiJobs.erase(cgi);
+	}
+	auto fcgi = _fcgiRequests.find(clientFd);
+	if (fcgi != _fcgiRequests.end()) {
+		_fastcgi.cancel(fcgi->second);
+		_fcgiRequests.erase(fcgi);
+	}
+	auto worker = _workerRequests.find(clientFd);
+	if (worker != _workerRequests.end()) {
+		_cgiWorkers.cancel(worker->second);
+		_workerRequests.erase(worker);
+	}
+	auto proxied = _proxyRequests.find(clientFd);
+	if (proxied != _proxyRequests.end()) {
+		_proxy.cancel(proxied->second.id);
+		_proxyRequests.erase(proxied);
+	}
+	_cgiQueue.forget(clientFd);
+	// A cache refill it waits on carries on for the others
+	auto wait = _cacheWaits.find(clientFd);
+	if (wait != _cacheWaits.end()) {
+		wait->second->forget(clientFd);
+		_cacheWaits.erase(wait);
+	}
+
 	// Remove from all tracking structures
 	_clientBuffers.erase(clientFd);
 	_clientToListenFd.erase(clientFd);
@@ -365,3 +785,585 @@ void ServerManager::cleanupClient(int clientFd) {
 	}
 	Logger::log(TRACE, "cleaned up client fd=" + std::to_string(clientFd));
 }
+
+/*
+	Responses are queued per client and written as the socket accepts them.
+	A large body never blocks the loop: whatever send() can't take now is
+	kept and finished on POLLOUT. Mapped files are sent straight from the
+	shared mapping, without a per-request copy.
+*/
+bool ServerManager::queueSend(int clientFd, const std::string& data,
+	const std::shared_ptr<const MappedFile>& file)
+{
+	auto it = _clientState.find(clientFd);
+	if (it == _clientState.end())
+		return false;
+
+	if (!data.empty())
+		it->second.out.push_back({ data, nullptr, 0 });
+	if (file && file->size() > 0)
+		it->second.out.push_back({ "", file, 0 });
+
+	// Optimistic write: most responses fit in the socket buffer right away
+	return flushClient(clientFd);
+}
+
+bool ServerManager::flushClient(int clientFd) {
+	ClientState& state = _clientState[clientFd];
+
+	while (!state.out.empty()) {
+		OutChunk& chunk = state.out.front();
+		const char* base = chunk.file ? chunk.file->data() : chunk.data.data();
+		size_t total = chunk.file ? chunk.file->size() : chunk.data.size();
+
+		ssize_t sent = send(clientFd, base + chunk.offset, total - chunk.offset, MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				updatePollEvents(clientFd);
+				return true;
+			}
+			Logger::log(ERROR, std::string("send() failed: ") + std::strerror(errno));
+			state.out.clear();
+			_toClose.push_back(clientFd);
+			return false;
+		}
+		state.lastActivity = time(NULL);
+		chunk.offset += static_cast<size_t>(sent);
+		if (chunk.offset == total)
+			state.out.pop_front();
+	}
+
+	// Everything written
+	resumeCgiStream(clientFd);
+	resumeProxyStream(clientFd);
+	if (state.closeAfterWrite)
+		_toClose.push_back(clientFd);
+	else
+		updatePollEvents(clientFd);
+	return true;
+}
+
+// Close once the last queued byte is out; stop reading new requests meanwhile
+void ServerManager::closeWhenFlushed(int clientFd) {
+	auto it = _clientState.find(clientFd);
+	if (it == _clientState.end() || it->second.out.empty()) {
+		_toClose.push_back(clientFd);
+		return;
+	}
+	it->second.closeAfterWrite = true;
+	updatePollEvents(clientFd);
+}
+
+// Read only when we'd act on it; write only when something is queued
+void ServerManager::updatePollEvents(int fd) {
+	const ClientState& state = _clientState[fd];
+	short events = 0;
+	if (!state.closeAfterWrite && !state.suspended)
+		events |= POLLIN;
+	if (state.suspended)
+		events |= POLLRDHUP;	// notice a client that gives up waiting
+	if (!state.out.empty())
+		events |= POLLOUT;
+
+	for (size_t i = 0; i < _fds.size(); ++i) {
+		if (_fds[i].fd == fd) {
+			_fds[i].events = events;
+			return;
+		}
+	}
+}
+
+// Runs work on the disk pool; done runs back on the loop for this client
+void ServerManager::submitIO(int clientFd, std::function<void()> work, std::function<void()> done) {
+	uint64_t id = _io.submit(std::move(work));
+	_ioWaiters[id] = { clientFd, std::move(done) };
+}
+
+// eventfd fired: resume every request whose disk job finished
+void ServerManager::completeIO() {
+	for (uint64_t id : _io.drain()) {
+		auto it = _ioWaiters.find(id);
+		if (it == _ioWaiters.end())
+			continue;	// client went away meanwhile
+
+		int clientFd = it->second.clientFd;
+		std::function<void()> done = std::move(it->second.done);
+		_ioWaiters.erase(it);
+		done();
+		resumeClient(clientFd);
+	}
+}
+
+// A job of this client completed: answer it if the handler is done waiting
+void ServerManager::resumeClient(int clientFd) {
+	auto h = _suspended.find(clientFd);
+	if (h == _suspended.end() || h->second->suspended())
+		return;	// gone, or waiting on another job
+
+	std::unique_ptr<RequestHandler> finished = std::move(h->second);
+	_suspended.erase(h);
+	_clientState[clientFd].suspended = false;
+
+	// 🔹 Pick up pipelined requests that queued behind this one
+	if (finishRequest(clientFd, *finished)) {
+		updatePollEvents(clientFd);
+		processRequests(clientFd);
+	}
+}
+
+/*
+	CGI runs next to the other clients instead of blocking the loop: the
+	script's pipes sit in _fds, stdin is fed as it drains, stdout/stderr
+	are read as they fill, and SIGCHLD (via the signalfd) reports the exit.
+	A closed pipe's pollfd is set to -1 and swept after the loop pass.
+*/
+void ServerManager::startCgi(int clientFd, const CgiProcess& proc, std::string input,
+	std::function<void(CgiJob&, const std::string&)> onHead,
+	std::function<void(const CgiJob&)> done)
+{
+	auto job = std::make_shared<CgiJob>();
+	job->clientFd = clientFd;
+	job->proc = proc;
+	job->deadline = time(NULL) + CGI_TIMEOUT;
+	job->onHead = std::move(onHead);
+	job->headSeen = !job->onHead;	// nothing to stream to
+	job->done = std::move(done);
+
+	if (proc.stdinFd >= 0) {
+		job->input = std::move(input);
+		_fds.push_back({ proc.stdinFd, POLLOUT, 0 });
+		_cgiPipes[proc.stdinFd] = job;
+	}
+	_fds.push_back({ proc.stdoutFd, POLLIN, 0 });
+	_cgiPipes[proc.stdoutFd] = job;
+	_fds.push_back({ proc.stderrFd, POLLIN, 0 });
+	_cgiPipes[proc.stderrFd] = job;
+	if (clientFd < 0)
+		_detachedCgi[proc.pid] = job;
+	else
+		_cgiJobs[clientFd] = job;
+
+	// The client may be gone by then; the child is reaped either way
+	std::weak_ptr<CgiJob> weak = job;
+	watchChild(proc.pid, [this, weak](int status) {
+		std::shared_ptr<CgiJob> job = weak.lock();
+		if (!job)
+			return;
+		job->exited = true;
+		job->status = status;
+		finishCgi(job);
+	});
+
+	// The pipe is empty: fill it now rather than a poll() round later
+	if (proc.stdinFd >= 0)
+		handleCgiPipe(proc.stdinFd, 0);
+}
+
+void ServerManager::handleCgiPipe(int fd, short revents) {
+	auto it = _cgiPipes.find(fd);
+	if (it == _cgiPipes.end())
+		return;
+	std::shared_ptr<CgiJob> job = it->second;
+
+	// 🔹 stdin: write what fits, close once the body is in (EOF for the script)
+	if (fd == job->proc.stdinFd) {
+		if (!(revents & (POLLERR | POLLHUP))) {
+			ssize_t n = write(fd, job->input.data() + job->written, job->input.size() - job->written);
+			if (n > 0)
+				job->written += static_cast<size_t>(n);
+			if (n >= 0 || errno == EAGAIN || errno == EINTR) {
+				if (job->written < job->input.size())
+					return;
+			}
+		}
+		// Done, or the script stopped reading: it gets what it got
+		closeCgiPipe(job->proc.stdinFd);
+		std::string().swap(job->input);
+		return;
+	}
+
+	// 🔹 stdout / stderr: read until the pipe is empty or closed
+	bool isStdout = (fd == job->proc.stdoutFd);
+	int& pipeFd = isStdout ? job->proc.stdoutFd : job->proc.stderrFd;
+	std::string& sink = isStdout ? job->out : job->err;
+	char buf[16384];
+	while (!(isStdout && job->paused)) {
+		ssize_t n = read(fd, buf, sizeof(buf));
+		if (n > 0) {
+			if (isStdout && job->framing != CGI_BUFFERED)
+				forwardCgi(*job, buf, static_cast<size_t>(n));
+			else
+				sink.append(buf, static_cast<size_t>(n));
+			continue;
+		}
+		if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+			// Still running: start streaming once the headers are in
+			if (isStdout && !job->headSeen)
+				streamCgi(*job);
+			return;
+		}
+		break;
+	}
+	if (isStdout && job->paused)
+		return;
+	closeCgiPipe(pipeFd);
+	finishCgi(job);
+}
+
+// The script is still running and its header block is in: offer the
+// response to onHead; if taken, what came after the headers goes out now
+void ServerManager::streamCgi(CgiJob& job) {
+	size_t end = job.out.find("\r\n\r\n");
+	size_t sep = 4;
+	size_t lf = job.out.find("\n\n");
+	if (lf != std::string::npos && (end == std::string::npos || lf < end)) {
+		end = lf;
+		sep = 2;
+	}
+	if (end == std::string::npos) {
+		if (job.out.size() > MAX_HEADER_SIZE)
+			job.headSeen = true;	// not headers: answered (500) at the end
+		return;
+	}
+	job.headSeen = true;
+	job.onHead(job, job.out.substr(0, end));
+	if (job.framing == CGI_BUFFERED)
+		return;
+
+	std::string body = job.out.substr(end + sep);
+	job.out.clear();
+	if (!body.empty())
+		forwardCgi(job, body.data(), body.size());
+}
+
+// One piece of a chunked body: "<hex size>\r\n<data>\r\n"
+static std::string chunk(const char* data, size_t len) {
+	char size[20];
+	snprintf(size, sizeof(size), "%zx\r\n", len);
+	std::string out;
+	out.reserve(len + 24);
+	out.append(size);
+	out.append(data, len);
+	out.append("\r\n");
+	return out;
+}
+
+// Queues script output for the client; stops reading the script while
+// more than CGI_STREAM_WINDOW bytes wait on the socket
+void ServerManager::forwardCgi(CgiJob& job, const char* data, size_t len) {
+	// A streaming script only times out when it goes quiet
+	job.deadline = time(NULL) + CGI_TIMEOUT;
+	if (job.framing == CGI_DISCARD)
+		return;
+
+	std::string encoded;
+	if (job.encoder) {
+		encoded = job.encoder->write(data, len);
+		data = encoded.data();
+		len = encoded.size();
+		if (len == 0)
+			return;
+	}
+	std::string piece = (job.framing == CGI_CHUNKED)
+		? chunk(data, len) : std::string(data, len);
+	if (!queueSend(job.clientFd, piece))
+		return;
+
+	if (queuedBytes(job.clientFd) > CGI_STREAM_WINDOW && !job.paused) {
+		job.paused = true;
+		watchFd(job.proc.stdoutFd, 0);	// stays open, just not polled
+	}
+}
+
+// The script is done: a clean exit ends the body, anything else leaves
+// it cut short (the handler closes the connection)
+void ServerManager::endCgiStream(CgiJob& job) {
+	bool ok = !job.timedOut && WIFEXITED(job.status) && WEXITSTATUS(job.status) == 0;
+	if (!ok || job.framing != CGI_CHUNKED)
+		return;
+	std::string tail;
+	if (job.encoder) {
+		std::string rest = job.encoder->finish();
+		if (!rest.empty())
+			tail = chunk(rest.data(), rest.size());
+	}
+	queueSend(job.clientFd, tail + "0\r\n\r\n");
+}
+
+// Response bytes waiting for the client's socket
+size_t ServerManager::queuedBytes(int clientFd) {
+	size_t queued = 0;
+	for (const OutChunk& chunk : _clientState[clientFd].out)
+		queued += (chunk.file ? chunk.file->size() : chunk.data.size()) - chunk.offset;
+	return queued;
+}
+
+// The client's queue drained: let its script write again
+void ServerManager::resumeCgiStream(int clientFd) {
+	auto it = _cgiJobs.find(clientFd);
+	if (it == _cgiJobs.end() || !it->second->paused)
+		return;
+	CgiJob& job = *it->second;
+	job.paused = false;
+	job.deadline = time(NULL) + CGI_TIMEOUT;	// the pause wasn't the script's doing
+	if (job.proc.stdoutFd >= 0)
+		_fds.push_back({ job.proc.stdoutFd, POLLIN, 0 });
+}
+
+// Closes a pipe end and retires its pollfd (removed by sweepFds)
+void ServerManager::closeCgiPipe(int& fd) {
+	if (fd < 0)
+		return;
+	for (size_t i = 0; i < _fds.size(); ++i) {
+		if (_fds[i].fd == fd) {
+			_fds[i].fd = -1;
+			break;
+		}
+	}
+	_cgiPipes.erase(fd);
+	close(fd);
+	fd = -1;
+}
+
+// Kills the script (unless already gone) and drops its pipes
+void ServerManager::stopCgi(CgiJob& job) {
+	if (!job.exited)
+		kill(job.proc.pid, SIGKILL);
+	closeCgiPipe(job.proc.stdinFd);
+	closeCgiPipe(job.proc.stdoutFd);
+	closeCgiPipe(job.proc.stderrFd);
+}
+
+// Answers once the script has exited and all its output is in
+void ServerManager::finishCgi(const std::shared_ptr<CgiJob>& job) {
+	if (!job->exited || job->proc.stdoutFd >= 0 || job->proc.stderrFd >= 0)
+		return;
+	closeCgiPipe(job->proc.stdinFd);
+
+	if (job->clientFd < 0) {
+		if (_detachedCgi.erase(job->proc.pid))
+			job->done(*job);
+		return;
+	}
+	auto it = _cgiJobs.find(job->clientFd);
+	if (it == _cgiJobs.end() || it->second != job)
+		return;
+	_cgiJobs.erase(it);
+
+	if (job->framing != CGI_BUFFERED)
+		endCgiStream(*job);
+	job->done(*job);
+	resumeClient(job->clientFd);
+}
+
+// Sends the request to its cgi_pass backend; done runs once the answer is in
+void ServerManager::submitFastCgi(int clientFd, const std::string& backend,
+	const std::map<std::string, std::string>& params, std::string body,
+	std::function<void(const FastCgiResult&)> done)
+{
+	uint64_t id = _fastcgi.submit(backend, params, std::move(body),
+		[this, clientFd, done](const FastCgiResult& result) {
+			_fcgiRequests.erase(clientFd);
+			done(result);
+			if (clientFd >= 0)
+				resumeClient(clientFd);
+		});
+	if (clientFd >= 0)
+		_fcgiRequests[clientFd] = id;
+}
+
+/*
+	A proxied answer is relayed as it arrives: the head once parsed, then
+	each piece of body (re-chunked if the backend gave no length). A
+	client more than PROXY_STREAM_WINDOW behind pauses the backend's
+	connection until its queue drains.
+*/
+void ServerManager::submitProxy(int clientFd, const std::string& upstream, const HttpRequest& req,
+	std::string body, std::function<bool(const ProxyHead&)> onHead,
+	std::function<void(const ProxyResult&)> done)
+{
+	uint64_t id = _proxy.submit(upstream, req, _clientState[clientFd].address, std::move(body),
+		[this, clientFd, onHead](const ProxyHead& head) {
+			auto it = _proxyRequests.find(clientFd);
+			if (it != _proxyRequests.end())
+				it->second.chunked = onHead(head);
+		},
+		[this, clientFd](const char* data, size_t len) { forwardProxy(clientFd, data, len); },
+		[this, clientFd, done](const ProxyResult& result) {
+			auto it = _proxyRequests.find(clientFd);
+			if (it != _proxyRequests.end()) {
+				if (result.ok && it->second.chunked)
+					queueSend(clientFd, "0\r\n\r\n");
+				_proxyRequests.erase(it);
+			}
+			done(result);
+			resumeClient(clientFd);
+		});
+	_proxyRequests[clientFd].id = id;
+}
+
+void ServerManager::forwardProxy(int clientFd, const char* data, size_t len) {
+	auto it = _proxyRequests.find(clientFd);
+	if (it == _proxyRequests.end() || len == 0)
+		return;
+	ProxyStream& stream = it->second;
+	std::string piece = stream.chunked ? chunk(data, len) : std::string(data, len);
+	if (!queueSend(clientFd, piece))
+		return;
+	if (!stream.paused && queuedBytes(clientFd) > PROXY_STREAM_WINDOW) {
+		stream.paused = true;
+		_proxy.pause(stream.id);
+	}
+}
+
+// The client's queue drained: read its backend again
+void ServerManager::resumeProxyStream(int clientFd) {
+	auto it = _proxyRequests.find(clientFd);
+	if (it == _proxyRequests.end() || !it->second.paused)
+		return;
+	it->second.paused = false;
+	_proxy.resume(it->second.id);
+}
+
+// Runs the script on a warm worker of the location's cgi_pool
+void ServerManager::submitCgiWorker(int clientFd, const std::string& pool,
+	const std::map<std::string, std::string>& env, const std::string& body,
+	std::function<void(const CgiWorkerResult&)> done)
+{
+	uint64_t id = _cgiWorkers.submit(pool, env, body,
+		[this, clientFd, done](const CgiWorkerResult& result) {
+			_workerRequests.erase(clientFd);
+			done(result);
+			if (clientFd >= 0)
+				resumeClient(clientFd);
+		});
+	if (clientFd >= 0)
+		_workerRequests[clientFd] = id;
+}
+
+void ServerManager::queueCgi(const Server& srv, const Location& loc, int clientFd,
+	CgiQueue::StartFn start, std::function<void(int code)> reject)
+{
+	std::string client = (clientFd >= 0) ? _clientState[clientFd].address : "";
+	std::shared_ptr<CgiSlot> slot = _cgiQueue.submit(CgiQueue::gateKey(srv.getRoot(), loc),
+		loc.getCgiLimits(), clientFd, client,
+		[this, clientFd, start, reject](const std::shared_ptr<CgiSlot>& slot) {
+			try {
+				start(slot);
+			}
+			catch (const std::exception& e) {
+				Logger::log(ERROR, std::string("500 error starting queued CGI: ") + e.what());
+				reject(500);
+			}
+			if (clientFd >= 0)
+				resumeClient(clientFd);
+		},
+		[this, clientFd, reject]() {
+			reject(503);
+			if (clientFd >= 0)
+				resumeClient(clientFd);
+		});
+	if (slot)
+		start(slot);
+}
+
+std::shared_ptr<CgiCache> ServerManager::cgiCache(const Server& srv, const Location& loc) {
+	if (loc.getCgiCache().maxBytes == 0)
+		return nullptr;
+	std::string zone = CgiCache::zoneKey(srv.getRoot(), loc);
+	std::shared_ptr<CgiCache>& cache = _cgiCaches[zone];
+	if (!cache)
+		cache = std::make_shared<CgiCache>(zone, loc.getCgiCache());
+	return cache;
+}
+
+// Zones the new configuration no longer has (refills in flight keep theirs alive)
+void ServerManager::pruneCgiCaches() {
+	std::set<std::string> wanted;
+	for (const Server& srv : _config->getServers()) {
+		for (const Location& loc : srv.getLocations()) {
+			if (loc.getCgiCache().maxBytes)
+				wanted.insert(CgiCache::zoneKey(srv.getRoot(), loc));
+		}
+	}
+	for (auto it = _cgiCaches.begin(); it != _cgiCaches.end(); ) {
+		if (wanted.count(it->first))
+			++it;
+		else
+			it = _cgiCaches.erase(it);
+	}
+}
+
+// cgi_cache_path sweep on the disk pool, if one is due and none runs
+void ServerManager::sweepCgiCache(const std::shared_ptr<CgiCache>& cache, time_t now) {
+	if (!cache->sweepDue(now))
+		return;
+	cache->beginSweep(now);
+	std::string dir = cache->config().path;
+	size_t maxBytes = cache->config().diskMaxBytes;
+	submitIO(-1, [dir, maxBytes, now]() { CgiCache::sweepDisk(dir, maxBytes, now); },
+		[cache]() { cache->endSweep(); });
+}
+
+void ServerManager::waitCgiCache(const std::shared_ptr<CgiCache>& cache, const std::string& key,
+	int clientFd, CgiCache::WaitFn fn)
+{
+	cache->wait(key, clientFd, std::move(fn));
+	_cacheWaits[clientFd] = cache;
+}
+
+// A refill is done: keep the answer if it may be kept (on disk too), and
+// hand it to everyone who waited. One that can't be kept may be personal:
+// only the client whose miss asked for it gets it, the others run their own.
+void ServerManager::completeCgiFill(const std::shared_ptr<CgiCache>& cache, const std::string& key,
+	const std::string& path, const CgiOutcome& outcome)
+{
+	HttpResponse res;
+	int code = CgiHandler::interpret(outcome, path, res);
+	bool kept = false;
+	if (code == 0) {
+		CgiCacheEntry entry;
+		kept = cache->store(key, res, time(NULL), entry);
+		if (!cache->config().path.empty()) {
+			std::string file = cache->diskFile(key);
+			if (kept) {
+				_io.submit([file, entry]() { CgiCache::writeDisk(file, entry); });
+				cache->noteDiskWrite(entry.bytes);
+				sweepCgiCache(cache, time(NULL));
+			} else {
+				_io.submit([file]() { CgiCache::removeDisk(file); });
+			}
+		}
+	}
+
+	CgiCache::Fill fill = cache->endFill(key);
+	for (auto& w : fill.waiters) {
+		_cacheWaits.erase(w.first);
+		if (code == 0 && !kept && w.first != fill.leader)
+			w.second(nullptr, 0);
+		else
+			w.second(code ? nullptr : &res, code);
+		resumeClient(w.first);
+	}
+}
+
+// Poll registration for fds owned by someone else (0 = forget it)
+void ServerManager::watchFd(int fd, short events) {
+	for (size_t i = 0; i < _fds.size(); ++i) {
+		if (_fds[i].fd == fd) {
+			if (events == 0)
+				_fds[i].fd = -1;	// swept after the loop pass
+			else
+				_fds[i].events = events;
+			return;
+		}
+	}
+	if (events != 0)
+		_fds.push_back({ fd, events, 0 });
+}
+
+// Drops the pollfds retired during the last pass
+void ServerManager::sweepFds() {
+	_fds.erase(std::remove_if(_fds.begin(), _fds.end(),
+		[](const struct pollfd& p) { return p.fd < 0; }), _fds.end());
+}
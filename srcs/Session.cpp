@@ -1,43 +1,126 @@
 #include "Session.hpp"
-#include <cstdlib>
+#include <sys/random.h>
+#include <random>
+
+bool operator==(const SessionKey& a, const SessionKey& b) {
+	return a.hi == b.hi && a.lo == b.lo;
+}
+
+// 128 bits from the kernel's CSPRNG: ids must not be guessable
+SessionKey Session::generateKey() {
+	SessionKey key;
+	uint64_t words[2];
+	if (getrandom(words, sizeof(words), 0) == static_cast<ssize_t>(sizeof(words))) {
+		key.hi = words[0];
+		key.lo = words[1];
+	} else {
+		std::random_device rd;
+		key.hi = (static_cast<uint64_t>(rd()) << 32) | rd();
+		key.lo = (static_cast<uint64_t>(rd()) << 32) | rd();
+	}
+	return key;
+}
 
 std::string Session::generateSessionId() {
-	static const char chars[] =
-		"0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
-	std::string id;
-	for (int i = 0; i < 16; ++i)
-		id += chars[rand() % (sizeof(chars) - 1)];
+	return formatId(generateKey());
+}
+
+std::string Session::formatId(const SessionKey& key) {
+	static const char hex[] = "0123456789abcdef";
+	std::string id(32, '0');
+	for (int i = 0; i < 16; ++i) {
+		id[15 - i] = hex[(key.hi >> (i * 4)) & 0xf];
+		id[31 - i] = hex[(key.lo >> (i * 4)) & 0xf];
+	}
 	return id;
 }
 
+bool Session::parseId(const std::string& id, SessionKey& key) {
+	if (id.size() != 32)
+		return false;
+	uint64_t words[2] = { 0, 0 };
+	for (size_t i = 0; i < 32; ++i) {
+		char c = id[i];
+		uint64_t digit;
+		if (c >= '0' && c <= '9')
+			digit = static_cast<uint64_t>(c - '0');
+		else if (c >= 'a' && c <= 'f')
+			digit = static_cast<uint64_t>(c - 'a' + 10);
+		else if (c >= 'A' && c <= 'F')
+			digit = static_cast<uint64_t>(c - 'A' + 10);
+		else
+			return false;
+		words[i / 16] = (words[i / 16] << 4) | digit;
+	}
+	key.hi = words[0];
+	key.lo = words[1];
+	return true;
+}
+
+uint64_t Session::hashKey(const SessionKey& key, uint64_t seed) {
+	uint64_t h = key.hi ^ seed;
+	h ^= key.lo + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
 Session::Session()
-	: _id(generateSessionId()), _lastAccess(time(NULL)), _expirySeconds(3600) {}
+	: _key(generateKey()), _lastAccess(time(NULL)) {}
 
-Session::Session(const std::string& id)
-	: _id(id), _lastAccess(time(NULL)), _expirySeconds(3600) {}
+Session::Session(const SessionKey& key)
+	: _key(key), _lastAccess(time(NULL)) {}
 
-const std::string& Session::getId() const { return _id; }
+std::string Session::getId() const { return formatId(_key); }
+const SessionKey& Session::getKey() const { return _key; }
 
 void Session::set(const std::string& key, const std::string& value) {
-	_data[key] = value;
+	_dirty = true;
+	for (auto& kv : _data) {
+		if (kv.first == key) {
+			kv.second = value;
+			touch();
+			return;
+		}
+	}
+	_data.push_back(std::make_pair(key, value));
 	touch();
 }
 
+void Session::markSaved() { _dirty = false; }
+bool Session::dirty() const { return _dirty; }
+
+void Session::setStoreSlot(uint32_t slot, uint32_t generation) {
+	_slot = slot;
+	_generation = generation;
+}
+
+uint32_t Session::storeSlot() const { return _slot; }
+uint32_t Session::storeGeneration() const { return _generation; }
+
 std::string Session::getSession(const std::string& key) const {
-	std::map<std::string, std::string>::const_iterator it = _data.find(key);
-	return (it != _data.end()) ? it->second : "";
+	for (const auto& kv : _data) {
+		if (kv.first == key)
+			return kv.second;
+	}
+	return "";
 }
 
-const std::map<std::string, std::string>& Session::getData() const {
+const std::vector<std::pair<std::string, std::string>>& Session::getData() const {
 	return _data;
 }
 
-void Session::touch() { _lastAccess = time(NULL); }
+time_t Session::lastAccess() const { return _lastAccess; }
 
-bool Session::expired() const {
-	return (difftime(time(NULL), _lastAccess) > _expirySeconds);
-}
+void Session::touch() { _lastAccess = time(NULL); }
 
 bool Session::has(const std::string& key) const {
-	return _data.count(key);
-}
\ No newline at end of file
+	for (const auto& kv : _data) {
+		if (kv.first == key)
+			return true;
+	}
+	return false;
+}
@@ -1,42 +1,308 @@
 #include "SessionManager.hpp"
+#include "Logger.hpp"
+#include <algorithm>
 
-SessionManager::SessionManager() {}
+SessionManager::SessionManager() : _seed(Session::generateKey().hi) {
+	configure(SessionConfig());
+}
+
+// The id is random already, but a client may send any id it likes:
+// mixed with a per-process seed so collisions can't be aimed at
+uint64_t SessionManager::hash(const SessionKey& key) const {
+	return Session::hashKey(key, _seed);
+}
+
+// Top bits pick the shard, low bits the slot
+SessionManager::Shard& SessionManager::shardFor(uint64_t h) {
+	return _shards[(h >> 56) % SESSION_SHARDS];
+}
+
+bool SessionManager::expired(const Entry& e, time_t now) const {
+	return now - e.session->lastAccess() > _config.timeout;
+}
+
+void SessionManager::configure(const SessionConfig& config) {
+	configureShared(config);
+
+	std::vector<std::unique_lock<std::mutex>> locks;
+	for (Shard& shard : _shards)
+		locks.emplace_back(shard.lock);
+
+	_config = config;
+	// A session's whole timeout spans about half the wheel
+	_tickSeconds = std::max<time_t>(1, (config.timeout * 2 + SESSION_WHEEL_SLOTS - 1) / SESSION_WHEEL_SLOTS);
+	time_t now = time(NULL);
+	for (Shard& shard : _shards) {
+		shard.wheel.assign(SESSION_WHEEL_SLOTS, std::vector<std::pair<uint32_t, uint32_t>>());
+		shard.tick = static_cast<uint64_t>(now / _tickSeconds);
+		for (uint32_t i = 0; i < shard.entries.size(); ++i) {
+			if (shard.entries[i].session)
+				schedule(shard, i);
+		}
+	}
+	// 🔹 Over a lowered session_max: the oldest of each shard in turn
+	while (_total > _config.maxSessions) {
+		for (Shard& shard : _shards) {
+			if (_total > _config.maxSessions && shard.oldest != NIL)
+				erase(shard, shard.oldest);
+		}
+	}
+}
+
+int64_t SessionManager::lookup(Shard& shard, const SessionKey& key, uint64_t h) const {
+	if (shard.index.empty())
+		return -1;
+	size_t mask = shard.index.size() - 1;
+	for (size_t i = h & mask; ; i = (i + 1) & mask) {
+		uint32_t slot = shard.index[i];
+		if (slot == 0)
+			return -1;
+		if (shard.entries[slot - 1].key == key)
+			return slot - 1;
+	}
+}
+
+// Doubles the index (never more than half full) and places everything again
+void SessionManager::grow(Shard& shard) {
+	size_t size = std::max<size_t>(64, shard.index.size() * 2);
+	shard.index.assign(size, 0);
+	size_t mask = size - 1;
+	for (uint32_t e = 0; e < shard.entries.size(); ++e) {
+		if (!shard.entries[e].session)
+			continue;
+		size_t i = shard.entries[e].hash & mask;
+		while (shard.index[i] != 0)
+			i = (i + 1) & mask;
+		shard.index[i] = e + 1;
+	}
+}
+
+uint32_t SessionManager::insert(Shard& shard, const SessionKey& key, uint64_t h) {
+	if ((shard.count + 1) * 2 > shard.index.size())
+		grow(shard);
+
+	uint32_t e;
+	if (!shard.free.empty()) {
+		e = shard.free.back();
+		shard.free.pop_back();
+	} else {
+		e = static_cast<uint32_t>(shard.entries.size());
+		shard.entries.push_back(Entry());
+	}
+	Entry& entry = shard.entries[e];
+	entry.key = key;
+	entry.hash = h;
+	entry.session = std::make_shared<Session>(key);
+
+	size_t mask = shard.index.size() - 1;
+	size_t i = h & mask;
+	while (shard.index[i] != 0)
+		i = (i + 1) & mask;
+	shard.index[i] = e + 1;
+
+	pushNewest(shard, e);
+	schedule(shard, e);
+	shard.count++;
+	_total++;
+	return e;
+}
 
-Session& SessionManager::getOrCreate(const std::string& id) {
-	// If ID exists → return the same session
-	if (!id.empty()) {
-		auto it = _sessions.find(id);
-		if (it != _sessions.end()) {
-			it->second.touch();
-			return it->second;
+// Removes the entry; later slots of its run move back into the gap
+void SessionManager::erase(Shard& shard, uint32_t e) {
+	Entry& entry = shard.entries[e];
+	size_t mask = shard.index.size() - 1;
+	size_t i = entry.hash & mask;
+	while (shard.index[i] != e + 1)
+		i = (i + 1) & mask;
+
+	for (size_t j = (i + 1) & mask; shard.index[j] != 0; j = (j + 1) & mask) {
+		size_t home = shard.entries[shard.index[j] - 1].hash & mask;
+		// j stays if its home lies cyclically in (i, j]
+		bool stays = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+		if (stays)
+			continue;
+		shard.index[i] = shard.index[j];
+		i = j;
+	}
+	shard.index[i] = 0;
+
+	unlinkLru(shard, e);
+	entry.session.reset();
+	entry.generation++;
+	shard.free.push_back(e);
+	shard.count--;
+	_total--;
+}
+
+void SessionManager::unlinkLru(Shard& shard, uint32_t e) {
+	Entry& entry = shard.entries[e];
+	if (entry.newer != NIL)
+		shard.entries[entry.newer].older = entry.older;
+	else
+		shard.newest = entry.older;
+	if (entry.older != NIL)
+		shard.entries[entry.older].newer = entry.newer;
+	else
+		shard.oldest = entry.newer;
+	entry.newer = NIL;
+	entry.older = NIL;
+}
+
+void SessionManager::pushNewest(Shard& shard, uint32_t e) {
+	Entry& entry = shard.entries[e];
+	entry.newer = NIL;
+	entry.older = shard.newest;
+	if (shard.newest != NIL)
+		shard.entries[shard.newest].newer = e;
+	shard.newest = e;
+	if (shard.oldest == NIL)
+		shard.oldest = e;
+}
+
+// Into the bucket of the tick after its deadline (at most a turn ahead)
+void SessionManager::schedule(Shard& shard, uint32_t e) {
+	Entry& entry = shard.entries[e];
+	time_t deadline = entry.session->lastAccess() + _config.timeout;
+	uint64_t due = static_cast<uint64_t>(deadline / _tickSeconds) + 1;
+	due = std::max(due, shard.tick + 1);
+	due = std::min(due, shard.tick + SESSION_WHEEL_SLOTS - 1);
+	entry.due = due;
+	shard.wheel[due % SESSION_WHEEL_SLOTS].push_back(std::make_pair(e, entry.generation));
+}
+
+// Runs the buckets of every tick up to now: expired sessions go,
+// the ones used since they were scheduled move on
+size_t SessionManager::advance(Shard& shard, time_t now) {
+	uint64_t target = static_cast<uint64_t>(now / _tickSeconds);
+	if (target <= shard.tick)
+		return 0;
+	// Behind by more than a turn: every bucket once is enough
+	if (target - shard.tick > SESSION_WHEEL_SLOTS)
+		shard.tick = target - SESSION_WHEEL_SLOTS;
+
+	size_t dropped = 0;
+	while (shard.tick < target) {
+		uint64_t tick = ++shard.tick;
+		std::vector<std::pair<uint32_t, uint32_t>> bucket;
+		bucket.swap(shard.wheel[tick % SESSION_WHEEL_SLOTS]);
+		for (const auto& ref : bucket) {
+			Entry& entry = shard.entries[ref.first];
+			if (!entry.session || entry.generation != ref.second || entry.due > tick)
+				continue;	// freed, reused, or moved further
+			if (expired(entry, now)) {
+				erase(shard, ref.first);
+				dropped++;
+			} else {
+				schedule(shard, ref.first);
+			}
 		}
+	}
+	return dropped;
+}
 
-		// ID does not exist → create session USING SAME ID
-		_sessions[id] = Session(id);
-		return _sessions[id];
+// Opens (or keeps) the shared store session_store asks for
+void SessionManager::configureShared(const SessionConfig& config) {
+	if (config.store != SESSION_STORE_SHARED) {
+		_shared.reset();
+		return;
 	}
+	if (_shared && _shared->path() == SharedSessionStore::pathFor(config.path)
+		&& _shared->maxSessions() == config.maxSessions) {
+		_shared->setTimeout(config.timeout);
+		return;
+	}
+	_shared.reset();
+	try {
+		_shared.reset(new SharedSessionStore(config.path, config.maxSessions, config.timeout));
+	} catch (const std::exception& e) {
+		Logger::log(ERROR, std::string(e.what()) + ", keeping sessions in memory");
+	}
+}
+
+std::shared_ptr<Session> SessionManager::create() {
+	if (_shared)
+		return _shared->create();
+	SessionKey key = Session::generateKey();
+	uint64_t h = hash(key);
+	Shard& shard = shardFor(h);
 
-	// No ID provided → generate new one
-	std::string newId = Session::generateSessionId();
-	_sessions[newId] = Session(newId);
-	return _sessions[newId];
+	// 🔹 Full: the least recently used of its shard makes room, or of the
+	// next shard holding any (one shard locked at a time)
+	size_t first = static_cast<size_t>(&shard - _shards);
+	for (size_t i = 0; i < SESSION_SHARDS && _total >= _config.maxSessions; ++i) {
+		Shard& victim = _shards[(first + i) % SESSION_SHARDS];
+		std::lock_guard<std::mutex> guard(victim.lock);
+		while (_total >= _config.maxSessions && victim.oldest != NIL)
+			erase(victim, victim.oldest);
+	}
+	std::lock_guard<std::mutex> guard(shard.lock);
+	return shard.entries[insert(shard, key, h)].session;
 }
 
-bool SessionManager::exists(const std::string& id) const {
-	return _sessions.find(id) != _sessions.end();
+std::shared_ptr<Session> SessionManager::find(const std::string& id) {
+	SessionKey key;
+	if (!Session::parseId(id, key))
+		return nullptr;
+	if (_shared)
+		return _shared->find(key);
+	uint64_t h = hash(key);
+	Shard& shard = shardFor(h);
+	std::lock_guard<std::mutex> guard(shard.lock);
+
+	int64_t found = lookup(shard, key, h);
+	if (found < 0)
+		return nullptr;
+	uint32_t e = static_cast<uint32_t>(found);
+	if (expired(shard.entries[e], time(NULL))) {
+		erase(shard, e);
+		return nullptr;
+	}
+	shard.entries[e].session->touch();
+	unlinkLru(shard, e);
+	pushNewest(shard, e);
+	return shard.entries[e].session;
+}
+
+bool SessionManager::exists(const std::string& id) {
+	return find(id) != nullptr;
 }
 
 void SessionManager::remove(const std::string& id) {
-	_sessions.erase(id);
+	SessionKey key;
+	if (!Session::parseId(id, key))
+		return;
+	if (_shared) {
+		_shared->remove(key);
+		return;
+	}
+	uint64_t h = hash(key);
+	Shard& shard = shardFor(h);
+	std::lock_guard<std::mutex> guard(shard.lock);
+	int64_t found = lookup(shard, key, h);
+	if (found >= 0)
+		erase(shard, static_cast<uint32_t>(found));
 }
 
-void SessionManager::cleanupExpired() {
-	for (std::map<std::string, Session>::iterator it = _sessions.begin();
-		 it != _sessions.end(); ) {
-		if (it->second.expired())
-			_sessions.erase(it++);
-		else
-			++it;
+size_t SessionManager::cleanupExpired(time_t now) {
+	size_t dropped = 0;
+	if (_shared)
+		dropped = _shared->cleanupExpired(now);
+	for (Shard& shard : _shards) {
+		std::lock_guard<std::mutex> guard(shard.lock);
+		dropped += advance(shard, now);
 	}
+	if (dropped)
+		Logger::log(DEBUG, "sessions: " + std::to_string(dropped) + " expired, " + std::to_string(size()) + " left");
+	return dropped;
 }
 
+void SessionManager::save(Session& session) {
+	if (_shared)
+		_shared->save(session);
+	else
+		session.markSaved();
+}
+
+size_t SessionManager::size() {
+	return _shared ? _shared->size() : _total.load();
+}
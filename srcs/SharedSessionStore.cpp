@@ -0,0 +1,382 @@
+#include "SharedSessionStore.hpp"
+#include "Logger.hpp"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include <new>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+static const char SHARED_SESSION_MAGIC[8] = "WSSESS1";
+
+struct SharedSessionStore::Header {
+	char					magic[8];
+	uint32_t				slotSize;
+	uint32_t				ways;
+	uint64_t				buckets;
+	uint64_t				seed;		// same bucket for a key in every process
+	std::atomic<uint64_t>	used;
+	pthread_mutex_t			stripes[SHARED_SESSION_STRIPES];
+};
+
+struct SharedSessionStore::Slot {
+	uint64_t	hi;
+	uint64_t	lo;
+	uint32_t	generation;
+	uint32_t	used;
+	int64_t		lastAccess;
+	uint32_t	length;
+	char		data[SHARED_SESSION_SLOT - 36];
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the session count is shared between processes");
+
+// Creates or opens a store file (or shared memory object); one somebody
+// else made, or that others may read, is refused: it would let them see
+// and forge session ids
+static int openPrivate(const std::string& path, bool shm) {
+	int fd = shm ? shm_open(path.c_str(), O_RDWR | O_CREAT, 0600)
+		: ::open(path.c_str(), O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+	if (fd < 0)
+		throw std::runtime_error("session_store " + path + ": " + strerror(errno));
+	struct stat st;
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_uid != geteuid()
+		|| (st.st_mode & (S_IRWXG | S_IRWXO)) != 0) {
+		close(fd);
+		throw std::runtime_error("session_store " + path
+			+ " must be a regular file owned by this user, with no group or other permissions");
+	}
+	return fd;
+}
+
+// Holds a stripe; a lock whose holder died is taken over (its bucket may
+// be half written, which at worst loses a session)
+namespace {
+	struct StripeLock {
+		pthread_mutex_t*	m;
+
+		StripeLock(pthread_mutex_t* mutex) : m(mutex) {
+			if (pthread_mutex_lock(m) == EOWNERDEAD) {
+				Logger::log(WARNING, "session store: a process died holding a lock, recovering it");
+				pthread_mutex_consistent(m);
+			}
+		}
+		~StripeLock() { pthread_mutex_unlock(m); }
+	};
+}
+
+std::string SharedSessionStore::pathFor(const std::string& path) {
+	return path.empty() ? SHARED_SESSION_NAME : path;
+}
+
+SharedSessionStore::SharedSessionStore(const std::string& path, size_t maxSessions, time_t timeout)
+	: _path(pathFor(path)), _shm(path.empty()), _maxSessions(maxSessions), _timeout(timeout),
+	_buckets(std::max<size_t>(1, (maxSessions + SHARED_SESSION_WAYS - 1) / SHARED_SESSION_WAYS))
+{
+	static_assert(sizeof(Slot) == SHARED_SESSION_SLOT, "slots are SHARED_SESSION_SLOT bytes");
+	_mapSize = slotsOffset() + _buckets * SHARED_SESSION_WAYS * sizeof(Slot);
+	try {
+		open();
+	} catch (...) {
+		if (_map)
+			munmap(_map, _mapSize);
+		if (_fd >= 0)
+			close(_fd);
+		throw;
+	}
+}
+
+SharedSessionStore::~SharedSessionStore() {
+	if (_map)
+		munmap(_map, _mapSize);
+	if (_fd >= 0)
+		close(_fd);		// drops the flock
+}
+
+// Slots start on a page of their own
+size_t SharedSessionStore::slotsOffset() {
+	return (sizeof(Header) + 4095) / 4096 * 4096;
+}
+
+/*
+	Every process keeps a shared flock on the file while it uses it. One
+	that gets it exclusive is alone: it may lay the file out again and
+	reset the mutexes (a dead process could have left one held), then
+	shares it like the others.
+
+	Turning the exclusive flock into a shared one isn't atomic, so all of
+	this happens under a second, exclusive flock on "<path>.lock": nobody
+	else can find itself alone in between.
+*/
+void SharedSessionStore::open() {
+	struct OpenLock {
+		int	fd;
+		~OpenLock() { close(fd); }		// drops the flock
+	} gate = { openPrivate(_path + ".lock", _shm) };
+	if (flock(gate.fd, LOCK_EX) < 0)
+		throw std::runtime_error("session_store " + _path + ".lock: flock: " + strerror(errno));
+
+	_fd = openPrivate(_path, _shm);
+	bool alone = (flock(_fd, LOCK_EX | LOCK_NB) == 0);
+	if (!alone && flock(_fd, LOCK_SH) < 0)
+		throw std::runtime_error("session_store " + _path + ": flock: " + strerror(errno));
+
+	struct stat st;
+	if (fstat(_fd, &st) < 0)
+		throw std::runtime_error("session_store " + _path + ": " + strerror(errno));
+	size_t fileSize = static_cast<size_t>(st.st_size);
+	if (fileSize != _mapSize) {
+		if (!alone)
+			throw std::runtime_error("session_store " + _path + " is in use with another session_max");
+		// ftruncate to 0 first: everything comes back zeroed
+		if (ftruncate(_fd, 0) < 0 || ftruncate(_fd, static_cast<off_t>(_mapSize)) < 0)
+			throw std::runtime_error("session_store " + _path + ": " + strerror(errno));
+	}
+
+	_map = mmap(NULL, _mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+	if (_map == MAP_FAILED) {
+		_map = nullptr;
+		throw std::runtime_error("session_store " + _path + ": mmap: " + strerror(errno));
+	}
+	_header = static_cast<Header*>(_map);
+	_slots = reinterpret_cast<Slot*>(static_cast<char*>(_map) + slotsOffset());
+
+	if (!matches(fileSize)) {
+		if (!alone)
+			throw std::runtime_error("session_store " + _path + " is in use with another layout");
+		if (fileSize != 0 && fileSize == _mapSize)
+			Logger::log(WARNING, "session_store " + _path + ": unknown layout, starting empty");
+		initialize();
+	} else if (alone) {
+		resetLocks();
+		Logger::log(INFO, "session_store " + _path + ": " + std::to_string(size()) + " sessions kept");
+	}
+	_seed = _header->seed;
+	if (alone)
+		flock(_fd, LOCK_SH);
+}
+
+bool SharedSessionStore::matches(size_t fileSize) const {
+	return fileSize == _mapSize
+		&& std::memcmp(_header->magic, SHARED_SESSION_MAGIC, sizeof(SHARED_SESSION_MAGIC)) == 0
+		&& _header->slotSize == sizeof(Slot) && _header->ways == SHARED_SESSION_WAYS
+		&& _header->buckets == _buckets;
+}
+
+// A new layout on a zeroed file; the magic goes last
+void SharedSessionStore::initialize() {
+	std::memset(static_cast<void*>(_header), 0, sizeof(Header));
+	new (&_header->used) std::atomic<uint64_t>(0);
+	_header->slotSize = sizeof(Slot);
+	_header->ways = SHARED_SESSION_WAYS;
+	_header->buckets = _buckets;
+	_header->seed = Session::generateKey().hi;
+	resetLocks();
+	std::memcpy(_header->magic, SHARED_SESSION_MAGIC, sizeof(SHARED_SESSION_MAGIC));
+}
+
+void SharedSessionStore::resetLocks() {
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	for (size_t i = 0; i < SHARED_SESSION_STRIPES; ++i)
+		pthread_mutex_init(&_header->stripes[i], &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+const std::string& SharedSessionStore::path() const { return _path; }
+size_t SharedSessionStore::maxSessions() const { return _maxSessions; }
+void SharedSessionStore::setTimeout(time_t timeout) { _timeout = timeout; }
+size_t SharedSessionStore::size() const { return _header->used.load(); }
+
+size_t SharedSessionStore::bucketOf(const SessionKey& key) const {
+	return Session::hashKey(key, _seed) % _buckets;
+}
+
+pthread_mutex_t* SharedSessionStore::stripe(size_t bucket) {
+	return &_header->stripes[bucket % SHARED_SESSION_STRIPES];
+}
+
+bool SharedSessionStore::expired(const Slot& slot, time_t now) const {
+	return now - slot.lastAccess > _timeout;
+}
+
+void SharedSessionStore::release(Slot& slot) {
+	slot.used = 0;
+	slot.generation++;
+	slot.length = 0;
+	_header->used--;
+}
+
+// The key's slot in its bucket (stripe held); an expired one is freed on the way
+int64_t SharedSessionStore::lookup(size_t bucket, const SessionKey& key, time_t now) {
+	for (size_t way = 0; way < SHARED_SESSION_WAYS; ++way) {
+		size_t index = bucket * SHARED_SESSION_WAYS + way;
+		Slot& slot = _slots[index];
+		if (!slot.used || slot.hi != key.hi || slot.lo != key.lo)
+			continue;
+		if (expired(slot, now)) {
+			release(slot);
+			return -1;
+		}
+		return static_cast<int64_t>(index);
+	}
+	return -1;
+}
+
+// A slot for key in its bucket (stripe held): a free one, an expired
+// one, else the least recently used is evicted
+size_t SharedSessionStore::take(size_t bucket, const SessionKey& key, time_t now) {
+	size_t first = bucket * SHARED_SESSION_WAYS;
+	size_t pick = first;
+	for (size_t index = first; index < first + SHARED_SESSION_WAYS; ++index) {
+		Slot& slot = _slots[index];
+		if (!slot.used || expired(slot, now)) {
+			pick = index;
+			break;
+		}
+		if (slot.lastAccess < _slots[pick].lastAccess)
+			pick = index;
+	}
+	Slot& slot = _slots[pick];
+	if (slot.used)
+		release(slot);
+	slot.hi = key.hi;
+	slot.lo = key.lo;
+	slot.used = 1;
+	slot.generation++;
+	slot.lastAccess = now;
+	slot.length = 0;
+	_header->used++;
+	return pick;
+}
+
+// A private copy of the slot's session (stripe held)
+std::shared_ptr<Session> SharedSessionStore::load(size_t index) {
+	const Slot& slot = _slots[index];
+	SessionKey key;
+	key.hi = slot.hi;
+	key.lo = slot.lo;
+	std::shared_ptr<Session> session = std::make_shared<Session>(key);
+
+	// "key\0value\0" pairs
+	size_t length = std::min<size_t>(slot.length, sizeof(slot.data));
+	size_t pos = 0;
+	while (pos < length) {
+		std::string name(slot.data + pos, strnlen(slot.data + pos, length - pos));
+		pos += name.size() + 1;
+		if (pos >= length)
+			break;
+		std::string value(slot.data + pos, strnlen(slot.data + pos, length - pos));
+		pos += value.size() + 1;
+		session->set(name, value);
+	}
+	session->setStoreSlot(static_cast<uint32_t>(index), slot.generation);
+	session->markSaved();
+	return session;
+}
+
+bool SharedSessionStore::store(Slot& slot, const Session& session) {
+	std::string packed;
+	for (const auto& kv : session.getData()) {
+		packed.append(kv.first).push_back('\0');
+		packed.append(kv.second).push_back('\0');
+	}
+	if (packed.size() > sizeof(slot.data))
+		return false;
+	std::memcpy(slot.data, packed.data(), packed.size());
+	slot.length = static_cast<uint32_t>(packed.size());
+	slot.lastAccess = session.lastAccess();
+	return true;
+}
+
+std::shared_ptr<Session> SharedSessionStore::create() {
+	SessionKey key = Session::generateKey();
+	size_t bucket = bucketOf(key);
+	std::shared_ptr<Session> session = std::make_shared<Session>(key);
+
+	StripeLock guard(stripe(bucket));
+	size_t index = take(bucket, key, time(NULL));
+	session->setStoreSlot(static_cast<uint32_t>(index), _slots[index].generation);
+	return session;
+}
+
+std::shared_ptr<Session> SharedSessionStore::find(const SessionKey& key) {
+	size_t bucket = bucketOf(key);
+	time_t now = time(NULL);
+
+	StripeLock guard(stripe(bucket));
+	int64_t index = lookup(bucket, key, now);
+	if (index < 0)
+		return nullptr;
+	_slots[index].lastAccess = now;
+	return load(static_cast<size_t>(index));
+}
+
+// Writes the session back: into the slot it was read from if that is
+// still its own (same generation), else wherever its key is now, else
+// (evicted meanwhile) into a new slot
+void SharedSessionStore::save(Session& session) {
+	if (!session.dirty())
+		return;
+	const SessionKey& key = session.getKey();
+	size_t bucket = bucketOf(key);
+	time_t now = time(NULL);
+
+	StripeLock guard(stripe(bucket));
+	int64_t index = -1;
+	size_t known = session.storeSlot();
+	if (known / SHARED_SESSION_WAYS == bucket && _slots[known].used
+		&& _slots[known].generation == session.storeGeneration())
+		index = static_cast<int64_t>(known);
+	else
+		index = lookup(bucket, key, now);
+	if (index < 0)
+		index = static_cast<int64_t>(take(bucket, key, now));
+
+	Slot& slot = _slots[index];
+	if (!store(slot, session)) {
+		Logger::log(WARNING, "session data over " + std::to_string(sizeof(slot.data))
+			+ " bytes, not saved to session_store");
+		return;
+	}
+	session.setStoreSlot(static_cast<uint32_t>(index), slot.generation);
+	session.markSaved();
+}
+
+void SharedSessionStore::remove(const SessionKey& key) {
+	size_t bucket = bucketOf(key);
+
+	StripeLock guard(stripe(bucket));
+	int64_t index = lookup(bucket, key, time(NULL));
+	if (index >= 0)
+		release(_slots[index]);
+}
+
+// A 64th of the buckets a second: a full pass a minute
+size_t SharedSessionStore::cleanupExpired(time_t now) {
+	if (now == _swept)
+		return 0;
+	_swept = now;
+	size_t batch = std::max<size_t>(1, _buckets / 64);
+	size_t dropped = 0;
+	for (size_t n = 0; n < batch; ++n) {
+		size_t bucket = _sweep;
+		_sweep = (_sweep + 1) % _buckets;
+
+		StripeLock guard(stripe(bucket));
+		for (size_t way = 0; way < SHARED_SESSION_WAYS; ++way) {
+			Slot& slot = _slots[bucket * SHARED_SESSION_WAYS + way];
+			if (slot.used && expired(slot, now)) {
+				release(slot);
+				dropped++;
+			}
+		}
+	}
+	return dropped;
+}
@@ -0,0 +1,55 @@
+#include "Signals.hpp"
+#include <sys/signalfd.h>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <string>
+
+sigset_t Signals::handled() {
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	sigaddset(&set, SIGHUP);
+	sigaddset(&set, SIGUSR1);
+	sigaddset(&set, SIGUSR2);
+	sigaddset(&set, SIGWINCH);
+	sigaddset(&set, SIGCHLD);
+	return set;
+}
+
+void Signals::block() {
+	sigset_t set = handled();
+	if (sigprocmask(SIG_BLOCK, &set, NULL) < 0)
+		throw std::runtime_error("failed to block signals: " + std::string(strerror(errno)));
+	// A CGI that exits early closes its stdin under us: report EPIPE instead
+	signal(SIGPIPE, SIG_IGN);
+}
+
+// Async-signal-safe: called between fork() and exec
+void Signals::unblockInChild() {
+	sigset_t none;
+	sigemptyset(&none);
+	sigprocmask(SIG_SETMASK, &none, NULL);
+	signal(SIGPIPE, SIG_DFL);	// ignored dispositions survive exec
+}
+
+// Initializes attr; the caller destroys it
+void Signals::spawnAttributes(posix_spawnattr_t& attr) {
+	sigset_t none, defaults;
+	sigemptyset(&none);
+	sigemptyset(&defaults);
+	sigaddset(&defaults, SIGPIPE);
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setsigmask(&attr, &none);
+	posix_spawnattr_setsigdefault(&attr, &defaults);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+}
+
+int Signals::openFd() {
+	sigset_t set = handled();
+	int fd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (fd < 0)
+		throw std::runtime_error("failed to create signalfd: " + std::string(strerror(errno)));
+	return fd;
+}
@@ -12,6 +12,7 @@
 #include <cstring>
 #include <sys/types.h>
 #include <errno.h>
+#include <memory>
 
 
 std::optional<HttpResponse> serveDeleteStatic(
@@ -56,11 +57,19 @@ std::optional<HttpResponse> serveDeleteStatic(
 	if (S_ISDIR(st.st_mode))
 		return handler.makeErrorResponse(srv, 403);
 
-	// 🔹6. Delete
-	if (std::remove(fullPath.c_str()) != 0) {
-		Logger::log(ERROR, "DELETE failed: " + fullPath);
-		return handler.makeErrorResponse(srv, 500);
-	}
-	// Success
-	return HttpResponse(204, "");
+	// 🔹6. Delete (on the disk pool)
+	auto removed = std::make_shared<bool>(false);
+	handler.offload(
+		[removed, fullPath]() {
+			*removed = (std::remove(fullPath.c_str()) == 0);
+		},
+		[removed, fullPath, &srv, &handler]() {
+			if (!*removed) {
+				Logger::log(ERROR, "DELETE failed: " + fullPath);
+				return handler.makeErrorResponse(srv, 500);
+			}
+			// Success
+			return HttpResponse(204, "");
+		});
+	return std::nullopt;
 }
\ No newline at end of file
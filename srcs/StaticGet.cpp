@@ -2,8 +2,11 @@
 #include "RequestHandler.hpp"
 #include "Logger.hpp"
 #include "utils.hpp"
+#include "Compression.hpp"
+#include "MappedFile.hpp"
+#include "Autoindex.hpp"
+#include "MimeTypes.hpp"
 #include <sys/stat.h>
-#include <dirent.h>
 #include <sstream>
 #include <fstream>
 #include <iostream>
@@ -11,13 +14,193 @@
 #include <string>
 #include <cstring>
 #include <sys/types.h>
+#include <memory>
+#include <vector>
+#include <functional>
+
+/*
+	Reads and directory listings run on the disk pool (handler.offload):
+	the function returns nullopt with the handler suspended, and the
+	completion lambda builds the response back on the loop. Those lambdas
+	capture req/srv/loc/handler by reference: all of them live in the
+	suspended RequestHandler (or the ServerManager) until it resumes.
+*/
+
+// Result of a file read done on the disk pool
+struct FileRead {
+	bool		ok = false;
+	std::string	body;
+	std::string	encoded;
+};
+
+static HttpResponse makeFileResponse(
+	const std::string& mime,
+	const std::string& body,
+	ContentEncoding enc,
+	bool vary)
+{
+	HttpResponse res(200, body);
+	res.setHeader("Content-Type", mime);
+	// A variant may exist for other clients, so caches must key on it
+	if (vary)
+		res.setHeader("Vary", "Accept-Encoding");
+	if (enc != ENCODING_IDENTITY)
+		res.setHeader("Content-Encoding", Compression::encodingName(enc));
+	res.setHeader("Content-Length", std::to_string(body.size()));
+	return res;
+}
+
+// gzip_static: serve file.br / file.gz as-is when the client accepts them
+static bool serveSidecar(
+	const HttpRequest& req,
+	const Server& srv,
+	const Location& loc,
+	RequestHandler& handler,
+	const std::string& path,
+	const struct stat& st)
+{
+	if (!loc.getGzipStatic())
+		return false;
+
+	static const char* codings[] = { "br", "gzip" };	// best ratio first
+	static const char* suffixes[] = { ".br", ".gz" };
+
+	// The client's preference first (q-values), br on a tie
+	size_t order[] = { 0, 1 };
+	double q[] = { Compression::acceptance(req, "br"), Compression::acceptance(req, "gzip") };
+	if (q[1] > q[0])
+		std::swap(order[0], order[1]);
+
+	for (size_t i : order) {
+		if (q[i] <= 0)
+			continue;
+
+		std::string sidecar = path + suffixes[i];
+		struct stat sst;
+		// Skip missing sidecars and ones older than the file they encode
+		if (stat(sidecar.c_str(), &sst) != 0 || !S_ISREG(sst.st_mode)
+			|| sst.st_mtime < st.st_mtime)
+			continue;
+
+		std::string coding = codings[i];
+		std::string mime = MimeTypes::forFile(path);
+		auto job = std::make_shared<FileRead>();
+		handler.offload(
+			[job, sidecar]() {
+				job->ok = readFile(sidecar, job->body);
+			},
+			[job, sidecar, coding, mime, &srv, &handler]() {
+				if (!job->ok) {
+					Logger::log(ERROR, std::string("403 Forbidden") + sidecar);
+					return handler.makeErrorResponse(srv, 403);
+				}
+				HttpResponse res = makeFileResponse(mime, job->body, ENCODING_IDENTITY, true);
+				res.setHeader("Content-Encoding", coding);
+				return res;
+			});
+		return true;
+	}
+	return false;
+}
+
+// Serves a regular file: a cached compressed variant right away, otherwise
+// the read (and compression) happens on the disk pool
+static std::optional<HttpResponse> serveFile(
+	const HttpRequest& req,
+	const Server& srv,
+	const Location& loc,
+	RequestHandler& handler,
+	const std::string& path,
+	const struct stat& st)
+{
+	const std::string& mime = MimeTypes::forFile(path);
+	size_t size = static_cast<size_t>(st.st_size);
+	bool compressible = Compression::isCompressible(loc, mime, size);
+	bool vary = compressible || loc.getGzipStatic();
+
+	ContentEncoding enc = compressible ? Compression::negotiate(req) : ENCODING_IDENTITY;
+	if (enc != ENCODING_IDENTITY) {
+		// 🔹 Hot path: no disk access at all
+		const std::string* cached = Compression::cached(path, st, enc);
+		if (cached && cached->size() < size)
+			return makeFileResponse(mime, *cached, enc, vary);
+		if (cached)
+			enc = ENCODING_IDENTITY;	// known not to pay off for this file
+	}
+
+	struct stat fileSt = st;
+	auto job = std::make_shared<FileRead>();
+	handler.offload(
+		// 🔹 Disk pool: read, and deflate while we're off the loop anyway
+		[job, path, enc]() {
+			job->ok = readFile(path, job->body);
+			if (job->ok && enc != ENCODING_IDENTITY)
+				Compression::compress(job->body, job->encoded, enc);
+		},
+		// 🔹 Loop: cache the variant and answer
+		[job, path, mime, enc, fileSt, vary, &srv, &handler]() {
+			if (!job->ok) {
+				Logger::log(ERROR, std::string("403 Forbidden") + path);
+				return handler.makeErrorResponse(srv, 403);
+			}
+			if (enc != ENCODING_IDENTITY && !job->encoded.empty()) {
+				bool paysOff = job->encoded.size() < job->body.size();
+				HttpResponse res = paysOff
+					? makeFileResponse(mime, job->encoded, enc, vary)
+					: makeFileResponse(mime, job->body, ENCODING_IDENTITY, vary);
+				Compression::store(path, fileSt, enc, std::move(job->encoded));
+				return res;
+			}
+			return makeFileResponse(mime, job->body, ENCODING_IDENTITY, vary);
+		});
+	return std::nullopt;
+}
+
+// Result of a directory scan done on the disk pool
+struct DirRead {
+	bool					ok = false;
+	std::vector<DirEntry>	entries;
+};
+
+static HttpResponse makeListingResponse(const std::string& mime, const std::string& body) {
+	HttpResponse res(200, body);
+	res.setHeader("Content-Type", mime);
+	res.setHeader("Content-Length", std::to_string(body.size()));
+	return res;
+}
+
+// Answers from the listing cache, or scans the directory on the disk pool
+// and caches the result; `render` turns the listing into the response
+static std::optional<HttpResponse> serveListing(
+	const Server& srv,
+	RequestHandler& handler,
+	const std::string& fullPath,
+	const struct stat& dirSt,
+	std::function<HttpResponse(DirListing&)> render)
+{
+	// 🔹 Hot path: directory unchanged since the last scan
+	if (DirListing* listing = Autoindex::lookup(dirSt))
+		return render(*listing);
+
+	struct stat st = dirSt;
+	auto job = std::make_shared<DirRead>();
+	handler.offload(
+		[job, fullPath]() { job->ok = Autoindex::scan(fullPath, job->entries); },
+		[job, fullPath, st, render, &srv, &handler]() {
+			if (!job->ok)
+				return handler.makeErrorResponse(srv, 403);
+			return render(*Autoindex::store(st, std::move(job->entries)));
+		});
+	return std::nullopt;
+}
 
 std::optional<HttpResponse> handleDirectoryRequest(
 	const HttpRequest& req,
 	const Server& srv,
 	const Location& loc,
 	RequestHandler& handler,
-	std::string fullPath)
+	std::string fullPath,
+	const struct stat& dirSt)
 {
 	std::string reqPath = req.getPath();
 	fullPath = ensureTrailingSlash(fullPath);
@@ -32,23 +215,10 @@ std::optional<HttpResponse> handleDirectoryRequest(
 		if (!autoindex)		// if autoindex off → forbidden
 			return handler.makeErrorResponse(srv, 403);
 
-		DIR* dir = opendir(fullPath.c_str());
-		if (!dir)
-			return handler.makeErrorResponse(srv, 403);
-
-		std::ostringstream out;
-		struct dirent* ent;
-		while ((ent = readdir(dir)) != NULL) {
-			if (ent->d_name[0] == '.') continue;
-			out << ent->d_name << "\n";
-		}
-		closedir(dir);
-
-		std::string listing = out.str();
-		HttpResponse res(200, listing);
-		res.setHeader("Content-Type", "text/plain");
-		res.setHeader("Content-Length", std::to_string(listing.size()));
-		return res;
+		return serveListing(srv, handler, fullPath, dirSt,
+			[](DirListing& listing) {
+				return makeListingResponse("text/plain", Autoindex::renderPlain(listing));
+			});
 	}
 	// 2. Try index.html
 	std::string indexName = loc.getIndex().empty() ? srv.getIndex() : loc.getIndex();
@@ -58,45 +228,18 @@ std::optional<HttpResponse> handleDirectoryRequest(
 
 	struct stat st;
 	if (stat(indexPath.c_str(), &st) == 0 && !S_ISDIR(st.st_mode)) {
-
-		std::string body;
-		if (!readFile(indexPath, body))
-			return handler.makeErrorResponse(srv, 403);
-
-		HttpResponse res(200, body);
-		res.setHeader("Content-Type", detectMime(indexPath));
-		res.setHeader("Content-Length", std::to_string(body.size()));
-		return res;
+		if (serveSidecar(req, srv, loc, handler, indexPath, st))
+			return std::nullopt;
+		return serveFile(req, srv, loc, handler, indexPath, st);
 	}
 
-	// 3. Autoindex ON → show directory listing
+	// 3. Autoindex ON → show directory listing (one page of it)
 	if (autoindex) {
-		DIR* dir = opendir(fullPath.c_str());
-		if (!dir)
-			return handler.makeErrorResponse(srv, 403);
-
-		std::ostringstream html;
-		html << "<html><head><meta charset=\"utf-8\">";
-		html << "<title>Index of " << reqPath << "</title></head><body>";
-		html << "<h1>Index of " << reqPath << "</h1><ul>";
-
-		struct dirent* ent;
-		while ((ent = readdir(dir)) != NULL) {
-			std::string name = ent->d_name;
-			if (name == ".") continue;
-
-			std::string href = ensureTrailingSlash(reqPath) + name;
-			html << "<li><a href=\"" << href << "\">" << name << "</a></li>";
-		}
-		closedir(dir);
-
-		html << "</ul></body></html>";
-
-		std::string body = html.str();
-		HttpResponse res(200, body);
-		res.setHeader("Content-Type", "text/html");
-		res.setHeader("Content-Length", std::to_string(body.size()));
-		return res;
+		size_t page = Autoindex::pageFromQuery(req.getQueryString());
+		return serveListing(srv, handler, fullPath, dirSt,
+			[reqPath, page](DirListing& listing) {
+				return makeListingResponse("text/html", Autoindex::renderHtml(listing, reqPath, page));
+			});
 	}
 	// 4. No index file + autoindex OFF → 403
 	return handler.makeErrorResponse(srv, 403);
@@ -137,18 +280,23 @@ std::optional<HttpResponse> serveGetStatic(const HttpRequest& req, const Server&
 	}
 	//3. Directory handling
 	   if (S_ISDIR(st.st_mode)) {
-		return handleDirectoryRequest(req, srv, loc, handler, fullPath);
-	}
-	// 4. Serve regular file
-	std::string body;
-	if (!readFile(fullPath, body)) {
-		Logger::log(ERROR, std::string("403 Forbidden") + fullPath);
-		return handler.makeErrorResponse(srv, 403);
+		return handleDirectoryRequest(req, srv, loc, handler, fullPath, st);
 	}
-	// Return successful response with file content
-	HttpResponse res(200, body);
-	res.setHeader("Content-Type", detectMime(fullPath));
-	res.setHeader("Content-Length", std::to_string(body.size()));
+	// 4. Precompressed sidecar
+	if (serveSidecar(req, srv, loc, handler, fullPath, st))
+		return std::nullopt;
 
-	return res;
+	// 5. Large file: share one mapping between all concurrent downloads
+	if (loc.getMmapThreshold() > 0
+		&& static_cast<size_t>(st.st_size) >= loc.getMmapThreshold()) {
+		if (auto mapped = MappedFile::open(fullPath, st)) {
+			HttpResponse res(200);
+			res.setHeader("Content-Type", mapped->contentType());
+			res.setBodyMapping(mapped);
+			return res;
+		}
+		// mmap failed: fall back to reading the file
+	}
+	// 6. Serve regular file
+	return serveFile(req, srv, loc, handler, fullPath, st);
 }
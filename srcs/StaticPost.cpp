@@ -11,6 +11,82 @@
 #include <string>
 #include <cstring>
 #include <sys/types.h>
+#include <memory>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+
+// Runs on the disk pool: no logging here, the error text goes back to the loop
+static std::string writeUpload(const std::string& fullPath, const std::string& fileData) {
+	struct stat st;
+
+	// ==========================================
+	// STEP 5: Create directory structure if needed
+	// ==========================================
+	// Recursively create all parent directories
+	// Example: "./www/uploads/2024/images/" → creates each level
+
+	size_t slash = fullPath.find_last_of('/');
+	std::string dirPath = fullPath.substr(0, slash);  // Get directory portion
+
+	if (stat(dirPath.c_str(), &st) != 0)
+	{
+		// Directory doesn't exist, create it recursively
+		size_t p = 0;
+		while (p < dirPath.size()) {
+			size_t next = dirPath.find('/', p);
+			if (next == 0) { // Skip leading slash in absolute paths
+				p = 1;
+				continue;
+			}
+			std::string part = dirPath.substr(0, next);
+			if (stat(part.c_str(), &st) != 0) {
+				// Directory doesn't exist, create it
+				// mkdir returns 0 on success, -1 on error
+				// We check if directory exists after mkdir to handle race conditions
+				if (mkdir(part.c_str(), 0755) != 0) {
+					// Double-check: maybe another thread/process created it
+					if (stat(part.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+						return "Failed to create directory: " + part;
+				}
+			}
+			if (next == std::string::npos) break;
+			p = next + 1;
+		}
+	}
+	// ==========================================
+	// STEP 6: Write file to disk
+	// ==========================================
+	// Write next to the target and rename over it: a download that has the
+	// old file memory-mapped keeps its (now unlinked) copy instead of
+	// reading a truncated one. The temporary name is unique (mkstemp):
+	// two uploads of the same file on the disk pool don't share it.
+	std::string tmpPath = fullPath + ".XXXXXX";
+	int fd = mkstemp(&tmpPath[0]);
+	if (fd < 0)
+		return "POST: cannot create a temporary file for " + fullPath;
+	fchmod(fd, 0644);	// mkstemp makes it 0600
+
+	// Write raw file data
+	size_t written = 0;
+	while (written < fileData.size()) {
+		ssize_t n = write(fd, fileData.data() + written, fileData.size() - written);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		written += static_cast<size_t>(n);
+	}
+	bool ok = (written == fileData.size());
+	if (close(fd) != 0)
+		ok = false;
+	if (!ok || std::rename(tmpPath.c_str(), fullPath.c_str()) != 0) {
+		std::remove(tmpPath.c_str());
+		return "POST: failed to save " + fullPath;
+	}
+	return "";
+}
 
 std::optional<HttpResponse> servePostStatic(
 	const HttpRequest& req,
@@ -245,63 +321,32 @@ std::optional<HttpResponse> servePostStatic(
 		// else: fullPath already contains a filename with extension, use as-is
 	}
 	// ==========================================
-	// STEP 5: Create directory structure if needed
+	// STEP 5-6: Create directories and write the file (disk pool)
 	// ==========================================
-	// Recursively create all parent directories
-	// Example: "./www/uploads/2024/images/" → creates each level
-
-	size_t slash = fullPath.find_last_of('/');
-	std::string dirPath = fullPath.substr(0, slash);  // Get directory portion
-
-	if (stat(dirPath.c_str(), &st) != 0)
-	{
-		// Directory doesn't exist, create it recursively
-		size_t p = 0;
-		while (p < dirPath.size()) {
-			size_t next = dirPath.find('/', p);
-			if (next == 0) { // Skip leading slash in absolute paths
-				p = 1;
-				continue;
-			}
-			std::string part = dirPath.substr(0, next);
-			if (stat(part.c_str(), &st) != 0) {
-				// Directory doesn't exist, create it
-				// mkdir returns 0 on success, -1 on error
-				// We check if directory exists after mkdir to handle race conditions
-				if (mkdir(part.c_str(), 0755) != 0) {
-					// Double-check: maybe another thread/process created it
-					if (stat(part.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
-						Logger::log(ERROR, "Failed to create directory: " + part);
-						return handler.makeErrorResponse(srv, 500);
-					}
-				}
+	auto error = std::make_shared<std::string>();
+	size_t size = fileData.size();
+	handler.offload(
+		[error, fullPath, data = std::move(fileData)]() {
+			*error = writeUpload(fullPath, data);
+		},
+		[error, fullPath, size, &srv, &handler]() {
+			if (!error->empty()) {
+				Logger::log(ERROR, *error);
+				return handler.makeErrorResponse(srv, 500);
 			}
-			if (next == std::string::npos) break;
-			p = next + 1;
-		}
-	}
-	// ==========================================
-	// STEP 6: Write file to disk
-	// ==========================================
-	// Open file in binary mode to preserve exact content
-	std::ofstream out(fullPath.c_str(), std::ios::binary);
-	if (!out.is_open())
-		return handler.makeErrorResponse(srv, 500);
-
-	// Write raw file data
-	out.write(fileData.c_str(), fileData.size());
-	out.close();
-	Logger::log(INFO, "POST: saved " + fullPath);
+			Logger::log(INFO, "POST: saved " + fullPath);
 
-	// ==========================================
-	// STEP 7: Return success response
-	// ==========================================
-	// Send 200 OK with template variables for success page
-	return handler.makeSuccessResponse(
-		srv,
-		{
-			{"filename", fullPath},
-			{"size", std::to_string(fileData.size())}
-		}
-	);
+			// ==========================================
+			// STEP 7: Return success response
+			// ==========================================
+			// Send 200 OK with template variables for success page
+			return handler.makeSuccessResponse(
+				srv,
+				{
+					{"filename", fullPath},
+					{"size", std::to_string(size)}
+				}
+			);
+		});
+	return std::nullopt;
 }
@@ -0,0 +1,153 @@
+#include "Upstream.hpp"
+#include "Logger.hpp"
+#include <algorithm>
+
+bool operator==(const UpstreamServer& a, const UpstreamServer& b) {
+	return a.address == b.address && a.weight == b.weight
+		&& a.maxFails == b.maxFails && a.failTimeout == b.failTimeout;
+}
+
+bool operator==(const UpstreamConfig& a, const UpstreamConfig& b) {
+	return a.name == b.name && a.servers == b.servers && a.balance == b.balance
+		&& a.hashKey == b.hashKey && a.keepalive == b.keepalive;
+}
+
+Upstream::Upstream(const UpstreamConfig& config) : _config(config) {
+	for (const UpstreamServer& s : config.servers) {
+		Peer peer;
+		peer.config = s;
+		_peers.push_back(peer);
+	}
+	if (config.balance != BALANCE_HASH)
+		return;
+	// 🔹 Points on the ring: "<address>#<n>", weight × UPSTREAM_RING_POINTS of them
+	for (size_t i = 0; i < _peers.size(); ++i) {
+		unsigned points = _peers[i].config.weight * UPSTREAM_RING_POINTS;
+		for (unsigned n = 0; n < points; ++n)
+			_ring.push_back(std::make_pair(hash(_peers[i].config.address + "#" + std::to_string(n)), i));
+	}
+	std::sort(_ring.begin(), _ring.end());
+}
+
+// FNV-1a, mixed (MurmurHash3's finalizer) so that keys differing only in
+// their last characters still land all around the ring, then folded to 32 bits
+uint32_t Upstream::hash(const std::string& key) {
+	uint64_t h = 14695981039346656037ULL;
+	for (unsigned char c : key) {
+		h ^= c;
+		h *= 1099511628211ULL;
+	}
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return static_cast<uint32_t>(h ^ (h >> 32));
+}
+
+const UpstreamConfig& Upstream::config() const { return _config; }
+const UpstreamServer& Upstream::server(size_t i) const { return _peers[i].config; }
+
+bool Upstream::usable(size_t i, time_t now, const std::vector<size_t>& tried, bool ignoreHealth) const {
+	if (std::find(tried.begin(), tried.end(), i) != tried.end())
+		return false;
+	return ignoreHealth || now >= _peers[i].downUntil;
+}
+
+int Upstream::pick(const std::string& key, time_t now, const std::vector<size_t>& tried) {
+	// Second pass: everything is down, so try them anyway
+	for (int pass = 0; pass < 2; ++pass) {
+		bool ignoreHealth = (pass == 1);
+		int i = -1;
+		switch (_config.balance) {
+			case BALANCE_LEAST_CONN:	i = pickLeastConn(now, tried, ignoreHealth); break;
+			case BALANCE_HASH:			i = pickHash(key, now, tried, ignoreHealth); break;
+			default:					i = pickRoundRobin(now, tried, ignoreHealth); break;
+		}
+		if (i >= 0)
+			return i;
+	}
+	return -1;
+}
+
+// nginx's smooth weighted round robin: everyone gains its weight, the
+// leader is picked and pays back the total
+int Upstream::pickRoundRobin(time_t now, const std::vector<size_t>& tried, bool ignoreHealth) {
+	int best = -1;
+	long total = 0;
+	for (size_t i = 0; i < _peers.size(); ++i) {
+		if (!usable(i, now, tried, ignoreHealth))
+			continue;
+		_peers[i].current += _peers[i].config.weight;
+		total += _peers[i].config.weight;
+		if (best < 0 || _peers[i].current > _peers[best].current)
+			best = static_cast<int>(i);
+	}
+	if (best >= 0)
+		_peers[best].current -= total;
+	return best;
+}
+
+// Fewest in flight per unit of weight; ties go round robin
+int Upstream::pickLeastConn(time_t now, const std::vector<size_t>& tried, bool ignoreHealth) {
+	int best = -1;
+	for (size_t i = 0; i < _peers.size(); ++i) {
+		if (!usable(i, now, tried, ignoreHealth))
+			continue;
+		if (best < 0 || _peers[i].active * _peers[best].config.weight
+				< _peers[best].active * _peers[i].config.weight)
+			best = static_cast<int>(i);
+	}
+	if (best < 0)
+		return -1;
+	std::vector<size_t> others = tried;
+	for (size_t i = 0; i < _peers.size(); ++i) {
+		if (_peers[i].active * _peers[best].config.weight != _peers[best].active * _peers[i].config.weight)
+			others.push_back(i);
+	}
+	int fair = pickRoundRobin(now, others, ignoreHealth);
+	return (fair >= 0) ? fair : best;
+}
+
+// First usable point clockwise from the key
+int Upstream::pickHash(const std::string& key, time_t now, const std::vector<size_t>& tried, bool ignoreHealth) {
+	if (_ring.empty())
+		return -1;
+	std::pair<uint32_t, size_t> probe(hash(key), 0);
+	size_t start = static_cast<size_t>(std::lower_bound(_ring.begin(), _ring.end(), probe) - _ring.begin());
+	for (size_t n = 0; n < _ring.size(); ++n) {
+		size_t i = _ring[(start + n) % _ring.size()].second;
+		if (usable(i, now, tried, ignoreHealth))
+			return static_cast<int>(i);
+	}
+	return -1;
+}
+
+void Upstream::acquire(size_t i) { _peers[i].active++; }
+
+void Upstream::release(size_t i) {
+	if (_peers[i].active > 0)
+		_peers[i].active--;
+}
+
+// max_fails within fail_timeout: out of rotation for fail_timeout
+void Upstream::failed(size_t i, time_t now) {
+	Peer& peer = _peers[i];
+	if (peer.config.maxFails == 0)
+		return;		// max_fails=0: never taken out
+	if (peer.fails == 0 || now - peer.firstFail >= peer.config.failTimeout) {
+		peer.fails = 0;
+		peer.firstFail = now;
+	}
+	if (++peer.fails < peer.config.maxFails)
+		return;
+	peer.fails = 0;
+	peer.downUntil = now + peer.config.failTimeout;
+	Logger::log(WARNING, "upstream " + _config.name + ": server " + peer.config.address
+		+ " marked down for " + std::to_string(peer.config.failTimeout) + "s");
+}
+
+void Upstream::succeeded(size_t i) {
+	_peers[i].fails = 0;
+	_peers[i].downUntil = 0;
+}
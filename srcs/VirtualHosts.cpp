@@ -0,0 +1,132 @@
+#include "VirtualHosts.hpp"
+#include "Logger.hpp"
+#include <stdexcept>
+#include <cctype>
+
+VirtualHosts::VirtualHosts(const std::vector<Server>& servers) {
+	for (size_t i = 0; i < servers.size(); ++i) {
+		PortTable& table = _ports[servers[i].getListenPort()];
+		if (table.labels.empty())
+			table.labels.resize(1);
+		if (servers[i].isDefault() && table.defaultServer < 0)
+			table.defaultServer = static_cast<long>(i);
+
+		for (const std::string& raw : servers[i].getServerNames()) {
+			if (raw.empty())
+				continue;
+			// 🔹 Regex: kept as written (no case folding)
+			if (raw[0] == '~') {
+				try {
+					table.patterns.push_back({ std::regex(raw.substr(1),
+						std::regex::optimize | std::regex::icase), i });
+				} catch (const std::regex_error& e) {
+					throw std::runtime_error("invalid server_name regex: " + raw + " (" + e.what() + ")");
+				}
+				continue;
+			}
+			std::string name = normalizeHost(raw);
+			if (name.rfind("*.", 0) == 0)
+				addWildcard(table, name.substr(2), i);
+			else if (name[0] == '.') {
+				addWildcard(table, name.substr(1), i);
+				table.exact.emplace(name.substr(1), i);
+			} else
+				table.exact.emplace(name, i);	// first server with a name keeps it
+		}
+	}
+}
+
+// "Example.COM:8080" → "example.com", "[::1]:80" → "[::1]", "a.b." → "a.b"
+std::string VirtualHosts::normalizeHost(const std::string& host) {
+	size_t end = host.size();
+	if (!host.empty() && host[0] == '[') {
+		size_t close = host.find(']');
+		if (close != std::string::npos)
+			end = close + 1;
+	} else {
+		size_t colon = host.find(':');
+		if (colon != std::string::npos)
+			end = colon;
+	}
+	if (end > 0 && host[end - 1] == '.')
+		--end;
+
+	std::string out(host, 0, end);
+	for (size_t i = 0; i < out.size(); ++i)
+		out[i] = static_cast<char>(std::tolower(static_cast<unsigned char>(out[i])));
+	return out;
+}
+
+void VirtualHosts::addWildcard(PortTable& table, const std::string& suffix, size_t server) {
+	size_t node = 0;
+	size_t end = suffix.size();
+	// Labels right to left: "example.com" → "com", "example"
+	while (end > 0) {
+		size_t dot = suffix.rfind('.', end - 1);
+		size_t start = dot == std::string::npos ? 0 : dot + 1;
+		std::string label = suffix.substr(start, end - start);
+
+		auto it = table.labels[node].children.find(label);
+		if (it == table.labels[node].children.end()) {
+			table.labels.push_back(LabelNode());
+			it = table.labels[node].children.emplace(label, table.labels.size() - 1).first;
+		}
+		node = it->second;
+		end = dot == std::string::npos ? 0 : dot;
+	}
+	if (table.labels[node].wildcard < 0)
+		table.labels[node].wildcard = static_cast<long>(server);
+}
+
+// Longest "*.suffix" that covers host (the wildcard needs at least one label)
+long VirtualHosts::matchWildcard(const PortTable& table, const std::string& host) {
+	long best = -1;
+	size_t node = 0;
+	size_t end = host.size();
+	std::string label;
+
+	while (end > 0) {
+		size_t dot = host.rfind('.', end - 1);
+		if (dot == std::string::npos)
+			break;	// what's left is the label the '*' stands for
+		label.assign(host, dot + 1, end - dot - 1);
+
+		auto it = table.labels[node].children.find(label);
+		if (it == table.labels[node].children.end())
+			break;
+		node = it->second;
+		if (table.labels[node].wildcard >= 0)
+			best = table.labels[node].wildcard;
+		end = dot;
+	}
+	return best;
+}
+
+size_t VirtualHosts::resolve(int port, const std::string& host) const {
+	auto it = _ports.find(port);
+	if (it == _ports.end())
+		return 0;
+	const PortTable& table = it->second;
+
+	if (!host.empty()) {
+		std::string name = normalizeHost(host);
+
+		// 🔹 Exact name
+		auto exact = table.exact.find(name);
+		if (exact != table.exact.end())
+			return exact->second;
+
+		// 🔹 Longest leading wildcard
+		long wildcard = matchWildcard(table, name);
+		if (wildcard >= 0)
+			return static_cast<size_t>(wildcard);
+
+		// 🔹 Regex, in config order
+		for (const Pattern& p : table.patterns) {
+			if (std::regex_search(name, p.regex))
+				return p.server;
+		}
+	}
+	// 🔹 Default server for this port
+	return table.defaultServer >= 0 ? static_cast<size_t>(table.defaultServer) : 0;
+}
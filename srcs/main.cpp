@@ -1,17 +1,14 @@
-#include "ConfigParser.hpp"
+#include "ConfigSnapshot.hpp"
 #include "ServerManager.hpp"
 #include "Logger.hpp"
-#include <csignal>
-
-bool g_running = true;
-
-void handleSignal(int) {
-	g_running = false;
-}
+#include "Compression.hpp"
+#include "MimeTypes.hpp"
+#include "Signals.hpp"
 
 int main(int argc, char **argv) {
 
-	signal(SIGINT, handleSignal);
+	// Before any thread exists: signals are read from a signalfd in the loop
+	Signals::block();
 
 	Logger::init("./log/access.log", "./log/error.log");
 	Logger::log(TRACE, "starting server...");
@@ -28,11 +25,12 @@ int main(int argc, char **argv) {
 	Logger::log(INFO, "configuration file: " + config_path);
 
 	try {
-		ConfigParser parser(config_path);
-		parser.parse();
+		std::shared_ptr<const ConfigSnapshot> config = ConfigSnapshot::load(config_path);
+		MimeTypes::load(config->getTypes());
+		Compression::generateSidecars(config->getServers());
 
-		ServerManager manager(parser.getServers());
-		g_running = true;
+		ServerManager manager(config);
+		manager.setCommandLine(argc, argv);
 		manager.run();
 	}
 	catch (const std::exception& e) {
@@ -1,6 +1,7 @@
 #include "utils.hpp"
 #include "Server.hpp"
 #include "Location.hpp"
+#include "MimeTypes.hpp"
 
 bool isDirective(const std::string& line) {
 	// If line ends with ';' → it's a directive
@@ -200,7 +201,7 @@ std::string urlDecode(const std::string &src) {
 	for (std::size_t i = 0; i < src.size(); ++i) {
 
 		if (src[i] == '%' && i + 2 < src.size()) {
-			int value = 0;
+			unsigned int value = 0;
 			std::sscanf(src.substr(i + 1, 2).c_str(), "%x", &value);
 			ret += static_cast<char>(value);
 			i += 2;
@@ -216,6 +217,24 @@ std::string urlDecode(const std::string &src) {
 	return ret;
 }
 
+// Text safe inside HTML markup and quoted attributes
+std::string htmlEscape(const std::string &src) {
+	std::string ret;
+	ret.reserve(src.size());
+
+	for (char c : src) {
+		switch (c) {
+			case '&':  ret += "&amp;";  break;
+			case '<':  ret += "&lt;";   break;
+			case '>':  ret += "&gt;";   break;
+			case '"':  ret += "&quot;"; break;
+			case '\'': ret += "&#39;";  break;
+			default:   ret += c;
+		}
+	}
+	return ret;
+}
+
 std::string sanitizeFilename(const std::string &n) {
 	std::string out;
 	for (char c : n)
@@ -244,19 +263,8 @@ bool readFile(const std::string& path, std::string& out) {
 	return true;
 }
 
-std::string detectMime(const std::string& path) {
-	std::string ext = getFileExtension(path);
-	if (ext == ".html" || ext == ".htm") return "text/html";
-	if (ext == ".css") return "text/css";
-	if (ext == ".js") return "application/javascript";
-	if (ext == ".json") return "application/json";
-	if (ext == ".png") return "image/png";
-	if (ext == ".jpg" || ext == ".jpeg") return "image/jpeg";
-	if (ext == ".gif") return "image/gif";
-	if (ext == ".txt") return "text/plain";
-	if (ext == ".svg") return "image/svg+xml";
-	if (ext == ".ico") return "image/x-icon";
-	return "application/octet-stream";
+const std::string& detectMime(const std::string& path) {
+	return MimeTypes::lookup(path);
 }
 
 std::string ensureTrailingSlash(const std::string &s) {
@@ -13,6 +13,16 @@ FORBIDDEN="/forbidden/"
 TOO_LARGE="/too_large/abc"
 PYTHON_CGI="/cgi-bin/test.py"
 PHP_CGI="/cgi-bin/test.php"
+POOLED_CGI="/cgi-bin/pid.py"
+STREAM_CGI="/cgi-bin/stream.py"
+ENV_CGI="/cgi-bin/env.py"
+FASTCGI="/fcgi/app"
+FASTCGI_SOCK="/tmp/webserv-fcgi.sock"
+CACHED_CGI="/cgi-cached/now.py"
+ACCEL_CGI="/cgi-cached/accel.py"
+ACCEL_TARGET="/protected/secret.txt"
+PROXY="/proxy/app"
+PROXY_BACKENDS="127.0.0.1:9101 127.0.0.1:9102"
 
 # ================================
 # COLORS
@@ -36,6 +46,28 @@ body_of() {
 	curl -s "$1"
 }
 
+# A second server on the config read from stdin, for settings the main
+# one doesn't use (stop_extra shuts it down)
+start_extra() {
+	extra_conf=$(mktemp /tmp/webserv-test-XXXXXX.conf)
+	cat > "$extra_conf"
+	./webServ "$extra_conf" > /dev/null 2>&1 &
+	extra=$!
+	sleep 1
+}
+
+stop_extra() {
+	kill -INT "$extra"
+	wait "$extra" 2>/dev/null
+	rm -f "$extra_conf"
+}
+
+# The visit count / on $1 reports for the cookies in jar $2 (kept up to date)
+visits_of() {
+	curl -s -o /dev/null -D - -b "$2" -c "$2" "$1/" \
+		| grep -i "^Set-Cookie: visits=" | head -1 | sed 's/.*visits=\([0-9]*\).*/\1/'
+}
+
 print_header() {
 	echo
 	echo "========================================"
@@ -153,6 +185,23 @@ test_autoindex() {
 	else
 		fail "Autoindex /pictures/ missing listing"
 	fi
+
+	# Past AUTOINDEX_PAGE_SIZE entries: pages, clamped, names escaped
+	dir=./www/pictures/_paging
+	mkdir -p "$dir"
+	(cd "$dir" && touch $(seq -f "f%04g" 1 1000) 'a<b>&"q.txt')
+	first=$(body_of "${BASE_URL}/pictures/_paging/")
+	second=$(body_of "${BASE_URL}/pictures/_paging/?page=2")
+	past=$(body_of "${BASE_URL}/pictures/_paging/?page=99")
+	echo "$first" | grep -q "page 1 of 2" && echo "$second" | grep -q "page 2 of 2" \
+		&& pass "Big directory listed one page at a time" \
+		|| fail "Paging missing: $(echo "$first" | grep -o 'page [0-9]* of [0-9]*')"
+	[ -n "$past" ] && [ "$past" = "$second" ] && pass "?page= past the end clamped to the last page" \
+											  || fail "?page=99 differs from the last page"
+	echo "$first" | grep -qF 'a&lt;b&gt;&amp;&quot;q.txt' && ! echo "$first" | grep -qF '<b>' \
+		&& pass "Entry names HTML-escaped" \
+		|| fail "Entry name not escaped"
+	rm -rf "$dir"
 }
 
 # ================================
@@ -235,6 +284,792 @@ test_keepalive() {
 	echo ""
 }
 
+# ================================
+# 14. Compression (gzip)
+# ================================
+test_gzip() {
+	print_header "Compression test"
+	enc=$(curl -s -o /dev/null -D - -H "Accept-Encoding: gzip" \
+		"${BASE_URL}/css/style.css" | grep -i "^Content-Encoding" | awk '{print $2}' | tr -d '\r')
+	[ "$enc" = "gzip" ] && pass "style.css served gzip-encoded" \
+						|| fail "style.css Content-Encoding: '$enc' (expected gzip)"
+
+	enc=$(curl -s -o /dev/null -D - "${BASE_URL}/css/style.css" \
+		| grep -i "^Content-Encoding" | awk '{print $2}' | tr -d '\r')
+	[ -z "$enc" ] && pass "No Accept-Encoding → identity" \
+				  || fail "Unexpected Content-Encoding: '$enc'"
+
+	# A listing past COMPRESSION_OFFLOAD_MIN is deflated on the disk pool
+	dir=./www/_gzip_listing
+	mkdir -p "$dir"
+	(cd "$dir" && touch $(seq -f "entry-%04g.txt" 1 600))
+	plain=$(body_of "${BASE_URL}/_gzip_listing/")
+	enc=$(curl -s -o /dev/null -D - -H "Accept-Encoding: gzip" "${BASE_URL}/_gzip_listing/" \
+		| grep -i "^Content-Encoding" | awk '{print $2}' | tr -d '\r')
+	decoded=$(curl -s -H "Accept-Encoding: gzip" "${BASE_URL}/_gzip_listing/" | gunzip 2>/dev/null)
+	[ "$enc" = "gzip" ] && [ "${#plain}" -gt 16384 ] && [ "$decoded" = "$plain" ] \
+		&& pass "Large listing gzip-encoded off the loop, decodes intact" \
+		|| fail "Large listing: encoding '$enc', ${#plain} bytes, decoded matches: $([ "$decoded" = "$plain" ] && echo yes || echo no)"
+	rm -rf "$dir"
+}
+
+# ================================
+# 15. Precompressed sidecar (gzip_static)
+# ================================
+test_gzip_static() {
+	print_header "gzip_static test"
+	if [ ! -f "./www/css/style.css.gz" ]; then
+		fail "style.css.gz sidecar was not generated at startup"
+		return
+	fi
+	size=$(curl -s -H "Accept-Encoding: gzip" "${BASE_URL}/css/style.css" | wc -c)
+	expected=$(wc -c < "./www/css/style.css.gz")
+	[ "$size" = "$expected" ] && pass "style.css served from its .gz sidecar" \
+							 || fail "Got $size bytes, sidecar has $expected"
+
+	# A .br sidecar is picked by q-value, not just because br is listed
+	cp ./www/css/style.css.gz ./www/css/style.css.br
+	for case in "br, gzip=br" "br;q=0.1, gzip=gzip" "gzip, br;q=0=gzip"; do
+		accept="${case%=*}"
+		want="${case##*=}"
+		enc=$(curl -s -o /dev/null -D - -H "Accept-Encoding: ${accept}" "${BASE_URL}/css/style.css" \
+			| grep -i "^Content-Encoding" | awk '{print $2}' | tr -d '\r')
+		[ "$enc" = "$want" ] && pass "Accept-Encoding '${accept}' → ${want}" \
+							 || fail "Accept-Encoding '${accept}' gave '${enc}' (expected ${want})"
+	done
+	rm -f ./www/css/style.css.br
+}
+
+# ================================
+# 16. FastCGI (cgi_pass to tools/fcgi_backend.py)
+# ================================
+test_fastcgi() {
+	print_header "FastCGI test"
+	python3 ./tools/fcgi_backend.py "unix:${FASTCGI_SOCK}" &
+	backend=$!
+	sleep 0.5
+
+	code=$(status_code "${BASE_URL}${FASTCGI}")
+	[ "$code" = "200" ] && pass "FastCGI returned 200" \
+						|| fail "FastCGI returned $code"
+
+	body=$(curl -s -X POST --data "hello" "${BASE_URL}${FASTCGI}")
+	echo "$body" | grep -q "body=5" && pass "Request body reached the backend" \
+									|| fail "Backend saw: $body"
+
+	code=$(status_code "${BASE_URL}${FASTCGI}?status=404")
+	[ "$code" = "404" ] && pass "Status header honoured" \
+						|| fail "Status header gave $code (expected 404)"
+
+	line=$(curl -s -o /dev/null -D - "${BASE_URL}${FASTCGI}?status=302%20Found" | head -1 | tr -d '\r')
+	[ "$line" = "HTTP/1.1 302 Found" ] && pass "Status reason phrase kept" \
+									   || fail "Status line was: $line"
+
+	# Backend closing right after END_REQUEST: the answer still counts
+	# (a few times: the close often arrives with the answer, not always)
+	lost=0
+	for i in 1 2 3 4 5 6 7 8 9 10; do
+		body=$(curl -s -w "\n%{http_code}" -X POST --data "hello" "${BASE_URL}${FASTCGI}?close=1")
+		echo "$body" | tail -1 | grep -q "^200$" && echo "$body" | grep -q "body=5" || lost=$((lost + 1))
+	done
+	[ "$lost" = "0" ] && pass "Answers kept when the backend closes after them" \
+					  || fail "$lost of 10 answers lost when the backend closed after them"
+
+	# Backend hanging up without an answer: a GET is tried once more,
+	# a POST isn't (it may have done its work already)
+	before=$(curl -s "${BASE_URL}${FASTCGI}" | sed -n 's/^drops=//p')
+	code=$(status_code "${BASE_URL}${FASTCGI}?drop=1")
+	after=$(curl -s "${BASE_URL}${FASTCGI}" | sed -n 's/^drops=//p')
+	[ "$code" = "502" ] && [ "$((after - before))" = "2" ] && pass "Dropped GET retried once" \
+		|| fail "Dropped GET: $code after $((after - before)) attempts (expected 502 after 2)"
+	code=$(curl -s -o /dev/null -w "%{http_code}" -X POST --data "hello" "${BASE_URL}${FASTCGI}?drop=1")
+	last=$(curl -s "${BASE_URL}${FASTCGI}" | sed -n 's/^drops=//p')
+	[ "$code" = "502" ] && [ "$((last - after))" = "1" ] && pass "Dropped POST not resent" \
+		|| fail "Dropped POST: $code after $((last - after)) attempts (expected 502 after 1)"
+
+	kill "$backend"
+	wait "$backend" 2>/dev/null
+	rm -f "$FASTCGI_SOCK"
+	code=$(status_code "${BASE_URL}${FASTCGI}")
+	[ "$code" = "502" ] && pass "Backend down → 502" \
+						|| fail "Backend down returned $code (expected 502)"
+}
+
+# ================================
+# 17. X-Accel-Redirect (script authorizes, static path serves)
+# ================================
+test_accel_redirect() {
+	print_header "X-Accel-Redirect test"
+	first=$(curl -s -D - "${BASE_URL}${ACCEL_CGI}" | tr -d '\r')
+	echo "$first" | grep -q "^only through accel.py" && pass "Lower-case x-accel-redirect served the target" \
+													 || fail "Script answer: $first"
+
+	code=$(status_code "${BASE_URL}${ACCEL_TARGET}")
+	[ "$code" = "404" ] && pass "Internal location refused a direct request" \
+						|| fail "Direct request returned $code (expected 404)"
+
+	# No Cache-Control from the script: every request asks it again
+	name1=$(echo "$first" | grep -i "^Content-Disposition")
+	name2=$(curl -s -o /dev/null -D - "${BASE_URL}${ACCEL_CGI}" | grep -i "^Content-Disposition" | tr -d '\r')
+	[ -n "$name1" ] && [ "$name1" != "$name2" ] && pass "Authorization not replayed from cgi_cache" \
+											   || fail "Same answer twice: $name1"
+}
+
+# ================================
+# 18. Reverse proxy (proxy_pass to tools/http_backend.py)
+# ================================
+test_proxy() {
+	print_header "Reverse proxy test"
+	backends=""
+	for addr in $PROXY_BACKENDS; do
+		python3 ./tools/http_backend.py "$addr" &
+		backends="$backends $!"
+	done
+	sleep 0.5
+
+	code=$(status_code "${BASE_URL}${PROXY}")
+	[ "$code" = "200" ] && pass "Proxy returned 200" \
+						|| fail "Proxy returned $code"
+
+	seen=$(for i in 1 2 3 4; do curl -s "${BASE_URL}${PROXY}" | grep "^backend="; done | sort -u | wc -l)
+	[ "$seen" = "2" ] && pass "Requests spread over both backends" \
+					|| fail "Requests reached $seen backend(s) (expected 2)"
+
+	body=$(curl -s -X POST -H "Content-Type: text/plain" --data "hello" "${BASE_URL}${PROXY}")
+	echo "$body" | grep -q "body=5" && pass "Request body reached the backend" \
+									|| fail "Backend saw: $body"
+
+	body=$(curl -s "${BASE_URL}${PROXY}?chunked=1")
+	echo "$body" | grep -q "part 2" && pass "Chunked answer relayed" \
+									|| fail "Chunked answer: $body"
+
+	kill $backends
+	wait $backends 2>/dev/null
+	code=$(status_code "${BASE_URL}${PROXY}")
+	[ "$code" = "502" ] && pass "Backends down → 502" \
+						|| fail "Backends down returned $code (expected 502)"
+}
+
+# ================================
+# 19. Session store (session_max, session_timeout)
+# ================================
+test_session_limits() {
+	print_header "Session limits test"
+	start_extra <<-EOF
+	session_max 1;
+	session_timeout 2s;
+	server {
+		listen 8091;
+		root ./www;
+		location / {
+			session on;
+		}
+	}
+	EOF
+	url="http://localhost:8091"
+	a=$(mktemp); b=$(mktemp)
+
+	visits_of "$url" "$a" > /dev/null
+	n=$(visits_of "$url" "$a")
+	[ "$n" = "2" ] && pass "Session kept between requests" \
+				   || fail "Second visit counted $n (expected 2)"
+
+	# session_max 1: a second client's session evicts the first
+	visits_of "$url" "$b" > /dev/null
+	n=$(visits_of "$url" "$a")
+	[ "$n" = "1" ] && pass "session_max evicted the least recently used" \
+				   || fail "Evicted session counted $n (expected 1)"
+
+	# session_timeout 2s: the only session, idle past it, is gone
+	sleep 3
+	n=$(visits_of "$url" "$a")
+	[ "$n" = "1" ] && pass "session_timeout expired the idle session" \
+				   || fail "Expired session counted $n (expected 1)"
+
+	rm -f "$a" "$b"
+	stop_extra
+}
+
+# ================================
+# 20. Sessions only where used, never under a client's id
+# ================================
+test_session_lazy() {
+	print_header "Lazy session test"
+	cookies=$(curl -s -o /dev/null -D - "${BASE_URL}/css/style.css" | grep -ci "^Set-Cookie")
+	[ "$cookies" = "0" ] && pass "No session for a location without one" \
+						 || fail "style.css set $cookies cookie(s)"
+
+	forged="0123456789abcdef0123456789abcdef"
+	id=$(curl -s -o /dev/null -D - -H "Cookie: session_id=${forged}" "${BASE_URL}/" \
+		| grep -i "^Set-Cookie: session_id=" | head -1 | sed 's/.*session_id=\([0-9a-f]*\).*/\1/')
+	[ -n "$id" ] && [ "$id" != "$forged" ] && pass "Unknown session_id replaced by a fresh one" \
+										   || fail "Session cookie for a forged id: '$id'"
+}
+
+# ================================
+# 21. CGI worker pool (cgi_pool .py)
+# ================================
+test_cgi_pool() {
+	print_header "CGI pool test"
+	pids=$(for i in 1 2 3 4 5 6; do curl -s "${BASE_URL}${POOLED_CGI}"; done | grep "^pid=" | sort -u | wc -l)
+	[ "$pids" -ge 1 ] && [ "$pids" -le 2 ] && pass "6 requests served by $pids warm worker(s)" \
+										   || fail "6 requests ran in $pids process(es) (expected the 2 pooled)"
+}
+
+# ================================
+# 22. Streamed CGI output (spawned scripts; pooled ones are collected whole)
+# ================================
+test_cgi_stream() {
+	print_header "CGI streaming test"
+	start_extra <<-EOF
+	server {
+		listen 8092;
+		root ./www;
+		location /cgi-bin/ {
+			root ./www/cgi-bin;
+			cgi_extension .py /usr/bin/python3;
+		}
+	}
+	EOF
+	out=$(curl -s -D - -w "\ntimes=%{time_starttransfer} %{time_total}" "http://localhost:8092${STREAM_CGI}" | tr -d '\r')
+	echo "$out" | grep -qi "^Transfer-Encoding: chunked" && echo "$out" | grep -q "^part 2" \
+		&& pass "Script output relayed chunked" \
+		|| fail "Streamed answer: $out"
+
+	# The first part arrives a second before the script ends
+	times=$(echo "$out" | grep "^times=" | cut -d= -f2)
+	early=$(echo "$times" | awk '{ print ($2 - $1 > 0.5) ? "yes" : "no" }')
+	[ "$early" = "yes" ] && pass "Headers and first part sent while the script ran" \
+						 || fail "First byte / total: $times"
+	stop_extra
+}
+
+# ================================
+# 23. CGI response cache (cgi_cache)
+# ================================
+test_cgi_cache() {
+	print_header "CGI cache test"
+	first=$(curl -s -D - "${BASE_URL}${CACHED_CGI}?t=$$" | tr -d '\r')
+	second=$(curl -s -D - "${BASE_URL}${CACHED_CGI}?t=$$" | tr -d '\r')
+	echo "$first" | grep -qi "^X-Cache-Status: MISS" && pass "First request ran the script (MISS)" \
+													 || fail "First answer: $first"
+	echo "$second" | grep -qi "^X-Cache-Status: HIT" \
+		&& [ "$(echo "$first" | grep "^now=")" = "$(echo "$second" | grep "^now=")" ] \
+		&& pass "Repeat served from the cache (HIT, same body)" \
+		|| fail "Repeat answer: $second"
+
+	other=$(curl -s "${BASE_URL}${CACHED_CGI}?t=$$-other" | grep "^now=")
+	[ "$other" != "$(echo "$first" | grep "^now=")" ] && pass "Another query string is another entry" \
+													  || fail "Other query got the cached body"
+}
+
+# ================================
+# 24. CGI concurrency limit (cgi_max_concurrency, cgi_queue_size)
+# ================================
+test_cgi_concurrency() {
+	print_header "CGI concurrency test"
+	start_extra <<-EOF
+	server {
+		listen 8093;
+		root ./www;
+		location /cgi-bin/ {
+			root ./www/cgi-bin;
+			cgi_extension .py /usr/bin/python3;
+			cgi_max_concurrency 1;
+			cgi_queue_size 1;
+		}
+	}
+	EOF
+	# stream.py runs for a second: one runs, one waits, one is turned away
+	codes=$(for i in 1 2 3; do
+		curl -s -o /dev/null -w "%{http_code}\n" "http://localhost:8093${STREAM_CGI}" &
+		sleep 0.1
+	done; wait)
+	ok=$(echo "$codes" | grep -c "^200$")
+	busy=$(echo "$codes" | grep -c "^503$")
+	[ "$ok" = "2" ] && [ "$busy" = "1" ] && pass "1 running + 1 queued answered, the third got 503" \
+										 || fail "Codes: $(echo $codes)"
+	stop_extra
+}
+
+# ================================
+# 25. File-backed shared session store (session_store shared <file>)
+# ================================
+shared_store_conf() {
+	cat <<-EOF
+	session_store shared $1;
+	server {
+		listen $2;
+		root ./www;
+		location / {
+			session on;
+		}
+	}
+	EOF
+}
+
+test_session_store_file() {
+	print_header "Shared session store test"
+	store="/tmp/webserv-test-sessions-$$"
+	jar=$(mktemp)
+	start_extra < <(shared_store_conf "$store" 8094)
+	visits_of "http://localhost:8094" "$jar" > /dev/null
+	n=$(visits_of "http://localhost:8094" "$jar")
+	[ "$n" = "2" ] && pass "Session kept in the mapped file" \
+				   || fail "Second visit counted $n (expected 2)"
+
+	# Another process mapping the same file sees the same session
+	other_conf=$(mktemp /tmp/webserv-test-XXXXXX.conf)
+	shared_store_conf "$store" 8095 > "$other_conf"
+	./webServ "$other_conf" > /dev/null 2>&1 &
+	other=$!
+	sleep 1
+	n=$(visits_of "http://localhost:8095" "$jar")
+	[ "$n" = "3" ] && pass "Second process continued the session" \
+				   || fail "Other process counted $n (expected 3)"
+	kill -INT "$other"
+	wait "$other" 2>/dev/null
+	rm -f "$other_conf"
+
+	# Restart: the file outlives the server
+	stop_extra
+	start_extra < <(shared_store_conf "$store" 8094)
+	n=$(visits_of "http://localhost:8094" "$jar")
+	[ "$n" = "4" ] && pass "Session survived a restart" \
+				   || fail "After restart counted $n (expected 4)"
+	stop_extra
+	rm -f "$jar" "$store" "$store.lock"
+}
+
+# ================================
+# 26. Graceful stop (SIGTERM with a request in flight)
+# ================================
+test_graceful_stop() {
+	print_header "Graceful stop test"
+	start_extra <<-EOF
+	server {
+		listen 8096;
+		root ./www;
+		location /cgi-bin/ {
+			root ./www/cgi-bin;
+			cgi_extension .py /usr/bin/python3;
+		}
+	}
+	EOF
+	# stream.py takes a second: the signal lands while it runs
+	out=$(mktemp)
+	curl -s "http://localhost:8096${STREAM_CGI}" > "$out" &
+	client=$!
+	sleep 0.3
+	kill -TERM "$extra"
+	wait "$client"
+	grep -q "^part 2" "$out" && pass "In-flight request finished after SIGTERM" \
+							 || fail "In-flight answer: $(cat "$out")"
+
+	for i in 1 2 3 4 5 6 7 8 9 10; do
+		kill -0 "$extra" 2>/dev/null || break
+		sleep 0.5
+	done
+	if kill -0 "$extra" 2>/dev/null; then
+		fail "Server still running 5s after SIGTERM"
+		kill -KILL "$extra"
+	else
+		pass "Server exited once drained"
+	fi
+	wait "$extra" 2>/dev/null
+	rm -f "$out" "$extra_conf"
+}
+
+# ================================
+# 27. Reload (SIGHUP) with a request in flight
+# ================================
+test_reload() {
+	print_header "Reload test"
+	start_extra <<-EOF
+	server {
+		listen 8097;
+		root ./www;
+		location /cgi-bin/ {
+			root ./www/cgi-bin;
+			cgi_extension .py /usr/bin/python3;
+		}
+	}
+	EOF
+	out=$(mktemp)
+	curl -s "http://localhost:8097${STREAM_CGI}" > "$out" &
+	client=$!
+	sleep 0.3
+
+	# New port, new location: the old listener goes, the old request stays
+	cat > "$extra_conf" <<-EOF
+	server {
+		listen 8098;
+		root ./www;
+		location /moved {
+			return 301 /pages/this_is_redirect.html;
+		}
+	}
+	EOF
+	kill -HUP "$extra"
+	sleep 0.5
+
+	code=$(status_code "http://localhost:8098/moved")
+	[ "$code" = "301" ] && pass "Reloaded config served on the new port" \
+						|| fail "New config returned $code (expected 301)"
+	code=$(status_code "http://localhost:8097/")
+	[ "$code" = "000" ] && pass "Dropped port no longer accepts" \
+						|| fail "Dropped port returned $code"
+	wait "$client"
+	grep -q "^part 2" "$out" && pass "Request in flight during reload finished" \
+							 || fail "In-flight answer: $(cat "$out")"
+	kill -0 "$extra" 2>/dev/null && pass "Server still running after reload" \
+								 || fail "Server died on reload"
+	rm -f "$out"
+	stop_extra
+}
+
+# ================================
+# 28. Binary upgrade (SIGUSR2, then the new process takes the sockets)
+# ================================
+test_upgrade() {
+	print_header "Binary upgrade test"
+	start_extra <<-EOF
+	server {
+		listen 8099;
+		root ./www;
+	}
+	EOF
+	# Requests keep coming while the sockets change hands
+	codes=$(mktemp)
+	(for i in $(seq 1 30); do status_code "http://localhost:8099/"; echo; sleep 0.1; done) > "$codes" &
+	load=$!
+	kill -USR2 "$extra"
+	# The old process stops accepting once the new one is up, then exits
+	for i in 1 2 3 4 5 6 7 8 9 10; do
+		kill -0 "$extra" 2>/dev/null || break
+		sleep 0.5
+	done
+	kill -0 "$extra" 2>/dev/null && fail "Old process still running after the upgrade" \
+								 || pass "Old process handed over and exited"
+	wait "$extra" 2>/dev/null
+
+	wait "$load"
+	failed=$(grep -vc "^200$" "$codes")
+	[ "$failed" = "0" ] && pass "Listener stayed up across the upgrade" \
+						|| fail "$failed of 30 requests failed during the upgrade"
+	rm -f "$codes"
+
+	# The new binary runs the same command line
+	extra=$(pgrep -f "webServ ${extra_conf}")
+	[ -n "$extra" ] && pass "New process (pid $extra) is serving" \
+					|| fail "No new process found"
+	[ -n "$extra" ] && kill -INT $extra
+	for i in 1 2 3 4 5 6 7 8 9 10; do
+		pgrep -f "webServ ${extra_conf}" > /dev/null || break
+		sleep 0.5
+	done
+	rm -f "$extra_conf"
+}
+
+# ================================
+# 29. cgi_cache_path sweeps (expired files, size cap)
+# ================================
+test_cgi_cache_disk() {
+	print_header "CGI disk cache test"
+	expiring=$(mktemp -d)
+	capped=$(mktemp -d)
+	start_extra <<-EOF
+	server {
+		listen 8100;
+		root ./www;
+		location /cgi-cached/ {
+			cgi_extension .py /usr/bin/python3;
+			cgi_cache 1M;
+			cgi_cache_valid 1;
+			cgi_cache_path ${expiring} 4K;
+		}
+	}
+	server {
+		listen 8101;
+		root ./www;
+		location /cgi-cached/ {
+			cgi_extension .py /usr/bin/python3;
+			cgi_cache 1M;
+			cgi_cache_valid 60;
+			cgi_cache_path ${capped} 4K;
+		}
+	}
+	EOF
+	# Answers good for a second; later writes trigger a sweep that drops them
+	for i in 1 2 3 4 5; do curl -s -o /dev/null "http://localhost:8100${CACHED_CGI}?old=$i"; done
+	sleep 2
+	for i in $(seq 1 10); do curl -s -o /dev/null "http://localhost:8100${CACHED_CGI}?new=$i"; done
+	sleep 0.5
+	old=$(ls "$expiring" | wc -l)
+	[ "$old" -le 10 ] && pass "Expired files removed ($old left of 15)" \
+					  || fail "$old files kept, expired ones included"
+
+	# Every query string is an entry: the directory stays near its 4K cap
+	for i in $(seq 1 100); do curl -s -o /dev/null "http://localhost:8101${CACHED_CGI}?x=$i"; done
+	sleep 0.5
+	bytes=$(cat "$capped"/* 2>/dev/null | wc -c)
+	[ "$bytes" -le 8192 ] && pass "Disk tier held to its cap ($bytes bytes for 100 answers)" \
+						  || fail "Disk tier grew to $bytes bytes (cap 4K)"
+	stop_extra
+	rm -rf "$expiring" "$capped"
+}
+
+# ================================
+# 30. Pooled and spawned CGI see the same environment
+# ================================
+test_cgi_pool_env() {
+	print_header "CGI pool environment test"
+	WEBSERV_TEST_PRIVATE=1 start_extra <<-EOF
+	server {
+		listen 8102;
+		root ./www;
+		location /cgi-bin/ {
+			root ./www/cgi-bin;
+			cgi_extension .py /usr/bin/python3;
+			cgi_pool .py 1 2;
+		}
+	}
+	server {
+		listen 8103;
+		root ./www;
+		location /cgi-bin/ {
+			root ./www/cgi-bin;
+			cgi_extension .py /usr/bin/python3;
+		}
+	}
+	EOF
+	pooled=$(curl -s "http://localhost:8102${ENV_CGI}")
+	spawned=$(curl -s "http://localhost:8103${ENV_CGI}")
+	echo "$pooled" | grep -q "^WEBSERV_TEST_PRIVATE$" && fail "Pooled script sees the server's environment" \
+													  || pass "Server environment kept from pooled scripts"
+	[ -n "$pooled" ] && [ "$pooled" = "$spawned" ] && pass "Pooled and spawned scripts get the same variables" \
+												   || fail "Variables differ: pooled [$(echo $pooled)] spawned [$(echo $spawned)]"
+	stop_extra
+}
+
+# ================================
+# 31. Mapped files (mmap_threshold) rewritten in place
+# ================================
+test_mmap_rewrite() {
+	print_header "Mapped file rewrite test"
+	file="./www/pictures/_mmap_test.bin"
+	python3 -c "open('$file', 'wb').write(b'a' * 300000)"
+	# A slow download keeps the mapping alive while the file changes
+	curl -s --limit-rate 100K -o /dev/null "${BASE_URL}/pictures/_mmap_test.bin" &
+	slow=$!
+	sleep 0.3
+	python3 -c "f = open('$file', 'r+b'); f.write(b'b' * 300000)"
+	got=$(curl -s "${BASE_URL}/pictures/_mmap_test.bin" | tr -d 'b' | wc -c)
+	[ "$got" = "0" ] && pass "Rewritten file served with its new content" \
+					 || fail "$got bytes of the old content served after the rewrite"
+	wait "$slow"
+	rm -f "$file"
+}
+
+# ================================
+# 32. Static compression on the disk pool (read and deflate off the loop)
+# ================================
+test_gzip_offload() {
+	print_header "Offloaded static compression test"
+	file=./www/_offload_test.txt
+	seq -f "line %g of a text file read and deflated on the disk pool" 1 2000 > "$file"
+	for round in first cached; do
+		enc=$(curl -s -o /dev/null -D - -H "Accept-Encoding: gzip" "${BASE_URL}/_offload_test.txt" \
+			| grep -i "^Content-Encoding" | awk '{print $2}' | tr -d '\r')
+		curl -s -H "Accept-Encoding: gzip" "${BASE_URL}/_offload_test.txt" | gunzip 2>/dev/null | cmp -s - "$file" \
+			&& [ "$enc" = "gzip" ] && pass "gzip answer ($round) decodes to the file" \
+			|| fail "gzip answer ($round): encoding '$enc', body differs from the file"
+	done
+	curl -s "${BASE_URL}/_offload_test.txt" | cmp -s - "$file" && pass "Identity answer matches the file" \
+															 || fail "Identity answer differs from the file"
+	rm -f "$file"
+}
+
+# ================================
+# 33. Page templates (compiled at config time)
+# ================================
+test_page_templates() {
+	print_header "Page template test"
+	# Browsers get the 301 page (301.html with {{REDIRECT_URL}} filled in)
+	body=$(curl -s -A "Mozilla/5.0" "${BASE_URL}${REDIRECT_URL}")
+	echo "$body" | grep -qF "url=${REDIRECT_TARGET}" && ! echo "$body" | grep -qF "{{" \
+		&& pass "Redirect page rendered with its target" \
+		|| fail "Redirect page: $(echo "$body" | grep -F "url=")"
+
+	# Loaded once: the page on disk isn't read again per error
+	expected=$(cat ./www/errors/404.html)
+	mv ./www/errors/404.html ./www/errors/404.html.moved
+	body=$(body_of "${BASE_URL}/no/such/page")
+	mv ./www/errors/404.html.moved ./www/errors/404.html
+	[ "$body" = "$expected" ] && pass "404 page served from memory" \
+							  || fail "404 page changed once its file was gone"
+}
+
+# ================================
+# 34. Location routing (exact, then regex, then longest prefix)
+# ================================
+test_location_routing() {
+	print_header "Location routing test"
+	start_extra <<-EOF
+	server {
+		listen 8104;
+		root ./www;
+		location / {
+			return 301 /root;
+		}
+		location /a/ {
+			return 301 /prefix-a;
+		}
+		location /a/b/ {
+			return 301 /prefix-ab;
+		}
+		location ~ \.txt$ {
+			return 301 /regex;
+		}
+		location /a/b/exact.txt {
+			return 301 /exact;
+		}
+	}
+	EOF
+	for case in "/a/b/c=/prefix-ab" "/a/x=/prefix-a" "/a/b/x.txt=/regex" "/a/b/exact.txt=/exact" "/zzz=/root"; do
+		path="${case%=*}"
+		want="${case##*=}"
+		got=$(curl -s -o /dev/null -D - "http://localhost:8104${path}" \
+			| grep -i "^Location:" | awk '{print $2}' | tr -d '\r')
+		[ "$got" = "$want" ] && pass "${path} routed to ${want}" \
+							 || fail "${path} routed to '${got}' (expected ${want})"
+	done
+	stop_extra
+}
+
+# ================================
+# 35. Virtual hosts on one port (Host with its :port)
+# ================================
+test_virtual_hosts() {
+	print_header "Virtual host test"
+	start_extra <<-EOF
+	server {
+		listen 8105;
+		server_name first.test;
+		root ./www;
+		location / {
+			return 301 /first;
+		}
+	}
+	server {
+		listen 8105;
+		server_name alpha.test beta.test;
+		root ./www;
+		location / {
+			return 301 /named;
+		}
+	}
+	server {
+		listen 8105;
+		server_name *.wild.test;
+		root ./www;
+		location / {
+			return 301 /wildcard;
+		}
+	}
+	EOF
+	for case in "beta.test:8105=/named" "BETA.Test:8105=/named" "alpha.test=/named" \
+				"x.wild.test:8105=/wildcard" "unknown.test:8105=/first"; do
+		host="${case%=*}"
+		want="${case##*=}"
+		got=$(curl -s -o /dev/null -D - -H "Host: ${host}" "http://localhost:8105/" \
+			| grep -i "^Location:" | awk '{print $2}' | tr -d '\r')
+		[ "$got" = "$want" ] && pass "Host ${host} served by ${want}" \
+							 || fail "Host ${host} served by '${got}' (expected ${want})"
+	done
+	stop_extra
+}
+
+# ================================
+# 36. CGI beside other traffic (scripts don't stall the loop)
+# ================================
+test_cgi_async() {
+	print_header "Asynchronous CGI test"
+	out1=$(mktemp /tmp/webserv-test-XXXXXX)
+	out2=$(mktemp /tmp/webserv-test-XXXXXX)
+	start=$(date +%s.%N)
+	curl -s "${BASE_URL}/cgi-bin/slow.py" > "$out1" &
+	slow1=$!
+	curl -s "${BASE_URL}/cgi-bin/slow.py" > "$out2" &
+	slow2=$!
+	sleep 0.3
+	static=$(curl -s -o /dev/null -w "%{http_code} %{time_total}" "${BASE_URL}/")
+	wait "$slow1" "$slow2"
+	elapsed=$(echo "$start $(date +%s.%N)" | awk '{ printf "%.1f", $2 - $1 }')
+
+	echo "$static" | awk '{ exit !($1 == 200 && $2 < 1) }' && pass "Static page answered while scripts ran" \
+														   || fail "Static page during CGI: $static"
+	grep -q "^done" "$out1" && grep -q "^done" "$out2" \
+		&& awk -v t="$elapsed" 'BEGIN { exit !(t < 3.5) }' \
+		&& pass "Two 2s scripts ran side by side (${elapsed}s)" \
+		|| fail "Scripts took ${elapsed}s: $(cat "$out1" "$out2")"
+	rm -f "$out1" "$out2"
+}
+
+# ================================
+# 37. Spawned CGI (posix_spawn, environment built by the server)
+# ================================
+test_cgi_spawn() {
+	print_header "Spawned CGI test"
+	start_extra <<-EOF
+	server {
+		listen 8106;
+		root ./www;
+		location /cgi-bin/ {
+			root ./www/cgi-bin;
+			allow_methods GET POST;
+			cgi_extension .py /usr/bin/python3;
+		}
+	}
+	EOF
+	out=$(curl -s -D - "http://localhost:8106/cgi-bin/status.py?x=1" | tr -d '\r')
+	line=$(echo "$out" | head -1)
+	[ "$line" = "HTTP/1.1 404 Not Found" ] && pass "Script's Status line kept" \
+										   || fail "Status line was: $line"
+	echo "$out" | grep -q "^method=GET" && echo "$out" | grep -q "^query=x=1" \
+		&& pass "Script saw the request in its environment" \
+		|| fail "Script answer: $out"
+	stop_extra
+}
+
+# ================================
+# 38. Large POST body into CGI stdin (script answers before reading)
+# ================================
+test_cgi_large_post() {
+	print_header "Large CGI POST test"
+	start_extra <<-EOF
+	server {
+		listen 8107;
+		root ./www;
+		client_max_body_size 8M;
+		location /cgi-bin/ {
+			root ./www/cgi-bin;
+			allow_methods GET POST;
+			cgi_extension .py /usr/bin/python3;
+		}
+	}
+	EOF
+	body=$(mktemp /tmp/webserv-test-XXXXXX)
+	head -c 5242880 /dev/urandom > "$body"
+	want="length=5242880 md5=$(md5sum < "$body" | awk '{print $1}')"
+	got=$(curl -s -m 20 -H "Content-Type: application/octet-stream" --data-binary "@${body}" \
+		"http://localhost:8107/cgi-bin/length.py" | tail -1)
+	[ "$got" = "$want" ] && pass "5 MB body reached the script intact" \
+						 || fail "Script saw: '$got' (expected '$want')"
+	rm -f "$body"
+	stop_extra
+}
+
 # ================================
 # RUN ALL TESTS
 # ================================
@@ -251,7 +1086,32 @@ test_autoindex
 test_method_not_allowed
 test_unknown_method
 test_python_cgi
+test_cgi_pool
+test_cgi_pool_env
+test_cgi_stream
+test_cgi_cache
+test_cgi_concurrency
+test_cgi_cache_disk
 test_php_cgi
 test_keepalive
+test_gzip
+test_gzip_static
+test_mmap_rewrite
+test_fastcgi
+test_accel_redirect
+test_proxy
+test_session_limits
+test_session_lazy
+test_session_store_file
+test_graceful_stop
+test_reload
+test_upgrade
+test_gzip_offload
+test_page_templates
+test_location_routing
+test_virtual_hosts
+test_cgi_async
+test_cgi_spawn
+test_cgi_large_post
 
 echo -e "${YELLOW}=== Tests Completed ===${RESET}"
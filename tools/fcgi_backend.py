@@ -0,0 +1,181 @@
+#!/usr/bin/env python3
+"""Minimal FastCGI responder, a local stand-in backend for cgi_pass.
+
+	python3 tools/fcgi_backend.py unix:/tmp/webserv-fcgi.sock
+	python3 tools/fcgi_backend.py 127.0.0.1:9000
+
+Multiplexes requests on one connection (answers FCGI_MPXS_CONNS=1),
+honours FCGI_KEEP_CONN and FCGI_ABORT_REQUEST. Each request is answered
+by a thread with a plain-text summary of what it received;
+?sleep=N delays the answer, ?status=N sets the Status header, ?close=1
+closes the connection right after the answer, whatever FCGI_KEEP_CONN says,
+and ?drop=1 closes it without answering (counted in every summary's drops=).
+"""
+
+import os
+import socket
+import struct
+import sys
+import threading
+import time
+from urllib.parse import parse_qs
+
+BEGIN_REQUEST, ABORT_REQUEST, END_REQUEST, PARAMS, STDIN, STDOUT, STDERR = 1, 2, 3, 4, 5, 6, 7
+GET_VALUES, GET_VALUES_RESULT, UNKNOWN_TYPE = 9, 10, 11
+KEEP_CONN = 1
+drops = 0
+
+
+def record(rtype, rid, content=b""):
+	out = b""
+	for i in range(0, max(len(content), 1), 65535):
+		chunk = content[i:i + 65535]
+		pad = (8 - len(chunk) % 8) % 8
+		out += struct.pack("!BBHHBx", 1, rtype, rid, len(chunk), pad) + chunk + b"\0" * pad
+	return out
+
+
+def read_length(data, pos):
+	if data[pos] < 128:
+		return data[pos], pos + 1
+	return struct.unpack("!I", data[pos:pos + 4])[0] & 0x7fffffff, pos + 4
+
+
+def parse_pairs(data):
+	pairs, pos = {}, 0
+	while pos < len(data):
+		nlen, pos = read_length(data, pos)
+		vlen, pos = read_length(data, pos)
+		pairs[data[pos:pos + nlen].decode()] = data[pos + nlen:pos + nlen + vlen].decode()
+		pos += nlen + vlen
+	return pairs
+
+
+def encode_pairs(pairs):
+	out = b""
+	for k, v in pairs.items():
+		for n in (len(k), len(v)):
+			out += bytes([n]) if n < 128 else struct.pack("!I", n | 0x80000000)
+		out += k.encode() + v.encode()
+	return out
+
+
+class Connection:
+	def __init__(self, sock):
+		self.sock = sock
+		self.lock = threading.Lock()
+		self.requests = {}		# id → {"params", "stdin", "keep", "aborted"}, still arriving
+		self.running = {}		# id → same, being answered
+		self.closing = False
+
+	def send(self, data):
+		with self.lock:
+			try:
+				self.sock.sendall(data)
+			except OSError:
+				pass
+
+	def respond(self, rid, req):
+		global drops
+		params = req["params"]
+		query = parse_qs(params.get("QUERY_STRING", ""))
+		time.sleep(float(query.get("sleep", ["0"])[0]))
+		self.running.pop(rid, None)
+		if req["aborted"]:
+			self.send(record(END_REQUEST, rid, struct.pack("!IB3x", 1, 0)))
+			return
+		if query.get("drop"):
+			drops += 1
+			self.closing = True
+			self.sock.shutdown(socket.SHUT_RDWR)
+			return
+		status = query.get("status", [None])[0]
+		body = (
+			"backend pid=%d\nmethod=%s\nscript=%s\nquery=%s\nbody=%d\ndrops=%d\n" % (
+				os.getpid(),
+				params.get("REQUEST_METHOD", ""),
+				params.get("SCRIPT_FILENAME", ""),
+				params.get("QUERY_STRING", ""),
+				len(req["stdin"]),
+				drops,
+			)
+		).encode()
+		head = "Content-Type: text/plain\r\n"
+		if status:
+			head += "Status: %s\r\n" % status
+		self.send(record(STDOUT, rid, head.encode() + b"\r\n" + body)
+			+ record(STDOUT, rid)
+			+ record(END_REQUEST, rid, struct.pack("!IB3x", 0, 0)))
+		if not req["keep"] or query.get("close"):
+			self.closing = True
+			self.sock.shutdown(socket.SHUT_RDWR)
+
+	def serve(self):
+		buf = b""
+		while not self.closing:
+			try:
+				data = self.sock.recv(65536)
+			except OSError:
+				break
+			if not data:
+				break
+			buf += data
+			while len(buf) >= 8:
+				_, rtype, rid, clen, pad = struct.unpack("!BBHHBx", buf[:8])
+				if len(buf) < 8 + clen + pad:
+					break
+				content, buf = buf[8:8 + clen], buf[8 + clen + pad:]
+				self.on_record(rtype, rid, content)
+		self.sock.close()
+
+	def on_record(self, rtype, rid, content):
+		if rtype == GET_VALUES:
+			values = {"FCGI_MPXS_CONNS": "1", "FCGI_MAX_REQS": "16", "FCGI_MAX_CONNS": "64"}
+			asked = parse_pairs(content)
+			self.send(record(GET_VALUES_RESULT, 0, encode_pairs({k: values[k] for k in asked if k in values})))
+		elif rtype == BEGIN_REQUEST:
+			flags = content[2]
+			self.requests[rid] = {"params": b"", "stdin": b"", "keep": bool(flags & KEEP_CONN), "aborted": False}
+		elif rtype == PARAMS and rid in self.requests:
+			self.requests[rid]["params"] += content
+		elif rtype == STDIN and rid in self.requests:
+			req = self.requests[rid]
+			if content:
+				req["stdin"] += content
+				return
+			req["params"] = parse_pairs(req["params"])
+			self.running[rid] = self.requests.pop(rid)
+			threading.Thread(target=self.respond, args=(rid, req), daemon=True).start()
+		elif rtype == ABORT_REQUEST:
+			if rid in self.requests:
+				self.requests.pop(rid)
+				self.send(record(END_REQUEST, rid, struct.pack("!IB3x", 1, 0)))
+			elif rid in self.running:
+				self.running[rid]["aborted"] = True
+		elif rtype not in (PARAMS, STDIN):
+			self.send(record(UNKNOWN_TYPE, 0, bytes([rtype]) + b"\0" * 7))
+
+
+def main():
+	if len(sys.argv) != 2:
+		sys.exit("usage: fcgi_backend.py unix:/path.sock | host:port")
+	spec = sys.argv[1]
+	if spec.startswith("unix:"):
+		path = spec[5:]
+		if os.path.exists(path):
+			os.unlink(path)
+		server = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+		server.bind(path)
+	else:
+		host, port = spec.rsplit(":", 1)
+		server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+		server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+		server.bind((host, int(port)))
+	server.listen(128)
+	while True:
+		sock, _ = server.accept()
+		threading.Thread(target=Connection(sock).serve, daemon=True).start()
+
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,100 @@
+#!/usr/bin/env python3
+"""Minimal HTTP/1.1 server, a local stand-in backend for proxy_pass.
+
+	python3 tools/http_backend.py 127.0.0.1:9101
+
+Keeps connections alive between requests and answers each with a
+plain-text summary of what it received, including which backend and
+which connection served it. ?sleep=N delays the answer, ?status=N sets
+the status, ?chunked=1 sends the body in chunks, ?stream=N sends N
+chunks a tenth of a second apart, ?close=1 frames the body by closing.
+"""
+
+import os
+import socket
+import sys
+import threading
+import time
+from urllib.parse import parse_qs, urlsplit
+
+REASONS = {200: "OK", 201: "Created", 204: "No Content", 302: "Found", 404: "Not Found", 500: "Internal Server Error"}
+
+
+def read_request(sock, buf):
+	"""One request off the connection: (method, target, headers, body, rest) or None once closed."""
+	while b"\r\n\r\n" not in buf:
+		data = sock.recv(65536)
+		if not data:
+			return None
+		buf += data
+	head, buf = buf.split(b"\r\n\r\n", 1)
+	lines = head.decode("latin-1").split("\r\n")
+	method, target, _ = lines[0].split(" ", 2)
+	headers = {}
+	for line in lines[1:]:
+		name, _, value = line.partition(":")
+		headers[name.strip().lower()] = value.strip()
+	length = int(headers.get("content-length", "0"))
+	while len(buf) < length:
+		data = sock.recv(65536)
+		if not data:
+			return None
+		buf += data
+	return method, target, headers, buf[:length], buf[length:]
+
+
+def serve(sock, name, conn_id):
+	buf, served = b"", 0
+	try:
+		while True:
+			req = read_request(sock, buf)
+			if req is None:
+				break
+			method, target, headers, body, buf = req
+			served += 1
+			query = parse_qs(urlsplit(target).query)
+			time.sleep(float(query.get("sleep", ["0"])[0]))
+			status = int(query.get("status", ["200"])[0])
+			text = (
+				"backend=%s\nconnection=%d\nrequests=%d\nmethod=%s\ntarget=%s\nbody=%d\nforwarded=%s\n" % (
+					name, conn_id, served, method, target, len(body), headers.get("x-forwarded-for", ""))
+			).encode()
+			head = "HTTP/1.1 %d %s\r\nContent-Type: text/plain\r\nX-Backend: %s\r\n" % (
+				status, REASONS.get(status, "Status"), name)
+			head += "Set-Cookie: a=1; Path=/\r\nSet-Cookie: b=2; Path=/\r\n"
+			if "close" in query:
+				sock.sendall((head + "Connection: close\r\n\r\n").encode() + text)
+				break
+			if "stream" in query or "chunked" in query:
+				sock.sendall((head + "Transfer-Encoding: chunked\r\n\r\n").encode())
+				for i in range(int(query.get("stream", ["3"])[0])):
+					piece = text if i == 0 else b"part %d\n" % i
+					sock.sendall(b"%x\r\n%s\r\n" % (len(piece), piece))
+					if "stream" in query:
+						time.sleep(0.1)
+				sock.sendall(b"0\r\n\r\n")
+				continue
+			sock.sendall((head + "Content-Length: %d\r\n\r\n" % len(text)).encode() + text)
+	except OSError:
+		pass
+	sock.close()
+
+
+def main():
+	if len(sys.argv) != 2:
+		sys.exit("usage: http_backend.py host:port")
+	host, port = sys.argv[1].rsplit(":", 1)
+	server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+	server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+	server.bind((host, int(port)))
+	server.listen(128)
+	name = "%s:%s/%d" % (host, port, os.getpid())
+	conn_id = 0
+	while True:
+		sock, _ = server.accept()
+		conn_id += 1
+		threading.Thread(target=serve, args=(sock, name, conn_id), daemon=True).start()
+
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,6 @@
+#!/usr/bin/env python3
+import os
+
+# The names of the variables the script was given, one per line
+print("Content-Type: text/plain\r\n\r")
+print("\n".join(sorted(os.environ)))
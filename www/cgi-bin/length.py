@@ -0,0 +1,11 @@
+#!/usr/bin/env python3
+import hashlib
+import sys
+
+# Writes more than a pipe holds before reading stdin: the server has to
+# read the answer while it is still feeding the body
+sys.stdout.write("Content-Type: text/plain\r\n\r\n")
+sys.stdout.write("#" * 131072 + "\n")
+sys.stdout.flush()
+data = sys.stdin.buffer.read()
+print("length=%d md5=%s" % (len(data), hashlib.md5(data).hexdigest()))
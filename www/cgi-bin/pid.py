@@ -0,0 +1,5 @@
+#!/usr/bin/env python3
+import os
+
+print("Content-Type: text/plain\r\n\r")
+print("pid=%d" % os.getpid())
@@ -0,0 +1,7 @@
+#!/usr/bin/env python3
+import time
+
+# Takes two seconds: other clients shouldn't notice
+time.sleep(2)
+print("Content-Type: text/plain\r\n\r")
+print("done")
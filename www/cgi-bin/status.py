@@ -0,0 +1,8 @@
+#!/usr/bin/env python3
+import os
+
+# Own status line, plus what the server put in the environment
+print("Status: 404 Not Found\r")
+print("Content-Type: text/plain\r\n\r")
+print("method=" + os.environ.get("REQUEST_METHOD", ""))
+print("query=" + os.environ.get("QUERY_STRING", ""))
@@ -0,0 +1,8 @@
+#!/usr/bin/env python3
+import time
+
+# Two parts a second apart: the first should reach the client at once
+print("Content-Type: text/plain\r\n\r")
+print("part 1", flush=True)
+time.sleep(1)
+print("part 2")
@@ -0,0 +1,10 @@
+#!/usr/bin/env python3
+import time
+
+# Hands the download of www/protected/secret.txt back to the server
+# (header names in lower case, as some frameworks send them); the
+# file name changes on every run
+print("x-accel-redirect: /protected/secret.txt\r")
+print("content-type: text/plain\r")
+print("content-disposition: attachment; filename=secret-%d.txt\r" % time.time_ns())
+print("\r")
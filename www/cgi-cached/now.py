@@ -0,0 +1,6 @@
+#!/usr/bin/env python3
+import time
+
+# A different body on every run: a repeat that matches came from cgi_cache
+print("Content-Type: text/plain\r\n\r")
+print("now=%d" % time.time_ns())